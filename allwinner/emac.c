@@ -50,6 +50,29 @@
 #define EMAC_NOCACHE
 #endif
 
+/* Receive straight into netbufs rather than copying each frame
+ * out of a dedicated ring of buffers.  A filled netbuf goes up to
+ * the network code and a fresh one takes its place on the ring.
+ * Frames no bigger than RX_COPYBREAK get copied into a small netbuf
+ * instead, which leaves the big one on the ring where we want it.
+ * Set RX_COPYBREAK to 0 to never copy.
+ */
+#define EMAC_RX_NETBUF
+#define RX_COPYBREAK	(NETBUF_SMALL - NETBUF_ETH_OFF)
+
+/* Take Rx frames off the ring in the net thread rather than at
+ * interrupt level.  The first Rx interrupt masks Rx interrupts and
+ * asks the net thread to call emac_rx_poll(), which keeps them
+ * masked until it finds the ring empty.  See net_poll_sched().
+ */
+#define EMAC_RX_POLL
+
+/* Let the emac check Rx checksums and fill in Tx checksums
+ * (IP header, TCP and UDP).  Both need the store and forward
+ * modes (RX_MD and TX_MD) that we always set.
+ */
+#define EMAC_CSUM_OFFLOAD
+
 #ifdef BOARD_H5
 /* On the h5 (aarch64) I get lots of these warnings:
 emac.c: warning: cast from pointer to integer of different size [-Wpointer-to-int-cast]
@@ -108,6 +131,15 @@ emac_debug_h5 ( void )
 #define emac_cache_invalidate(a,b)	invalidate_dcache_range ( a, b )
 #endif
 
+/* Netbufs live in ordinary cached ram, so unlike the rings
+ * they always need cache maintenance when handed to the DMA.
+ * We flush (clean and invalidate) a netbuf before the emac gets it,
+ * and nobody touches it until the emac gives it back, so the "dc ivac
+ * acts like dc civac" problem on the H5 does us no harm here.
+ */
+#define nb_cache_flush(a,b)		flush_dcache_range ( a, b )
+#define nb_cache_invalidate(a,b)	invalidate_dcache_range ( a, b )
+
 void emac_show ( void );
 static void tx_start ( void );
 static void rx_start ( void );
@@ -228,6 +260,7 @@ struct emac_desc {
 #define DS_TX_INT		0x80000000	/* Set TX_INT when finished */
 #define DS_TX_LAST		0x40000000	/* This is the last buffer in a packet */
 #define DS_TX_FIRST		0x20000000	/* This is the first buffer in a packet */
+#define	DS_TX_CSUM_FULL		0x18000000	/* Insert IP header and TCP/UDP checksums */
 #define	DS_TX_EOR		0x02000000	/* End of Ring */
 #define	DS_TX_ADR_CHAIN		0x01000000	/* was magic for U-Boot */
 
@@ -259,7 +292,6 @@ struct emac_desc {
  * putting nothing in any of them.
  */
 #define RX_SIZE		2048
-#define TX_SIZE		2048
 #define RX_ETH_SIZE	2044
 
 /*
@@ -277,6 +309,14 @@ static struct emac_desc rx_desc[NUM_RX];
 static struct emac_desc *rx_list;
 static struct emac_desc *tx_list;
 
+#ifdef EMAC_RX_NETBUF
+/* The netbuf behind each Rx descriptor */
+static struct netbuf *rx_netbuf[NUM_RX];
+#endif
+
+/* The netbuf behind each Tx descriptor, freed by tx_cleaner() */
+static struct netbuf *tx_netbuf[NUM_TX];
+
 static struct emac_desc *cur_rx_dma;
 
 static struct emac_desc *cur_tx_dma;
@@ -285,6 +325,11 @@ static struct emac_desc *clean_tx_dma;
 static int emac_wait_flag = 0;
 static struct sem *emac_sem;
 
+/* Senders wait here when the Tx ring is full */
+static int tx_space_wait = 0;
+static struct sem *tx_space_sem;
+static int tx_full_count = 0;
+
 void emac_debug_h3 ( void );
 void emac_debug_h5 ( void );
 
@@ -354,9 +399,32 @@ tx_list_show ( void )
  * We have 32 * 2k for Tx bufs (64K)
  * and we have 64 * 64 bytes for descriptors (4K)
  * This is 128 + 4 = 132K, fits handily in 1M
+ * (with EMAC_RX_NETBUF there are no Rx bufs here)
  */
 static char *nocache;
 
+#ifdef EMAC_RX_NETBUF
+/* Put a netbuf on an Rx descriptor.
+ * The DMA gets the whole data area past the headroom,
+ * which starts on a cache line.
+ */
+static void
+rx_arm ( struct emac_desc *edp, struct netbuf *nbp )
+{
+	char *buf = (char *) nbp->eptr;
+	int room = netbuf_room ( nbp );
+
+	if ( room > RX_ETH_SIZE )
+	    room = RX_ETH_SIZE;
+
+	nb_cache_flush ( (void *) buf, buf + room );
+
+	rx_netbuf[edp - rx_list] = nbp;
+	edp->buf = (vp32) buf;
+	edp->size = room & ~3;
+}
+#endif
+
 static struct emac_desc *
 rx_list_init ( void )
 {
@@ -376,6 +444,26 @@ rx_list_init ( void )
 	buf = (char *) mem;
 	*/
 
+#ifdef EMAC_RX_NETBUF
+#ifdef EMAC_NOCACHE
+	desc = (struct emac_desc *) nocache;
+	nocache += NUM_RX * sizeof(struct emac_desc);
+#else
+	desc = (struct emac_desc *) ram_alloc ( NUM_RX * sizeof(struct emac_desc) );
+#endif
+	rx_list = desc;
+
+	for ( edp = desc; edp < &desc[NUM_RX]; edp ++ ) {
+	    struct netbuf *nbp;
+
+	    nbp = netbuf_alloc_user ( NB_USER_RX, NETBUF_MAX );
+	    if ( ! nbp )
+		panic ( "emac - no netbufs for Rx ring" );
+	    rx_arm ( edp, nbp );
+	    edp->status = DS_ACTIVE;
+	    edp->next = (vp32) &edp[1];
+	}
+#else
 #ifdef EMAC_NOCACHE
 	/* This gives us a full megabyte of memory with
 	 * caching disabled.
@@ -398,6 +486,7 @@ rx_list_init ( void )
 	    edp->next = (vp32) &edp[1];
 	    buf += RX_SIZE;
 	}
+#endif
 
 	desc[NUM_RX-1].next = (vp32) &desc[0];
 
@@ -437,27 +526,25 @@ tx_list_init ( void )
 	int i;
 	struct emac_desc *edp;
 	struct emac_desc *desc;
-	// u32 mem;
-	char *buf;
 
+	/* Only descriptors here, no buffers.
+	 * We transmit straight out of the netbufs we are handed,
+	 * emac_send_int() points each descriptor at one.
+	 */
 #ifdef EMAC_NOCACHE
-	// buf = (char *) ram_section_nocache ( 1 );
-	buf = nocache;
-	nocache += NUM_TX * TX_SIZE;
 	desc = (struct emac_desc *) nocache;
 	nocache += NUM_TX * sizeof(struct emac_desc);
 #else
 	/* We can depend on ram_alloc to give us dma aligned addresses */
 	desc = (struct emac_desc *) ram_alloc ( NUM_TX * sizeof(struct emac_desc) );
-	buf = (char *) ram_alloc ( NUM_TX * TX_SIZE );
 #endif
 
 	for ( edp = desc; edp < &desc[NUM_TX]; edp ++ ) {
 	    edp->status = DS_ACTIVE;
 	    edp->size = 0;
-	    edp->buf = (vp32) buf;
+	    edp->buf = 0;
 	    edp->next = (vp32) &edp[1];
-	    buf += TX_SIZE;
+	    tx_netbuf[edp - desc] = (struct netbuf *) 0;
 	}
 
 	desc[NUM_TX-1].next = (vp32) &desc[0];
@@ -515,6 +602,7 @@ init_rings ( void )
 
 static int rx_count = 0;
 static int tx_count = 0;
+static int rx_drop_count = 0;
 
 #include <net/net.h> 
 
@@ -612,87 +700,204 @@ static char last_buf[2048];
 static int prior_len;
 static char prior_buf[2048];
 
-/* !! remember.  This is called at interrupt level.
- * Do as little as possible and hand the packet to
- * net_rcv() as efficiently as possible.
- */
+#ifdef EMAC_RX_NETBUF
+static int rx_copy_count = 0;
 
-static void
-rx_handler ( int stat )
+/* Take a frame off an Rx descriptor.
+ * Usually we hand the netbuf the frame landed in up to the
+ * network code and put a fresh netbuf on the descriptor.
+ * Small frames get copied so the big buffer stays put.
+ * If we cannot get a netbuf, the frame is dropped and the
+ * descriptor keeps the one it has.
+ */
+static struct netbuf *
+rx_receive ( struct emac_desc *edp, int len )
 {
 	struct netbuf *nbp;
-	int len;
-	int tag = ' ';
+	struct netbuf *fresh;
+
+	nbp = rx_netbuf[edp - rx_list];
+
+	if ( len <= RX_COPYBREAK ) {
+	    fresh = netbuf_alloc_user_i ( NB_USER_RX, len );
+	    if ( fresh ) {
+		nb_cache_invalidate ( (void *) nbp->eptr, (char *) nbp->eptr + len );
+		memcpy ( (char *) fresh->eptr, (char *) nbp->eptr, len );
+		fresh->elen = len;
+		rx_copy_count++;
+		return fresh;
+	    }
+	} else {
+	    fresh = netbuf_alloc_user_i ( NB_USER_RX, NETBUF_MAX );
+	    if ( fresh ) {
+		nb_cache_invalidate ( (void *) nbp->eptr, (char *) nbp->eptr + len );
+		nbp->elen = len;
+		rx_arm ( edp, fresh );
+		return nbp;
+	    }
+	}
 
+	rx_drop_count++;
+	net_drop ( NET_DROP_NOBUF );
 	if ( debug_mask & DB_RX )
-		printf ( "Rx interrupt, packet incoming (emac)\n" );
+	    printf ( "Rx packet dropped, no netbuf available\n" );
+	return (struct netbuf *) 0;
+}
+#endif
 
-	et_rx ();
+#ifdef EMAC_CSUM_OFFLOAD
+/* The checksum engine only vouches for the whole packet when it
+ * is an unfragmented IPv4 TCP or UDP datagram.  For anything else
+ * (a fragment, ICMP, ...) the stack has to check it for itself.
+ */
+static int
+rx_csum_usable ( struct netbuf *nbp )
+{
+	struct ip_hdr *ipp;
+
+	if ( nbp->eptr->type != ETH_IP_SWAP )
+	    return 0;
+
+	ipp = (struct ip_hdr *) ((char *) nbp->eptr + sizeof ( struct eth_hdr ));
+	if ( ipp->offset & htons ( IP_MF | IP_OFFMASK ) )
+	    return 0;
+
+	return ipp->proto == IPPROTO_TCP || ipp->proto == IPPROTO_UDP;
+}
+#endif
+
+/* Hand the current Rx descriptor back to the DMA
+ * and move along the ring.
+ */
+static void
+rx_give_back ( void )
+{
+	cur_rx_dma->status = DS_ACTIVE;
+
+	// flush_dcache_range ( (void *) cur_rx_dma, &cur_rx_dma[1] );
+	emac_cache_flush ( (void *) cur_rx_dma, &cur_rx_dma[1] );
+
+	/* Next slot on ring, possible wrap around */
+	cur_rx_dma = (struct emac_desc *) cur_rx_dma->next;
+}
+
+/* Take the frame (if any) off the current Rx descriptor,
+ * hand the descriptor back to the DMA and move along.
+ * Returns 0 if the ring is empty.
+ * *nbpp gets the netbuf, which will be null if we had
+ * to drop the frame.
+ * Must be called with interrupts off.
+ */
+static int
+rx_next ( struct netbuf **nbpp )
+{
+	struct netbuf *nbp;
+	int len;
 
 	// invalidate_dcache_range ( (void *) cur_rx_dma, &cur_rx_dma[1] );
 	emac_cache_invalidate ( (void *) cur_rx_dma, &cur_rx_dma[1] );
 
-	while ( ! (cur_rx_dma->status & DS_ACTIVE) ) {
-	    int i_dma = (cur_rx_dma - rx_list);
-		if ( debug_mask & DB_RX )
-			printf ( "Rx interrupt, %08x, slot %d, status = %08x\n",
-				cur_rx_dma, i_dma, cur_rx_dma->status );
+	if ( cur_rx_dma->status & DS_ACTIVE )
+	    return 0;
+
+	if ( debug_mask & DB_RX )
+		printf ( "Rx interrupt, %08x, slot %d, status = %08x\n",
+			cur_rx_dma, cur_rx_dma - rx_list, cur_rx_dma->status );
 
-	    rx_count++;
-	    len = (cur_rx_dma->status >> 16) & 0x3fff;
-	    last_desc_stat = cur_rx_dma->status;
+	rx_count++;
+	len = (cur_rx_dma->status >> 16) & 0x3fff;
+	last_desc_stat = cur_rx_dma->status;
 
-	    if ( last_desc_stat & ~0x3fff0000 != 0x00000320 )
-			printf ( "Unusual desc status: %08x\n", cur_rx_dma->status );
+	if ( last_desc_stat & ~0x3fff0000 != 0x00000320 )
+		printf ( "Unusual desc status: %08x\n", cur_rx_dma->status );
 
-	    // nbp = netbuf_alloc ();
-	    nbp = netbuf_alloc_i ();
+	/* The DMA could not keep up, this frame is damaged.
+	 * Don't waste a netbuf on it, just keep draining.
+	 */
+	if ( last_desc_stat & DS_OVERFLOW ) {
+		rx_drop_count++;
+		net_drop ( NET_DROP_RING );
+		rx_give_back ();
+		*nbpp = (struct netbuf *) 0;
+		return 1;
+	}
 
+#ifdef EMAC_RX_NETBUF
+	nbp = rx_receive ( cur_rx_dma, len - 4 );
+#else
+	// nbp = netbuf_alloc ();
+	nbp = netbuf_alloc_user_i ( NB_USER_RX, len - 4 );
+	/* If we are out of netbufs, we drop the packet, but we
+	 * must still hand the descriptor back to the DMA and
+	 * keep draining the ring.
+	 */
+	if ( nbp ) {
+#ifdef NETBUF_POISON
 		// sanity check
-		if ( strncmp ( nbp->data, "DEAD", 4 ) != 0 )
+		if ( strncmp ( (char *) nbp->eptr, "DEAD", 4 ) != 0 )
 			panic ( "Rx emac netbuf overuse" );
+#endif
 
-	    if ( ! nbp ) {
-			if ( debug_mask & DB_RX )
-				printf ( "Rx packet dropped, no netbuf available\n" );
-			return;     /* drop packet */
-		}
+		// pkt_arrive ();
 
-	    // pkt_arrive ();
+		nbp->elen = len - 4;
+		// memcpy ( (char *) nbp->eptr, (void *) cur_rx_dma->buf, len - 4 );
+		memcpy ( (char *) nbp->eptr, (void *) cur_rx_dma->buf, len - 4 );
+	} else {
+		rx_drop_count++;
+		net_drop ( NET_DROP_NOBUF );
+		if ( debug_mask & DB_RX )
+			printf ( "Rx packet dropped, no netbuf available\n" );
+	}
+#endif
 
-	    nbp->elen = len - 4;
-	    // memcpy ( (char *) nbp->eptr, (void *) cur_rx_dma->buf, len - 4 );
-	    memcpy ( (char *) nbp->eptr, (void *) cur_rx_dma->buf, len - 4 );
+#ifdef EMAC_CSUM_OFFLOAD
+	if ( nbp && ! (last_desc_stat & (DS_HEADER_ERR | DS_PAYLOAD_ERR))
+	    && rx_csum_usable ( nbp ) )
+		nbp->flags |= NB_CSUM_OK;
+#endif
 
-	    if ( last_capture ) {
-			if ( last_len ) {
-				prior_len = last_len;
-				memcpy ( prior_buf, last_buf, last_len );
-			}
-			last_len = len - 4;
-			memcpy ( last_buf, (void *) cur_rx_dma->buf, len - 4 );
-	    }
+	if ( last_capture && nbp ) {
+		if ( last_len ) {
+			prior_len = last_len;
+			memcpy ( prior_buf, last_buf, last_len );
+		}
+		last_len = nbp->elen;
+		memcpy ( last_buf, (char *) nbp->eptr, nbp->elen );
+	}
 
-	    // emac_show_packet ( tag, i_dma, nbp );
-	    // tag = '*';
+	// emac_show_packet ( tag, i_dma, nbp );
 
-	    cur_rx_dma->status = DS_ACTIVE;
+	// if ( debug_mask & DB_RX ) {
+		// printf ( "Rx packet len = %d\n", len );
+	// 	net_dump ( nbp, "Rx packet", len );
+	// }
 
-	    // flush_dcache_range ( (void *) cur_rx_dma, &cur_rx_dma[1] );
-	    emac_cache_flush ( (void *) cur_rx_dma, &cur_rx_dma[1] );
+	rx_give_back ();
 
-		// if ( debug_mask & DB_RX ) {
-			// printf ( "Rx packet len = %d\n", len );
-		// 	net_dump ( nbp, "Rx packet", len );
-		// }
+	*nbpp = nbp;
+	return 1;
+}
 
-	    net_rcv ( nbp );
+#ifndef EMAC_RX_POLL
+/* !! remember.  This is called at interrupt level.
+ * Do as little as possible and hand the packet to
+ * net_rcv() as efficiently as possible.
+ */
 
-		/* Next slot on ring, possible wrap around */
-	    cur_rx_dma = (struct emac_desc *) cur_rx_dma->next;
+static void
+rx_handler ( int stat )
+{
+	struct netbuf *nbp;
+
+	if ( debug_mask & DB_RX )
+		printf ( "Rx interrupt, packet incoming (emac)\n" );
+
+	et_rx ();
 
-	    // invalidate_dcache_range ( (void *) cur_rx_dma, &cur_rx_dma[1] );
-	    emac_cache_invalidate ( (void *) cur_rx_dma, &cur_rx_dma[1] );
+	while ( rx_next ( &nbp ) ) {
+	    if ( nbp )
+		net_rcv ( nbp );
 	}
 
 #ifdef BOARD_H5
@@ -709,6 +914,56 @@ rx_handler ( int stat )
 	// if ( debug_mask & DB_RX )
 	//	printf ( "Rx interrupt, done)\n" );
 }
+#endif
+
+#ifdef EMAC_RX_POLL
+static int rx_polling = 0;
+
+/* Called from the net thread, not at interrupt level.
+ * Rx interrupts are masked while we are polling.
+ */
+static int
+emac_rx_poll ( int budget )
+{
+	struct emac *ep = EMAC_BASE;
+	struct netbuf *nbp;
+	int more;
+	int done = 0;
+
+	while ( done < budget ) {
+	    INT_lock;
+	    more = rx_next ( &nbp );
+	    INT_unlock;
+	    if ( ! more )
+		break;
+	    done++;
+	    if ( nbp )
+		net_rcv_poll ( nbp );
+	}
+
+	if ( done == budget )
+	    return done;
+
+	/* Ring looks empty, so back to interrupts.
+	 * We ack the Rx status first and then take one more look,
+	 * so a frame that slipped in after we last looked either
+	 * gets seen here or raises a fresh interrupt.
+	 */
+	INT_lock;
+	ep->int_stat = INT_RX;
+	emac_cache_invalidate ( (void *) cur_rx_dma, &cur_rx_dma[1] );
+	if ( ! (cur_rx_dma->status & DS_ACTIVE) ) {
+	    INT_unlock;
+	    net_poll_more ();
+	    return done;
+	}
+	rx_polling = 0;
+	ep->int_ena |= INT_RX;
+	INT_unlock;
+
+	return done;
+}
+#endif
 
 /* Some notes on the cur and clean pointers ...
  * cur always points to the next available slot
@@ -719,8 +974,9 @@ rx_handler ( int stat )
  *  (not really, there is still one slot, but we
  *   cannot use it without making the list look empty).
  *
- * XXX - someday when we do transmits straight out of netbufs
- *   this would be the place to release those netbufs.
+ * We transmit straight out of netbufs, so this is where
+ *  they finally get released, and where anybody waiting
+ *  for space in a full ring gets woken up.
  *
  * For some reason XXX at this time:
  *  When I send a UDP packet, 1.08 milliseconds elapses
@@ -733,6 +989,8 @@ rx_handler ( int stat )
 static void
 tx_cleaner ( void )
 {
+	struct netbuf *nbp;
+	int i;
 
 	if ( cur_tx_dma == clean_tx_dma ) {
 		if ( debug_mask & DB_TX )
@@ -750,12 +1008,24 @@ tx_cleaner ( void )
 	}
 
 	while ( clean_tx_dma != cur_tx_dma ) {
+	    emac_cache_invalidate ( (void *) clean_tx_dma, &clean_tx_dma[1] );
 	    if ( clean_tx_dma->status & DS_ACTIVE)
 			break;
 	    // printf ( "Tx clean: %08x %08x\n", clean_tx_dma->status, clean_tx_dma->size );
+	    i = clean_tx_dma - tx_list;
+	    nbp = tx_netbuf[i];
+	    if ( nbp ) {
+			tx_netbuf[i] = (struct netbuf *) 0;
+			netbuf_free_i ( nbp );
+	    }
 	    clean_tx_dma = (struct emac_desc *) clean_tx_dma->next;
 	    // pkt_finish ();
 	}
+
+	if ( tx_space_wait ) {
+	    tx_space_wait = 0;
+	    sem_unblock ( tx_space_sem );
+	}
 	if ( debug_mask & DB_TX ) {
 		printf ( "Emac tx cleaner - done\n" );
 		tx_list_show ();
@@ -832,10 +1102,26 @@ emac_handler ( int junk )
 	    printf ( " *** unexpected emac Rx int status: %08x\n", stat );
 
 	// ep->int_ena = INT_RX | INT_TX | INT_TX_UNDERFLOW;
+#ifdef EMAC_RX_POLL
+	/* While polling, leave the Rx status alone (don't ack it below),
+	 * emac_rx_poll() deals with it when it turns interrupts back on.
+	 */
+	if ( rx_polling )
+	    stat &= ~INT_RX;
+
+	if ( stat & INT_RX ) {
+	    ++rx_int_count;
+	    et_rx ();
+	    rx_polling = 1;
+	    ep->int_ena &= ~INT_RX;
+	    net_poll_sched ( emac_rx_poll );
+	}
+#else
 	if ( stat & INT_RX ) {
 	    ++rx_int_count;
 	    rx_handler ( stat );
 	}
+#endif
 
 	if ( stat & INT_TX ) {
 	    ++tx_int_count;
@@ -927,6 +1213,37 @@ set_mac ( char *mac_id )
 	    (mac_id[2] << 16) + (mac_id[3] << 24);
 }
 
+/* The multicast addresses we want, all of them.
+ * Slot 0 is our own address, that leaves 7 for multicast.
+ * If there are more than that, we take all multicast and
+ * the network code sorts it out.
+ */
+void
+emac_mcast ( unsigned char *list, int count )
+{
+	struct emac *ep = EMAC_BASE;
+	unsigned char *mac;
+	int i;
+
+	if ( count > MAC_ADDR_SLOTS - 1 ) {
+	    ep->rx_filt |= RX_ALL_MULTI;
+	    count = 0;
+	} else
+	    ep->rx_filt &= ~RX_ALL_MULTI;
+
+	for ( i=1; i<MAC_ADDR_SLOTS; i++ ) {
+	    if ( i <= count ) {
+		mac = &list[(i-1) * ETH_ADDR_SIZE];
+		ep->mac_addr[i].lo = mac[0] + (mac[1] << 8) +
+		    (mac[2] << 16) + (mac[3] << 24);
+		ep->mac_addr[i].hi = (mac[4] + (mac[5] << 8)) | MAC_ADDR_ENA;
+	    } else {
+		ep->mac_addr[i].hi = 0;
+		ep->mac_addr[i].lo = 0;
+	    }
+	}
+}
+
 // seems to take 2 milliseconds
 // actually takes 10 ticks
 #define SOFT_RESET_TIMEOUT	500
@@ -1096,6 +1413,7 @@ emac_init_new ( void )
 	emac_state = 1;
 
 	emac_sem = sem_signal_new ( SEM_FIFO );
+	tx_space_sem = sem_signal_new ( SEM_FIFO );
 
 	// phy_init ();	// 1-10-2023
 
@@ -1171,6 +1489,12 @@ emac_init_new ( void )
 	ep->rx_ctl1 |= TX_MD;
 	ep->tx_ctl1 |= RX_MD;
 
+#ifdef EMAC_CSUM_OFFLOAD
+	/* Despite the name, this also turns on the Rx checksum engine */
+	ep->rx_ctl0 |= RX_CHECK_CRC;
+	net_offload_set ( NET_CSUM_RX | NET_CSUM_TX );
+#endif
+
 	/* Shut down receiver and receive DMA */
 	ep->rx_ctl0 &= ~RX_EN;
 	ep->rx_ctl1 &= ~RX_DMA_ENA;
@@ -1333,6 +1657,11 @@ emac_show ( void )
 	printf ( "Emac int count: %d, rx/tx = %d/%d\n", int_count, rx_int_count, tx_int_count );
 	printf ( "Emac rx_count: %d\n", rx_count );
 	printf ( "Emac tx_count: %d\n", tx_count );
+	printf ( "Emac tx waits (ring full): %d\n", tx_full_count );
+	printf ( "Emac rx dropped (no netbuf): %d\n", rx_drop_count );
+#ifdef EMAC_RX_NETBUF
+	printf ( "Emac rx copied (copybreak %d): %d\n", RX_COPYBREAK, rx_copy_count );
+#endif
 }
 
 void
@@ -1364,6 +1693,7 @@ emac_send_int ( struct netbuf *nbp, int wait )
 			phy_show ();
 			phy_update ();
 	    }
+	    netbuf_free ( nbp );
 	    return;
 	}
 
@@ -1384,17 +1714,27 @@ emac_send_int ( struct netbuf *nbp, int wait )
 
         len = nbp->ilen + sizeof(struct eth_hdr);
 
+	/* The DMA reads the frame right out of the netbuf,
+	 * which is always in cached ram.
+	 */
+	nb_cache_flush ( (void *) nbp->eptr, (char *) nbp->eptr + len );
+
 	/* statistics */
 	// pkt_send ();
 
 	INT_lock;
 	// tx_cleaner ();
 
-	if ( cur_tx_dma->next == (vp32) clean_tx_dma ) {
-	    printf ( " !!! *** Tx ring full, packet not sent\n" );
-		tx_list_show ();
-	    INT_unlock;
-	    return;
+	/* Ring full, wait for tx_cleaner() to make room.
+	 * This used to just drop the packet.
+	 * sem_block_cpu() returns with interrupts enabled,
+	 * so we lock again and take another look.
+	 */
+	while ( cur_tx_dma->next == (vp32) clean_tx_dma ) {
+	    tx_full_count++;
+	    tx_space_wait = 1;
+	    sem_block_cpu ( tx_space_sem );
+	    INT_lock;
 	}
 
 	if ( debug_mask & DB_TX ) {
@@ -1402,10 +1742,9 @@ emac_send_int ( struct netbuf *nbp, int wait )
         // dump_buf ( nbp->eptr, len );
 	}
 
-	memcpy ( (void *) cur_tx_dma->buf, (char *) nbp->eptr, len );
-
-	// flush_dcache_range ( (unsigned long ) cur_tx_dma->buf, (unsigned long) cur_tx_dma->buf + len );
-	emac_cache_flush ( (unsigned long ) cur_tx_dma->buf, (unsigned long) cur_tx_dma->buf + len );
+	/* The descriptor owns the netbuf until tx_cleaner() frees it */
+	tx_netbuf[cur_tx_dma - tx_list] = nbp;
+	cur_tx_dma->buf = (vp32) nbp->eptr;
 
 	/* ARP packets are small (42 bytes) and may get rejected unless padded.
 	 */
@@ -1422,7 +1761,10 @@ emac_send_int ( struct netbuf *nbp, int wait )
 	 *  XXX - we could check that here.
 	 */
 	// cur_tx_dma->size = len | DS_TX_SEND;
-	cur_tx_dma->size = (len & 0x7ff) | DS_TX_SEND;
+	if ( nbp->flags & NB_CSUM_TX )
+	    cur_tx_dma->size = (len & 0x7ff) | DS_TX_SEND | DS_TX_CSUM_FULL;
+	else
+	    cur_tx_dma->size = (len & 0x7ff) | DS_TX_SEND;
 	cur_tx_dma->status = DS_ACTIVE;
 
 	// flush_dcache_range ( (void *) cur_tx_dma, &cur_tx_dma[1] );
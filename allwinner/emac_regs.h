@@ -33,11 +33,15 @@ struct emac {
 	// volatile void * rx_desc;
 	vp32 rx_desc;		/* 34 */
 
-	vu32 rx_filt;		/* 38 -- never used*/
+	vu32 rx_filt;		/* 38 */
 	int __pad3;			/* 3C --*/
 
 	vu32 rx_hash0;		/* 40 -- never used */
 	vu32 rx_hash1;		/* 44 -- never used */
+	/* We use the extra mac_addr slots for multicast rather
+	 * than the hash table (so does linux).  They are exact,
+	 * and 7 groups is plenty.
+	 */
 
 	vu32 mii_cmd;		/* 48 */
 	vu32 mii_data;		/* 4c */
@@ -125,3 +129,7 @@ struct emac {
 #define	RX_FILT_DIS		0x80000000
 #define	RX_DROP_BROAD		0x00020000
 #define	RX_ALL_MULTI		0x00010000
+
+/* in mac_addr[n].hi for n > 0, filter on this address */
+#define MAC_ADDR_ENA		0x80000000
+#define MAC_ADDR_SLOTS		8
@@ -162,6 +162,62 @@ r_CCNT ( void )
     return rv;
 }
 
+/* low byte of the affinity register gives core (0-3) */
+static inline int
+get_core_id ( void )
+{
+    unsigned int mpidr;
+
+    get_MPID ( mpidr );
+    return mpidr & 0xff;
+}
+
+/* Simple spin locks for data shared between cores.
+ * These know nothing about interrupts, so the caller should
+ * hold INT_lock if an interrupt routine might want the same lock.
+ */
+static inline void
+cpu_spin_lock ( volatile int *lock )
+{
+    int tmp;
+
+    asm volatile (
+	"1:	ldrex	%0, [%1]\n"
+	"	cmp	%0, #0\n"
+	"	wfene\n"
+	"	strexeq	%0, %2, [%1]\n"
+	"	cmpeq	%0, #0\n"
+	"	bne	1b\n"
+	"	dmb\n"
+	: "=&r" ( tmp ) : "r" ( lock ), "r" ( 1 ) : "cc", "memory" );
+}
+
+static inline void
+cpu_spin_unlock ( volatile int *lock )
+{
+    asm volatile ( "dmb" : : : "memory" );
+    *lock = 0;
+    asm volatile ( "dsb\n\tsev" : : : "memory" );
+}
+
+/* Add to a counter that more than one core (or an interrupt
+ * routine) might be adding to at the same time.
+ * No barrier, it is only a count.
+ */
+static inline void
+cpu_atomic_add ( volatile int *p, int val )
+{
+    int tmp, fail;
+
+    asm volatile (
+	"1:	ldrex	%0, [%2]\n"
+	"	add	%0, %0, %3\n"
+	"	strex	%1, %0, [%2]\n"
+	"	cmp	%1, #0\n"
+	"	bne	1b\n"
+	: "=&r" ( tmp ), "=&r" ( fail ) : "r" ( p ), "r" ( val ) : "cc", "memory" );
+}
+
 #ifdef notdef
 /* Disable interrupts to lock section */
 static inline void
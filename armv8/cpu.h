@@ -98,6 +98,63 @@ r_CCNT ( void )
  */
 #define get_MPIDR(val)	asm volatile ( "mrs %0, MPIDR_EL1" : "=r" ( val ) )
 
+/* Number the cores 0 to NUM_CORES-1 across clusters.
+ * The fire3 has two clusters of 4, so core 2 of cluster 1
+ * is 6.  Per core arrays get indexed by this.
+ */
+static inline int
+get_core_id ( void )
+{
+    unsigned long mpidr;
+
+    get_MPIDR ( mpidr );
+    return ((mpidr >> 8) & 0xff) << 2 | (mpidr & 0x3);
+}
+
+/* Simple spin locks for data shared between cores.
+ * These know nothing about interrupts, so the caller should
+ * hold INT_lock if an interrupt routine might want the same lock.
+ * I avoid the gcc __atomic builtins here, since on aarch64 they
+ * can turn into calls to libgcc helpers that we don't link with.
+ */
+static inline void
+cpu_spin_lock ( volatile int *lock )
+{
+    int tmp;
+
+    asm volatile (
+	"	sevl\n"
+	"1:	wfe\n"
+	"2:	ldaxr	%w0, [%1]\n"
+	"	cbnz	%w0, 1b\n"
+	"	stxr	%w0, %w2, [%1]\n"
+	"	cbnz	%w0, 2b\n"
+	: "=&r" ( tmp ) : "r" ( lock ), "r" ( 1 ) : "memory" );
+}
+
+static inline void
+cpu_spin_unlock ( volatile int *lock )
+{
+    asm volatile ( "stlr wzr, [%0]" : : "r" ( lock ) : "memory" );
+}
+
+/* Add to a counter that more than one core (or an interrupt
+ * routine) might be adding to at the same time.
+ * No barrier, it is only a count.
+ */
+static inline void
+cpu_atomic_add ( volatile int *p, int val )
+{
+    int tmp, fail;
+
+    asm volatile (
+	"1:	ldxr	%w0, [%2]\n"
+	"	add	%w0, %w0, %w3\n"
+	"	stxr	%w1, %w0, [%2]\n"
+	"	cbnz	%w1, 1b\n"
+	: "=&r" ( tmp ), "=&r" ( fail ) : "r" ( p ), "r" ( val ) : "memory" );
+}
+
 #define get_SP(x)	asm volatile ("add %0, sp, #0\n" :"=r" ( x ) )
 #define get_FP(x)	asm volatile ("add %0, fp, #0\n" :"=r" ( x ) )
 
@@ -111,6 +168,14 @@ r_CCNT ( void )
 #define INT_lock 	asm volatile("msr DAIFClr, #3" : : : "cc")
 #endif
 
+/* Types for mmu_set_attr () */
+#define MMU_ATTR_INVALID	0	/* accesses fault, for guard pages */
+#define MMU_ATTR_NORMAL		1	/* cached ram */
+#define MMU_ATTR_NOCACHE	2	/* uncached ram, for DMA, not executable */
+#define MMU_ATTR_DEVICE		3	/* device registers, not executable */
+
+int mmu_set_attr ( unsigned long, unsigned long, int );
+
 // Returns the EL but in bits [3:2]
 #define get_EL(val)	asm volatile ( "mrs %0, CurrentEL" : "=r" ( val ) )
 
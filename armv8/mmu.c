@@ -69,6 +69,7 @@ tlb_invalidate_all ( void )
  */
 void pte_show ( u64 * );
 void pte_dump ( u64 *, int );
+void mmu_footprint ( void );
 
 void
 mmu_show ( void )
@@ -127,6 +128,8 @@ mmu_show ( void )
 	printf ( " TCR:tg0 = %08x\n", (val>>14) & 0x3 );
 	printf ( " TCR:tg1 = %08x\n", (val>>30) & 0x3 );
 
+	mmu_footprint ();
+
 #ifdef notdef
 	tp = (u64 *) ttbr;
 	pte_dump ( tp, 512 );
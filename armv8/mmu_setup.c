@@ -114,8 +114,10 @@ ADDR 000000007fff0ff8  000000007fe00000
  */
 #define CHUNK_SIZE 0x200000
 
-/* We set aside 64K for page tables,
- * although we only need/user 8K
+/* We set aside 64K for page tables.
+ * The level 1 and level 2 tables use 8K, the rest is
+ * handed out 4K at a time when mmu_set_attr() needs
+ * to break a block into smaller pieces.
  */
 #define PG_SIZE	64*1024
 
@@ -142,6 +144,51 @@ ADDR 000000007fff0ff8  000000007fe00000
 
 static addr_t mmu_setup ( addr_t, u64 );
 
+/* With a 4K granule each table has 512 entries.
+ * A level 1 entry maps 1G, level 2 maps 2M, level 3 maps 4K.
+ */
+#define MMU_ENTRIES	512
+#define MMU_SHIFT(l)	(12 + 9 * (3 - (l)))
+#define MMU_LSIZE(l)	(1UL << MMU_SHIFT(l))
+
+/* The contiguous hint tells the TLB that 16 adjacent entries
+ * map one aligned, physically contiguous range with the same
+ * attributes, so it can hold them all in a single entry.
+ * That is 32M for 2M blocks and 64K for 4K pages.
+ */
+#define MMU_CONTIG	16
+#define PTE_CONTIG	(1UL << 52)
+
+#define PTE_ADDR_MASK	0x0000fffffffff000UL
+
+#define PTE_TYPE_MASK	3
+#define PTE_TYPE_VALID	1
+#define PTE_TYPE_BLOCK	1
+#define PTE_TYPE_TABLE	3
+#define PTE_TYPE_PAGE	3
+
+/* Nothing should ever execute from device registers or
+ * uncached buffers, so anything that isn't normal ram gets
+ * execute never.  We run at EL2, where bit 54 is the XN that
+ * counts and bit 53 (PXN at EL1) is ignored.
+ */
+#define PTE_UXN		(1UL << 54)
+#define PTE_PXN		(1UL << 53)
+#define PTE_XN		(PTE_UXN | PTE_PXN)
+
+/* Descriptor bits (less the type bits) for each mmu_set_attr() type.
+ * The AttrIndx values select from the MAIR we inherit from U-boot:
+ *  4 is normal cached, 3 is normal uncached, 0 is device nGnRnE.
+ * 0x400 is the access flag, 0x300 is inner shareable.
+ */
+#define PTE_NORMAL	0x710
+#define PTE_NOCACHE	(0x70c | PTE_XN)
+#define PTE_DEVICE	(0x400 | PTE_XN)
+
+static u64 *level1;
+static u64 *mmu_next_table;
+static u64 *mmu_end_table;
+
 static inline void
 mmu_on ( void )
 {
@@ -199,6 +246,259 @@ ram_section_nocache ( int xx )
 		return (void *) UNCACHED_BASE;
 }
 
+/* Set or clear the contiguous hint on each aligned group of
+ * 16 entries in a level 2 or level 3 table.
+ * All 16 must be valid leaf entries with the same attributes
+ * mapping a single aligned range.
+ */
+static void
+mmu_contig_scan ( u64 *table, int level )
+{
+		u64 size = MMU_LSIZE(level);
+		u64 type;
+		u64 first;
+		int i, j;
+
+		type = level == 3 ? PTE_TYPE_PAGE : PTE_TYPE_BLOCK;
+
+		for ( i=0; i<MMU_ENTRIES; i += MMU_CONTIG ) {
+			for ( j=0; j<MMU_CONTIG; j++ )
+				table[i+j] &= ~PTE_CONTIG;
+
+			first = table[i];
+			if ( (first & PTE_TYPE_MASK) != type )
+				continue;
+			if ( (first & PTE_ADDR_MASK) & (size * MMU_CONTIG - 1) )
+				continue;
+
+			for ( j=1; j<MMU_CONTIG; j++ )
+				if ( table[i+j] != first + j * size )
+					break;
+			if ( j < MMU_CONTIG )
+				continue;
+
+			for ( j=0; j<MMU_CONTIG; j++ )
+				table[i+j] |= PTE_CONTIG;
+		}
+}
+
+static inline int
+pte_is_table ( u64 pte, int level )
+{
+		return level < 3 && (pte & PTE_TYPE_MASK) == PTE_TYPE_TABLE;
+}
+
+/* Redo the contiguous hints everywhere below level 1 */
+static void
+mmu_contig_all ( void )
+{
+		u64 *l2;
+		int i, j;
+
+		for ( i=0; i<MMU_ENTRIES; i++ ) {
+			if ( ! pte_is_table ( level1[i], 1 ) )
+				continue;
+			l2 = (u64 *) (level1[i] & PTE_ADDR_MASK);
+			mmu_contig_scan ( l2, 2 );
+			for ( j=0; j<MMU_ENTRIES; j++ )
+				if ( pte_is_table ( l2[j], 2 ) )
+					mmu_contig_scan ( (u64 *) (l2[j] & PTE_ADDR_MASK), 3 );
+		}
+}
+
+/* Replace a block entry with a table of entries one level
+ * down that map the same thing, so that part of it can be
+ * changed.  An invalid entry becomes a table of invalid entries.
+ */
+static int
+mmu_split ( u64 *pte, int level )
+{
+		u64 *table;
+		u64 size;
+		u64 val;
+		int i;
+
+		if ( mmu_next_table >= mmu_end_table ) {
+			printf ( "mmu_split: out of page tables\n" );
+			return 0;
+		}
+		table = mmu_next_table;
+		mmu_next_table += MMU_ENTRIES;
+
+		size = MMU_LSIZE(level+1);
+		val = *pte & ~PTE_CONTIG;
+
+		for ( i=0; i<MMU_ENTRIES; i++ ) {
+			if ( ! (val & PTE_TYPE_VALID) )
+				table[i] = 0;
+			else if ( level+1 == 3 )
+				table[i] = (val | PTE_TYPE_PAGE) + i * size;
+			else
+				table[i] = val + i * size;
+		}
+
+		*pte = (u64) table | PTE_TYPE_TABLE;
+		return 1;
+}
+
+/* Work through one table, using the biggest entries that
+ * fit the range and splitting blocks only at the ends.
+ * An invalid entry is given an identity mapping, otherwise
+ * we keep whatever address the entry already maps to,
+ * which matters for the uncached alias of ram.
+ */
+static int
+mmu_set_range ( u64 *table, int level, u64 va, u64 end, u64 bits )
+{
+		u64 size = MMU_LSIZE(level);
+		u64 *pte;
+		u64 next;
+		u64 pa;
+
+		while ( va < end ) {
+			pte = &table[(va >> MMU_SHIFT(level)) & (MMU_ENTRIES-1)];
+			next = (va & ~(size-1)) + size;
+
+			if ( (va & (size-1)) == 0 && next <= end && ! pte_is_table ( *pte, level ) ) {
+				if ( *pte & PTE_TYPE_VALID )
+					pa = *pte & PTE_ADDR_MASK;
+				else
+					pa = va;
+				if ( ! bits )
+					*pte = 0;
+				else
+					*pte = pa | bits | (level == 3 ? PTE_TYPE_PAGE : PTE_TYPE_BLOCK);
+			} else {
+				if ( ! pte_is_table ( *pte, level ) && ! mmu_split ( pte, level ) )
+					return 0;
+				if ( ! mmu_set_range ( (u64 *) (*pte & PTE_ADDR_MASK), level+1,
+						va, next < end ? next : end, bits ) )
+					return 0;
+			}
+			va = next;
+		}
+		return 1;
+}
+
+/* Change the attributes for an arbitrary range of addresses.
+ * This is the arm64 counterpart of mmu_remap() on the armv7,
+ * but handles any 4K aligned range, so things like guard pages
+ * (MMU_ATTR_INVALID) or a single uncached device window don't
+ * cost us the large mappings around them.
+ *
+ * We edit the tables with the MMU off, the same way mmu_setup()
+ * switches tables, which sidesteps the break-before-make rules
+ * for live tables.  Only this core's TLB gets invalidated, so
+ * do this before other cores are started.
+ */
+int
+mmu_set_attr ( addr_t start, u64 size, int attr )
+{
+		u64 bits;
+		int rv;
+
+		if ( (start | size) & (MMU_LSIZE(3)-1) ) {
+			printf ( "mmu_set_attr: %016lx, %lx not page aligned\n", start, size );
+			return 0;
+		}
+
+		switch ( attr ) {
+		    case MMU_ATTR_INVALID:
+			bits = 0;
+			break;
+		    case MMU_ATTR_NORMAL:
+			bits = PTE_NORMAL;
+			break;
+		    case MMU_ATTR_NOCACHE:
+			bits = PTE_NOCACHE;
+			break;
+		    case MMU_ATTR_DEVICE:
+			bits = PTE_DEVICE;
+			break;
+		    default:
+			printf ( "mmu_set_attr: bad type %d\n", attr );
+			return 0;
+		}
+
+		INT_lock;
+		dcache_disable ();
+		mmu_off ();
+
+		rv = mmu_set_range ( level1, 1, start, start + size, bits );
+		mmu_contig_all ();
+
+		tlb_invalidate_all ();
+		mmu_on ();
+        asm volatile ( "dsb sy" );
+        asm volatile ( "isb" );
+		dcache_enable ();
+		INT_unlock;
+
+		return rv;
+}
+
+/* Count what it takes to map everything.
+ * Each valid leaf entry needs a TLB entry of its own,
+ * except that a contiguous group of 16 needs only one.
+ */
+struct mmu_count {
+		int leaf[4];
+		int contig[4];
+		int tables;
+		u64 bytes;
+};
+
+static void
+mmu_count_table ( u64 *table, int level, struct mmu_count *cp )
+{
+		u64 pte;
+		int i;
+
+		cp->tables++;
+		for ( i=0; i<MMU_ENTRIES; i++ ) {
+			pte = table[i];
+			if ( ! (pte & PTE_TYPE_VALID) )
+				continue;
+			if ( pte_is_table ( pte, level ) ) {
+				mmu_count_table ( (u64 *) (pte & PTE_ADDR_MASK), level+1, cp );
+				continue;
+			}
+			cp->bytes += MMU_LSIZE(level);
+			if ( pte & PTE_CONTIG )
+				cp->contig[level]++;
+			else
+				cp->leaf[level]++;
+		}
+}
+
+void
+mmu_footprint ( void )
+{
+		struct mmu_count count;
+		int level;
+		int tlb;
+
+		if ( ! level1 ) {
+			printf ( "MMU tables not set up by Kyu\n" );
+			return;
+		}
+
+		memset ( (char *) &count, 0, sizeof(count) );
+		mmu_count_table ( level1, 1, &count );
+
+		tlb = 0;
+		printf ( "MMU footprint, %d M mapped with %d tables (%d spare):\n",
+		    (int) (count.bytes / (1024*1024)), count.tables,
+		    (int) (mmu_end_table - mmu_next_table) / MMU_ENTRIES );
+		for ( level=1; level<=3; level++ ) {
+			printf ( "  %7dK entries: %4d, %4d more in %d contiguous groups\n",
+			    (int) (MMU_LSIZE(level) / 1024), count.leaf[level],
+			    count.contig[level], count.contig[level] / MMU_CONTIG );
+			tlb += count.leaf[level] + count.contig[level] / MMU_CONTIG;
+		}
+		printf ( "  %d TLB entries would cover it all\n", tlb );
+}
+
 /* Currently we ignore the arguments as far as the MMU
  * setup and have things wired in for our two H5 boards.
  * We do return a corrected size value.
@@ -210,7 +510,6 @@ mmu_setup ( addr_t ram_start, u64 ram_size )
 		u64 *addr;
 		u64 add;
 		u64 val;
-		u64 *level1;
 		u64 *level2;
 
 		// dump_l ( (void *) MMU_BASE, 16 );
@@ -225,9 +524,9 @@ mmu_setup ( addr_t ram_start, u64 ram_size )
 		 * This is very much H5 specific and has
 		 * the value for RAM_BASE wired in.
 		 */
-		level1[0] = 0x0000000000000401;		/* IO */
+		level1[0] = 0x0000000000000401 | PTE_XN;	/* IO */
 		level1[1] = 0x0000000040000711;		/* 1G of ram */
-		level1[2] = 0x0000000040000401;		/* again - uncached */
+		level1[2] = 0x0000000040000401 | PTE_XN;	/* again - uncached */
 		level1[3] = 0;						/* invalid, just for the record */
 		// dump_l ( level1, 4 );
 
@@ -250,10 +549,17 @@ mmu_setup ( addr_t ram_start, u64 ram_size )
 		val = level2[NUM_CHUNKS-1];
 		// printf ( "Level2-last = %016lx\n", val );
 		val &= ~0xfff;
-		val |= 0x401;
+		val |= 0x401 | PTE_XN;
 		// printf ( "Level2-last = %016lx\n", val );
 		level2[NUM_CHUNKS-1] = val;
 
+		/* Everything else is plain cached ram, so all but
+		 * the last 32M get the contiguous hint.
+		 */
+		mmu_next_table = &level2[MMU_ENTRIES];
+		mmu_end_table = (u64 *) (MMU_BASE + PG_SIZE);
+		mmu_contig_scan ( level2, 2 );
+
 		// dump_l ( level2, 8 );
 
 		/* Don't turn off the MMU without first
@@ -0,0 +1,19 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * string.h for the ARM v8
+ *
+ * Tells lib/string.c which routines we provide in string.S
+ * The generic versions are still compiled, but get a _c suffix.
+ */
+
+#define __HAVE_ARCH_MEMCPY
+#define __HAVE_ARCH_MEMSET
+#define __HAVE_ARCH_MEMCMP
+
+/* THE END */
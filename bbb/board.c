@@ -250,7 +250,18 @@ get_board_net_addr ( char *addr )
 void
 board_net_send ( struct netbuf *nbp )
 {
+	/* cpsw does not hold on to netbufs (yet), see cpsw_send() */
 	cpsw_send ( nbp );
+	netbuf_free ( nbp );
+}
+
+/* Multicast addresses to let in, count of them.
+ * Returns nonzero if the switch can't take them all.
+ */
+int
+board_net_mcast ( unsigned char *list, int count )
+{
+	return cpsw_mcast ( list, count );
 }
 
 void
@@ -50,6 +50,9 @@
 #include <malloc.h>
 #include <omap_ints.h>
 
+#include "netbuf.h"
+#include "net.h"
+
 /* Hardware base addresses */
 /* from the TRM, chapter 2, pages 175-176 */
 
@@ -84,6 +87,11 @@
 /* bit to enable/disable interrupts for our channel */
 #define OUR_CPDMA_INT	0x01
 
+/* Take Rx packets off the ring in the net thread rather than at
+ * interrupt level, see cpsw_rx_poll() and net_poll_sched().
+ */
+#define CPSW_RX_POLL
+
 /* XXX TRM says 1152 entries */
 #define NUM_ALE_ENTRIES		1024
 
@@ -925,9 +933,59 @@ ale_add_mcast(struct cpsw_priv *priv, u8 *addr, int port_mask)
 	return 0;
 }
 
+static void
+ale_del(struct cpsw_priv *priv, u8 *addr)
+{
+	u32 ale_entry[ALE_ENTRY_SIZE] = {0, 0, 0};
+	int idx;
+
+	idx = ale_match_addr(priv, addr);
+	if (idx >= 0)
+		ale_write ( ale_entry, idx );
+}
+
 /* Ethernet broadcast address */
 static unsigned char NetBcastAddr[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
 
+/* The multicast addresses we want, all of them.
+ * The ALE has plenty of room, so each gets an entry that
+ * sends it to the host port, and we remove the ones that
+ * are no longer on the list.
+ * Returns -1 if there were more than we keep track of.
+ */
+#define CPSW_MCAST_MAX	32
+
+static unsigned char cpsw_mc_list[CPSW_MCAST_MAX][6];
+static int cpsw_mc_count;
+
+int
+cpsw_mcast ( unsigned char *list, int count )
+{
+	struct cpsw_priv *priv = &cpsw_private;
+	int rv = 0;
+	int i, j;
+
+	if ( count > CPSW_MCAST_MAX ) {
+	    count = CPSW_MCAST_MAX;
+	    rv = -1;
+	}
+
+	for ( i=0; i<cpsw_mc_count; i++ ) {
+	    for ( j=0; j<count; j++ )
+		if ( memcmp ( cpsw_mc_list[i], &list[j*6], 6 ) == 0 )
+		    break;
+	    if ( j == count )
+		ale_del ( priv, cpsw_mc_list[i] );
+	}
+
+	for ( j=0; j<count; j++ ) {
+	    memcpy ( cpsw_mc_list[j], &list[j*6], 6 );
+	    (void) ale_add_mcast ( priv, cpsw_mc_list[j], 1 << HOST_PORT );
+	}
+	cpsw_mc_count = count;
+	return rv;
+}
+
 /* XXX merge with the above */
 static void
 ale_broadcast ( int port )
@@ -1187,7 +1245,8 @@ tx_submit ( char *buffer, int len )
 
 	desc = cpdma_desc_alloc();
 	if (!desc) {
-	    printf ("tx_submit - dropping (no descriptor)\n" );
+	    // printf ("tx_submit - dropping (no descriptor)\n" );
+	    net_drop ( NET_DROP_RING );
 	    return -1;
 	}
 
@@ -1567,9 +1626,6 @@ eth_test ( int arg )
 
 /* The current set of official Kyu entry points */
 
-#include "netbuf.h"
-#include "net.h"
-
 static void
 net_wonk ( struct netbuf *nbp )
 {
@@ -1632,7 +1688,7 @@ cpsw_tx_isr ( int dummy )
 	dma->eoi_vector = TX_EOI;
 }
 
-static void
+static struct netbuf *
 reap_one ( struct cpdma_desc *dp )
 {
 	char *buf;
@@ -1652,10 +1708,14 @@ reap_one ( struct cpdma_desc *dp )
 	++rx_count;
 
 	// nbp = netbuf_alloc ();
-	nbp = netbuf_alloc_i ();
+	nbp = netbuf_alloc_user_i ( NB_USER_RX, len - 4 );
 
-	if ( ! nbp )
-	    return;	/* drop packet */
+	/* drop packet, but give the descriptor back */
+	if ( ! nbp ) {
+	    net_drop ( NET_DROP_NOBUF );
+	    rx_buffer_add ( dp );
+	    return nbp;
+	}
 
 	/* 5-21-2015 - there is a trailing 4 bytes that is being treasured
 	 * in the buffer that we don't want or need (CRC probably)
@@ -1666,38 +1726,110 @@ reap_one ( struct cpdma_desc *dp )
 	/* Replace the buffer descriptor on the list */
 	rx_buffer_add ( dp );
 
-	net_rcv ( nbp );
+	return nbp;
 }
 
-void
-cpsw_rx_isr ( int dummy )
+/* Take the next received packet off the Rx list.
+ * Returns 0 if there is nothing there.
+ * *nbpp gets the netbuf, null if we had to drop it.
+ * Must be called with interrupts off.
+ */
+static int
+rx_next ( struct netbuf **nbpp )
 {
 	struct cpsw_priv *priv = &cpsw_private;
 	struct stateram_regs *stram = (struct stateram_regs *) STATERAM_BASE;
-	struct dma_regs *dma = (struct dma_regs *) CPDMA_BASE;
 	struct cpdma_desc *desc;
 
-	et_rx ();
-	// if ( rx_int_count < 20 )
-	//    printf ( "Interrupt (RX): %08x\n", dma->rx_intstat );
-	rx_int_count++;
+	if ( ! priv->rx_head )
+	    return 0;
 
-	// rx_process ();
-	while ( priv->rx_head ) {
+	desc = priv->rx_head;
+
+	if ( desc->mode & CPDMA_DESC_OWN ) {
+	    if ( stram->rxhdp[OUR_CPDMA] == 0 )
+		stram->rxhdp[OUR_CPDMA] = desc;
+	    return 0;
+	}
 
-	    desc = priv->rx_head;
+	priv->rx_head = desc->next;
+	stram->rxcp[OUR_CPDMA] = desc;
 
-	    if ( desc->mode & CPDMA_DESC_OWN ) {
-		if ( stram->rxhdp[OUR_CPDMA] == 0 )
-		    stram->rxhdp[OUR_CPDMA] = desc;
+	*nbpp = reap_one ( desc );
+	return 1;
+}
+
+#ifdef CPSW_RX_POLL
+static int rx_poll_count = 0;
+
+/* Called from the net thread, not at interrupt level.
+ * The Rx interrupt is disabled in the wrapper while we poll.
+ * The CPDMA keeps its Rx interrupt asserted as long as there
+ * are packets we have not acknowledged via rxcp, so when we
+ * enable it again any packet that slipped in after our last
+ * look just gives us a new interrupt.
+ */
+static int
+cpsw_rx_poll ( int budget )
+{
+	struct dma_regs *dma = (struct dma_regs *) CPDMA_BASE;
+	struct wr_regs *wrp = (struct wr_regs *) WR_BASE;
+	struct netbuf *nbp;
+	int more;
+	int done = 0;
+
+	rx_poll_count++;
+
+	while ( done < budget ) {
+	    INT_lock;
+	    more = rx_next ( &nbp );
+	    INT_unlock;
+	    if ( ! more )
 		break;
-	    }
+	    done++;
+	    if ( nbp )
+		net_rcv_poll ( nbp );
+	}
+
+	if ( done == budget )
+	    return done;
+
+	/* Ring is empty, back to interrupts */
+	INT_lock;
+	dma->eoi_vector = RX_EOI;
+	wrp->c0_rx_ena = OUR_CPDMA_INT;
+	INT_unlock;
 
-	    priv->rx_head = desc->next;
-	    stram->rxcp[OUR_CPDMA] = desc;
+	return done;
+}
+#endif
 
-	    reap_one ( desc );
+void
+cpsw_rx_isr ( int dummy )
+{
+	struct dma_regs *dma = (struct dma_regs *) CPDMA_BASE;
+#ifdef CPSW_RX_POLL
+	struct wr_regs *wrp = (struct wr_regs *) WR_BASE;
+#else
+	struct netbuf *nbp;
+#endif
+
+	et_rx ();
+	// if ( rx_int_count < 20 )
+	//    printf ( "Interrupt (RX): %08x\n", dma->rx_intstat );
+	rx_int_count++;
+
+#ifdef CPSW_RX_POLL
+	/* Mask Rx in the wrapper and let the net thread take it from here */
+	wrp->c0_rx_ena = 0;
+	net_poll_sched ( cpsw_rx_poll );
+#else
+	// rx_process ();
+	while ( rx_next ( &nbp ) ) {
+	    if ( nbp )
+		net_rcv ( nbp );
 	}
+#endif
 
 	dma->rx_intstat = OUR_CPDMA_INT;
 	dma->eoi_vector = RX_EOI;
@@ -1731,6 +1863,10 @@ cpsw_int_enable ( void )
 /* Kyu entry point. */
 /* Called first to initialize the device */
 /* Then call cpsw_activate() */
+/* Unlike the emac, the 3-port switch in the am3359 has no
+ * checksum offload, so we never call net_offload_set() and
+ * the network code does all checksums in software.
+ */
 int
 cpsw_init ( void )
 {
@@ -1782,6 +1918,9 @@ cpsw_show ( void )
 {
 	printf ( "Receive count: %d\n", rx_count );
 	printf ( "Receive INT count: %d\n", rx_int_count );
+#ifdef CPSW_RX_POLL
+	printf ( "Receive polls: %d\n", rx_poll_count );
+#endif
 	printf ( "Transmit count: %d\n", tx_count );
 	printf ( "Transmit INT count: %d\n", tx_int_count );
 }
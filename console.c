@@ -212,6 +212,57 @@ getline ( char *buf, int n )
  * msg_buf on the stack.
  */
 
+/* A copy of everything that goes out the console.
+ * The tftp server hands this out as "log", which beats
+ * scrolling back through a terminal (if you even had one
+ * hooked up when the trouble started).
+ * log_next counts every byte we ever saved, so the ring
+ * has wrapped once it gets past LOG_SIZE.
+ * We take no lock, a printf from interrupt level racing with
+ * one from a thread can scramble a few characters, but that
+ * is true on the console itself anyway.
+ */
+#define LOG_SIZE	(64*1024)	/* must be a power of 2 */
+
+static char log_buf[LOG_SIZE];
+static unsigned int log_next;
+
+static void
+log_save ( char *s )
+{
+	while ( *s )
+	    log_buf[log_next++ & (LOG_SIZE-1)] = *s++;
+}
+
+static void
+log_savec ( int ch )
+{
+	log_buf[log_next++ & (LOG_SIZE-1)] = ch;
+}
+
+/* Where the log is, oldest first.
+ * Once the ring wraps it takes two pieces.
+ * Returns the number of pieces.
+ */
+int
+log_pieces ( char **a1, int *l1, char **a2, int *l2 )
+{
+	unsigned int next = log_next;
+	int off = next & (LOG_SIZE-1);
+
+	if ( next <= LOG_SIZE ) {
+	    *a1 = log_buf;
+	    *l1 = next;
+	    return 1;
+	}
+
+	*a1 = &log_buf[off];
+	*l1 = LOG_SIZE - off;
+	*a2 = log_buf;
+	*l2 = off;
+	return 2;
+}
+
 /* Added 12/2/2002 -- with gcc 3.2 printf() calls
  * get optimized into puts() and putchar() calls
  * whenever possible, so you had better supply
@@ -221,6 +272,9 @@ getline ( char *buf, int n )
 void
 puts ( char *buf )
 {
+	log_save ( buf );
+	log_savec ( '\n' );
+
 	/* On the arm/BBB - this is all we got ! */
 	serial_puts ( buf );
 	serial_putc ( '\n' );
@@ -245,6 +299,7 @@ puts ( char *buf )
 void
 putchar ( int ch )
 {
+	log_savec ( ch );
 	serial_putc ( ch );
 #ifdef ARCH_X86
 	if ( cur_thread->con_mode == SIO_0 )
@@ -265,6 +320,8 @@ putchar ( int ch )
 void
 console_puts ( char *buf )
 {
+	log_save ( buf );
+
 #ifdef BOARD_H3
  #ifdef WANT_PUTS_LOCK
 	h3_spin_lock ( 3 );
@@ -393,6 +393,14 @@ void
 board_net_send ( struct netbuf *nbp )
 {
         // emac_send ( nbp );
+	netbuf_free ( nbp );
+}
+
+/* No multicast filter on this one (yet), so we say so */
+int
+board_net_mcast ( unsigned char *list, int count )
+{
+	return -1;
 }
 
 void
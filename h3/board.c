@@ -478,6 +478,19 @@ board_net_send ( struct netbuf *nbp )
 #endif
 }
 
+/* Multicast addresses to let in, count of them.
+ * The emac takes all multicast when it runs out of slots,
+ * so this always works.
+ */
+int
+board_net_mcast ( unsigned char *list, int count )
+{
+#ifdef WANT_NET
+	emac_mcast ( list, count );
+#endif
+	return 0;
+}
+
 void
 board_net_debug ( void )
 {
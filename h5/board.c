@@ -447,6 +447,17 @@ board_net_send ( struct netbuf *nbp )
         emac_send ( nbp );
 }
 
+/* Multicast addresses to let in, count of them.
+ * The emac takes all multicast when it runs out of slots,
+ * so this always works.
+ */
+int
+board_net_mcast ( unsigned char *list, int count )
+{
+	emac_mcast ( list, count );
+	return 0;
+}
+
 void
 board_net_debug ( void )
 {
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * board.c for the host build
+ *
+ * The "network device" here is whatever linux.c opened for us,
+ * a TAP interface or pcap files.  We run a thread that reads
+ * frames from it and hands them to net_rcv() with INT_lock held,
+ * just the way a driver does from its interrupt routine.
+ *
+ * agent  10-19-2026
+ */
+
+#include "kyu.h"
+#include "kyulib.h"
+#include "board.h"
+#include "arch/cpu.h"
+
+#include "netbuf.h"
+#include "net.h"
+
+/* In linux.c */
+int host_net_open ( void );
+int host_net_replay ( void );
+int host_net_recv ( char *, int );
+void host_net_send ( char *, int );
+int host_thread ( void (*) ( long ), long );
+void host_sleep_ms ( int );
+
+int net_get_inq_count ( void );
+
+/* When we replay a pcap file, the frames come as fast as we
+ * can read them.  Real hardware would overrun and drop them,
+ * but that makes a poor test, so we hold off while the input
+ * queue is this deep.
+ */
+#define REPLAY_INQ_MAX	16
+
+/* A locally administered address, nobody else will have it */
+static unsigned char host_mac[ETH_ADDR_SIZE] = { 0x02, 0, 0, 0, 0, 1 };
+
+static int net_ok;
+static int rx_count;
+static int rx_drop_count;
+static int tx_count;
+
+int
+board_get_cpu_mhz ( void )
+{
+	/* Our cycle counter is in nanoseconds */
+	return 1000;
+}
+
+/* ---------------------------------- */
+
+/* Our "interrupt routine" */
+static void
+host_rx_thread ( long xx )
+{
+	char buf[NETBUF_MAX];
+	struct netbuf *nbp;
+	int replay;
+	int len;
+
+	replay = host_net_replay ();
+
+	for ( ;; ) {
+	    len = host_net_recv ( buf, NETBUF_MAX );
+	    if ( len <= 0 )
+		break;
+
+	    if ( replay ) {
+		while ( net_get_inq_count () >= REPLAY_INQ_MAX )
+		    host_sleep_ms ( 1 );
+	    }
+
+	    INT_lock;
+	    rx_count++;
+	    nbp = netbuf_alloc_user_i ( NB_USER_RX, len );
+	    if ( nbp ) {
+		memcpy ( (char *) nbp->eptr, buf, len );
+		nbp->elen = len;
+		net_rcv ( nbp );
+	    } else {
+		rx_drop_count++;
+		net_drop ( NET_DROP_NOBUF );
+	    }
+	    INT_unlock;
+	}
+
+	if ( replay )
+	    printf ( "Replay done, %d frames\n", rx_count );
+	else
+	    printf ( "Network device went away\n" );
+}
+
+/* Initialize the network device */
+int
+board_net_init ( void )
+{
+	net_ok = host_net_open ();
+	return net_ok;
+}
+
+/* Bring the network device online.
+ * A replay waits for board_after_net(), or the first
+ * frames would arrive before we even have an IP address.
+ */
+void
+board_net_activate ( void )
+{
+	if ( net_ok && ! host_net_replay () )
+	    (void) host_thread ( host_rx_thread, 0 );
+}
+
+/* Called once the network is alive and well */
+void
+board_after_net ( void )
+{
+	if ( net_ok && host_net_replay () )
+	    (void) host_thread ( host_rx_thread, 0 );
+}
+
+void
+board_net_show ( void )
+{
+	printf ( "Host net: %d received, %d dropped, %d sent\n",
+	    rx_count, rx_drop_count, tx_count );
+}
+
+void
+get_board_net_addr ( char *addr )
+{
+	memcpy ( addr, host_mac, ETH_ADDR_SIZE );
+}
+
+void
+board_net_send ( struct netbuf *nbp )
+{
+	char buf[ETH_MIN_SIZE];
+	int len;
+
+	memcpy ( nbp->eptr->src, host_mac, ETH_ADDR_SIZE );
+	len = nbp->ilen + sizeof(struct eth_hdr);
+	tx_count++;
+
+	/* The hardware would pad short frames for us */
+	if ( len < ETH_MIN_SIZE ) {
+	    memset ( buf, 0, ETH_MIN_SIZE );
+	    memcpy ( buf, (char *) nbp->eptr, len );
+	    host_net_send ( buf, ETH_MIN_SIZE );
+	} else
+	    host_net_send ( (char *) nbp->eptr, len );
+
+	netbuf_free ( nbp );
+}
+
+/* Linux hands a TAP device everything, so we have
+ * all multicast whether we like it or not.
+ */
+int
+board_net_mcast ( unsigned char *list, int count )
+{
+	return 0;
+}
+
+void
+board_net_debug ( void )
+{
+	board_net_show ();
+}
+
+/* THE END */
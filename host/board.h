@@ -0,0 +1,34 @@
+#ifndef _BOARD_H
+#define _BOARD_H
+
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * board.h for the host build
+ *
+ * Kyu as a linux program, to run the network code (and its tests)
+ * on a workstation.  See Readme.host
+ *
+ *  Kyu project  10-19-2026  agent
+ */
+
+#define BOARD_HOST
+
+#define WANT_NET
+
+#define ARCH_HOST
+
+#define NUM_CORES	1
+
+#define CONSOLE_BAUD		115200
+#define INITIAL_CONSOLE		SERIAL
+
+#define NETBUF_PREPAD	0
+
+/* THE END */
+#endif /* _BOARD_H */
@@ -0,0 +1,76 @@
+/* cksum.c
+ * Internet checksum routines for the host build
+ *
+ * unsigned int csum_partial ( const void *buf, int len, unsigned int sum )
+ * unsigned int csum_partial_copy ( void *dst, const void *src, int len, unsigned int sum )
+ *
+ * Same contract as arch/cksum.S on the boards: a 32 bit partial
+ * sum (not complemented, maybe not folded) that can be handed back
+ * in as "sum" for the next piece.  net/in_cksum.c finishes the job.
+ *
+ * Plain C, 16 bit words into a 64 bit accumulator.  The compiler
+ * on the workstation does a fine job with this, and here we are
+ * only interested in getting the right answer.  A buffer that
+ * starts on an odd address gets its result byte swapped at the end.
+ *
+ * agent  10-19-2026
+ */
+
+#include <arch/types.h>
+#include <kyulib.h>
+
+static unsigned int
+csum_fold32 ( unsigned long acc )
+{
+	acc = (acc & 0xffffffff) + (acc >> 32);
+	acc = (acc & 0xffffffff) + (acc >> 32);
+	return acc;
+}
+
+unsigned int
+csum_partial ( const void *buf, int len, unsigned int sum )
+{
+	const unsigned char *p = buf;
+	unsigned long acc = 0;
+	int odd;
+
+	if ( len <= 0 )
+	    return sum;
+
+	/* Line up on a 16 bit boundary */
+	odd = (unsigned long) p & 1;
+	if ( odd ) {
+	    acc += *p++ << 8;
+	    len--;
+	}
+
+	while ( len > 1 ) {
+	    acc += *(const unsigned short *) p;
+	    p += 2;
+	    len -= 2;
+	}
+
+	if ( len )
+	    acc += *p;
+
+	acc = csum_fold32 ( acc );
+	acc = (acc & 0xffff) + (acc >> 16);
+	acc = (acc & 0xffff) + (acc >> 16);
+
+	if ( odd )
+	    acc = ((acc & 0xff) << 8) | (acc >> 8);
+
+	acc += sum;
+	return csum_fold32 ( acc );
+}
+
+unsigned int
+csum_partial_copy ( void *dst, const void *src, int len, unsigned int sum )
+{
+	if ( len <= 0 )
+	    return sum;
+	memcpy ( dst, (void *) src, len );
+	return csum_partial ( dst, len, sum );
+}
+
+/* THE END */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * cpu.h for the host (linux) build
+ *
+ * There is no hardware to poke here, so what the ARM does with
+ * an instruction we do with a call into the stand-ins in kernel.c
+ * and linux.c.  The rest of Kyu can't tell the difference.
+ *
+ *  Kyu project  10-19-2026  agent
+ */
+
+#ifndef __CPU_H_
+#define __CPU_H_	1
+
+/* ------------------------------------------------------------------ */
+
+/* Byte swapping, same as the ARM.
+ * We only build on little endian hosts.
+ */
+typedef unsigned short __u16;
+typedef unsigned long __u32;
+
+#ifndef __SWAP_H
+#define __SWAP_H 1
+
+#define ___swab16(x) \
+        ((__u16)( \
+                (((__u16)(x) & (__u16)0x00ffU) << 8) | \
+                (((__u16)(x) & (__u16)0xff00U) >> 8) ))
+#define ___swab32(x) \
+        ((__u32)( \
+                (((__u32)(x) & (__u32)0x000000ffUL) << 24) | \
+                (((__u32)(x) & (__u32)0x0000ff00UL) <<  8) | \
+                (((__u32)(x) & (__u32)0x00ff0000UL) >>  8) | \
+                (((__u32)(x) & (__u32)0xff000000UL) >> 24) ))
+
+/* XXX - evil if we do htons(x++) */
+#define htons(x)        ___swab16(x)
+#define ntohs(x)        ___swab16(x)
+
+#define htonl(x)        ___swab32(x)
+#define ntohl(x)        ___swab32(x)
+#endif /* __SWAP_H */
+
+/* ------------------------------------------------------------------ */
+
+/* "Interrupts" are off when we hold one big lock.
+ * The network driver thread takes it too before it calls
+ * net_rcv(), just as if it were an interrupt routine.
+ */
+void host_int_lock ( void );
+void host_int_unlock ( void );
+
+#define INT_lock	host_int_lock ()
+#define INT_unlock	host_int_unlock ()
+
+/* The cycle counter is a nanosecond clock, see board_get_cpu_mhz() */
+unsigned long host_ccnt ( void );
+void host_ccnt_set ( unsigned long );
+
+static inline unsigned long
+r_CCNT ( void )
+{
+	return host_ccnt ();
+}
+
+#define get_CCNT(val)	val = host_ccnt ()
+#define set_CCNT(val)	host_ccnt_set ( val )
+
+/* One core as far as Kyu knows */
+static inline int
+get_core_id ( void )
+{
+	return 0;
+}
+
+/* We do have real threads running at once, so these
+ * had better work.  The host compiler has the builtins.
+ */
+static inline void
+cpu_spin_lock ( volatile int *lock )
+{
+	while ( __atomic_exchange_n ( lock, 1, __ATOMIC_ACQUIRE ) )
+	    ;
+}
+
+static inline void
+cpu_spin_unlock ( volatile int *lock )
+{
+	__atomic_store_n ( lock, 0, __ATOMIC_RELEASE );
+}
+
+static inline void
+cpu_atomic_add ( volatile int *p, int val )
+{
+	__atomic_fetch_add ( p, val, __ATOMIC_RELAXED );
+}
+
+#define get_SP(x)	x = (reg_t) __builtin_frame_address ( 0 )
+#define get_FP(x)	x = (reg_t) __builtin_frame_address ( 0 )
+
+#endif
+
+/* THE END */
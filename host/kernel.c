@@ -0,0 +1,718 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * kernel.c
+ * Stand-ins for the Kyu kernel in the host build.
+ *
+ * The network code wants threads, semaphores, a timer that ticks
+ * once per millisecond, a console, and not much else.  Rather than
+ * drag thread.c (and the assembly under it) onto linux, we give it
+ * the same calls built on pthreads (see linux.c).
+ *
+ * Every Kyu thread is a pthread, but only one of them runs at a
+ * time, just as on a board.  A thread holds the "cpu" while it runs
+ * and gives it up whenever it blocks: on a semaphore, in a delay,
+ * or waiting for a line of input.  There is no preemption, so a
+ * thread that spins without blocking will hang things.  Priorities
+ * are kept for thr_show() and otherwise ignored.
+ *
+ * The network driver thread (see board.c) is our interrupt,
+ * it takes INT_lock but never the cpu.
+ *
+ * agent  10-19-2026
+ */
+
+#include "kyu.h"
+#include "kyulib.h"
+#include "thread.h"
+#include "tests.h"
+#include "arch/cpu.h"
+
+/* In linux.c */
+void host_cpu_get ( void );
+void host_cpu_put ( void );
+int host_ms ( void );
+void host_sleep_ms ( int );
+void *host_sem_new ( int );
+void host_sem_free ( void * );
+int host_sem_wait ( void *, int );
+void host_sem_post ( void * );
+int host_thread ( tfptr, long );
+void host_thread_exit ( void );
+void host_exit ( int );
+int host_getline ( char *, int );
+
+void *malloc ( unsigned long );
+void panic ( char * );
+
+void net_init ( void );
+void shell_main ( long );
+void gb_init_rand ( long );
+
+/* How long to wait for tests to finish once input runs out */
+#define EOF_WAIT	60	/* seconds */
+
+/* No stacks or registers here, linux has them.
+ * What the pthread needs to get going goes alongside.
+ */
+static struct thread thr_pool[MAX_THREADS];
+static void *thr_hsem[MAX_THREADS];
+static tfptr thr_func[MAX_THREADS];
+static void *thr_arg[MAX_THREADS];
+static char thr_test[MAX_THREADS];
+
+static __thread struct thread *cur_thread;
+
+/* Threads started once the shell is up, which is to say tests */
+static int shell_up;
+static volatile int test_count;
+
+/* Threads made but not yet running, see getline() */
+static volatile int thr_starting;
+
+static struct sem sem_pool[MAX_SEM];
+static void *sem_hsem[MAX_SEM];
+
+static char *state_name[] = {
+	"READY", "WAIT", "SWAIT", "DELAY", "IDLE", "JOIN",
+	"ZOMBIE", "FAULT", "REPEAT", "KILLED", "DEAD"
+};
+
+static void
+thr_start ( long arg )
+{
+	struct thread *tp = &thr_pool[arg];
+	tfptr func = thr_func[arg];
+	long farg = (long) thr_arg[arg];
+	int next;
+
+	cur_thread = tp;
+	host_cpu_get ();
+	thr_starting--;
+
+	if ( tp->flags & TF_BLOCK )
+	    thr_block ( WAIT );
+
+	if ( ! (tp->flags & TF_REPEAT) ) {
+	    (*func) ( farg );
+	    thr_exit ();
+	}
+
+	/* Repeating thread, call it every rep_reload ticks */
+	next = host_ms ();
+	for ( ;; ) {
+	    (*func) ( farg );
+	    next += tp->rep_reload;
+	    if ( next < host_ms () ) {
+		tp->overruns++;
+		next = host_ms ();
+		continue;
+	    }
+	    tp->state = REPEAT;
+	    host_cpu_put ();
+	    host_sleep_ms ( next - host_ms () );
+	    host_cpu_get ();
+	    tp->state = READY;
+	}
+}
+
+static struct thread *
+thr_alloc ( void )
+{
+	struct thread *tp;
+	int i;
+
+	INT_lock;
+	for ( i=0; i<MAX_THREADS; i++ ) {
+	    tp = &thr_pool[i];
+	    if ( tp->state == DEAD ) {
+		memset ( (char *) tp, 0, sizeof(struct thread) );
+		tp->state = READY;
+		INT_unlock;
+		return tp;
+	    }
+	}
+	INT_unlock;
+	return (struct thread *) 0;
+}
+
+struct thread *
+thr_new_repeat ( char *name, tfptr func, void *arg, int prio, int flags, int nticks )
+{
+	struct thread *tp;
+	int i;
+
+	tp = thr_alloc ();
+	if ( ! tp ) {
+	    panic ( "threads all gone" );
+	    return (struct thread *) 0;
+	}
+	i = tp - thr_pool;
+
+	strncpy ( tp->name, name, MAX_TNAME-1 );
+	tp->pri = prio;
+	tp->flags = flags;
+	if ( nticks > 0 ) {
+	    tp->flags |= TF_REPEAT;
+	    tp->rep_reload = nticks;
+	}
+
+	thr_func[i] = func;
+	thr_arg[i] = arg;
+
+	/* So a thr_unblock() that comes before we even
+	 * get going won't be lost.
+	 */
+	if ( flags & TF_BLOCK )
+	    tp->state = WAIT;
+
+	if ( ! thr_hsem[i] )
+	    thr_hsem[i] = host_sem_new ( 0 );
+
+	thr_test[i] = shell_up;
+	if ( shell_up )
+	    test_count++;
+
+	thr_starting++;
+	if ( ! host_thread ( thr_start, i ) ) {
+	    thr_starting--;
+	    if ( shell_up )
+		test_count--;
+	    tp->state = DEAD;
+	    return (struct thread *) 0;
+	}
+
+	return tp;
+}
+
+struct thread *
+thr_new ( char *name, tfptr func, void *arg, int prio, int flags )
+{
+	return thr_new_repeat ( name, func, arg, prio, flags, 0 );
+}
+
+struct thread *
+thr_self ( void )
+{
+	return cur_thread;
+}
+
+void
+thr_exit ( void )
+{
+	struct thread *tp = cur_thread;
+
+	if ( thr_test[tp - thr_pool] )
+	    test_count--;
+	tp->state = DEAD;
+	host_int_unlock ();
+	host_cpu_put ();
+	host_thread_exit ();
+}
+
+/* Give up the cpu, and interrupts come back on.
+ */
+void
+thr_block ( enum thread_state why )
+{
+	struct thread *tp = cur_thread;
+
+	tp->state = why;
+	host_int_unlock ();
+	host_cpu_put ();
+	(void) host_sem_wait ( thr_hsem[tp - thr_pool], -1 );
+	host_cpu_get ();
+	tp->state = READY;
+}
+
+/* Also cuts a delay short */
+void
+thr_unblock ( struct thread *tp )
+{
+	if ( tp->state == READY || tp->state == DEAD )
+	    return;
+	host_sem_post ( thr_hsem[tp - thr_pool] );
+}
+
+void
+thr_delay ( int nticks )
+{
+	struct thread *tp = cur_thread;
+
+	host_int_unlock ();
+	if ( nticks <= 0 )
+	    return;
+
+	tp->state = DELAY;
+	host_cpu_put ();
+	(void) host_sem_wait ( thr_hsem[tp - thr_pool], nticks );
+	host_cpu_get ();
+	tp->state = READY;
+}
+
+void
+thr_yield ( void )
+{
+	host_cpu_put ();
+	host_sleep_ms ( 0 );
+	host_cpu_get ();
+}
+
+void
+thr_show ( void )
+{
+	struct thread *tp;
+	int i;
+
+	printf ( "  Thread:       name (  &tp   )    state     pri\n" );
+	for ( i=0; i<MAX_THREADS; i++ ) {
+	    tp = &thr_pool[i];
+	    if ( tp->state == DEAD )
+		continue;
+	    printf ( "%c Thread: %10s (%08lx) %8s %5d",
+		tp == cur_thread ? '*' : ' ',
+		tp->name, (long) tp, state_name[tp->state], tp->pri );
+	    if ( tp->state == SWAIT && tp->cur_sem )
+		printf ( "  %s", tp->cur_sem->name );
+	    if ( tp->flags & TF_REPEAT )
+		printf ( "  every %d, %d overruns", tp->rep_reload, tp->overruns );
+	    printf ( "\n" );
+	}
+}
+
+void
+thr_show_name ( char *name )
+{
+	int i;
+
+	for ( i=0; i<MAX_THREADS; i++ ) {
+	    if ( thr_pool[i].state != DEAD && strcmp ( thr_pool[i].name, name ) == 0 ) {
+		printf ( "Thread %s: state %s, pri %d\n", name,
+		    state_name[thr_pool[i].state], thr_pool[i].pri );
+		return;
+	    }
+	}
+	printf ( "No such thread: %s\n", name );
+}
+
+/* We can't take a pthread away from under itself */
+void
+thr_kill_name ( char *name )
+{
+	printf ( "No killing threads in the host build\n" );
+}
+
+void
+thr_debug ( int val )
+{
+}
+
+/* ------------------------------------------------------------------ */
+/* Semaphores.
+ * A Kyu sem is SET when it will block, a host sem
+ * is set when it will not.  Don't let that confuse you.
+ */
+
+static struct sem *
+sem_new ( int state, int flags )
+{
+	struct sem *sp;
+	int i;
+
+	INT_lock;
+	for ( i=0; i<MAX_SEM; i++ ) {
+	    sp = &sem_pool[i];
+	    if ( ! sem_hsem[i] ) {
+		sem_hsem[i] = host_sem_new ( state == CLEAR );
+		if ( ! sem_hsem[i] )
+		    break;
+		sp->state = state;
+		sp->flags = flags;
+		sp->name[0] = '\0';
+		sp->list = (struct thread *) 0;
+		INT_unlock;
+		return sp;
+	    }
+	}
+	INT_unlock;
+	return (struct sem *) 0;
+}
+
+struct sem *
+sem_signal_new ( int flags )
+{
+	return sem_new ( SET, flags );
+}
+
+struct sem *
+sem_mutex_new ( int flags )
+{
+	return sem_new ( CLEAR, flags );
+}
+
+void
+sem_destroy ( struct sem *sp )
+{
+	int i = sp - sem_pool;
+
+	INT_lock;
+	host_sem_free ( sem_hsem[i] );
+	sem_hsem[i] = (void *) 0;
+	INT_unlock;
+}
+
+void
+sem_set_name ( struct sem *sp, char *name )
+{
+	strncpy ( sp->name, name, MAX_SEM_NAME-1 );
+	sp->name[MAX_SEM_NAME-1] = '\0';
+}
+
+static void
+sem_wait ( struct sem *sp, int ms )
+{
+	struct thread *tp = cur_thread;
+
+	host_int_unlock ();
+
+	tp->state = SWAIT;
+	tp->cur_sem = sp;
+	host_cpu_put ();
+	(void) host_sem_wait ( sem_hsem[sp - sem_pool], ms );
+	host_cpu_get ();
+	tp->cur_sem = (struct sem *) 0;
+	tp->state = READY;
+}
+
+/* Called with interrupts off, returns with them on */
+void
+sem_block_cpu ( struct sem *sp )
+{
+	sem_wait ( sp, -1 );
+}
+
+void
+sem_block ( struct sem *sp )
+{
+	sem_wait ( sp, -1 );
+}
+
+void
+sem_block_t ( struct sem *sp, int nticks )
+{
+	sem_wait ( sp, nticks > 0 ? nticks : 0 );
+}
+
+/* OK from "interrupt level" */
+void
+sem_unblock ( struct sem *sp )
+{
+	host_sem_post ( sem_hsem[sp - sem_pool] );
+}
+
+void
+cpu_signal ( struct sem *sp )
+{
+	sem_unblock ( sp );
+}
+
+/* ------------------------------------------------------------------ */
+/* Condition variables, or what Kyu calls that (see thread.c).
+ * tcp_bsd uses one for its input queue.
+ */
+
+static struct cv cv_pool[MAX_CV];
+static int cv_next;
+
+struct cv *
+cv_new ( void )
+{
+	struct cv *cp;
+
+	INT_lock;
+	if ( cv_next >= MAX_CV ) {
+	    INT_unlock;
+	    panic ( "condition variables all gone" );
+	    return (struct cv *) 0;
+	}
+	cp = &cv_pool[cv_next++];
+	INT_unlock;
+
+	cp->signal = sem_signal_new ( SEM_FIFO );
+	cp->mutex = sem_mutex_new ( SEM_FIFO );
+	if ( ! cp->signal || ! cp->mutex )
+	    panic ( "no semaphores for a cv" );
+	return cp;
+}
+
+void
+cv_set_sname ( struct cv *cp, char *name )
+{
+	sem_set_name ( cp->signal, name );
+}
+
+void
+cv_set_mname ( struct cv *cp, char *name )
+{
+	sem_set_name ( cp->mutex, name );
+}
+
+void
+cv_signal ( struct cv *cp )
+{
+	sem_unblock ( cp->signal );
+}
+
+void
+cv_lock ( struct cv *cp )
+{
+	sem_block ( cp->mutex );
+}
+
+void
+cv_unlock ( struct cv *cp )
+{
+	sem_unblock ( cp->mutex );
+}
+
+/* Entered holding the mutex, returns without it.
+ * A host sem remembers a post, so a signal that comes
+ * between the two calls doesn't get lost.
+ */
+void
+cv_wait ( struct cv *cp )
+{
+	sem_unblock ( cp->mutex );
+	sem_block ( cp->signal );
+}
+
+/* ------------------------------------------------------------------ */
+/* The timer ticks once a millisecond, like the boards */
+
+int
+get_timer_count_t ( void )
+{
+	return host_ms ();
+}
+
+int
+get_timer_count_s ( void )
+{
+	return host_ms () / 1000;
+}
+
+int
+timer_rate_get ( void )
+{
+	return DEFAULT_TIMER_RATE;
+}
+
+void
+delay_us ( int us )
+{
+	host_sleep_ms ( (us + 999) / 1000 );
+}
+
+void
+delay_ms ( int ms )
+{
+	host_sleep_ms ( ms );
+}
+
+/* ------------------------------------------------------------------ */
+/* Memory.
+ * The network code gets its netbufs with ram_alloc() and later
+ * checks addresses against what ram_alloc() handed out, so we
+ * keep track of the range.
+ */
+
+#define RAM_ALIGN	64	/* cache line, like the boards */
+
+static unsigned long ram_low;
+static unsigned long ram_high;
+
+addr_t
+ram_alloc ( int size )
+{
+	unsigned long rv;
+
+	rv = (unsigned long) malloc ( size + RAM_ALIGN );
+	if ( ! rv )
+	    panic ( "ran outa ram" );
+	rv = (rv + RAM_ALIGN - 1) & ~(unsigned long) (RAM_ALIGN - 1);
+
+	if ( ! ram_low || rv < ram_low )
+	    ram_low = rv;
+	if ( rv + size > ram_high )
+	    ram_high = rv + size;
+	return rv;
+}
+
+int
+valid_ram_address ( unsigned long addr )
+{
+	return addr >= ram_low && addr < ram_high;
+}
+
+/* No console log here, stdout can go to a file */
+void
+console_puts ( char *buf )
+{
+	printf ( "%s", buf );
+}
+
+int
+log_pieces ( char **a1, int *l1, char **a2, int *l2 )
+{
+	return 0;
+}
+
+/* ------------------------------------------------------------------ */
+
+void
+panic ( char *msg )
+{
+	printf ( "PANIC: %s\n", msg );
+	host_exit ( 1 );
+}
+
+void
+reset_cpu ( void )
+{
+	host_exit ( 0 );
+}
+
+/* Once stdin runs dry, let any tests that are running finish,
+ * then we are done.
+ */
+static void
+input_done ( void )
+{
+	int i;
+
+	for ( i=0; i<EOF_WAIT*10 && test_count > 0; i++ ) {
+	    host_cpu_put ();
+	    host_sleep_ms ( 100 );
+	    host_cpu_get ();
+	}
+	if ( test_count > 0 )
+	    printf ( "Giving up on %d test threads\n", test_count );
+	host_exit ( 0 );
+}
+
+/* On a board the shell blocks waiting on the uart, and
+ * whatever it just launched (the test wrapper runs at a lower
+ * priority) gets to run.  Commands from a pipe are there at
+ * once, so hold off until new threads have had the cpu.
+ * Otherwise the next command overwrites the n_info that the
+ * last one left for its wrapper in tests.c.
+ */
+void
+getline ( char *buf, int n )
+{
+	int rv;
+
+	shell_up = 1;
+
+	while ( thr_starting > 0 ) {
+	    host_cpu_put ();
+	    host_sleep_ms ( 1 );
+	    host_cpu_get ();
+	}
+
+	host_cpu_put ();
+	rv = host_getline ( buf, n );
+	host_cpu_get ();
+
+	if ( rv < 0 ) {
+	    printf ( "\n" );
+	    input_done ();
+	}
+}
+
+/* Odds and ends the shell (tests.c) wants
+ * that make no sense here.
+ */
+void
+shell_x ( char **wp, int nw )
+{
+	printf ( "No symbol table in the host build\n" );
+}
+
+void
+cpu_info ( void )
+{
+	printf ( "Kyu on linux, no cpu to speak of\n" );
+}
+
+void
+kyu_debugger ( void )
+{
+}
+
+void
+unroll_cur_short ( void )
+{
+	printf ( "No tracebacks in the host build\n" );
+}
+
+void
+mem_dumper ( int type, char *addr, char *count )
+{
+	printf ( "No memory dumps in the host build\n" );
+}
+
+void set_delay_auto ( void ) {}
+void set_delay_user ( void ) {}
+
+/* The network and TCP tests come along (tcp_test_list is
+ * in tcp_bsd/test.c).  test_kyu.c and test_io.c poke at the
+ * real thread system and the board hardware, so not those.
+ */
+struct test kyu_test_list[] = {
+	0,	0,	0
+};
+
+struct test io_test_list[] = {
+	0,	0,	0
+};
+
+/* ------------------------------------------------------------------ */
+
+/* From main() in linux.c, in place of sys_init().
+ * We become the "sys" thread, get the network going,
+ * then turn into the shell.
+ */
+void
+kyu_host_main ( void )
+{
+	struct thread *tp;
+	int i;
+
+	for ( i=0; i<MAX_THREADS; i++ )
+	    thr_pool[i].state = DEAD;
+
+	tp = thr_alloc ();
+	strcpy ( tp->name, "sys" );
+	tp->pri = PRI_SHELL;
+	thr_hsem[0] = host_sem_new ( 0 );
+	cur_thread = tp;
+	host_cpu_get ();
+
+	printf ( "Kyu starting on linux\n" );
+
+	gb_init_rand ( 0x163389 );
+
+	net_init ();
+	board_after_net ();
+
+	strcpy ( tp->name, "shell" );
+	shell_main ( 0 );
+}
+
+/* THE END */
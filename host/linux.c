@@ -0,0 +1,535 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * linux.c
+ * The "hardware" for the host build.
+ *
+ * This is the only file in the host build that gets compiled
+ * against the linux (glibc) headers, everything else is Kyu code
+ * compiled with -nostdinc just like for a board.  So nothing here
+ * knows about Kyu structures, and nothing in Kyu knows about
+ * pthreads.  kernel.c and board.c call these host_xxx() routines
+ * the way board code would poke at registers.
+ *
+ * We provide:
+ *  - a lock that is what INT_lock becomes.
+ *  - a lock so only one Kyu thread runs at once.
+ *  - binary semaphores with timeouts (for Kyu sem_xxx).
+ *  - threads and a millisecond clock.
+ *  - the console (stdin/stdout).
+ *  - the network "wire", either a TAP interface or pcap files.
+ *
+ * agent  10-19-2026
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+void kyu_host_main ( void );
+
+/* ------------------------------------------------------------------ */
+/* Interrupt lock */
+
+/* On the ARM, INT_lock does not nest and INT_unlock always
+ * turns interrupts back on, no matter how many times we locked.
+ * Kyu code counts on that, so a recursive mutex won't do.
+ * We remember who holds it, a second lock by the same thread
+ * does nothing, and unlocking when we don't hold it does nothing.
+ */
+static pthread_mutex_t int_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t int_owner;
+static volatile int int_held;
+
+void
+host_int_lock ( void )
+{
+	if ( int_held && pthread_equal ( int_owner, pthread_self () ) )
+	    return;
+	pthread_mutex_lock ( &int_mutex );
+	int_owner = pthread_self ();
+	int_held = 1;
+}
+
+void
+host_int_unlock ( void )
+{
+	if ( ! int_held || ! pthread_equal ( int_owner, pthread_self () ) )
+	    return;
+	int_held = 0;
+	pthread_mutex_unlock ( &int_mutex );
+}
+
+/* The "cpu".
+ * Kyu was written for one processor, so only one Kyu thread
+ * gets to run at a time.  A thread holds this while it runs
+ * and lets go of it whenever it would block.
+ * The network driver thread plays the part of an interrupt
+ * and never takes it.
+ */
+static pthread_mutex_t cpu_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void
+host_cpu_get ( void )
+{
+	pthread_mutex_lock ( &cpu_mutex );
+}
+
+void
+host_cpu_put ( void )
+{
+	pthread_mutex_unlock ( &cpu_mutex );
+}
+
+/* ------------------------------------------------------------------ */
+/* Time */
+
+static unsigned long
+host_ns ( void )
+{
+	struct timespec ts;
+
+	clock_gettime ( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static unsigned long boot_ns;
+static unsigned long ccnt_base;
+
+/* Milliseconds since we started */
+int
+host_ms ( void )
+{
+	return (host_ns () - boot_ns) / 1000000;
+}
+
+void
+host_sleep_ms ( int ms )
+{
+	struct timespec ts;
+
+	if ( ms <= 0 ) {
+	    sched_yield ();
+	    return;
+	}
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while ( nanosleep ( &ts, &ts ) < 0 && errno == EINTR )
+	    ;
+}
+
+/* A 1 Ghz cycle counter */
+unsigned long
+host_ccnt ( void )
+{
+	return host_ns () - ccnt_base;
+}
+
+void
+host_ccnt_set ( unsigned long val )
+{
+	ccnt_base = host_ns () - val;
+}
+
+/* ------------------------------------------------------------------ */
+/* Semaphores */
+
+struct host_sem {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int set;
+};
+
+void *
+host_sem_new ( int set )
+{
+	struct host_sem *sp;
+	pthread_condattr_t attr;
+
+	sp = malloc ( sizeof(struct host_sem) );
+	if ( ! sp )
+	    return NULL;
+
+	pthread_mutex_init ( &sp->mutex, NULL );
+	pthread_condattr_init ( &attr );
+	pthread_condattr_setclock ( &attr, CLOCK_MONOTONIC );
+	pthread_cond_init ( &sp->cond, &attr );
+	pthread_condattr_destroy ( &attr );
+	sp->set = set;
+	return sp;
+}
+
+void
+host_sem_free ( void *arg )
+{
+	struct host_sem *sp = arg;
+
+	pthread_cond_destroy ( &sp->cond );
+	pthread_mutex_destroy ( &sp->mutex );
+	free ( sp );
+}
+
+/* ms < 0 waits forever.
+ * Returns 1 if we got it, 0 on timeout.
+ */
+int
+host_sem_wait ( void *arg, int ms )
+{
+	struct host_sem *sp = arg;
+	struct timespec ts;
+	int rv = 1;
+
+	if ( ms >= 0 ) {
+	    clock_gettime ( CLOCK_MONOTONIC, &ts );
+	    ts.tv_sec += ms / 1000;
+	    ts.tv_nsec += (ms % 1000) * 1000000L;
+	    if ( ts.tv_nsec >= 1000000000L ) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	    }
+	}
+
+	pthread_mutex_lock ( &sp->mutex );
+	while ( ! sp->set ) {
+	    if ( ms < 0 )
+		pthread_cond_wait ( &sp->cond, &sp->mutex );
+	    else if ( pthread_cond_timedwait ( &sp->cond, &sp->mutex, &ts ) == ETIMEDOUT ) {
+		rv = sp->set;
+		break;
+	    }
+	}
+	if ( rv )
+	    sp->set = 0;
+	pthread_mutex_unlock ( &sp->mutex );
+
+	return rv;
+}
+
+/* Like Kyu, a signal with nobody waiting is remembered (once) */
+void
+host_sem_post ( void *arg )
+{
+	struct host_sem *sp = arg;
+
+	pthread_mutex_lock ( &sp->mutex );
+	sp->set = 1;
+	pthread_cond_signal ( &sp->cond );
+	pthread_mutex_unlock ( &sp->mutex );
+}
+
+/* ------------------------------------------------------------------ */
+/* Threads */
+
+struct host_start {
+	void (*func) ( long );
+	long arg;
+};
+
+static void *
+host_thread_start ( void *xp )
+{
+	struct host_start start = *(struct host_start *) xp;
+
+	free ( xp );
+	(*start.func) ( start.arg );
+	return NULL;
+}
+
+/* Returns 0 if we could not */
+int
+host_thread ( void (*func) ( long ), long arg )
+{
+	struct host_start *sp;
+	pthread_attr_t attr;
+	pthread_t tid;
+	int rv;
+
+	sp = malloc ( sizeof(struct host_start) );
+	if ( ! sp )
+	    return 0;
+	sp->func = func;
+	sp->arg = arg;
+
+	pthread_attr_init ( &attr );
+	pthread_attr_setdetachstate ( &attr, PTHREAD_CREATE_DETACHED );
+	rv = pthread_create ( &tid, &attr, host_thread_start, sp );
+	pthread_attr_destroy ( &attr );
+
+	if ( rv ) {
+	    free ( sp );
+	    return 0;
+	}
+	return 1;
+}
+
+void
+host_thread_exit ( void )
+{
+	pthread_exit ( NULL );
+}
+
+void
+host_exit ( int code )
+{
+	fflush ( stdout );
+	exit ( code );
+}
+
+/* ------------------------------------------------------------------ */
+/* Console */
+
+/* Returns -1 at the end of input */
+int
+host_getline ( char *buf, int size )
+{
+	int n;
+
+	fflush ( stdout );
+	if ( ! fgets ( buf, size, stdin ) )
+	    return -1;
+
+	n = strlen ( buf );
+	while ( n > 0 && (buf[n-1] == '\n' || buf[n-1] == '\r') )
+	    buf[--n] = '\0';
+
+	/* Echo it, so a script's output makes sense */
+	if ( ! isatty ( 0 ) )
+	    printf ( "%s\n", buf );
+	return n;
+}
+
+/* ------------------------------------------------------------------ */
+/* The wire.
+ * A TAP interface, or frames read from one pcap file
+ * and/or written to another.
+ */
+
+#define PCAP_MAGIC	0xa1b2c3d4
+#define PCAP_ETHERNET	1
+
+struct pcap_hdr {
+	unsigned int magic;
+	unsigned short major;
+	unsigned short minor;
+	int zone;
+	unsigned int sigfigs;
+	unsigned int snaplen;
+	unsigned int linktype;
+};
+
+struct pcap_rec {
+	unsigned int sec;
+	unsigned int usec;
+	unsigned int incl_len;
+	unsigned int orig_len;
+};
+
+static char *opt_tap;
+static char *opt_pcap_in;
+static char *opt_pcap_out;
+
+static int tap_fd = -1;
+static FILE *pcap_in;
+static FILE *pcap_out;
+static pthread_mutex_t pcap_out_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+tap_open ( char *name )
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = open ( "/dev/net/tun", O_RDWR );
+	if ( fd < 0 ) {
+	    perror ( "/dev/net/tun" );
+	    return -1;
+	}
+
+	memset ( &ifr, 0, sizeof(ifr) );
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strncpy ( ifr.ifr_name, name, IFNAMSIZ-1 );
+
+	if ( ioctl ( fd, TUNSETIFF, &ifr ) < 0 ) {
+	    perror ( "TUNSETIFF" );
+	    close ( fd );
+	    return -1;
+	}
+	return fd;
+}
+
+/* Returns 1 if there is something to talk to */
+int
+host_net_open ( void )
+{
+	struct pcap_hdr hdr;
+
+	if ( opt_tap ) {
+	    tap_fd = tap_open ( opt_tap );
+	    if ( tap_fd < 0 )
+		return 0;
+	}
+
+	if ( opt_pcap_in ) {
+	    pcap_in = fopen ( opt_pcap_in, "r" );
+	    if ( ! pcap_in ) {
+		perror ( opt_pcap_in );
+		return 0;
+	    }
+	    if ( fread ( &hdr, sizeof(hdr), 1, pcap_in ) != 1 ||
+		    hdr.magic != PCAP_MAGIC || hdr.linktype != PCAP_ETHERNET ) {
+		fprintf ( stderr, "%s: not an ethernet pcap file\n", opt_pcap_in );
+		fclose ( pcap_in );
+		pcap_in = NULL;
+		return 0;
+	    }
+	}
+
+	if ( opt_pcap_out ) {
+	    pcap_out = fopen ( opt_pcap_out, "w" );
+	    if ( ! pcap_out ) {
+		perror ( opt_pcap_out );
+		return 0;
+	    }
+	    memset ( &hdr, 0, sizeof(hdr) );
+	    hdr.magic = PCAP_MAGIC;
+	    hdr.major = 2;
+	    hdr.minor = 4;
+	    hdr.snaplen = 65535;
+	    hdr.linktype = PCAP_ETHERNET;
+	    fwrite ( &hdr, sizeof(hdr), 1, pcap_out );
+	    fflush ( pcap_out );
+	}
+
+	return tap_fd >= 0 || pcap_in || pcap_out;
+}
+
+/* 1 if we are replaying a file, so the driver
+ * knows to go easy on the input queue.
+ */
+int
+host_net_replay ( void )
+{
+	return pcap_in != NULL;
+}
+
+/* Blocks until a frame shows up.
+ * Returns the length, 0 when there will be no more.
+ */
+int
+host_net_recv ( char *buf, int size )
+{
+	struct pcap_rec rec;
+	int n;
+
+	if ( pcap_in ) {
+	    for ( ;; ) {
+		if ( fread ( &rec, sizeof(rec), 1, pcap_in ) != 1 )
+		    return 0;
+		if ( rec.incl_len > 65535 )
+		    return 0;
+		if ( rec.incl_len <= (unsigned) size ) {
+		    if ( fread ( buf, rec.incl_len, 1, pcap_in ) != 1 )
+			return 0;
+		    return rec.incl_len;
+		}
+		/* Too big, skip it */
+		fseek ( pcap_in, rec.incl_len, SEEK_CUR );
+	    }
+	}
+
+	if ( tap_fd < 0 )
+	    return 0;
+
+	for ( ;; ) {
+	    n = read ( tap_fd, buf, size );
+	    if ( n > 0 )
+		return n;
+	    if ( n < 0 && errno == EINTR )
+		continue;
+	    return 0;
+	}
+}
+
+void
+host_net_send ( char *buf, int len )
+{
+	struct pcap_rec rec;
+	unsigned long ns;
+
+	if ( tap_fd >= 0 )
+	    (void) write ( tap_fd, buf, len );
+
+	if ( pcap_out ) {
+	    ns = host_ns () - boot_ns;
+	    rec.sec = ns / 1000000000UL;
+	    rec.usec = (ns % 1000000000UL) / 1000;
+	    rec.incl_len = len;
+	    rec.orig_len = len;
+
+	    pthread_mutex_lock ( &pcap_out_mutex );
+	    fwrite ( &rec, sizeof(rec), 1, pcap_out );
+	    fwrite ( buf, len, 1, pcap_out );
+	    fflush ( pcap_out );
+	    pthread_mutex_unlock ( &pcap_out_mutex );
+	}
+}
+
+/* ------------------------------------------------------------------ */
+
+static void
+usage ( void )
+{
+	fprintf ( stderr, "Usage: kyu [-t tap] [-r in.pcap] [-w out.pcap]\n" );
+	fprintf ( stderr, "  -t tap       talk to linux through this TAP interface\n" );
+	fprintf ( stderr, "  -r in.pcap   feed the frames in this file to Kyu\n" );
+	fprintf ( stderr, "  -w out.pcap  save the frames Kyu sends\n" );
+	fprintf ( stderr, "Shell commands come from stdin, as on the serial port.\n" );
+	exit ( 1 );
+}
+
+int
+main ( int argc, char **argv )
+{
+	int c;
+
+	while ( (c = getopt ( argc, argv, "t:r:w:h" )) != -1 ) {
+	    switch ( c ) {
+	    case 't':
+		opt_tap = optarg;
+		break;
+	    case 'r':
+		opt_pcap_in = optarg;
+		break;
+	    case 'w':
+		opt_pcap_out = optarg;
+		break;
+	    default:
+		usage ();
+	    }
+	}
+
+	setvbuf ( stdout, NULL, _IOLBF, 0 );
+
+	boot_ns = host_ns ();
+	ccnt_base = boot_ns;
+
+	kyu_host_main ();
+	return 0;
+}
+
+/* THE END */
@@ -0,0 +1,28 @@
+/* types.h for the host (linux) build.
+ * Same as the armv8, since a 64 bit linux host
+ * (x86_64 or aarch64) is LP64 too.
+ * agent  10-19-2026
+ */
+
+#ifndef __TYPES_H_
+#define __TYPES_H_	1
+
+typedef	int			i32;
+typedef	unsigned int		u32;
+typedef	volatile unsigned int	vu32;
+
+/* 32 bit pointer */
+typedef	unsigned int		p32;
+typedef	volatile unsigned int	vp32;
+
+typedef	long			i64;
+typedef	unsigned long		u64;
+typedef	volatile unsigned long	vu64;
+
+/* 64 bit */
+typedef	unsigned long		reg_t;
+typedef	unsigned long		addr_t;
+
+#endif
+
+/* THE END */
@@ -69,6 +69,11 @@
 
 #define WANT_SMP
 
+/* tftp server, for pulling logs and memory off a running Kyu */
+#define WANT_TFTPD
+/* lets tftpd serve any address at all, see tftpd.c */
+// #define WANT_TFTPD_MEM
+
 // #define WANT_TCP_XINU
 // #define WANT_TCP_BSD
 // #define WANT_TCP_KYU
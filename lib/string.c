@@ -43,7 +43,14 @@ void *memcpy(void *, const void *, size_t);
  * would usually be hauled in via
  * string.h (in particular from asm/string.h).
  * This whole business is worthy of study.
+ *
+ * 5-2026 - we now do exactly that for memcpy, memset
+ * and memcmp, which have assembly versions in the arch
+ * directory.  We still compile the C versions here, but
+ * rename them (memcpy_c and so on) so they can be timed
+ * against the arch versions.
  */
+#include "arch/string.h"
 
 #else
 #include <linux/types.h>
@@ -598,7 +605,9 @@ int strtobool(const char *s, bool *res)
 }
 EXPORT_SYMBOL(strtobool);
 
-#ifndef __HAVE_ARCH_MEMSET
+#ifdef __HAVE_ARCH_MEMSET
+#define memset	memset_c
+#endif
 /**
  * memset - Fill a region of memory with the given value
  * @s: Pointer to the start of the area.
@@ -616,7 +625,7 @@ void *memset(void *s, int c, size_t count)
 	return s;
 }
 EXPORT_SYMBOL(memset);
-#endif
+#undef memset
 
 #ifndef KYU
 /**
@@ -641,7 +650,9 @@ void memzero_explicit(void *s, size_t count)
 EXPORT_SYMBOL(memzero_explicit);
 #endif
 
-#ifndef __HAVE_ARCH_MEMCPY
+#ifdef __HAVE_ARCH_MEMCPY
+#define memcpy	memcpy_c
+#endif
 /**
  * memcpy - Copy one area of memory to another
  * @dest: Where to copy to
@@ -661,7 +672,7 @@ void *memcpy(void *dest, const void *src, size_t count)
 	return dest;
 }
 EXPORT_SYMBOL(memcpy);
-#endif
+#undef memcpy
 
 #ifndef __HAVE_ARCH_MEMMOVE
 /**
@@ -695,7 +706,6 @@ void *memmove(void *dest, const void *src, size_t count)
 EXPORT_SYMBOL(memmove);
 #endif
 
-#ifndef __HAVE_ARCH_MEMCMP
 /**
  * memcmp - Compare two areas of memory
  * @cs: One area of memory
@@ -703,6 +713,9 @@ EXPORT_SYMBOL(memmove);
  * @count: The size of the area.
  */
 #undef memcmp
+#ifdef __HAVE_ARCH_MEMCMP
+#define memcmp	memcmp_c
+#endif
 __visible int memcmp(const void *cs, const void *ct, size_t count)
 {
 	const unsigned char *su1, *su2;
@@ -714,7 +727,7 @@ __visible int memcmp(const void *cs, const void *ct, size_t count)
 	return res;
 }
 EXPORT_SYMBOL(memcmp);
-#endif
+#undef memcmp
 
 #ifndef __HAVE_ARCH_MEMSCAN
 /**
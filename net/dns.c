@@ -21,27 +21,24 @@
 #include "arch/cpu.h"
 
 /* XXX - Still not fully complete.
- * For example it fails to resolve prep.ai.mit.edu
- * This is now an alias for ftp.gnu.org
- * nslookup shows this as:
- * prep.ai.mit.edu	canonical name = ftp.gnu.org
- *
- * So, I am not handling this canonical name properly.
- * Fine for things on the local LAN.
+ * We only ask for A records.  A name that is an alias
+ * (prep.ai.mit.edu is really ftp.gnu.org) works as long as
+ * the server sends the A record along with the CNAME,
+ * which any recursive server will do.
  */
 
-/*
-nameserver 208.67.222.222
-nameserver 208.67.220.220
-#nameserver 192.168.0.1
-*/
+/* We try these in turn, moving to the next one when a
+ * request goes unanswered or a server gives us an error.
+ *
+nameserver 192.168.0.1
+ */
+static char *dns_servers[] = {
+	"208.67.222.222",
+	"208.67.220.220",
+	0
+};
 
-/*
-#define RESOLVER "10.0.0.54"
-#define RESOLVER "128.196.100.50"
-#define RESOLVER "192.168.0.1"
-*/
-#define RESOLVER "208.67.222.222"
+#define MAX_DNS_SERVERS	4
 
 /* In seconds */
 #define LOOKUP_TIMEOUT	30
@@ -89,25 +86,78 @@ static int dns_id = 1;
 /* Query classes */
 #define C_IN		1
 
-#define MAX_DNS_CACHE	32
+/* The cache.
+ * Entries are found by hashing the name, and each one remembers
+ * an answer (F_VALID) for as long as its TTL says,
+ * or that the name does not exist (F_NEG) for DNS_NEG_TTL.
+ *
+ * A name being looked up (F_PENDING) is on the pending list.
+ * Anyone else who wants the same name just waits along with
+ * the first fellow, so there is only ever one request out per name,
+ * but any number of different names can be in flight at once.
+ * dns_tick() resends unanswered requests, to the next server
+ * each time, waiting twice as long as the time before.
+ *
+ * All of this is shared by the threads doing lookups, the net thread
+ * (dns_rcv) and the timer (dns_tick).  It is all short work, so we
+ * use INT_lock.  Sending a request has to be done without it.
+ */
+#define DNS_CACHE_SIZE	64
+#define DNS_HASH_SIZE	32	/* must be a power of 2 */
+#define DNS_NAME_MAX	64
+
+#define DNS_NEG_TTL	60
+#define DNS_MIN_TTL	5
+#define DNS_MAX_TTL	(24*60*60)
+
+#define DNS_RETRY	1	/* first resend, seconds */
+#define DNS_RETRY_MAX	8
 
 #define F_PENDING	0x0001
-#define F_PERM		0x0002
 #define F_VALID		0x0004
+#define F_NEG		0x0008
 
 struct dns_data {
-    	char name[64];
+	struct dns_data *hnext;		/* hash chain, or free list */
+	struct dns_data *pnext;		/* pending list */
+    	char name[DNS_NAME_MAX];
 	u32 ip_addr;
 	int flags;
 	int id;
+	int expire;		/* dns_now when the answer or request runs out */
+	int retry;		/* dns_now when we ask again */
+	int backoff;
+	int server;
+	int nref;		/* threads looking at this entry */
+	int nsleep;		/* threads waiting for the answer */
 	struct sem *sem;
-	int ttl;
-} dns_cache[MAX_DNS_CACHE];
+};
+
+static struct dns_data dns_cache[DNS_CACHE_SIZE];
+static struct dns_data *dns_hash[DNS_HASH_SIZE];
+static struct dns_data *dns_free;
+static struct dns_data *dns_pending;
+
+/* seconds, counted by dns_tick() */
+static int dns_now;
+
+static struct dns_stats {
+	int hits;
+	int neg_hits;
+	int misses;
+	int joined;
+	int queries;
+	int resends;
+	int timeouts;
+	int nxdomain;
+	int errors;
+} dns_stats;
+
+static u32 dns_server_ip[MAX_DNS_SERVERS];
+static int dns_nservers;
 
 u32 dns_lookup_t ( char *, int );
 u32 dns_lookup ( char * );
-static struct dns_data * dns_alloc ( void );
-static u32 dns_cache_lookup ( char * );
 void dns_show ( char * );
 void dns_cache_show ( void );
 
@@ -147,16 +197,32 @@ dns_pack ( char *fqdn, char *buf )
 	return buf;
 }
 
+/* Everything here comes off the wire, so we never look past
+ * "end", never follow more than DNS_MAX_PTRS compression pointers
+ * (they can point in a loop), and never put more than DNS_NAME_BUF
+ * bytes in buf.  Returns 0 if the name is bogus.
+ */
+#define DNS_NAME_BUF	128
+#define DNS_MAX_PTRS	16
+
 static char *
-dns_unpack ( char *pkt, char *data, char *buf )
+dns_unpack ( char *pkt, char *data, char *end, char *buf )
 {
     	char *p = data;
+	char *bend = buf + DNS_NAME_BUF - 1;
 	int n;
+	int nptr = 0;
 	char *rv = (char *) 0;
 	short val;
 
-	while ( *p ) {
+	for ( ;; ) {
+	    if ( p >= end )
+		return (char *) 0;
+	    if ( ! *p )
+		break;
 	    if ( (*p & 0xc0) == 0xc0 ) {
+		if ( p + 2 > end || ++nptr > DNS_MAX_PTRS )
+		    return (char *) 0;
 		if ( rv == (char *) 0 )
 		    rv = p + 2;
 		/*
@@ -167,10 +233,12 @@ dns_unpack ( char *pkt, char *data, char *buf )
 		p = &pkt[n];
 		continue;
 	    }
-	    n = *p++;
+	    n = *p++ & 0x3f;
+	    if ( p + n > end || buf + n + 1 > bend )
+		return (char *) 0;
 	    while ( n-- )
 		*buf++ = *p++;
-	    if ( *p )
+	    if ( p < end && *p )
 		*buf++ = '.';
 	}
 
@@ -182,8 +250,6 @@ dns_unpack ( char *pkt, char *data, char *buf )
 	return  rv;
 }
 
-static u32 dns_ip;
-
 /*
 #define REPLY_PORT	32770
 */
@@ -231,29 +297,99 @@ dns_show ( char *host )
 	    printf ( "DNS lookup: %s --> FAILED!\n", host );
 }
 
-u32
-dns_lookup_t ( char *host, int timeout )
+
+static int
+dns_hash_name ( char *name )
+{
+	unsigned int h = 0;
+
+	while ( *name )
+	    h = h * 31 + *name++;
+	return (h ^ (h >> 16)) & (DNS_HASH_SIZE-1);
+}
+
+/* All of the following want INT_lock held */
+
+static struct dns_data *
+dns_find ( char *name )
+{
+	struct dns_data *ap;
+
+	for ( ap = dns_hash[dns_hash_name(name)]; ap; ap = ap->hnext )
+	    if ( strcmp ( name, ap->name ) == 0 )
+		return ap;
+
+	return (struct dns_data *) 0;
+}
+
+static void
+dns_unhash ( struct dns_data *ap )
+{
+	struct dns_data **pp;
+
+	for ( pp = &dns_hash[dns_hash_name(ap->name)]; *pp; pp = &(*pp)->hnext )
+	    if ( *pp == ap ) {
+		*pp = ap->hnext;
+		break;
+	    }
+}
+
+/* Get an entry for a new name.
+ * When they are all in use we throw out the one closest
+ * to expiring (or already expired), never one someone is using.
+ * Returns 0 if all of them are busy.
+ */
+static struct dns_data *
+dns_new ( char *name )
+{
+	struct dns_data *ap;
+	struct dns_data *minp;
+	int h;
+	int i;
+
+	if ( ! dns_free ) {
+	    minp = (struct dns_data *) 0;
+	    for ( i=0; i<DNS_CACHE_SIZE; i++ ) {
+		ap = &dns_cache[i];
+		if ( ap->nref || (ap->flags & F_PENDING) )
+		    continue;
+		if ( ! minp || ap->expire - minp->expire < 0 )
+		    minp = ap;
+	    }
+	    if ( ! minp )
+		return (struct dns_data *) 0;
+	    dns_unhash ( minp );
+	    minp->hnext = dns_free;
+	    dns_free = minp;
+	}
+
+	ap = dns_free;
+	dns_free = ap->hnext;
+
+	strcpy ( ap->name, name );
+	ap->flags = 0;
+	ap->nref = 0;
+	ap->nsleep = 0;
+	ap->sem = (struct sem *) 0;
+
+	h = dns_hash_name ( name );
+	ap->hnext = dns_hash[h];
+	dns_hash[h] = ap;
+
+	return ap;
+}
+
+/* Build the request for this entry, returns the size */
+static int
+dns_query_build ( struct dns_data *ap, char *dns_buf )
 {
-	char dns_buf[128];
 	struct dns_info *dp;
 	char *np;
-	u32 ipnum;
-	struct dns_data *dcp;
 	unsigned short val;
 
-	/*
-	printf ("DNS lookup started for %s\n", host );
-	*/
-
-	if ( ipnum = dns_cache_lookup ( host ) )
-	    return ipnum;
-
 	/* build request packet */
 	dp = (struct dns_info *) dns_buf;
-	/*
-	dp->id = htons(dns_id++);
-	*/
-	dp->id = htons(dns_id);
+	dp->id = htons(ap->id);
 
 	dp->flags = htons ( STD_REQ );
 	dp->nquery = htons ( 1 );
@@ -261,7 +397,9 @@ dns_lookup_t ( char *host, int timeout )
 	dp->n_auth = 0;
 	dp->n_add = 0;
 
-	np = dns_pack ( host, dp->buf );
+	np = dns_pack ( ap->name, dp->buf );
+	if ( ! np )
+	    return 0;
 
 #ifdef ARM_ALIGNMENT_HACK
 	/* must be careful about ARM alignment */
@@ -277,47 +415,140 @@ dns_lookup_t ( char *host, int timeout )
 	*((short *) np) = htons ( C_IN );
 	np += 2;
 #endif
+	return np - dns_buf;
+}
 
-	/* build cache entry */
-	dcp = dns_alloc ();
-	dcp->flags = F_PENDING;
-	dcp->ttl = timeout;
-	dcp->id = dns_id++;
-	strcpy ( dcp->name, host );
+/* The request is finished, one way or another.
+ * Called with INT_lock held, the caller must do the
+ * dns_wake() when it lets go of the lock.
+ */
+static void
+dns_done ( struct dns_data *ap, int flags, int ttl, struct sem **spp, int *np )
+{
+	struct dns_data **pp;
 
-	/*
-	dns_cache_show ();
-	printf ("Waiting on DNS ID: %d\n", dcp->id );
-	*/
+	for ( pp = &dns_pending; *pp; pp = &(*pp)->pnext )
+	    if ( *pp == ap ) {
+		*pp = ap->pnext;
+		break;
+	    }
 
-	dcp->sem = sem_signal_new ( SEM_FIFO );
+	ap->flags = flags;
+	ap->expire = dns_now + ttl;
 
-	/*
-	printf ("DNS udp, sending to %s\n", ip2str32 ( dns_ip ) );
-	*/
+	*spp = ap->sem;
+	*np = ap->nsleep;
+	ap->sem = (struct sem *) 0;
+	ap->nsleep = 0;
+}
 
-	udp_send ( dns_ip, REPLY_PORT, DNS_PORT, (char *) dp, (char *)np - dns_buf );
+static void
+dns_wake ( struct sem *sem, int n )
+{
+	while ( n-- )
+	    sem_unblock ( sem );
+	sem_destroy ( sem );
+}
 
-	sem_block ( dcp->sem );
-	sem_destroy ( dcp->sem );
+u32
+dns_lookup_t ( char *host, int timeout )
+{
+	char dns_buf[128];
+	struct dns_data *dcp;
+	u32 ipnum;
+	int len = 0;
 
 	/*
-	dns_cache_show ();
+	printf ("DNS lookup started for %s\n", host );
 	*/
 
-	if ( dcp->flags & F_VALID ) {
+	if ( strlen ( host ) >= DNS_NAME_MAX )
+	    return 0;
+
+	INT_lock;
+	dcp = dns_find ( host );
+
+	/* An answer, or a "no such name", that is still good */
+	if ( dcp && (dcp->flags & (F_VALID|F_NEG)) && dcp->expire - dns_now > 0 ) {
+	    if ( dcp->flags & F_VALID ) {
+		dns_stats.hits++;
+		ipnum = dcp->ip_addr;
+	    } else {
+		dns_stats.neg_hits++;
+		ipnum = 0;
+	    }
+	    INT_unlock;
+	    return ipnum;
+	}
+
+	if ( ! dcp )
+	    dcp = dns_new ( host );
+	if ( ! dcp ) {
+	    INT_unlock;
+	    return 0;
+	}
+
+	if ( dcp->flags & F_PENDING ) {
+	    /* Somebody already asked, wait with them,
+	     * but not less time than we were told.
+	     */
+	    dns_stats.joined++;
+	    if ( dcp->expire - (dns_now + timeout) < 0 )
+		dcp->expire = dns_now + timeout;
+	} else {
+	    /* A name that won't go in a packet will never
+	     * get an answer, so say so now.
+	     */
+	    dcp->id = dns_id++ & 0xffff;
+	    len = dns_query_build ( dcp, dns_buf );
+	    if ( ! len ) {
+		dcp->flags = F_NEG;
+		dcp->expire = dns_now + DNS_NEG_TTL;
+		INT_unlock;
+		return 0;
+	    }
+
+	    /* build cache entry */
+	    dns_stats.misses++;
+	    dcp->flags = F_PENDING;
+	    dcp->expire = dns_now + timeout;
+	    dcp->backoff = DNS_RETRY;
+	    dcp->retry = dns_now + DNS_RETRY;
+	    dcp->server = 0;
+	    dcp->sem = sem_signal_new ( SEM_FIFO );
+	    dcp->pnext = dns_pending;
+	    dns_pending = dcp;
+	}
+	dcp->nref++;
+
+	if ( len ) {
+	    INT_unlock;
 	    /*
-	    printf ("DNS got it: %s\n", ip2str32 ( dcp->ip_addr ) );
+	    printf ("DNS udp, sending to %s\n", ip2str32 ( dns_server_ip[0] ) );
 	    */
-	    return dcp->ip_addr;
+	    dns_stats.queries++;
+	    udp_send ( dns_server_ip[0], REPLY_PORT, DNS_PORT, dns_buf, len );
+	    INT_lock;
 	}
 
-	/* timed out or failed */
+	/* The answer could even have come while we were sending */
+	while ( dcp->flags & F_PENDING ) {
+	    dcp->nsleep++;
+	    sem_block_cpu ( dcp->sem );
+	    INT_lock;
+	}
+
+	/* timed out or failed gives zero */
+	ipnum = 0;
+	if ( dcp->flags & F_VALID )
+	    ipnum = dcp->ip_addr;
+	dcp->nref--;
+	INT_unlock;
+
 	/*
-	printf ("DNS failed: %d\n", dcp->flags);
+	printf ("DNS got it: %s\n", ip2str32 ( ipnum ) );
 	*/
-	dcp->flags = 0;
-	return 0;
+	return ipnum;
 }
 
 u32
@@ -331,7 +562,8 @@ dns_resp_show ( struct netbuf *nbp )
 {
     	struct dns_info *dp;
 	struct rr_info *rp;
-	char buf[128];
+	char buf[DNS_NAME_BUF];
+	char *end;
 	int rcode;
 	char *cp;
 	u32 ip;
@@ -339,6 +571,7 @@ dns_resp_show ( struct netbuf *nbp )
 	u32 lval;
 
 	dp = (struct dns_info *) nbp->dptr;
+	end = nbp->dptr + nbp->dlen;
 
     	printf ("Received DNS reply (%d bytes)\n", nbp->dlen );
 	printf ("id = %d\n", ntohs(dp->id));
@@ -351,12 +584,20 @@ dns_resp_show ( struct netbuf *nbp )
 	}
 
 	/* skip the Query */
-	cp = dns_unpack ( (char *) dp, dp->buf, buf );
+	cp = dns_unpack ( (char *) dp, dp->buf, end, buf );
+	if ( ! cp ) {
+	    printf ("bad query name\n" );
+	    return;
+	}
 	cp += 4;
 	printf ("query: %s\n", buf );
 	printf ("next: %d\n", cp-((char *)dp) );
 
-	rp = (struct rr_info *) dns_unpack ( (char *) dp, cp, buf );
+	rp = (struct rr_info *) dns_unpack ( (char *) dp, cp, end, buf );
+	if ( ! rp || rp->buf + 4 > end ) {
+	    printf ("short answer\n" );
+	    return;
+	}
 	printf ("name = %s\n", buf );
 	printf ("next: %d\n", ((char *)rp)-((char *)dp) );
 
@@ -369,38 +610,91 @@ dns_resp_show ( struct netbuf *nbp )
 	printf ("IP = %s\n", ip2str32 ( ip ) );
 }
 
+
 static struct dns_data *
 find_pending ( int id )
 {
 	struct dns_data *ap;
-	int i;
 
-	for ( i=0; i<MAX_DNS_CACHE; i++ ) {
-	    ap = &dns_cache[i];
-	    if ( (ap->flags & F_PENDING) && ap->id == id )
+	for ( ap = dns_pending; ap; ap = ap->pnext )
+	    if ( ap->id == id )
 		return ap;
-	}
 
 	return (struct dns_data *) 0;
 }
 
+/* Work through the answers, skipping any CNAME records,
+ * to find the first A record.
+ * Returns 1 and fills in ip and ttl if we find one.
+ * The answer count and the record lengths come from the
+ * packet, so we check each record fits before touching it.
+ * (rp->buf is where the fixed part of a record ends,
+ * sizeof(struct rr_info) is padded past that.)
+ */
+static int
+dns_answer ( struct dns_info *dp, char *end, u32 *ip, u32 *ttl )
+{
+	struct rr_info *rp;
+	char buf[DNS_NAME_BUF];
+	char *cp;
+	unsigned short type;
+	unsigned short len;
+	int n;
+
+	/* skip the Query */
+	cp = dns_unpack ( (char *) dp, dp->buf, end, buf );
+	if ( ! cp )
+	    return 0;
+	cp += 4;
+
+	for ( n = ntohs(dp->n_ans); n > 0; n-- ) {
+	    /* get the resource record */
+	    if ( cp >= end )
+		return 0;
+	    rp = (struct rr_info *) dns_unpack ( (char *) dp, cp, end, buf );
+	    if ( ! rp || rp->buf > end )
+		return 0;
+
+	    /* ARM alignment issues */
+	    memcpy ( &type, (char *) &rp->type, 2 );
+	    memcpy ( &len, (char *) &rp->len, 2 );
+	    len = ntohs ( len );
+	    if ( rp->buf + len > end )
+		return 0;
+
+	    if ( ntohs(type) == Q_A && len == 4 ) {
+		memcpy ( ip, rp->buf, 4 );
+		memcpy ( ttl, (char *) &rp->ttl, sizeof(u32) );
+		*ttl = ntohl ( *ttl );
+		return 1;
+	    }
+	    cp = rp->buf + len;
+	}
+
+	return 0;
+}
+
+#define RCODE_NXDOMAIN	3
+
 void
 dns_rcv ( struct netbuf *nbp )
 {
     	struct dns_info *dp;
-	struct rr_info *rp;
 	struct dns_data *ap;
-	char buf[128];
-	char *cp;
+	struct sem *sem;
+	int nwake;
+	int rcode;
 	u32 ip;
-	int len;
 	u32 ttl;
+	int found;
 
 	/*
 	dns_resp_show ( nbp );
 	*/
 
 	dp = (struct dns_info *) nbp->dptr;
+	if ( nbp->dlen < (char *) dp->buf - (char *) dp )
+	    return;
 
 	/* Ignore anything that isn't a response.
 	 * (we aren't a DNS server, for crying
@@ -409,49 +703,45 @@ dns_rcv ( struct netbuf *nbp )
 	if ( ! (ntohs(dp->flags) & F_RESP)  )
 	    return;
 
-	/* The response indicates an error.
-	 * We used to just ignore this and let the
-	 * request timeout, but it is a lot cleaner
-	 * to wake up the pending request.
-	 */
-	if ( ntohs(dp->flags) & 0x000f ) {
-	    ap = find_pending ( ntohs ( dp->id ) );
-	    sem_unblock ( ap->sem );
-	    return;
-	}
-
-	/* skip the Query */
-	cp = 4 + dns_unpack ( (char *) dp, dp->buf, buf );
-
-	/* get the resource record */
-	rp = (struct rr_info *) dns_unpack ( (char *) dp, cp, buf );
-
-#ifdef ARM_ALIGNMENT_HACK
-	/* ARM alignment issues */
-	memcpy ( &len, (char *) &rp->len, 2 );
-	if ( ntohs(len) != 4 )
-	    return;
+	rcode = ntohs(dp->flags) & 0x000f;
+	found = 0;
+	if ( ! rcode )
+	    found = dns_answer ( dp, nbp->dptr + nbp->dlen, &ip, &ttl );
 
-	memcpy ( &ip, rp->buf, 4 );
-#else
-	// len = rp->len;
-	if ( ntohs(rp->len) != 4 )
+	INT_lock;
+	ap = find_pending ( ntohs ( dp->id ) );
+	if ( ! ap ) {
+	    INT_unlock;
 	    return;
-	ip = *(u32 *) rp->buf;
-#endif
-	// printf ("IP = %s\n", ip2str32(ip) );
+	}
 
-	ap = find_pending ( ntohs ( dp->id ) );
-	if ( ap ) {
-	    ap->flags = F_VALID;
-	    memcpy ( &ttl, (char *) &rp->ttl, sizeof(u32) );
-	    ap->ttl = ntohl(ttl);
+	if ( found ) {
+	    if ( ttl < DNS_MIN_TTL )
+		ttl = DNS_MIN_TTL;
+	    if ( ttl > DNS_MAX_TTL )
+		ttl = DNS_MAX_TTL;
 	    ap->ip_addr = ip;
 	    /*
 	    printf ( "Adding entry for %s\n", ip2str32 ( ip ) );
 	    */
-	    sem_unblock ( ap->sem );
+	    dns_done ( ap, F_VALID, ttl, &sem, &nwake );
+	} else if ( rcode == RCODE_NXDOMAIN ) {
+	    /* The name does not exist, remember that */
+	    dns_stats.nxdomain++;
+	    dns_done ( ap, F_NEG, DNS_NEG_TTL, &sem, &nwake );
+	} else if ( rcode ) {
+	    /* The server is having trouble, try another one soon */
+	    dns_stats.errors++;
+	    ap->retry = dns_now;
+	    INT_unlock;
+	    return;
+	} else {
+	    /* No A record, we used to let these time out */
+	    dns_done ( ap, 0, 0, &sem, &nwake );
 	}
+	INT_unlock;
+
+	dns_wake ( sem, nwake );
 }
 
 void
@@ -459,51 +749,71 @@ dns_init ( void )
 {
 	int i;
 
-	if ( ! net_dots ( RESOLVER, &dns_ip ) )
-	    panic ( "resolver netdots" );
+	dns_nservers = 0;
+	for ( i=0; dns_servers[i] && i < MAX_DNS_SERVERS; i++ ) {
+	    if ( ! net_dots ( dns_servers[i], &dns_server_ip[i] ) )
+		panic ( "resolver netdots" );
+	    dns_nservers++;
+	}
 
-	for ( i=0; i<MAX_DNS_CACHE; i++ )
+	dns_free = (struct dns_data *) 0;
+	for ( i=DNS_CACHE_SIZE-1; i >= 0; i-- ) {
 	    dns_cache[i].flags = 0;
+	    dns_cache[i].hnext = dns_free;
+	    dns_free = &dns_cache[i];
+	}
+	for ( i=0; i<DNS_HASH_SIZE; i++ )
+	    dns_hash[i] = (struct dns_data *) 0;
+	dns_pending = (struct dns_data *) 0;
 
 	udp_hookup ( DNS_PORT, dns_rcv );
 }
 
-/* This is called once a second */
+/* This is called once a second.
+ * Answers in the cache just get checked when someone
+ * looks for them, we only need to look at requests.
+ */
 void
 dns_tick ( void )
 {
 	struct dns_data *ap;
-	int i;
+	char dns_buf[128];
+	struct sem *sem;
+	int nwake;
+	u32 server;
+	int len;
 
-	for ( i=0; i<MAX_DNS_CACHE; i++ ) {
-	    ap = &dns_cache[i];
-	    if ( ! ap->flags )
-		continue;
-	    if ( ap->flags & F_PERM )	/* permanent */
-		continue;
+	INT_lock;
+	dns_now++;
+
+again:
+	for ( ap = dns_pending; ap; ap = ap->pnext ) {
+	    if ( ap->expire - dns_now <= 0 ) {
+		dns_stats.timeouts++;
+		dns_done ( ap, 0, 0, &sem, &nwake );
+		INT_unlock;
+		/* still ours, nobody has been woken up */
+		printf ( "DNS lookup for %s timed out\n", ap->name );
+		dns_wake ( sem, nwake );
+		INT_lock;
+		goto again;
+	    }
 
-	    if ( ap->ttl )
-		ap->ttl--;
-	    else {
-		printf ( "DNS entry for %s expired\n", ap->name );
-		if ( ap->flags & F_PENDING )
-		    sem_unblock ( ap->sem );
-		ap->flags = 0;
+	    if ( ap->retry - dns_now <= 0 ) {
+		ap->server = (ap->server + 1) % dns_nservers;
+		server = dns_server_ip[ap->server];
+		ap->retry = dns_now + ap->backoff;
+		if ( ap->backoff < DNS_RETRY_MAX )
+		    ap->backoff *= 2;
+		len = dns_query_build ( ap, dns_buf );
+		INT_unlock;
+		dns_stats.resends++;
+		udp_send ( server, REPLY_PORT, DNS_PORT, dns_buf, len );
+		INT_lock;
+		goto again;
 	    }
 	}
-}
-
-static u32
-dns_cache_lookup ( char *name )
-{
-	int i;
-
-	for ( i=0; i<MAX_DNS_CACHE; i++ )
-	    if ( (dns_cache[i].flags & F_VALID) &&
-		strcmp ( name, dns_cache[i].name ) == 0 )
-		    return dns_cache[i].ip_addr;
-
-	return 0;
+	INT_unlock;
 }
 
 void
@@ -512,46 +822,24 @@ dns_cache_show ( void )
 	struct dns_data *ap;
 	int i;
 
-	for ( i=0; i<MAX_DNS_CACHE; i++ ) {
+	INT_lock;
+	for ( i=0; i<DNS_CACHE_SIZE; i++ ) {
 	    ap = &dns_cache[i];
 
 	    if ( ! ap->flags )
 		continue;
 
 	    printf ( "dns: %s at %s (ttl= %d)", ap->name,
-		ip2str32 ( ap->ip_addr ), ap->ttl );
+		ip2str32 ( ap->ip_addr ), ap->expire - dns_now );
 	    printf ( " %04x\n", ap->flags );
 	}
-}
+	INT_unlock;
 
-/* Find a free entry in the dns cache.
- * make second pass if needed to find the entry
- * nearly ready to expire.
- * ALWAYS returns something.
- * XXX - may want a lock here.
- */
-static struct dns_data *
-dns_alloc ( void )
-{
-	int i;
-	struct dns_data *ap;
-	struct dns_data *minp;
-
-	for ( i=0; i<MAX_DNS_CACHE; i++ ) {
-	    ap = &dns_cache[i];
-	    if ( ! ap->flags )
-	    	return ap;
-	}
-
-	minp = &dns_cache[0];
-	for ( i=0; i<MAX_DNS_CACHE; i++ ) {
-	    ap = &dns_cache[i];
-	    if ( ! ap->flags )	/* XXX */
-		continue;
-	    if ( ap->ttl < minp->ttl )
-	    	minp = ap;
-	}
-	return minp;
+	printf ( "dns: %d hits, %d negative hits, %d misses, %d joined a lookup\n",
+	    dns_stats.hits, dns_stats.neg_hits, dns_stats.misses, dns_stats.joined );
+	printf ( "dns: %d queries, %d resends, %d timeouts, %d NXDOMAIN, %d server errors\n",
+	    dns_stats.queries, dns_stats.resends, dns_stats.timeouts,
+	    dns_stats.nxdomain, dns_stats.errors );
 }
 
 /* THE END */
@@ -8,35 +8,104 @@
  */
 
 #include <arch/types.h>
+#include "net.h"
 
-/* portable, naive, but simple */
+/* The real work is done by csum_partial() in arch/cksum.S,
+ * which adds a word at a time using the carry chain.
+ * It returns a 32 bit partial sum that can be passed back in
+ * to continue the sum over another piece of the packet.
+ * csum_partial_copy() does the same while copying.
+ *
+ * All sums here are of 16 bit words as they sit in memory,
+ * so there is no byte swapping to worry about, other than
+ * the odd offset business in csum_block_add()
+ */
+
+/* Fold a 32 bit partial sum down to 16 bits */
 unsigned short
-in_cksum ( unsigned short *data, int len )
+csum_fold ( unsigned int sum )
 {
-	i32 sum = 0;
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return sum;
+}
 
-	while ( len > 1 ) {
-	    /* sum += * ((unsigned short *) data)++; */
-	    sum += *data++;
-	    if ( sum & 0x80000000 )
-		sum = (sum & 0xffff) + (sum >> 16);
-	    len -= 2;
+/* Add (or subtract) two partial sums */
+unsigned int
+csum_add ( unsigned int sum, unsigned int add )
+{
+	sum += add;
+	return sum + (sum < add);
+}
+
+unsigned int
+csum_sub ( unsigned int sum, unsigned int sub )
+{
+	return csum_add ( sum, ~sub );
+}
+
+/* Add in the partial sum of a block that began at "offset"
+ * bytes into the packet.  If that was odd, the bytes of
+ * the block sum are in the wrong halves of each word.
+ */
+unsigned int
+csum_block_add ( unsigned int sum, unsigned int part, int offset )
+{
+	if ( offset & 1 ) {
+	    part = csum_fold ( part );
+	    part = ((part & 0xff) << 8) | (part >> 8);
 	}
+	return csum_add ( sum, part );
+}
 
-	if ( len )
-	    sum += (unsigned short) * (unsigned char *) data;
+/* Incremental checksum update (RFC 1624, eqn 3)
+ *  HC' = ~(~HC + ~m + m')
+ * For when we rewrite a field in a header that already has
+ * a good checksum and don't want to sum the whole thing again.
+ * The old and new values are as they sit in the packet.
+ */
+void
+csum_replace2 ( unsigned short *sum, unsigned short old, unsigned short new )
+{
+	unsigned int s;
 
-	while ( sum >> 16 )
-	    sum = (sum & 0xffff) + (sum >> 16);
+	s = ~*sum & 0xffff;
+	s += ~old & 0xffff;
+	s += new;
+	*sum = ~csum_fold ( s );
+}
 
-	return ~sum & 0xffff;
+void
+csum_replace4 ( unsigned short *sum, u32 old, u32 new )
+{
+	unsigned int s;
+
+	s = ~*sum & 0xffff;
+	s += (~old & 0xffff) + (~old >> 16);
+	s += (new & 0xffff) + (new >> 16);
+	*sum = ~csum_fold ( s );
+}
+
+unsigned short
+in_cksum ( void *data, int len )
+{
+	return ~csum_fold ( csum_partial ( data, len, 0 ) ) & 0xffff;
 }
 
 /* Does not return ones complement */
 unsigned short
-in_cksum_i ( unsigned short *data, int len, unsigned short init )
+in_cksum_i ( void *data, int len, unsigned short init )
+{
+	return csum_fold ( csum_partial ( data, len, init ) );
+}
+
+/* The original, kept so test_net.c can compare.
+ * portable, naive, but simple
+ */
+unsigned short
+in_cksum_c ( unsigned short *data, int len )
 {
-	i32 sum = init;
+	i32 sum = 0;
 
 	while ( len > 1 ) {
 	    /* sum += * ((unsigned short *) data)++; */
@@ -52,7 +121,7 @@ in_cksum_i ( unsigned short *data, int len, unsigned short init )
 	while ( sum >> 16 )
 	    sum = (sum & 0xffff) + (sum >> 16);
 
-	return sum;
+	return ~sum & 0xffff;
 }
 
 /* THE END */
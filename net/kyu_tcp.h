@@ -17,9 +17,14 @@
 
 typedef void (*vfptr) ( void );
 
+/* rcv_list is optional, it gets a list of packets linked
+ * through "next".  If it is null, tcp_rcv_list() calls rcv
+ * for each one.
+ */
 struct tcp_ops {
 	vfptr	init;
 	ufptr	rcv;
+	ufptr	rcv_list;
 };
 
 struct tcp_ops * tcp_bsd_init ( void );
@@ -43,21 +43,232 @@
 #define ETH_MIN_SIZE	60
 #define ETH_MAX_SIZE	1514
 
+/* Biggest IP datagram that goes out in one frame */
+#define IP_MTU		1500
+
 /* in netinet/in.h in bsd sources */
 #define IPPROTO_ICMP	1
+#define IPPROTO_IGMP	2
 #define IPPROTO_TCP	6
 #define IPPROTO_UDP	17
 
 #define IP_BROADCAST	0xffffffff
 
+/* 224.0.0.0/4, argument in network byte order */
+#define IP_MULTICAST(ip)	((ntohl(ip) & 0xf0000000) == 0xe0000000)
+
 typedef void (*ufptr) ( struct netbuf * );
 
+/* driver receive poll function, see net_poll_sched() */
+typedef int (*npfptr) ( int );
+
+void net_poll_sched ( npfptr );
+void net_poll_more ( void );
+void net_rcv_poll ( struct netbuf * );
+void net_want_tidy ( void );
+
+/* Statistics, see net_stats.c */
+#define NS_ARP_IN		0
+#define NS_ARP_OUT		1
+#define NS_IP_IN		2
+#define NS_IP_OUT		3
+#define NS_ICMP_IN		4
+#define NS_ICMP_OUT		5
+#define NS_UDP_IN		6
+#define NS_UDP_OUT		7
+#define NS_TCP_IN		8
+#define NS_TCP_OUT		9
+#define NS_FRAG_IN		10	/* IP fragments */
+#define NS_FRAG_OUT		11
+#define NS_INQ_HWM		12	/* high water marks */
+#define NS_OUTQ_HWM		13
+#define NS_LOOPQ_HWM		14
+#define NS_TCPQ_HWM		15
+#define NS_NUM			16
+
+extern int net_stats[];
+
+/* These get bumped at interrupt level and in threads, and the
+ * netbuf magazines already let other cores into the network code,
+ * so counting is an atomic add (see arch/cpu.h, which you need).
+ * A high water mark is a plain compare and store, a race can
+ * cost us a peak but never makes one up.
+ */
+#define NET_COUNT(x,n)		cpu_atomic_add ( &(x), (n) )
+#define NET_STAT(x)		NET_COUNT ( net_stats[x], 1 )
+#define NET_STAT_HWM(x,v)	do { if ( (v) > net_stats[x] ) net_stats[x] = (v); } while ( 0 )
+
+int net_stats_format ( char *, int );
+void net_stats_export ( u32, int, int );
+
+/* Reasons we drop packets, for net_drop() */
+#define NET_DROP_NOBUF		0	/* driver could not get a netbuf */
+#define NET_DROP_QUEUE		1	/* input queue full */
+#define NET_DROP_NOTUS		2	/* not our MAC address */
+#define NET_DROP_ETYPE		3	/* ether type we don't handle */
+#define NET_DROP_CKSUM		4	/* bad IP header checksum */
+#define NET_DROP_FRAG		5	/* IP fragment we could not use */
+#define NET_DROP_PROTO		6	/* IP protocol we don't handle */
+#define NET_DROP_NOPORT		7	/* nobody listening on UDP port */
+#define NET_DROP_SHED		8	/* refused to shed load */
+#define NET_DROP_UDPSUM		9	/* bad UDP checksum */
+#define NET_DROP_RING		10	/* driver DMA ring full or overrun */
+#define NET_DROP_NOROUTE	11	/* no route to send it */
+#define NET_DROP_ARP		12	/* ARP queue full, or no answer */
+#define NET_DROP_IFDOWN		13	/* interface is down */
+#define NET_DROP_MCAST		14	/* multicast group we are not in */
+#define NET_DROP_NUM		15
+
+void net_drop ( int );
+
+/* Checksum offload, what the network hardware can do for us */
+#define NET_CSUM_RX		0x01	/* verifies Rx checksums (sets NB_CSUM_OK) */
+#define NET_CSUM_TX		0x02	/* fills in Tx checksums (honors NB_CSUM_TX) */
+
+void net_offload_set ( int );
+int net_offload ( void );
+
+/* in_cksum.c and arch/cksum.S */
+unsigned short in_cksum ( void *, int );
+unsigned short in_cksum_i ( void *, int, unsigned short );
+unsigned int csum_partial ( const void *, int, unsigned int );
+unsigned int csum_partial_copy ( void *, const void *, int, unsigned int );
+unsigned short csum_fold ( unsigned int );
+unsigned int csum_add ( unsigned int, unsigned int );
+unsigned int csum_sub ( unsigned int, unsigned int );
+unsigned int csum_block_add ( unsigned int, unsigned int, int );
+void csum_replace2 ( unsigned short *, unsigned short, unsigned short );
+void csum_replace4 ( unsigned short *, u32, u32 );
+
 char * ip2str ( unsigned char * );
 char * ip2str32 ( u32 );
 char * ether2str ( unsigned char * );
 
+void ip_rcv_list ( struct netbuf * );
+void ip_send_frag ( u32, int, char *, int, char *, int );
+void tcp_rcv_list ( struct netbuf * );
+
 void udp_hookup ( int, ufptr );
+void udp_reclaim ( void );
 int get_ephem_port ( void );
+struct netbuf * udp_alloc ( int );
+void udp_send_nb ( u32, int, int, struct netbuf * );
+
+/* UDP sockets, see net_udp.c */
+#define UDP_WAIT_FOREVER	(-1)
+
+struct udp_sock;
+
+struct udp_msg {
+	char *buf;
+	int len;
+	u32 ip;		/* network byte order */
+	int port;
+};
+
+struct udp_sock * udp_sock_open ( int );
+void udp_sock_close ( struct udp_sock * );
+int udp_sock_port ( struct udp_sock * );
+void udp_sock_qmax ( struct udp_sock *, int );
+/* A datagram that came in as IP fragments is a chain of netbufs,
+ * so callers of udp_recv_nb() should get at it with netbuf_copy_data()
+ * unless they know it is small.
+ */
+struct netbuf * udp_recv_nb ( struct udp_sock *, int );
+int udp_recvfrom ( struct udp_sock *, char *, int, u32 *, int *, int );
+int udp_recvmmsg ( struct udp_sock *, struct udp_msg *, int, int );
+int udp_sendto ( struct udp_sock *, u32, int, char *, int );
+int udp_sendmmsg ( struct udp_sock *, struct udp_msg *, int );
+
+/* tftp server exports, see tftpd.c */
+#define TFTPD_MAXSEG	3
+
+struct tftp_seg {
+	char *addr;
+	int len;
+};
+
+typedef int (*tdfptr) ( void *, struct tftp_seg * );
+
+void tftpd_export ( char *, char *, int );
+void tftpd_export_fn ( char *, tdfptr, void * );
+
+/* Network interfaces and routes, see net_if.c */
+#define NETIF_NAME	8
+
+#define NETIF_UP	0x01
+#define NETIF_LOOP	0x02	/* loopback, never sees a wire */
+#define NETIF_CSUM_TX	0x04	/* hardware fills in Tx checksums */
+
+struct netif;
+
+/* Hand a finished frame to the hardware */
+typedef void (*nofptr) ( struct netif *, struct netbuf * );
+
+struct netif {
+	char name[NETIF_NAME];
+	int index;
+	int flags;
+	u32 ip;			/* network byte order */
+	u32 mask;
+	unsigned char mac[ETH_ADDR_SIZE];
+	nofptr output;
+	/* statistics */
+	int rx_packets;
+	int rx_bytes;
+	int rx_drops;
+	int tx_packets;
+	int tx_bytes;
+	int tx_drops;
+};
+
+extern struct netif *netif_primary;
+extern struct netif *netif_loop;
+
+struct netif * netif_add ( char *, nofptr, unsigned char * );
+void netif_addr ( struct netif *, u32, u32 );
+struct netif * netif_get ( int );
+struct netif * netif_find ( char * );
+struct netif * netif_find_ip ( u32 );
+
+int route_add ( u32, u32, u32, struct netif * );
+int route_del ( u32, u32 );
+struct netif * route_lookup ( u32, u32 * );
+int route_plen ( u32 );
+u32 ip_source ( u32 );
+int ip_csum_tx ( u32 );
+
+/* Multicast, see net_mcast.c */
+extern int ip_mcast_ttl;
+
+int ip_mcast_join ( u32 );
+int ip_mcast_leave ( u32 );
+int ip_mcast_member ( u32 );
+int ip_mcast_mac_ok ( unsigned char * );
+void ip_mcast_ttl_set ( int );
+void mcast_ether ( u32, unsigned char * );
+
+/* Raw ethernet, see net_raw.c */
+struct raw_sock;
+
+extern int raw_count;
+
+struct raw_sock * raw_open ( int );
+void raw_close ( struct raw_sock * );
+int raw_rcv_i ( struct netbuf * );
+struct netbuf * raw_recv_nb ( struct raw_sock *, int );
+int raw_recv ( struct raw_sock *, char *, int, unsigned char *, int );
+struct netbuf * raw_alloc ( int );
+void raw_send_nb ( struct raw_sock *, unsigned char *, struct netbuf * );
+int raw_send ( struct raw_sock *, unsigned char *, char *, int );
+
+/* Packet capture, see net_cap.c */
+extern int capture_on;
+
+void capture_start ( int );
+void capture_stop ( void );
+void capture_filter ( int, int, u32 );
+void capture_pkt ( struct netbuf *, int );
 
 /* This stuff is either static assigned,
  * or obtained via DHCP (except mac address)
@@ -12,10 +12,6 @@
  */
 
 /* XXX - Todo
- * expire arp cache entries (20 minutes),
- * (BSD expires incomplete entries in 3 minutes)
- * issue and wait for arp requests
- * (queue of waiting packets to go out).
  * IF we get a reply to our Grat. arp, we should
  * issue a "duplicate IP in use" message with the
  * MAC address of the offender.
@@ -72,22 +68,97 @@ struct eth_arp {
 
 extern struct host_info host_info;
 
+/* Made new for each arp_ping() and cleared by whoever signals it,
+ * so a second answer to the same ping can't leave it set for the next.
+ */
 static struct sem *arp_ping_sem;
 
-#define MAX_ARP_CACHE	32
+/* The neighbor table.
+ * Entries come from a fixed pool and are found by hashing the IP address.
+ * They also sit on an LRU list, so when the pool runs dry we recycle
+ * whatever we have gone longest without using.
+ * We talk to hundreds of machines on a flat subnet, and a small table
+ * that thrashes sends every packet back through ARP.
+ *
+ * An entry lives its life like this:
+ *  pending  - request sent, packets (up to ARP_QUEUE_MAX) wait for the answer.
+ *		We ask again every ARP_RETRY seconds, ARP_PROBES times in all.
+ *  valid    - we have an answer and trust it for ARP_REACHABLE seconds.
+ *  stale    - we still use it, but the first time we do, we send a
+ *		unicast request to make sure the fellow is still there.
+ *		No answer after ARP_PROBES tries and the entry goes away.
+ *		A stale entry nobody uses for ARP_STALE seconds goes away.
+ *
+ * Timers run off a wheel of one second slots, so arp_tick() only
+ * looks at the entries in one slot, not the whole table.
+ * Timeouts longer than the wheel just go around again.
+ */
+#define ARP_CACHE_SIZE	256	/* entries in the pool */
+#define ARP_HASH_SIZE	128	/* must be a power of 2 */
+#define ARP_WHEEL_SIZE	64	/* must be a power of 2 */
+
+#define ARP_QUEUE_MAX	8	/* packets held awaiting an answer (an 8K datagram is 6 fragments) */
+#define ARP_RETRY	1	/* seconds between requests */
+#define ARP_PROBES	3	/* requests before we give up */
+#define ARP_REACHABLE	(5*60)
+#define ARP_STALE	(15*60)
 
 #define F_PENDING	0x0001
 #define F_PING		0x0002
-#define F_PERM		0x0004
 #define F_VALID		0x0008
+#define F_STALE		0x0010
 
 struct arp_data {
+	struct arp_data *hnext;		/* hash chain, or free list */
+	struct arp_data *wnext;		/* timer wheel slot */
+	struct arp_data *lru_next;
+	struct arp_data *lru_prev;
 	int flags;
-	int ttl;
+	int expire;			/* arp_now when the timer runs out */
+	int wslot;			/* wheel slot we are on, -1 if none */
+	int probes;			/* requests sent with no answer */
 	unsigned int ip_addr;
 	char ether[ETH_ADDR_SIZE];
+	int qlen;
 	struct netbuf *outq;
-} arp_cache[MAX_ARP_CACHE];
+	struct netbuf *outq_tail;
+};
+
+static struct arp_data arp_cache[ARP_CACHE_SIZE];
+static struct arp_data *arp_hash[ARP_HASH_SIZE];
+static struct arp_data *arp_wheel[ARP_WHEEL_SIZE];
+static struct arp_data *arp_free;
+
+/* Circular, lru_next of this is the most recently used */
+static struct arp_data arp_lru;
+
+/* seconds, counted by arp_tick() */
+static int arp_now;
+
+static struct arp_stats {
+	int count;
+	int hits;
+	int misses;
+	int evicted;
+	int queued;
+	int qdrops;
+	int requests;
+	int failed;
+	int stale;
+} arp_stats;
+
+/* Fibonacci hash, hosts on the same net differ only in the
+ * high bytes of a network order address.
+ */
+#define ARP_HASH(ip)	((((u32) (ip)) * 2654435761u >> 16) & (ARP_HASH_SIZE-1))
+
+/* ARP traffic comes from the net thread, output from any thread
+ * that sends IP, and timers from the net-timer thread.
+ */
+static struct sem *arp_sem;
+
+#define ARP_LOCK	sem_block ( arp_sem )
+#define ARP_UNLOCK	sem_unblock ( arp_sem )
 
 // static int arp_save ( char *, unsigned char * );
 // void arp_save_icmp ( char *, unsigned char * );
@@ -96,7 +167,9 @@ void arp_save_icmp ( char *, u32 );
 
 void arp_show ( void );
 void arp_reply ( struct netbuf * );
-static struct arp_data * arp_alloc ( void );
+void arp_request ( u32 );
+static void arp_request_to ( u32, unsigned char * );
+static void arp_announce_if ( struct netif * );
 
 static void
 arp_show_stuff ( char *str, struct eth_arp *eap )
@@ -112,21 +185,188 @@ arp_show_stuff ( char *str, struct eth_arp *eap )
 	printf ( " (%s)\n", ip2str ( (char *) &eap->tpa ) );
 }
 
-struct arp_data *
-arp_lookup_e ( u32 ip_addr )
+/* -------------------------- */
+/* The table itself, all of these need the lock held.
+ */
+
+static struct arp_data *
+arp_lookup ( u32 ip_addr )
 {
-	int i;
 	struct arp_data *ap;
 
-	for ( i=0; i<MAX_ARP_CACHE; i++ ) {
-	    ap = &arp_cache[i];
+	for ( ap = arp_hash[ARP_HASH(ip_addr)]; ap; ap = ap->hnext )
 	    if ( ap->ip_addr == ip_addr )
 		return ap;
-	}
 
 	return (struct arp_data *) 0;
 }
 
+static void
+arp_lru_unlink ( struct arp_data *ap )
+{
+	ap->lru_prev->lru_next = ap->lru_next;
+	ap->lru_next->lru_prev = ap->lru_prev;
+}
+
+static void
+arp_lru_touch ( struct arp_data *ap )
+{
+	if ( arp_lru.lru_next == ap )
+	    return;
+
+	arp_lru_unlink ( ap );
+	ap->lru_next = arp_lru.lru_next;
+	ap->lru_prev = &arp_lru;
+	arp_lru.lru_next->lru_prev = ap;
+	arp_lru.lru_next = ap;
+}
+
+static void
+arp_wheel_unlink ( struct arp_data *ap )
+{
+	struct arp_data **pp;
+
+	if ( ap->wslot < 0 )
+	    return;
+
+	for ( pp = &arp_wheel[ap->wslot]; *pp; pp = &(*pp)->wnext )
+	    if ( *pp == ap ) {
+		*pp = ap->wnext;
+		break;
+	    }
+	ap->wslot = -1;
+}
+
+/* Set the timer on an entry to go off "secs" from now */
+static void
+arp_timer ( struct arp_data *ap, int secs )
+{
+	arp_wheel_unlink ( ap );
+
+	ap->expire = arp_now + secs;
+	ap->wslot = ap->expire & (ARP_WHEEL_SIZE-1);
+	ap->wnext = arp_wheel[ap->wslot];
+	arp_wheel[ap->wslot] = ap;
+}
+
+static void
+arp_flush_queue ( struct arp_data *ap )
+{
+	struct netbuf *nbp, *xbp;
+
+	for ( nbp = ap->outq; nbp; nbp = xbp ) {
+	    xbp = nbp->next;
+	    net_drop ( NET_DROP_ARP );
+	    netbuf_free ( nbp );
+	}
+	ap->outq = ap->outq_tail = (struct netbuf *) 0;
+	ap->qlen = 0;
+}
+
+/* Hold a packet until the address is resolved.
+ * If the queue is full, the oldest packet goes.
+ */
+static void
+arp_enqueue ( struct arp_data *ap, struct netbuf *nbp )
+{
+	struct netbuf *xbp;
+
+	if ( ap->qlen >= ARP_QUEUE_MAX ) {
+	    xbp = ap->outq;
+	    ap->outq = xbp->next;
+	    ap->qlen--;
+	    netbuf_free ( xbp );
+	    arp_stats.qdrops++;
+	    net_drop ( NET_DROP_ARP );
+	}
+
+	nbp->next = (struct netbuf *) 0;
+	if ( ap->outq )
+	    ap->outq_tail->next = nbp;
+	else
+	    ap->outq = nbp;
+	ap->outq_tail = nbp;
+	ap->qlen++;
+	arp_stats.queued++;
+}
+
+/* Take an entry completely out of the table */
+static void
+arp_remove ( struct arp_data *ap )
+{
+	struct arp_data **pp;
+
+	arp_flush_queue ( ap );
+	arp_wheel_unlink ( ap );
+	arp_lru_unlink ( ap );
+
+	for ( pp = &arp_hash[ARP_HASH(ap->ip_addr)]; *pp; pp = &(*pp)->hnext )
+	    if ( *pp == ap ) {
+		*pp = ap->hnext;
+		break;
+	    }
+
+	ap->ip_addr = 0;
+	ap->flags = 0;
+	ap->hnext = arp_free;
+	arp_free = ap;
+	arp_stats.count--;
+}
+
+/* Get a new entry for this address.
+ * When the pool is empty we take the least recently used
+ * entry, but never one that arp_ping() is waiting on.
+ */
+static struct arp_data *
+arp_new ( u32 ip_addr )
+{
+	struct arp_data *ap;
+	int h;
+
+	if ( ! arp_free ) {
+	    for ( ap = arp_lru.lru_prev; ap != &arp_lru; ap = ap->lru_prev )
+		if ( ! (ap->flags & F_PING) )
+		    break;
+	    if ( ap == &arp_lru )
+		return (struct arp_data *) 0;
+	    arp_remove ( ap );
+	    arp_stats.evicted++;
+	}
+
+	ap = arp_free;
+	arp_free = ap->hnext;
+
+	ap->ip_addr = ip_addr;
+	ap->flags = 0;
+	ap->probes = 0;
+	ap->wslot = -1;
+	ap->qlen = 0;
+	ap->outq = ap->outq_tail = (struct netbuf *) 0;
+
+	h = ARP_HASH(ip_addr);
+	ap->hnext = arp_hash[h];
+	arp_hash[h] = ap;
+
+	ap->lru_next = arp_lru.lru_next;
+	ap->lru_prev = &arp_lru;
+	arp_lru.lru_next->lru_prev = ap;
+	arp_lru.lru_next = ap;
+
+	arp_stats.count++;
+	return ap;
+}
+
+/* Start a pending entry on its way */
+static void
+arp_resolve ( struct arp_data *ap )
+{
+	ap->flags |= F_PENDING;
+	ap->flags &= ~(F_VALID|F_STALE);
+	ap->probes = 1;
+	arp_timer ( ap, ARP_RETRY );
+	arp_request ( ap->ip_addr );
+}
+
 /* -------------------------- */
 
 void
@@ -145,7 +385,8 @@ arp_rcv ( struct netbuf *nbp )
 	}
 #endif
 
-	if ( eap->tpa != host_info.my_ip ) {
+	/* Asking about us, on the interface it came in on */
+	if ( eap->tpa != nbp->ifp->ip ) {
 	    netbuf_free ( nbp );
 	    return;
 	}
@@ -184,10 +425,10 @@ arp_reply ( struct netbuf *nbp )
 	eap->tpa = eap->spa;
 	memcpy ( eap->tha, eap->sha, ETH_ADDR_SIZE ); 
 	// memcpy ( eap->spa, (char *) &host_info.my_ip, 4 );
-	eap->spa = host_info.my_ip;
+	eap->spa = nbp->ifp->ip;
 	eap->op = OP_REPLY_SWAP;
 
-	net_addr_get ( eap->sha );
+	memcpy ( eap->sha, nbp->ifp->mac, ETH_ADDR_SIZE );
 
 	nbp->eptr->type = ETH_ARP_SWAP;
 	memcpy ( nbp->eptr->dst, eap->tha, ETH_ADDR_SIZE );
@@ -197,16 +438,29 @@ arp_reply ( struct netbuf *nbp )
 
 #define ARP_ETHER_SWAP	0x0100
 
-void
-arp_request ( u32 target_ip )
+/* An ARP frame fits handily in a small netbuf */
+#define ARP_FRAME_SIZE	(sizeof(struct eth_hdr) + sizeof(struct eth_arp))
+
+/* Usually broadcast, but a unicast request is the polite
+ * way to check up on an entry we already have.
+ */
+static void
+arp_request_to ( u32 target_ip, unsigned char *dst )
 {
 	struct netbuf *nbp;
 	struct eth_arp *eap;
+	struct netif *ifp;
 	// u32 unknown = target_ip;
 
+	/* Ask on whatever net it is on */
+	ifp = route_lookup ( target_ip, (u32 *) 0 );
+	if ( ! ifp )
+	    ifp = netif_primary;
+
 	/* get a netbuf for this */
-	if ( ! (nbp = netbuf_alloc ()) )
+	if ( ! (nbp = netbuf_alloc_size ( ARP_FRAME_SIZE )) )
 	    return;
+	nbp->ifp = ifp;
 
 	eap = (struct eth_arp *) nbp->iptr;
 
@@ -215,9 +469,9 @@ arp_request ( u32 target_ip )
 	eap->hlen = ETH_ADDR_SIZE;
 	eap->plen = 4;
 
-	net_addr_get ( eap->sha );
+	memcpy ( eap->sha, ifp->mac, ETH_ADDR_SIZE );
 	// memcpy ( eap->spa, (char *) &host_info.my_ip, 4 );
-	eap->spa = host_info.my_ip;
+	eap->spa = ifp->ip;
 
 	memcpy ( eap->tha, zeros, ETH_ADDR_SIZE ); 
 	// memcpy ( eap->tpa, (char *) &unknown, 4 );
@@ -226,39 +480,84 @@ arp_request ( u32 target_ip )
 	eap->op = OP_REQ_SWAP;
 
 	nbp->eptr->type = ETH_ARP_SWAP;
-	memcpy ( nbp->eptr->dst, broad, ETH_ADDR_SIZE );
+	memcpy ( nbp->eptr->dst, dst, ETH_ADDR_SIZE );
 	nbp->ilen = sizeof ( struct eth_arp );
 
+	arp_stats.requests++;
 	net_send ( nbp );
 }
 
+void
+arp_request ( u32 target_ip )
+{
+	arp_request_to ( target_ip, broad );
+}
+
 /* Called from the IP layer when we have a packet to send */
 void
 ip_arp_send ( struct netbuf *nbp )
 {
 	struct arp_data *ap;
+	struct netif *ifp;
 	u32 dest_ip = nbp->iptr->dst;
 
 	nbp->eptr->type = ETH_IP_SWAP;
+	NET_STAT ( NS_IP_OUT );
+	ip_stat ( nbp->iptr, 1 );
 
-	/* broadcast is easy */
+	/* broadcast is easy, it goes out eth0
+	 * unless somebody says otherwise.
+	 */
 	if ( dest_ip == IP_BROADCAST ) {
 	    memcpy ( nbp->eptr->dst, broad, ETH_ADDR_SIZE );
 	    net_send ( nbp );
 	    return;
 	}
 
-	/*  XXX - here is the sum total of our IP routing.
-	 *  Anything not on our local net goes to the getway
+	/* The routing table picks the interface, and
+	 * turns the address into a gateway if need be.
+	 */
+	ifp = route_lookup ( dest_ip, &dest_ip );
+	if ( ! ifp ) {
+	    net_drop ( NET_DROP_NOROUTE );
+	    netbuf_free ( nbp );
+	    return;
+	}
+	nbp->ifp = ifp;
+
+	/* No ARP, no ethernet header, and no output queue */
+	if ( ifp->flags & NETIF_LOOP ) {
+	    (*ifp->output) ( ifp, nbp );
+	    return;
+	}
+
+	/* No ARP for multicast either, the MAC
+	 * address comes right out of the group.
 	 */
-	if ( (dest_ip & host_info.net_mask) != host_info.my_net ) {
-	    printf ( "Route to gateway -- %08x %08x\n", dest_ip, host_info.my_net );
-	    dest_ip = host_info.gate_ip;
+	if ( IP_MULTICAST ( dest_ip ) ) {
+	    mcast_ether ( dest_ip, nbp->eptr->dst );
+	    net_send ( nbp );
+	    return;
 	}
 
-	ap = arp_lookup_e ( dest_ip );
-	if ( ap ) {
+	ARP_LOCK;
+	ap = arp_lookup ( dest_ip );
+
+	if ( ap && (ap->flags & F_VALID) ) {
+	    arp_stats.hits++;
+	    arp_lru_touch ( ap );
 	    memcpy ( nbp->eptr->dst, ap->ether, ETH_ADDR_SIZE );
+
+	    /* First use of a stale entry, check it is still good.
+	     * Once probes is set, arp_tick() handles the retries.
+	     */
+	    if ( (ap->flags & F_STALE) && ! ap->probes ) {
+		ap->probes = 1;
+		arp_timer ( ap, ARP_RETRY );
+		arp_request_to ( dest_ip, ap->ether );
+	    }
+	    ARP_UNLOCK;
+
 	    net_send ( nbp );
 #ifdef DEBUG_ARP
 	    printf ( "IP arp send -- sent packet to %s\n", ip2str32 ( dest_ip ) );
@@ -266,30 +565,43 @@ ip_arp_send ( struct netbuf *nbp )
 	    return;
 	}
 
-	/* build a pending entry and queue the packet
-	 */
-	ap = arp_alloc ();
+	arp_stats.misses++;
 
-	ap->ip_addr = dest_ip;
-	ap->flags = F_PENDING;
+	if ( ! ap ) {
+	    ap = arp_new ( dest_ip );
+	    if ( ! ap ) {
+		ARP_UNLOCK;
+		net_drop ( NET_DROP_ARP );
+		netbuf_free ( nbp );
+		return;
+	    }
+	}
 
+	/* Queue the packet, and ask unless we already
+	 * have a request out (arp_tick() does the retries).
+	 */
+	arp_enqueue ( ap, nbp );
 #ifdef DEBUG_ARP
-	printf ("IP arp send: ARP request sent for %s\n", ip2str32 ( dest_ip ) );
+	printf ("Pending packet queued for %s\n", ip2str32 ( ap->ip_addr ) );
 #endif
 
-	/* We only wait 20 seconds.
-	 * (BSD waits 3 minutes)
-	 */
-	ap->ttl = 20;
-	nbp->next = ap->outq;
-	nbp->refcount++;
-	ap->outq = nbp;
-
+	if ( ! (ap->flags & F_PENDING) ) {
 #ifdef DEBUG_ARP
-	printf ("Pending packet queued for %s\n", ip2str32 ( ap->ip_addr ) );
+	    printf ("IP arp send: ARP request sent for %s\n", ip2str32 ( dest_ip ) );
 #endif
+	    arp_resolve ( ap );
+	}
+	ARP_UNLOCK;
+}
 
-	arp_request ( dest_ip );
+/* Only the first answer (or the giving up) counts */
+static void
+arp_ping_wake ( void )
+{
+	if ( arp_ping_sem ) {
+	    sem_unblock ( arp_ping_sem );
+	    arp_ping_sem = (struct sem *) 0;
+	}
 }
 
 /* Funky old test fixture to test the stack when all
@@ -302,39 +614,51 @@ arp_ping ( u32 target_ip, char *ether )
 {
 	static int busy = 0;	/* paranoid */
 	struct arp_data *ap;
+	struct sem *sem;
 	int rv = 0;
 
 	if ( busy )
 	    return 0;
 	busy = 1;
 
-	ap = arp_lookup_e ( target_ip ); 
+	ARP_LOCK;
+	ap = arp_lookup ( target_ip ); 
 	if ( ! ap )
-	    ap = arp_alloc ();
-
-	ap->ip_addr = target_ip;
-	ap->flags = F_PING;
+	    ap = arp_new ( target_ip );
+	sem = (struct sem *) 0;
+	if ( ap )
+	    sem = sem_signal_new ( SEM_FIFO );
+	if ( ! sem ) {
+	    ARP_UNLOCK;
+	    busy = 0;
+	    return 0;
+	}
+	arp_ping_sem = sem;
 
 	/*
 	printf ("ARP ping request sent for %s\n", ip2str32 ( target_ip ) );
 	*/
 
-	/* We only wait 10 seconds.
+	/* We wait for ARP_PROBES requests to go unanswered.
 	 */
-	ap->ttl = 10;
-	ap->outq = (struct netbuf *) 0;
-
-    	arp_request ( target_ip );
+	ap->flags |= F_PING;
+	arp_resolve ( ap );
+	ARP_UNLOCK;
 
-	sem_block ( arp_ping_sem );
+	sem_block ( sem );
+	sem_destroy ( sem );
 
+	ARP_LOCK;
 	if ( ap->flags & F_VALID ) {
 	    memcpy ( ether, ap->ether, ETH_ADDR_SIZE );
 	    rv = 1;
 	}
 
-	/* free the entry */
-	ap->ip_addr = 0;
+	/* An answer is as good as any other, keep it */
+	ap->flags &= ~F_PING;
+	if ( ! (ap->flags & F_VALID) )
+	    arp_remove ( ap );
+	ARP_UNLOCK;
 
 	busy = 0;
 	return rv;
@@ -360,12 +684,25 @@ show_arp_ping ( u32 target_ip )
  */
 void
 arp_announce ( void )
+{
+	struct netif *ifp;
+	int i;
+
+	for ( i=0; (ifp = netif_get ( i )); i++ )
+	    if ( ifp->ip && (ifp->flags & NETIF_UP) && ! (ifp->flags & NETIF_LOOP) )
+		arp_announce_if ( ifp );
+}
+
+/* One interface */
+static void
+arp_announce_if ( struct netif *ifp )
 {
 	struct netbuf *nbp;
 	struct eth_arp *eap;
 
-	if ( ! (nbp = netbuf_alloc ()) )
+	if ( ! (nbp = netbuf_alloc_size ( ARP_FRAME_SIZE )) )
 	    return;
+	nbp->ifp = ifp;
 
 #ifdef DEBUG_ARP
     printf ( "Sending Gratuitous ARP\n" );
@@ -378,13 +715,13 @@ arp_announce ( void )
 	eap->hlen = ETH_ADDR_SIZE;
 	eap->plen = 4;
 
-	net_addr_get ( eap->sha );
+	memcpy ( eap->sha, ifp->mac, ETH_ADDR_SIZE );
 
 	// memcpy ( eap->spa, (char *) &host_info.my_ip, 4 );
-	eap->spa = host_info.my_ip;
+	eap->spa = ifp->ip;
 	memcpy ( eap->tha, zeros, ETH_ADDR_SIZE ); 
 	// memcpy ( eap->tpa, (char *) &host_info.my_ip, 4 );
-	eap->tpa = host_info.my_ip;
+	eap->tpa = ifp->ip;
 	eap->op = OP_REQ_SWAP;
 
 	nbp->eptr->type = ETH_ARP_SWAP;
@@ -398,48 +735,94 @@ arp_announce ( void )
 /* -------------------------------------------------- */
 /* -------------------------------------------------- */
 
-/* May need lock */
-void
+/* The timer on an entry ran out, see the table of
+ * states at the top of the file.
+ */
+static void
 arp_expire ( struct arp_data *ap )
 {
-	struct netbuf *nbp, *xbp;
-
 	/*
 	printf ( "ARP entry for %s expired\n", ip2str32 ( ap->ip_addr ) );
 	*/
 
-	ap->ip_addr = 0;
+	if ( ap->flags & F_PENDING ) {
+	    if ( ap->probes < ARP_PROBES ) {
+		ap->probes++;
+		arp_timer ( ap, ARP_RETRY );
+		arp_request ( ap->ip_addr );
+		return;
+	    }
+	    arp_stats.failed++;
+	    if ( ap->flags & F_PING ) {
+		/* arp_ping() gets rid of it */
+		ap->flags &= ~F_PENDING;
+		arp_flush_queue ( ap );
+		arp_timer ( ap, ARP_RETRY );
+		arp_ping_wake ();
+		return;
+	    }
+	    arp_remove ( ap );
+	    return;
+	}
 
-	if ( ap->flags & F_PING ) {
-	    sem_unblock ( arp_ping_sem );
+	if ( ! (ap->flags & F_VALID) ) {
+	    /* Left behind by a failed ping */
+	    arp_timer ( ap, ARP_RETRY );
+	    return;
 	}
 
-	for ( nbp = ap->outq; nbp; nbp = xbp ) {
-	    xbp = nbp->next;
-	    netbuf_free ( nbp );
+	if ( ! (ap->flags & F_STALE) ) {
+	    ap->flags |= F_STALE;
+	    ap->probes = 0;
+	    arp_timer ( ap, ARP_STALE );
+	    arp_stats.stale++;
+	    return;
 	}
 
+	/* Stale and being checked, unicast first, then
+	 * broadcast our last try in case it moved.
+	 */
+	if ( ap->probes && ap->probes < ARP_PROBES ) {
+	    ap->probes++;
+	    arp_timer ( ap, ARP_RETRY );
+	    if ( ap->probes < ARP_PROBES )
+		arp_request_to ( ap->ip_addr, ap->ether );
+	    else
+		arp_request ( ap->ip_addr );
+	    return;
+	}
+
+	if ( ap->probes )
+	    arp_stats.failed++;
+	arp_remove ( ap );
 }
 
-/* This is called once a second */
+/* This is called once a second.
+ * We only look at one slot on the wheel.
+ * Entries due on a later trip around just get put back.
+ */
 void
 arp_tick ( void )
 {
-	struct arp_data *ap;
-	int i;
+	struct arp_data *ap, *xp;
+	int slot;
+
+	ARP_LOCK;
+	arp_now++;
+	slot = arp_now & (ARP_WHEEL_SIZE-1);
 
-	for ( i=0; i<MAX_ARP_CACHE; i++ ) {
-	    ap = &arp_cache[i];
-	    if ( ! ap->ip_addr )
-		continue;
-	    if ( ap->flags & F_PERM )	/* permanent */
-		continue;
+	ap = arp_wheel[slot];
+	arp_wheel[slot] = (struct arp_data *) 0;
 
-	    if ( ap->ttl )
-		ap->ttl--;
+	for ( ; ap; ap = xp ) {
+	    xp = ap->wnext;
+	    ap->wslot = -1;
+	    if ( ap->expire - arp_now > 0 )
+		arp_timer ( ap, ap->expire - arp_now );
 	    else
 		arp_expire ( ap );
 	}
+	ARP_UNLOCK;
 }
 
 void
@@ -447,124 +830,104 @@ arp_init ( void )
 {
 	int i;
 
-	for ( i=0; i<MAX_ARP_CACHE; i++ ) {
+	arp_free = (struct arp_data *) 0;
+	for ( i=ARP_CACHE_SIZE-1; i >= 0; i-- ) {
 	    arp_cache[i].ip_addr = 0;
+	    arp_cache[i].hnext = arp_free;
+	    arp_free = &arp_cache[i];
 	}
-	arp_ping_sem = sem_signal_new ( SEM_FIFO );
+	for ( i=0; i<ARP_HASH_SIZE; i++ )
+	    arp_hash[i] = (struct arp_data *) 0;
+	for ( i=0; i<ARP_WHEEL_SIZE; i++ )
+	    arp_wheel[i] = (struct arp_data *) 0;
+
+	arp_lru.lru_next = arp_lru.lru_prev = &arp_lru;
+	arp_now = 0;
+
+	arp_sem = sem_mutex_new ( SEM_FIFO );
+	sem_set_name ( arp_sem, "arp-lock" );
 }
 
+/* Most recently used first */
 void
 arp_show ( void )
 {
 	struct arp_data *ap;
-	int i;
-
-	for ( i=0; i<MAX_ARP_CACHE; i++ ) {
-	    ap = &arp_cache[i];
-	    if ( ! ap->ip_addr )
-		continue;
 
+	ARP_LOCK;
+	for ( ap = arp_lru.lru_next; ap != &arp_lru; ap = ap->lru_next ) {
 	    printf ( "arp: %s at %s (ttl= %d)",
 		ip2str32 ( ap->ip_addr ),
-		ether2str( ap->ether), ap->ttl );
+		ether2str( ap->ether), ap->expire - arp_now );
 	    if ( ap->flags )
 		printf ( " %04x", ap->flags );
+	    if ( ap->qlen )
+		printf ( " %d queued", ap->qlen );
 	    printf ( "\n" );
 	}
-}
-
-/* Find a free entry in the arp cache.
- * make second pass if needed to find the entry
- * nearly ready to expire.
- * ALWAYS returns something.
- * XXX - may want a lock here.
- */
-static struct arp_data *
-arp_alloc ( void )
-{
-	int i;
-	struct arp_data *ap;
-	struct arp_data *minp;
-
-	for ( i=0; i<MAX_ARP_CACHE; i++ ) {
-	    ap = &arp_cache[i];
-	    if ( ! ap->ip_addr )
-	    	return ap;
-	}
 
-	minp = &arp_cache[0];
-	for ( i=0; i<MAX_ARP_CACHE; i++ ) {
-	    ap = &arp_cache[i];
-	    if ( ! ap->flags )	/* XXX */
-		continue;
-	    if ( ap->ttl < minp->ttl )
-	    	minp = ap;
-	}
-	return minp;
+	printf ( "arp: %d of %d entries, %d hits, %d misses, %d evicted\n",
+	    arp_stats.count, ARP_CACHE_SIZE,
+	    arp_stats.hits, arp_stats.misses, arp_stats.evicted );
+	printf ( "arp: %d requests, %d failed, %d went stale, %d queued, %d dropped from queue\n",
+	    arp_stats.requests, arp_stats.failed, arp_stats.stale,
+	    arp_stats.queued, arp_stats.qdrops );
+	ARP_UNLOCK;
 }
 
+/* Someone told us where ip_addr lives, either with ARP or,
+ * sneakily, by sending us an ICMP packet.
+ * Returns 1 if this is a new entry.
+ */
 static int
 arp_save ( char *ether, u32 ip_addr )
 {
-	int i;
 	struct arp_data *ap;
-	struct arp_data *zp;
 	struct netbuf *nbp, *xbp;
+	int rv = 0;
 
-	zp = (struct arp_data *) 0;
-
-	for ( i=0; i<MAX_ARP_CACHE; i++ ) {
-	    ap = &arp_cache[i];
-	    if ( ap->ip_addr == ip_addr ) {
-		/* Refresh entry or filling a pending request */
-		memcpy ( ap->ether, ether, ETH_ADDR_SIZE ); 
-		ap->ttl = 20 * 60;
-		ap->flags |= F_VALID;
-
-		if ( ap->flags & F_PING ) {
-		    sem_unblock ( arp_ping_sem );
-		}
-
-		if ( ap->flags & F_PENDING ) {
-		    /*
-		    printf ("Pending ARP for %s satisfied\n", ip2str32 ( ap->ip_addr ) );
-		    */
-		    ap->flags &= ~F_PENDING;
-
-		    for ( nbp = ap->outq; nbp; nbp = xbp ) {
-			memcpy ( nbp->eptr->dst, ap->ether, ETH_ADDR_SIZE );
-			xbp = nbp->next;
-			net_send ( nbp );
-			netbuf_free ( nbp );
-			/*
-			printf ("Pending packet sent\n");
-			*/
-		    }
-		    ap->outq = (struct netbuf *) 0;
-		}
-
-	    	return 0;
+	ARP_LOCK;
+	ap = arp_lookup ( ip_addr );
+	if ( ! ap ) {
+	    ap = arp_new ( ip_addr );
+	    if ( ! ap ) {
+		ARP_UNLOCK;
+		return 0;
 	    }
-
-	    if ( ! zp && ! ap->ip_addr )
-	    	zp = ap;
+	    rv = 1;
 	}
 
-	/* The above loop is an optimization, but
-	 * we fall back on this if we need to replace an
-	 * entry to get a slot.
-	 */
-	zp = arp_alloc ();
+	/* Refresh entry or filling a pending request */
+	memcpy ( ap->ether, ether, ETH_ADDR_SIZE ); 
+	ap->flags |= F_VALID;
+	ap->flags &= ~F_STALE;
+	ap->probes = 0;
+	arp_timer ( ap, ARP_REACHABLE );
+	arp_lru_touch ( ap );
 
-	/* New entry */
-	// memcpy ( &zp->ip_addr, ip_addr, 4 );
-	zp->ip_addr = ip_addr;
-	memcpy ( zp->ether, ether, ETH_ADDR_SIZE );
-	zp->flags = 0;
-	zp->ttl = 20 * 60;
-	zp->outq = (struct netbuf *) 0;
+	if ( ap->flags & F_PING )
+	    arp_ping_wake ();
 
-	return 1;
+	if ( ap->flags & F_PENDING ) {
+	    /*
+	    printf ("Pending ARP for %s satisfied\n", ip2str32 ( ap->ip_addr ) );
+	    */
+	    ap->flags &= ~F_PENDING;
+
+	    for ( nbp = ap->outq; nbp; nbp = xbp ) {
+		memcpy ( nbp->eptr->dst, ap->ether, ETH_ADDR_SIZE );
+		xbp = nbp->next;
+		net_send ( nbp );
+		/*
+		printf ("Pending packet sent\n");
+		*/
+	    }
+	    ap->outq = ap->outq_tail = (struct netbuf *) 0;
+	    ap->qlen = 0;
+	}
+	ARP_UNLOCK;
+
+	return rv;
 }
 
 /* Public entry point for illicit arp caching.
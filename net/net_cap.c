@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * net_cap.c
+ * Packet capture, for when Wireshark isn't watching.
+ *
+ * capture_last() in the emac driver keeps two frames, and that is
+ * not much help with a problem that shows up once a day.  Here we
+ * keep a ring of frames going in and out of the ethernet, already
+ * in pcap format, so you can pull it off a running system with
+ * "tftp -m binary kyu -c get capture" and hand it to Wireshark.
+ *
+ * The ring holds pcap records (16 byte header, then the frame)
+ * back to back and never splits one across the end.  When we need
+ * room we toss the oldest.  Only the first "snaplen" bytes of a
+ * frame get saved, which is all you need to see what is going on.
+ * There are simple filters (protocol, port and host) so the ring
+ * can hold a lot of just the traffic you care about.
+ *
+ * Time stamps come from the CCNT cycle counter.  It wraps every
+ * few seconds (and the timing code likes to reset it), so we keep
+ * an eye on the tick count too and believe that when they disagree.
+ * There is no time of day, so the capture starts at 1970 plus uptime,
+ * Wireshark doesn't care.
+ *
+ * When capture is off, all it costs is a test of capture_on where
+ * frames go in (net_ether) and out (net_send).  When it is on we do
+ * one memcpy of snaplen bytes with interrupts off.  Frames we send
+ * are saved before the driver sees them, so with checksum offload
+ * they have zero checksums, just like tcpdump on linux.
+ * Nothing on lo gets captured.
+ *
+ * A tftp fetch freezes the ring until the transfer is done.
+ *
+ * agent  10-19-2026
+ */
+
+#include <arch/types.h>
+#include <kyu.h>
+#include <kyulib.h>
+
+#include "net.h"
+#include "netbuf.h"
+#include "arch/cpu.h"
+
+/* Start capturing everything as soon as the network is up */
+// #define CAPTURE_AT_BOOT
+
+#define CAP_RING_SIZE	(128*1024)
+#define CAP_SNAP_DEF	128
+
+/* pcap file format */
+#define PCAP_MAGIC	0xa1b2c3d4
+#define PCAP_ETHERNET	1
+
+struct pcap_hdr {
+	u32 magic;
+	unsigned short major;
+	unsigned short minor;
+	int zone;
+	u32 sigfigs;
+	u32 snaplen;
+	u32 linktype;
+};
+
+struct pcap_rec {
+	u32 sec;
+	u32 usec;
+	u32 incl_len;
+	u32 orig_len;
+};
+
+#define CAP_HLEN	sizeof(struct pcap_rec)
+
+int capture_on;
+
+static char cap_ring[CAP_RING_SIZE];
+static int cap_head;		/* where the next record goes */
+static int cap_tail;		/* the oldest record */
+static int cap_wrap;		/* end of the data, once head wraps */
+static int cap_wrapped;
+
+static int cap_snaplen = CAP_SNAP_DEF;
+static int cap_busy;		/* tftp is reading the ring */
+
+static struct pcap_hdr cap_file_hdr;
+
+/* filters, 0 means anything goes */
+static int cap_proto;
+static int cap_port;
+static u32 cap_host;
+
+static int cap_count;		/* in the ring right now */
+static int cap_saved;
+static int cap_tossed;		/* pushed out to make room */
+static int cap_missed;		/* came along while we were frozen */
+
+/* time stamp */
+static int cap_hz;
+static int cap_mhz;
+static unsigned int cap_ccnt;
+static int cap_tick;
+static u32 cap_sec;
+static u32 cap_usec;
+
+static int capture_export ( void *, struct tftp_seg * );
+
+void
+capture_init ( void )
+{
+	cap_hz = timer_rate_get ();
+	cap_mhz = board_get_cpu_mhz ();
+	if ( cap_mhz < 1 )
+	    cap_mhz = 1;
+
+	cap_file_hdr.magic = PCAP_MAGIC;
+	cap_file_hdr.major = 2;
+	cap_file_hdr.minor = 4;
+	cap_file_hdr.linktype = PCAP_ETHERNET;
+
+#ifdef WANT_TFTPD
+	tftpd_export_fn ( "capture", capture_export, (void *) 0 );
+#endif
+
+#ifdef CAPTURE_AT_BOOT
+	capture_start ( 0 );
+#endif
+}
+
+/* Forget everything in the ring and start over.
+ * A snaplen of 0 means the default.
+ */
+void
+capture_start ( int snaplen )
+{
+	if ( snaplen <= 0 )
+	    snaplen = CAP_SNAP_DEF;
+	if ( snaplen > ETH_MAX_SIZE )
+	    snaplen = ETH_MAX_SIZE;
+
+	INT_lock;
+	cap_snaplen = snaplen;
+	cap_file_hdr.snaplen = snaplen;
+	cap_head = cap_tail = 0;
+	cap_wrapped = 0;
+	cap_count = 0;
+	cap_saved = cap_tossed = cap_missed = 0;
+
+	cap_tick = get_timer_count_t ();
+	cap_ccnt = r_CCNT ();
+	cap_sec = cap_tick / cap_hz;
+	cap_usec = (cap_tick % cap_hz) * (1000000 / cap_hz);
+	capture_on = 1;
+	INT_unlock;
+}
+
+/* The ring stays there to be fetched */
+void
+capture_stop ( void )
+{
+	capture_on = 0;
+}
+
+/* proto is IPPROTO_xxx, or ETH_ARP for arp.
+ * The port can be either end of a UDP or TCP packet,
+ * likewise the host (network byte order) is either end.
+ */
+void
+capture_filter ( int proto, int port, u32 host )
+{
+	INT_lock;
+	cap_proto = proto;
+	cap_port = port;
+	cap_host = host;
+	INT_unlock;
+}
+
+/* Called with interrupts off */
+static void
+cap_stamp ( struct pcap_rec *rp )
+{
+	unsigned int now = r_CCNT ();
+	int tick = get_timer_count_t ();
+	unsigned int us;
+	int dt;
+
+	dt = tick - cap_tick;
+	us = (now - cap_ccnt) / cap_mhz;
+
+	/* A long quiet spell is too much for CCNT (and for
+	 * microseconds in an int), so go by the timer, whole
+	 * seconds and leftover ticks, as capture_init() does.
+	 * Otherwise CCNT, unless it wrapped or somebody reset it.
+	 */
+	if ( dt > 2 * cap_hz ) {
+	    cap_sec += dt / cap_hz;
+	    us = (dt % cap_hz) * (1000000 / cap_hz);
+	} else if ( us > (dt * 1000 / cap_hz + 2) * 1000 )
+	    us = dt * (1000000 / cap_hz);
+
+	cap_tick = tick;
+	cap_ccnt = now;
+
+	cap_usec += us;
+	while ( cap_usec >= 1000000 ) {
+	    cap_usec -= 1000000;
+	    cap_sec++;
+	}
+
+	rp->sec = cap_sec;
+	rp->usec = cap_usec;
+}
+
+static int
+cap_match ( struct netbuf *nbp )
+{
+	struct ip_hdr *ipp;
+	unsigned short *pp;
+
+	if ( nbp->eptr->type != ETH_IP_SWAP )
+	    return ! cap_host && ! cap_port && (! cap_proto || cap_proto == ETH_ARP) &&
+		nbp->eptr->type == ETH_ARP_SWAP;
+
+	if ( cap_proto == ETH_ARP )
+	    return 0;
+
+	ipp = (struct ip_hdr *) ((char *) nbp->eptr + sizeof(struct eth_hdr));
+	if ( cap_proto && ipp->proto != cap_proto )
+	    return 0;
+	if ( cap_host && ipp->src != cap_host && ipp->dst != cap_host )
+	    return 0;
+
+	if ( cap_port ) {
+	    if ( ipp->proto != IPPROTO_UDP && ipp->proto != IPPROTO_TCP )
+		return 0;
+	    /* Only the first fragment has the ports */
+	    if ( ipp->offset & htons ( IP_OFFMASK ) )
+		return 0;
+	    pp = (unsigned short *) ((char *) ipp + ipp->hl * 4);
+	    if ( ntohs ( pp[0] ) != cap_port && ntohs ( pp[1] ) != cap_port )
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+cap_reclen ( int off )
+{
+	struct pcap_rec rec;
+
+	memcpy ( (char *) &rec, &cap_ring[off], CAP_HLEN );
+	return CAP_HLEN + rec.incl_len;
+}
+
+/* Called with interrupts off.
+ * Once the tail goes around, head may need to wrap again.
+ */
+static void
+cap_make_room ( int n )
+{
+	for ( ;; ) {
+	    if ( ! cap_wrapped ) {
+		if ( cap_head + n <= CAP_RING_SIZE )
+		    return;
+		cap_wrap = cap_head;
+		cap_head = 0;
+		cap_wrapped = 1;
+	    }
+
+	    if ( cap_head + n <= cap_tail )
+		return;
+
+	    cap_tail += cap_reclen ( cap_tail );
+	    cap_count--;
+	    cap_tossed++;
+	    if ( cap_tail >= cap_wrap ) {
+		cap_tail = 0;
+		cap_wrapped = 0;
+	    }
+	}
+}
+
+/* From net_ether() and net_send(), only when capture_on is set.
+ * tx is 1 for frames we are sending.
+ */
+void
+capture_pkt ( struct netbuf *nbp, int tx )
+{
+	struct pcap_rec rec;
+	struct eth_hdr *ehp;
+	int len;
+
+	if ( nbp->ifp && (nbp->ifp->flags & NETIF_LOOP) )
+	    return;
+
+	INT_lock;
+	if ( cap_busy ) {
+	    cap_missed++;
+	    INT_unlock;
+	    return;
+	}
+
+	if ( (cap_proto || cap_port || cap_host) && ! cap_match ( nbp ) ) {
+	    INT_unlock;
+	    return;
+	}
+
+	len = nbp->elen;
+	if ( len > cap_snaplen )
+	    len = cap_snaplen;
+
+	cap_make_room ( CAP_HLEN + len );
+
+	cap_stamp ( &rec );
+	rec.incl_len = len;
+	rec.orig_len = nbp->elen;
+	memcpy ( &cap_ring[cap_head], (char *) &rec, CAP_HLEN );
+	memcpy ( &cap_ring[cap_head + CAP_HLEN], (char *) nbp->eptr, len );
+
+	/* The driver fills this in, later */
+	if ( tx && nbp->ifp ) {
+	    ehp = (struct eth_hdr *) &cap_ring[cap_head + CAP_HLEN];
+	    memcpy ( ehp->src, nbp->ifp->mac, ETH_ADDR_SIZE );
+	}
+
+	cap_head += CAP_HLEN + len;
+	cap_count++;
+	cap_saved++;
+	INT_unlock;
+}
+
+/* For tftpd, the file header and the ring in one or two pieces.
+ * Called again with seg null when the transfer is over.
+ */
+static int
+capture_export ( void *arg, struct tftp_seg *seg )
+{
+	int n = 1;
+
+	if ( ! seg ) {
+	    cap_busy = 0;
+	    return 0;
+	}
+
+	INT_lock;
+	cap_busy = 1;
+
+	seg[0].addr = (char *) &cap_file_hdr;
+	seg[0].len = sizeof(struct pcap_hdr);
+
+	if ( cap_wrapped ) {
+	    seg[n].addr = &cap_ring[cap_tail];
+	    seg[n].len = cap_wrap - cap_tail;
+	    n++;
+	    seg[n].addr = &cap_ring[0];
+	    seg[n].len = cap_head;
+	    n++;
+	} else if ( cap_head > cap_tail ) {
+	    seg[n].addr = &cap_ring[cap_tail];
+	    seg[n].len = cap_head - cap_tail;
+	    n++;
+	}
+	INT_unlock;
+
+	return n;
+}
+
+void
+capture_show ( void )
+{
+	if ( ! capture_on && ! cap_saved )
+	    return;
+
+	printf ( "Capture %s, snaplen %d:", capture_on ? "on" : "off", cap_snaplen );
+	if ( cap_proto )
+	    printf ( " proto %d", cap_proto );
+	if ( cap_port )
+	    printf ( " port %d", cap_port );
+	if ( cap_host )
+	    printf ( " host %s", ip2str32 ( cap_host ) );
+	printf ( "\n" );
+	printf ( "  %d frames saved, %d in ring, %d pushed out, %d missed\n",
+	    cap_saved, cap_count, cap_tossed, cap_missed );
+}
+
+/* THE END */
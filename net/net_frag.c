@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * net_frag.c
+ * Put fragmented IP datagrams back together.
+ *
+ * We never copy the pieces into one big buffer (a netbuf holds
+ * one frame, and that is that).  Instead the netbufs get chained
+ * together through "frag", in order, and the first one goes up
+ * to the protocol as the datagram.  Each netbuf in the chain has
+ * its piece of the IP payload at pptr, flen bytes of it.
+ * Only UDP knows how to deal with a chain (see udp_cksum_ok()
+ * and netbuf_copy_data()), ip_check() drops anything else.
+ *
+ * Datagrams being put together are found by hashing
+ * (src, dst, id, proto), and they also sit on a list,
+ * oldest first.  Anything we can't finish in IPQ_TIMEOUT
+ * seconds gets tossed, as does the oldest whenever we are
+ * holding more than IPQ_MEM_MAX bytes of netbufs, or we run
+ * out of slots.  Fragments that overlap are an attack or
+ * a broken sender, so they cost the whole datagram.
+ *
+ * The net thread does all the work here, but the timer runs in
+ * the net-timer thread, so everything happens with interrupts off.
+ * That is why we use netbuf_free_i() throughout.
+ *
+ * agent  10-19-2026
+ */
+
+#include <arch/types.h>
+#include <kyu.h>
+#include <kyulib.h>
+
+#include "net.h"
+#include "netbuf.h"
+#include "arch/cpu.h"
+
+#define IPQ_SIZE	32		/* datagrams at once */
+#define IPQ_HASH_SIZE	16		/* must be a power of 2 */
+#define IPQ_TIMEOUT	30		/* seconds */
+#define IPQ_MEM_MAX	(128*1024)	/* bytes of netbuf data areas */
+
+struct ipq {
+	struct ipq *hnext;
+	struct ipq *lnext;	/* age list */
+	struct ipq *lprev;
+	u32 src;
+	u32 dst;
+	unsigned short id;
+	unsigned char proto;
+	struct netbuf *frags;	/* sorted by offset */
+	int total;		/* payload size, -1 until we see the end */
+	int have;		/* payload bytes so far */
+	int mem;
+	int expire;
+};
+
+static struct ipq ipq_pool[IPQ_SIZE];
+static struct ipq *ipq_hash[IPQ_HASH_SIZE];
+static struct ipq *ipq_free;
+
+/* Circular, lnext of this is the oldest */
+static struct ipq ipq_age;
+
+static int ipq_mem;
+static int ipq_count;
+
+/* seconds, counted by ip_frag_tick() */
+static int ipq_now;
+
+static struct ipq_stats {
+	int frags;
+	int done;
+	int timeout;
+	int evicted;
+	int overlap;
+	int bad;
+} ipq_stats;
+
+#define IPQ_HASH(src,id)	((((src) >> 24) ^ (id)) & (IPQ_HASH_SIZE-1))
+
+void
+ip_frag_init ( void )
+{
+	int i;
+
+	ipq_free = (struct ipq *) 0;
+	for ( i=IPQ_SIZE-1; i >= 0; i-- ) {
+	    ipq_pool[i].hnext = ipq_free;
+	    ipq_free = &ipq_pool[i];
+	}
+	for ( i=0; i<IPQ_HASH_SIZE; i++ )
+	    ipq_hash[i] = (struct ipq *) 0;
+
+	ipq_age.lnext = ipq_age.lprev = &ipq_age;
+	ipq_mem = 0;
+	ipq_count = 0;
+	ipq_now = 0;
+}
+
+/* Where the fragment starts in the payload, in bytes */
+static int
+ipq_offset ( struct netbuf *nbp )
+{
+	return (ntohs ( nbp->iptr->offset ) & IP_OFFMASK) * 8;
+}
+
+/* Toss a datagram and everything it holds.
+ * Called with interrupts off.
+ */
+static void
+ipq_kill ( struct ipq *qp )
+{
+	struct ipq **pp;
+	struct netbuf *nbp;
+
+	for ( pp = &ipq_hash[IPQ_HASH(qp->src,qp->id)]; *pp; pp = &(*pp)->hnext ) {
+	    if ( *pp == qp ) {
+		*pp = qp->hnext;
+		break;
+	    }
+	}
+
+	qp->lprev->lnext = qp->lnext;
+	qp->lnext->lprev = qp->lprev;
+
+	while ( qp->frags ) {
+	    nbp = qp->frags;
+	    qp->frags = nbp->frag;
+	    nbp->frag = (struct netbuf *) 0;
+	    netbuf_free_i ( nbp );
+	}
+
+	ipq_mem -= qp->mem;
+	ipq_count--;
+
+	qp->hnext = ipq_free;
+	ipq_free = qp;
+}
+
+static struct ipq *
+ipq_lookup ( struct ip_hdr *ipp )
+{
+	struct ipq *qp;
+
+	for ( qp = ipq_hash[IPQ_HASH(ipp->src,ipp->id)]; qp; qp = qp->hnext ) {
+	    if ( qp->id == ipp->id && qp->src == ipp->src &&
+		    qp->dst == ipp->dst && qp->proto == ipp->proto )
+		return qp;
+	}
+	return (struct ipq *) 0;
+}
+
+static struct ipq *
+ipq_new ( struct ip_hdr *ipp )
+{
+	struct ipq *qp;
+	int h;
+
+	if ( ! ipq_free ) {
+	    ipq_stats.evicted++;
+	    ipq_kill ( ipq_age.lnext );
+	}
+
+	qp = ipq_free;
+	ipq_free = qp->hnext;
+
+	qp->src = ipp->src;
+	qp->dst = ipp->dst;
+	qp->id = ipp->id;
+	qp->proto = ipp->proto;
+	qp->frags = (struct netbuf *) 0;
+	qp->total = -1;
+	qp->have = 0;
+	qp->mem = 0;
+	qp->expire = ipq_now + IPQ_TIMEOUT;
+
+	h = IPQ_HASH(qp->src,qp->id);
+	qp->hnext = ipq_hash[h];
+	ipq_hash[h] = qp;
+
+	/* newest goes at the end */
+	qp->lnext = &ipq_age;
+	qp->lprev = ipq_age.lprev;
+	ipq_age.lprev->lnext = qp;
+	ipq_age.lprev = qp;
+
+	ipq_count++;
+	return qp;
+}
+
+/* Fragment in, whole datagram (maybe) out.
+ * Returns the first netbuf of the chain once we have it all,
+ * otherwise we keep (or free) the netbuf and return 0.
+ * Each fragment can have its own header length (options get
+ * copied into only some of them), ip_check() has vetted it.
+ */
+struct netbuf *
+ip_reass ( struct netbuf *nbp )
+{
+	struct ip_hdr *ipp = nbp->iptr;
+	struct ipq *qp;
+	struct netbuf **pp;
+	struct netbuf *xbp;
+	int off, len, more;
+	int hlen;
+	int xoff;
+
+	ipq_stats.frags++;
+	NET_STAT ( NS_FRAG_IN );
+
+	/* Don't trust ilen, short frames get padded */
+	hlen = ipp->hl * 4;
+	off = ipq_offset ( nbp );
+	len = ntohs ( ipp->len ) - hlen;
+	more = ipp->offset & htons ( IP_MF );
+
+	/* The whole thing, header and all, must fit in ip_len */
+	if ( len <= 0 || len > nbp->ilen - hlen || hlen + off + len > 65535 ||
+		(more && (len & 7)) ) {
+	    ipq_stats.bad++;
+	    net_drop ( NET_DROP_FRAG );
+	    netbuf_free ( nbp );
+	    return (struct netbuf *) 0;
+	}
+
+	nbp->pptr = (char *) ipp + hlen;
+	nbp->flen = len;
+	nbp->next = (struct netbuf *) 0;
+	nbp->frag = (struct netbuf *) 0;
+
+	/* The hardware might have checked the IP header,
+	 * it cannot have checked the UDP checksum.
+	 */
+	nbp->flags &= ~NB_CSUM_OK;
+
+	INT_lock;
+
+	qp = ipq_lookup ( ipp );
+	if ( ! qp )
+	    qp = ipq_new ( ipp );
+
+	/* Find our place, and check the neighbors for overlap */
+	for ( pp = &qp->frags; *pp; pp = &(*pp)->frag ) {
+	    xoff = ipq_offset ( *pp );
+	    if ( xoff >= off )
+		break;
+	    if ( xoff + (*pp)->flen > off )
+		goto overlap;
+	}
+
+	if ( *pp ) {
+	    xbp = *pp;
+	    xoff = ipq_offset ( xbp );
+	    if ( xoff == off && xbp->flen == len ) {
+		/* a plain duplicate, we already have it */
+		INT_unlock;
+		netbuf_free ( nbp );
+		return (struct netbuf *) 0;
+	    }
+	    if ( off + len > xoff )
+		goto overlap;
+	}
+
+	if ( ! more ) {
+	    if ( qp->total >= 0 || (*pp) )
+		goto overlap;
+	    qp->total = off + len;
+	} else if ( qp->total >= 0 && off + len >= qp->total )
+	    goto overlap;
+
+	nbp->frag = *pp;
+	*pp = nbp;
+	qp->have += len;
+	qp->mem += nbp->size;
+	ipq_mem += nbp->size;
+
+	if ( qp->have == qp->total ) {
+	    /* All here, pull it off the queue.
+	     * ipq_kill() would free the pieces, so take them first.
+	     */
+	    xbp = qp->frags;
+	    len = qp->total;
+	    qp->frags = (struct netbuf *) 0;
+	    ipq_kill ( qp );
+	    ipq_stats.done++;
+	    INT_unlock;
+
+	    /* The first fragment speaks for the whole datagram,
+	     * its header (options and all) becomes the header.
+	     */
+	    ipp = xbp->iptr;
+	    hlen = ipp->hl * 4;
+
+	    /* Checked above with each fragment's own header,
+	     * but the first one may carry longer options.
+	     */
+	    if ( len + hlen > 65535 ) {
+		ipq_stats.bad++;
+		net_drop ( NET_DROP_FRAG );
+		netbuf_free ( xbp );
+		return (struct netbuf *) 0;
+	    }
+
+	    ipp->len = htons ( len + hlen );
+	    ipp->offset = 0;
+	    ipp->sum = 0;
+	    ipp->sum = in_cksum ( (char *) ipp, hlen );
+	    xbp->ilen = len + hlen;
+	    xbp->plen = len;
+	    return xbp;
+	}
+
+	/* Stay under the memory limit, oldest goes first.
+	 * That can be this one, if it is the only one.
+	 */
+	while ( ipq_mem > IPQ_MEM_MAX ) {
+	    ipq_stats.evicted++;
+	    ipq_kill ( ipq_age.lnext );
+	}
+
+	INT_unlock;
+	return (struct netbuf *) 0;
+
+overlap:
+	ipq_stats.overlap++;
+	ipq_kill ( qp );
+	INT_unlock;
+	net_drop ( NET_DROP_FRAG );
+	netbuf_free ( nbp );
+	return (struct netbuf *) 0;
+}
+
+/* Once a second, from the net-timer thread.
+ * The age list is also in order of expiration.
+ */
+void
+ip_frag_tick ( void )
+{
+	struct ipq *qp;
+
+	INT_lock;
+	ipq_now++;
+	for ( ;; ) {
+	    qp = ipq_age.lnext;
+	    if ( qp == &ipq_age || qp->expire > ipq_now )
+		break;
+	    ipq_stats.timeout++;
+	    ipq_kill ( qp );
+	}
+	INT_unlock;
+}
+
+void
+ip_frag_show ( void )
+{
+	printf ( "IP fragments: %d received, %d datagrams reassembled\n",
+	    ipq_stats.frags, ipq_stats.done );
+	printf ( "  %d timed out, %d evicted, %d overlapped, %d bad\n",
+	    ipq_stats.timeout, ipq_stats.evicted, ipq_stats.overlap, ipq_stats.bad );
+	printf ( "  %d in progress holding %d bytes (limit %d)\n",
+	    ipq_count, ipq_mem, IPQ_MEM_MAX );
+}
+
+/* THE END */
@@ -40,6 +40,9 @@ static void icmp_reply ( struct netbuf *, int );
 static void
 icmp_arp_evil ( struct netbuf *nbp )
 {
+	/* Nothing from lo has an ethernet header */
+	if ( nbp->ifp && (nbp->ifp->flags & NETIF_LOOP) )
+	    return;
     	// arp_save_icmp ( nbp->eptr->src, (unsigned char *) &nbp->iptr->src );
     	arp_save_icmp ( nbp->eptr->src, nbp->iptr->src );
 }
@@ -97,17 +100,20 @@ icmp_rcv ( struct netbuf *nbp )
 	}
 }
 
-/* Funky short cut, modify the packet and return it
+/* Funky short cut, modify the packet and return it.
+ * Only the type changes, so we patch the checksum
+ * rather than summing the whole thing again.
  */
 static void
 icmp_reply ( struct netbuf *nbp, int len )
 {
 	struct icmp_hdr *icp;
+	unsigned short old;
 
 	icp = (struct icmp_hdr *) nbp->pptr;
+	old = * (unsigned short *) icp;
 	icp->type = TY_ECHO_REPLY;
-	icp->sum = 0;
-	icp->sum = in_cksum ( (char *) icp, len );
+	csum_replace2 ( &icp->sum, old, * (unsigned short *) icp );
 	ip_reply ( nbp );
 }
 
@@ -122,8 +128,12 @@ icmp_ping ( u32 target_ip )
 	struct icmp_hdr *icp;
 	int size;
 
+	/* load with junk */
+	size = 56;
+
 	/* get a netbuf for this */
-	if ( ! (nbp = netbuf_alloc ()) )
+	nbp = netbuf_alloc_user ( NB_USER_SHELL, sizeof(struct eth_hdr) + sizeof(struct ip_hdr) + sizeof(struct icmp_hdr) + size );
+	if ( ! nbp )
 	    return;
 
 	nbp->pptr = (char *) nbp->iptr + sizeof ( struct ip_hdr );
@@ -131,8 +141,6 @@ icmp_ping ( u32 target_ip )
 
 	nbp->iptr->proto = IPPROTO_ICMP;
 
-	/* load with junk */
-	size = 56;
 	memset ( nbp->dptr, 0xab, size );
 
 	size += sizeof(struct icmp_hdr);
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * net_if.c
+ * Network interfaces and the routing table.
+ *
+ * For years Kyu had one interface, and host_info was all
+ * there was to know about it.  Now a node can be on more than
+ * one network (say the instruments on one and control on the
+ * other), so we keep a table of interfaces and a table of routes.
+ *
+ * The board network driver is always "eth0", and host_info is
+ * still its address (TCP and DHCP know all about host_info).
+ * Another driver can call netif_add() with its own output
+ * function, set nbp->ifp on what it receives and hand it to
+ * net_rcv() as usual.  A packet with no ifp came in on eth0.
+ * So far no board has a second network device, so nothing
+ * does that and eth0 and lo are the only interfaces there are.
+ * A second interface has only ever been tried on paper.
+ *
+ * There is also "lo", the loopback interface.  It has 127/8,
+ * and every address we give another interface gets a host
+ * route to lo as well, so talking to ourselves never goes
+ * near a wire (or ARP).  See net_loop_output() in net_main.c.
+ *
+ * Routes are a sorted array, longest prefix first, so the first
+ * match is the one we want.  Nobody has more than a handful of
+ * routes, and a scan of a small array is hard to beat.
+ * On top of that we remember the last lookup, since most
+ * traffic goes to the same place as the packet before it.
+ * Lookups and changes both happen with interrupts off.
+ *
+ * agent  10-19-2026
+ */
+
+#include <arch/types.h>
+#include <kyu.h>
+#include <kyulib.h>
+
+#include "net.h"
+#include "netbuf.h"
+#include "arch/cpu.h"
+
+extern struct host_info host_info;
+
+#define NETIF_MAX	4
+#define ROUTE_MAX	32
+
+static struct netif netif_table[NETIF_MAX];
+static int netif_count;
+
+struct netif *netif_primary;
+struct netif *netif_loop;
+
+struct route {
+	u32 dest;		/* all in network byte order */
+	u32 mask;
+	u32 gw;			/* zero for a directly connected net */
+	struct netif *ifp;
+	int plen;		/* prefix length, for sorting */
+	int use;
+};
+
+static struct route route_table[ROUTE_MAX];
+static int route_count;
+
+/* last lookup */
+static u32 route_last_dst;
+static struct route *route_last;
+
+static int route_hits;
+static int route_lookups;
+static int route_misses;
+
+/* ------------------------------------------------- */
+/* Interfaces */
+
+struct netif *
+netif_add ( char *name, nofptr output, unsigned char *mac )
+{
+	struct netif *ifp;
+
+	if ( netif_count >= NETIF_MAX ) {
+	    printf ( "netif: no room for %s\n", name );
+	    return (struct netif *) 0;
+	}
+
+	ifp = &netif_table[netif_count];
+	memset ( (char *) ifp, 0, sizeof(struct netif) );
+	strncpy ( ifp->name, name, NETIF_NAME-1 );
+	ifp->index = netif_count;
+	ifp->output = output;
+	if ( mac )
+	    memcpy ( ifp->mac, (char *) mac, ETH_ADDR_SIZE );
+	ifp->flags = NETIF_UP;
+
+	netif_count++;
+	if ( ! netif_primary )
+	    netif_primary = ifp;
+	return ifp;
+}
+
+/* Give an interface its address, this also
+ * adds the route to the network it is on,
+ * and the route for the address itself via lo.
+ */
+void
+netif_addr ( struct netif *ifp, u32 ip, u32 mask )
+{
+	int host = netif_loop && ifp != netif_loop;
+
+	if ( ifp->ip ) {
+	    (void) route_del ( ifp->ip & ifp->mask, ifp->mask );
+	    if ( host )
+		(void) route_del ( ifp->ip, IP_BROADCAST );
+	}
+
+	ifp->ip = ip;
+	ifp->mask = mask;
+	if ( ip ) {
+	    (void) route_add ( ip & mask, mask, 0, ifp );
+	    if ( host )
+		(void) route_add ( ip, IP_BROADCAST, 0, netif_loop );
+	}
+}
+
+/* For walking the table, returns 0 past the end */
+struct netif *
+netif_get ( int index )
+{
+	if ( index < 0 || index >= netif_count )
+	    return (struct netif *) 0;
+	return &netif_table[index];
+}
+
+struct netif *
+netif_find ( char *name )
+{
+	int i;
+
+	for ( i=0; i<netif_count; i++ )
+	    if ( strcmp ( name, netif_table[i].name ) == 0 )
+		return &netif_table[i];
+	return (struct netif *) 0;
+}
+
+/* Is this one of our addresses ? */
+struct netif *
+netif_find_ip ( u32 ip )
+{
+	int i;
+
+	for ( i=0; i<netif_count; i++ )
+	    if ( netif_table[i].ip == ip )
+		return &netif_table[i];
+	return (struct netif *) 0;
+}
+
+void
+netif_show ( void )
+{
+	struct netif *ifp;
+	int i;
+
+	for ( i=0; i<netif_count; i++ ) {
+	    ifp = &netif_table[i];
+	    printf ( "%s: %s", ifp->name, ip2str32 ( ifp->ip ) );
+	    printf ( "/%d %s%s%s\n", route_plen ( ifp->mask ),
+		ifp->flags & NETIF_LOOP ? "loopback" : ether2str ( ifp->mac ),
+		ifp->flags & NETIF_CSUM_TX ? " (tx csum)" : "",
+		ifp->flags & NETIF_UP ? "" : " (down)" );
+	    printf ( "  Rx %d packets, %d bytes, %d dropped\n",
+		ifp->rx_packets, ifp->rx_bytes, ifp->rx_drops );
+	    printf ( "  Tx %d packets, %d bytes, %d dropped\n",
+		ifp->tx_packets, ifp->tx_bytes, ifp->tx_drops );
+	}
+}
+
+/* ------------------------------------------------- */
+/* Routes */
+
+int
+route_plen ( u32 mask )
+{
+	u32 m = ntohl ( mask );
+	int n = 0;
+
+	while ( m & 0x80000000 ) {
+	    n++;
+	    m <<= 1;
+	}
+	return n;
+}
+
+/* Returns 0 if the table is full */
+int
+route_add ( u32 dest, u32 mask, u32 gw, struct netif *ifp )
+{
+	struct route *rp;
+	int plen = route_plen ( mask );
+	int i;
+
+	dest &= mask;
+
+	INT_lock;
+
+	/* Replace one we already have */
+	for ( i=0; i<route_count; i++ ) {
+	    rp = &route_table[i];
+	    if ( rp->dest == dest && rp->mask == mask ) {
+		rp->gw = gw;
+		rp->ifp = ifp;
+		route_last = (struct route *) 0;
+		INT_unlock;
+		return 1;
+	    }
+	}
+
+	if ( route_count >= ROUTE_MAX ) {
+	    INT_unlock;
+	    return 0;
+	}
+
+	/* Keep longest prefix first */
+	for ( i=route_count; i > 0 && route_table[i-1].plen < plen; i-- )
+	    route_table[i] = route_table[i-1];
+
+	rp = &route_table[i];
+	rp->dest = dest;
+	rp->mask = mask;
+	rp->gw = gw;
+	rp->ifp = ifp;
+	rp->plen = plen;
+	rp->use = 0;
+	route_count++;
+
+	route_last = (struct route *) 0;
+	INT_unlock;
+	return 1;
+}
+
+/* Returns 0 if there was no such route */
+int
+route_del ( u32 dest, u32 mask )
+{
+	int i;
+
+	dest &= mask;
+
+	INT_lock;
+	for ( i=0; i<route_count; i++ )
+	    if ( route_table[i].dest == dest && route_table[i].mask == mask )
+		break;
+
+	if ( i == route_count ) {
+	    INT_unlock;
+	    return 0;
+	}
+
+	route_count--;
+	for ( ; i<route_count; i++ )
+	    route_table[i] = route_table[i+1];
+
+	route_last = (struct route *) 0;
+	INT_unlock;
+	return 1;
+}
+
+/* Which interface, and who on that net gets the packet.
+ * nexthop may be null if you don't care.
+ * Returns 0 if we have no route at all.
+ */
+struct netif *
+route_lookup ( u32 dst, u32 *nexthop )
+{
+	struct route *rp;
+	struct netif *ifp;
+	int i;
+
+	INT_lock;
+	route_lookups++;
+
+	rp = route_last;
+	if ( rp && route_last_dst == dst )
+	    route_hits++;
+	else {
+	    rp = (struct route *) 0;
+	    for ( i=0; i<route_count; i++ ) {
+		if ( (dst & route_table[i].mask) == route_table[i].dest ) {
+		    rp = &route_table[i];
+		    break;
+		}
+	    }
+	    if ( ! rp ) {
+		route_misses++;
+		INT_unlock;
+		return (struct netif *) 0;
+	    }
+	    route_last = rp;
+	    route_last_dst = dst;
+	}
+
+	rp->use++;
+	ifp = rp->ifp;
+	if ( nexthop )
+	    *nexthop = rp->gw ? rp->gw : dst;
+	INT_unlock;
+
+	return ifp;
+}
+
+/* The source address for a packet to dst */
+u32
+ip_source ( u32 dst )
+{
+	struct netif *ifp;
+
+	if ( dst == IP_BROADCAST )
+	    return host_info.my_ip;
+
+	ifp = route_lookup ( dst, (u32 *) 0 );
+	if ( ! ifp )
+	    return host_info.my_ip;
+
+	/* Talking to ourself, we are both ends */
+	if ( ifp->flags & NETIF_LOOP )
+	    return dst;
+	return ifp->ip;
+}
+
+/* Will somebody else take care of the checksums
+ * for a packet to dst ?  Either the hardware of the interface
+ * it goes out on does it, or it goes to lo and nobody
+ * needs them at all.  Broadcast goes out eth0.
+ */
+int
+ip_csum_tx ( u32 dst )
+{
+	struct netif *ifp;
+
+	if ( dst == IP_BROADCAST )
+	    ifp = netif_primary;
+	else
+	    ifp = route_lookup ( dst, (u32 *) 0 );
+
+	return ifp && (ifp->flags & (NETIF_LOOP | NETIF_CSUM_TX));
+}
+
+void
+route_show ( void )
+{
+	struct route *rp;
+	int i;
+
+	printf ( "Routes: %d lookups, %d from cache, %d with no route\n",
+	    route_lookups, route_hits, route_misses );
+
+	for ( i=0; i<route_count; i++ ) {
+	    rp = &route_table[i];
+	    printf ( "  %s/%d", ip2str32 ( rp->dest ), rp->plen );
+	    if ( rp->gw )
+		printf ( " via %s", ip2str32 ( rp->gw ) );
+	    printf ( " dev %s, used %d\n", rp->ifp->name, rp->use );
+	}
+}
+
+/* THE END */
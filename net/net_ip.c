@@ -21,8 +21,6 @@
 
 extern struct host_info host_info;
 
-extern u32 loopback_ip;
-
 static int ip_debug = 0;
 
 void
@@ -42,20 +40,63 @@ proto_name ( int proto )
 	    return "udp";
 	if ( proto == IPPROTO_TCP )
 	    return "tcp";
+	if ( proto == IPPROTO_IGMP )
+	    return "igmp";
 	sprintf ( buf, "%d", proto );
 	return buf;
 }
 
-/* Called for every packet with our mac address and with ether type IP
- */
+static void ip_deliver ( struct netbuf * );
+static void ip_output ( struct netbuf *, u32, int, int );
+struct netbuf * ip_reass ( struct netbuf * );
+
+/* Count a packet in or out by protocol */
 void
-ip_rcv ( struct netbuf *nbp )
+ip_stat ( struct ip_hdr *ipp, int out )
+{
+	int x;
+
+	if ( ipp->proto == IPPROTO_ICMP )
+	    x = NS_ICMP_IN;
+	else if ( ipp->proto == IPPROTO_UDP )
+	    x = NS_UDP_IN;
+	else if ( ipp->proto == IPPROTO_TCP )
+	    x = NS_TCP_IN;
+	else
+	    return;
+
+	/* out follows in */
+	NET_STAT ( x + out );
+}
+
+/* Sanity checks on an arriving IP packet.
+ * Returns 0 if we dropped it (and freed the netbuf),
+ * or if it was a fragment and we are holding onto it.
+ * Once the last fragment arrives we hand back the
+ * whole datagram, which is not the netbuf we were given.
+ */
+static struct netbuf *
+ip_check ( struct netbuf *nbp )
 {
 	struct ip_hdr *ipp;
 	int cksum;
+	int hlen;
 
 	ipp = nbp->iptr;
-	cksum = in_cksum ( nbp->iptr, sizeof(struct ip_hdr) );
+	NET_STAT ( NS_IP_IN );
+
+	/* IGMP comes with options, most everything else doesn't */
+	hlen = ipp->hl * 4;
+	if ( hlen < sizeof(struct ip_hdr) || hlen > nbp->ilen ) {
+	    net_drop ( NET_DROP_CKSUM );
+	    netbuf_free ( nbp );
+	    return (struct netbuf *) 0;
+	}
+
+	if ( nbp->flags & NB_CSUM_OK )
+	    cksum = 0;
+	else
+	    cksum = in_cksum ( nbp->iptr, hlen );
 
 	if ( ip_debug ) {
 	    printf ( "ip_rcv - packet from %s (%d) proto = %s, sum= %04x\n",
@@ -70,24 +111,44 @@ ip_rcv ( struct netbuf *nbp )
 	// ipp = nbp->iptr;
 
 	if ( cksum ) {
-	    printf ( "bad IP packet from %s (%d) proto = %d, sum= %04x\n",
+	    if ( ip_debug )
+		printf ( "bad IP packet from %s (%d) proto = %d, sum= %04x\n",
 		    ip2str32 ( ipp->src ), nbp->ilen, ipp->proto, cksum );
+	    net_drop ( NET_DROP_CKSUM );
 	    netbuf_free ( nbp );
-	    return;
+	    return (struct netbuf *) 0;
 	}
 
-	/* We aren't handling fragmented IP packets.
-	 * I feel sort of guilty, but we skipped this "for now"
+	/* The hardware filter goes by MAC address, and
+	 * 32 groups share each one of those.
 	 */
-	if ( ipp->offset & IP_OFFMASK_SWAP ) {
-	    printf ( "Fragmented (%04x) IP packet from %s (%d) proto = %d, sum= %04x\n",
-		    ipp->offset, ip2str32 ( ipp->src ), nbp->ilen, ipp->proto, cksum );
+	if ( IP_MULTICAST ( ipp->dst ) && ! ip_mcast_member ( ipp->dst ) ) {
+	    net_drop ( NET_DROP_MCAST );
 	    netbuf_free ( nbp );
-	    return;
+	    return (struct netbuf *) 0;
 	}
 
-	nbp->pptr = (char *) nbp->iptr + sizeof(struct ip_hdr);
-	nbp->plen = nbp->ilen - sizeof(struct ip_hdr);
+	/* The first fragment has offset zero,
+	 * but it does have "more fragments" set.
+	 */
+	if ( ipp->offset & htons ( IP_MF | IP_OFFMASK ) ) {
+	    nbp = ip_reass ( nbp );
+	    if ( ! nbp )
+		return nbp;
+
+	    /* Only UDP knows what to do with a chain */
+	    if ( nbp->iptr->proto != IPPROTO_UDP ) {
+		net_drop ( NET_DROP_FRAG );
+		netbuf_free ( nbp );
+		return (struct netbuf *) 0;
+	    }
+	    ip_stat ( nbp->iptr, 0 );
+	    return nbp;
+	}
+
+	nbp->pptr = (char *) nbp->iptr + hlen;
+	nbp->plen = nbp->ilen - hlen;
+	ip_stat ( ipp, 0 );
 
 // #define DEBUG_THIS
 
@@ -117,6 +178,61 @@ ip_rcv ( struct netbuf *nbp )
 	    printf ( "Proto: %d", ipp->proto );
 	printf ( "\n" );
 #endif
+	return nbp;
+}
+
+/* Called for every packet with our mac address and with ether type IP
+ */
+void
+ip_rcv ( struct netbuf *nbp )
+{
+	nbp = ip_check ( nbp );
+	if ( nbp )
+	    ip_deliver ( nbp );
+}
+
+/* Same as ip_rcv(), but for a list of packets linked through "next".
+ * TCP segments get collected and go to TCP as a single list,
+ * so the TCP code takes its lock and wakes its thread once
+ * for the whole bunch.
+ */
+void
+ip_rcv_list ( struct netbuf *list )
+{
+	struct netbuf *nbp;
+	struct netbuf *tcp_head = (struct netbuf *) 0;
+	struct netbuf *tcp_tail = (struct netbuf *) 0;
+
+	while ( list ) {
+	    nbp = list;
+	    list = nbp->next;
+	    nbp->next = (struct netbuf *) 0;
+
+	    nbp = ip_check ( nbp );
+	    if ( ! nbp )
+		continue;
+
+	    if ( nbp->iptr->proto == IPPROTO_TCP ) {
+		if ( tcp_tail )
+		    tcp_tail->next = nbp;
+		else
+		    tcp_head = nbp;
+		tcp_tail = nbp;
+		continue;
+	    }
+
+	    ip_deliver ( nbp );
+	}
+
+	if ( tcp_head )
+	    tcp_rcv_list ( tcp_head );
+}
+
+/* Hand a packet that passed ip_check() to the protocol */
+static void
+ip_deliver ( struct netbuf *nbp )
+{
+	struct ip_hdr *ipp = nbp->iptr;
 
 	/* XXX - should verify that it is addressed to us, or to a broadcast */
 
@@ -132,19 +248,23 @@ ip_rcv ( struct netbuf *nbp )
 	    // printf ( "Sizeof eth = %d\n", sizeof(struct eth_hdr) );
 	    // printf ( "Sizeof ip = %d\n", sizeof(struct ip_hdr) );
 	    tcp_rcv ( nbp );
+	} else if ( ipp->proto == IPPROTO_IGMP ) {
+	    igmp_rcv ( nbp );
 	} else {
-	    printf ( "IP from %s (size:%d) proto = %d, sum= %04x\n",
+	    if ( ip_debug )
+		printf ( "IP from %s (size:%d) proto = %d, sum= %04x\n",
 		    ip2str32 ( ipp->src ), nbp->plen, ipp->proto, ipp->sum );
+	    net_drop ( NET_DROP_PROTO );
 	    netbuf_free ( nbp );
 	}
 
 #ifdef DEBUG_IP
 	if ( ipp->proto == IPPROTO_ICMP ) {
-	    printf ( "ICMP packet, size = %d, sum= %04x %04x", nbp->plen, ipp->sum, cksum );
+	    printf ( "ICMP packet, size = %d, sum= %04x", nbp->plen, ipp->sum );
 	} else if ( ipp->proto == IPPROTO_UDP ) {
-	    printf ( "UDP packet, size = %d, sum= %04x %04x", nbp->plen, ipp->sum, cksum );
+	    printf ( "UDP packet, size = %d, sum= %04x", nbp->plen, ipp->sum );
 	} else if ( ipp->proto == IPPROTO_TCP ) {
-	    printf ( "TCP packet, size = %d, sum= %04x %04x", nbp->plen, ipp->sum, cksum );
+	    printf ( "TCP packet, size = %d, sum= %04x", nbp->plen, ipp->sum );
 	} else {
 	    printf ( "IP packet (size:%d) proto = %d, sum= %04x", nbp->plen, ipp->proto, ipp->sum );
 	}
@@ -180,6 +300,57 @@ static int ip_id = 1;
 
 void
 ip_send ( struct netbuf *nbp, u32 dest_ip )
+{
+	ip_output ( nbp, dest_ip, ip_id++, 0 );
+}
+
+/* Send a datagram too big for one frame, in pieces.
+ * The protocol header (hdr, hlen) leads off the first piece.
+ * It must already have its checksum, no one frame holds enough
+ * to figure it out, so checksum offload is no help here.
+ * Every fragment but the last carries a multiple of 8 bytes.
+ * If we can't get a netbuf we give up, a datagram with a
+ * piece missing is just going to time out at the other end.
+ */
+void
+ip_send_frag ( u32 dest_ip, int proto, char *hdr, int hlen, char *buf, int len )
+{
+	struct netbuf *nbp;
+	int total = hlen + len;
+	int max = (IP_MTU - sizeof(struct ip_hdr)) & ~7;
+	int id = ip_id++;
+	int off, n, h;
+
+	for ( off = 0; off < total; off += n ) {
+	    n = total - off;
+	    if ( n > max )
+		n = max;
+
+	    nbp = netbuf_alloc_size ( sizeof(struct eth_hdr) + sizeof(struct ip_hdr) + n );
+	    if ( ! nbp )
+		return;
+
+	    nbp->pptr = (char *) nbp->iptr + sizeof(struct ip_hdr);
+	    nbp->plen = n;
+
+	    h = 0;
+	    if ( off < hlen ) {
+		h = hlen - off;
+		if ( h > n )
+		    h = n;
+		memcpy ( nbp->pptr, hdr + off, h );
+	    }
+	    memcpy ( nbp->pptr + h, buf + off + h - hlen, n - h );
+
+	    nbp->iptr->proto = proto;
+	    NET_STAT ( NS_FRAG_OUT );
+	    ip_output ( nbp, dest_ip, id,
+		(off >> 3) | (off + n < total ? IP_MF : 0) );
+	}
+}
+
+static void
+ip_output ( struct netbuf *nbp, u32 dest_ip, int id, int offset )
 {
 	struct ip_hdr *ipp;
 
@@ -205,10 +376,14 @@ ip_send ( struct netbuf *nbp, u32 dest_ip )
 	// printf ( "***LEN: %04x %04x\n", ipp->len, nbp->ilen );
 	ipp->len = htons(nbp->ilen);
 
-	ipp->id = ip_id++;
-	ipp->offset = 0;
+	ipp->id = id;
+	ipp->offset = htons ( offset );
 
-	ipp->ttl = 64;
+	/* Multicast stays on this net unless asked */
+	if ( IP_MULTICAST ( dest_ip ) )
+	    ipp->ttl = ip_mcast_ttl;
+	else
+	    ipp->ttl = 64;
 
 	/* proto is already filled in by caller */
 	/* XXX - this may not work out well for TCP as
@@ -216,32 +391,19 @@ ip_send ( struct netbuf *nbp, u32 dest_ip )
 	 * As long as this matches what BSD set, OK.
 	 */
 
-	ipp->src = host_info.my_ip;
+	ipp->src = ip_source ( dest_ip );
 	ipp->dst = dest_ip;
 
 	ipp->sum = 0;
-	ipp->sum = in_cksum ( (char *) ipp, sizeof ( struct ip_hdr ) );
+	if ( ! (nbp->flags & NB_CSUM_TX) )
+	    ipp->sum = in_cksum ( (char *) ipp, sizeof ( struct ip_hdr ) );
 
 	if ( ip_debug ) {
 	    printf ( "IP ip_send - ready to go: ...\n" );
 	    dump_buf ( (char *) ipp, 20 );
 	}
 
-	if ( dest_ip == loopback_ip ) {
-	    // Must do this or our IP code will toss the packet
-	    memcpy ( nbp->eptr->dst, host_info.our_mac, ETH_ADDR_SIZE );
-	    // Must do this also
-	    nbp->eptr->type = ETH_IP_SWAP;
-	    // This too
-	    nbp->elen = nbp->ilen + sizeof(struct eth_hdr);
-
-	    printf ( "Sending IP packet to loopback\n" );
-	    printf ( " ilen = %d\n", nbp->ilen );
-	    net_rcv_noint ( nbp );
-	    return;
-	}
-
-	/* Send over the wire */
+	/* Over the wire, or to lo */
 	ip_arp_send ( nbp );
 }
 
@@ -33,7 +33,11 @@ u32 cholla_ip = 0x3464c480;	/* cholla: 128.196.100.52 */
 
 /* Some machine that will respond to ping and arp */
 /* Best if this is a linux machine that can run Wireshark */
+#ifdef BOARD_HOST
+u32 test_ip = 0x0A000501;	/* the linux end of the TAP: 10.0.5.1 */
+#else
 u32 test_ip = 0xC0A80005;	/* trona: 192.168.0.5 */
+#endif
 
 u32 loopback_ip;
 
@@ -43,11 +47,14 @@ static void slow_net ( long );
 // static void fast_net ( void );
 
 static void net_thread ( long );
+static void net_eth_output ( struct netif *, struct netbuf * );
+static void net_loop_output ( struct netif *, struct netbuf * );
+static void net_loop_rcv ( struct netbuf * );
 static void output_thread ( long );
 static void netbuf_init ( void );
 void netbuf_show ( void );
 void net_show ( void );
-static void net_handle ( struct netbuf * );
+static void net_handle_list ( struct netbuf * );
 void net_addr_get ( char * );
 void net_show_packet ( char *, struct netbuf * );
 
@@ -68,11 +75,38 @@ struct host_info host_info;
 
 /* queue of incoming packets
  */
+#define NET_INQ_MAX	256
+
 static struct sem *inq_sem;
 static struct netbuf *inq_head;
 static struct netbuf *inq_tail;
 static int inq_count;
 
+/* queue of packets we sent to ourself (see net_loop_output)
+ */
+#define NET_LOOPQ_MAX	256
+
+static struct netbuf *loopq_head;
+static struct netbuf *loopq_tail;
+static int loopq_count;
+
+/* receive polling (see net_poll_sched) */
+#define NET_POLL_BUDGET	16
+
+static npfptr net_poll_fn;
+static int net_poll_again;
+
+/* Something to free once the net thread is idle */
+static int net_tidy;
+static int net_poll_count;
+static int net_poll_frames;
+static int net_poll_full;
+static int net_poll_hist[NET_POLL_BUDGET+1];
+
+/* frames collected by net_rcv_poll(), only touched by the net thread */
+static struct netbuf *poll_head;
+static struct netbuf *poll_tail;
+
 /* queue of outgoint packets
  */
 static struct sem *outq_sem;
@@ -150,8 +184,6 @@ host_info_init ( void )
 	net_addr_get ( host_info.our_mac );
 	init_ephem_port ();
 
-	(void) net_dots ( "127.0.0.1", &loopback_ip );
-
 	/* Someday this will get overwritten by DHCP
 	 */
 
@@ -177,7 +209,13 @@ host_info_init ( void )
 	(void) net_dots ( "192.168.0.61", &host_info.my_ip );		/* orange_pi h3 */
 #endif
 
+#ifdef BOARD_HOST
+	/* Linux is at the other end of the TAP, see host/Readme.host */
+	(void) net_dots ( "10.0.5.2", &host_info.my_ip );
+	(void) net_dots ( "10.0.5.1", &host_info.gate_ip );
+#else
 	(void) net_dots ( "192.168.0.1", &host_info.gate_ip );
+#endif
 	host_info.net_mask = htonl ( 0xffffff00 );
 
 #ifdef notdef
@@ -208,6 +246,12 @@ host_info_init ( void )
 
 	host_info.my_net = host_info.my_ip & host_info.net_mask;
 
+	/* eth0 is what host_info describes */
+	memcpy ( netif_primary->mac, host_info.our_mac, ETH_ADDR_SIZE );
+	netif_addr ( netif_primary, host_info.my_ip, host_info.net_mask );
+	if ( host_info.gate_ip )
+	    (void) route_add ( 0, 0, host_info.gate_ip, netif_primary );
+
 	printf ( "My IP = %s, netmask = %08x\n", ip2str32(host_info.my_ip), ntohl(host_info.net_mask) );
 	printf ( "My network = %s\n", ip2str32(host_info.my_net) );
 	printf ( "My MAC address is: %s\n", ether2str(host_info.our_mac) );
@@ -239,10 +283,22 @@ net_init ( void )
     system_clock_rate = timer_rate_get();
 
     netbuf_init ();
+    (void) netif_add ( "eth0", net_eth_output, (unsigned char *) 0 );
+
+    /* lo must be there before anyone else gets an address */
+    (void) net_dots ( "127.0.0.1", &loopback_ip );
+    netif_loop = netif_add ( "lo", net_loop_output, (unsigned char *) 0 );
+    netif_loop->flags |= NETIF_LOOP;
+    netif_addr ( netif_loop, loopback_ip, htonl ( 0xff000000 ) );
+
     udp_init ();
     kyu_tcp_init ();
 
     arp_init ();
+    ip_frag_init ();
+    net_stats_init ();
+    capture_init ();
+    raw_init ();
     dns_init ();
 
     // bootp_init ();
@@ -252,6 +308,10 @@ net_init ( void )
     inq_tail = (struct netbuf *) 0;
     inq_count = 0;
 
+    loopq_head = (struct netbuf *) 0;
+    loopq_tail = (struct netbuf *) 0;
+    loopq_count = 0;
+
     outq_head = (struct netbuf *) 0;
     outq_tail = (struct netbuf *) 0;
     outq_count = 0;
@@ -347,9 +407,14 @@ The clock seems to be running just at the rate it should.
     }
 
     host_info_init ();
+    mcast_init ();
 
     arp_announce ();
 
+#ifdef WANT_TFTPD
+    tftpd_init ();
+#endif
+
     // net_show ();
 
     /*
@@ -365,7 +430,10 @@ static void
 slow_net ( long xxx )
 {
 	arp_tick ();
+	ip_frag_tick ();
+	igmp_tick ();
 	dns_tick ();
+	net_stats_tick ();
 }
 
 #ifdef notdef
@@ -398,41 +466,86 @@ net_rcv_noint ( struct netbuf *nbp )
 }
 #endif
 
-/* The above, reinstated 11-21-2022 to support
- * the loopback interface.  We want to put a packet into
- * the IP queue, but are not running at interrupt level.
+/* The above was reinstated 11-21-2022 for loopback, which
+ * put a fake ethernet frame onto the input queue along with
+ * everything from the driver.  Now lo has a queue of its own.
+ * This is the output function for lo, called from ip_arp_send()
+ * in whatever thread is sending, so we just queue the packet
+ * and let the net thread hand it straight to IP.
+ * Nothing here ever touches a wire, so there is no ethernet
+ * header and nobody computes or checks checksums.
  */
-void
-net_rcv_noint ( struct netbuf *nbp )
+static void
+net_loop_output ( struct netif *ifp, struct netbuf *nbp )
 {
 	nbp->next = (struct netbuf *) 0;
+	nbp->flags &= ~NB_CSUM_TX;
+	nbp->flags |= NB_CSUM_OK;
+	nbp->elen = nbp->ilen + sizeof(struct eth_hdr);
 
 	INT_lock;
-    	if ( inq_tail ) {
-	    inq_tail->next = nbp;
-	    inq_tail = nbp;
+	if ( loopq_count >= NET_LOOPQ_MAX ) {
+	    NET_COUNT ( ifp->tx_drops, 1 );
+	    net_drop ( NET_DROP_QUEUE );
+	    netbuf_free_i ( nbp );
+	    INT_unlock;
+	    return;
+	}
+
+	if ( loopq_tail ) {
+	    loopq_tail->next = nbp;
+	    loopq_tail = nbp;
 	} else {
-	    inq_tail = nbp;
-	    inq_head = nbp;
+	    loopq_tail = nbp;
+	    loopq_head = nbp;
 	}
-	inq_count++;
+	loopq_count++;
+	NET_STAT_HWM ( NS_LOOPQ_HWM, loopq_count );
+	NET_COUNT ( ifp->tx_packets, 1 );
+	NET_COUNT ( ifp->tx_bytes, nbp->ilen );
 	INT_unlock;
-	// printf ( "Packet (loopback) added to IP queue: %d\n", inq_count );
 
-	/*
-	cpu_signal ( inq_sem );
-	*/
 	sem_unblock ( inq_sem );
 }
 
+/* In the net thread, everything lo had queued up.
+ * The UDP code counts on only the net thread calling it,
+ * which is why we don't deliver in net_loop_output().
+ */
+static void
+net_loop_rcv ( struct netbuf *list )
+{
+	struct netbuf *nbp;
+
+	for ( nbp = list; nbp; nbp = nbp->next ) {
+	    NET_COUNT ( netif_loop->rx_packets, 1 );
+	    NET_COUNT ( netif_loop->rx_bytes, nbp->ilen );
+	}
+
+	ip_rcv_list ( list );
+}
+
 /* Called by the device driver at interrupt level to place a
  * packet on input queue and awaken handler thread.
  */
 void
 net_rcv ( struct netbuf *nbp )
 {
+	/* Raw ether types skip the queue entirely */
+	if ( raw_count && raw_rcv_i ( nbp ) )
+	    return;
+
 	nbp->next = (struct netbuf *) 0;
 
+	/* Rather than let a flood of packets eat every netbuf
+	 * we have, we start dropping at the door.
+	 */
+	if ( inq_count >= NET_INQ_MAX ) {
+	    net_drop ( NET_DROP_QUEUE );
+	    netbuf_free_i ( nbp );
+	    return;
+	}
+
 	if ( inq_tail ) {
 	    inq_tail->next = nbp;
 	    inq_tail = nbp;
@@ -441,34 +554,188 @@ net_rcv ( struct netbuf *nbp )
 	    inq_head = nbp;
 	}
 	inq_count++;
+	NET_STAT_HWM ( NS_INQ_HWM, inq_count );
 
 	cpu_signal ( inq_sem );
 	// sem_unblock ( inq_sem );
 }
 
+/* NAPI style receive (as Linux calls it).
+ * Taking every frame off the ring in the interrupt routine
+ * works fine until packets arrive faster than we can deal with
+ * them, then we spend all our time in interrupt code and never
+ * get around to processing anything (receive livelock).
+ * So a driver can do this instead: on an Rx interrupt it masks
+ * further Rx interrupts and calls net_poll_sched() with its poll
+ * function.  The net thread calls that function, which takes up
+ * to "budget" frames off the ring and hands each to net_rcv_poll().
+ * When the ring is empty the driver turns its Rx interrupt back
+ * on and returns less than the budget.  Returning the full budget
+ * means there is more to do and we will call again.  A driver that
+ * finds a frame came in just as it was turning interrupts back on
+ * returns what it did and calls net_poll_more() to be called again.
+ *
+ * We only have one interface, so one pending poll is enough.
+ */
+
+/* Called by the device driver at interrupt level */
+void
+net_poll_sched ( npfptr fn )
+{
+	net_poll_fn = fn;
+	cpu_signal ( inq_sem );
+}
+
+/* Called by the driver poll function (in the net thread)
+ * to ask for another call, whatever it returns.
+ */
+void
+net_poll_more ( void )
+{
+	net_poll_again = 1;
+}
+
+/* Called from any thread when UDP has retired ports.
+ * The net thread frees them when it runs out of work,
+ * since it can't be partway down a hash chain then.
+ */
+void
+net_want_tidy ( void )
+{
+	INT_lock;
+	net_tidy = 1;
+	INT_unlock;
+
+	if ( inq_sem )
+	    sem_unblock ( inq_sem );
+}
+
+/* Called by the driver poll function (in the net thread).
+ * We just collect them, net_poll_run() processes them as a batch.
+ */
+void
+net_rcv_poll ( struct netbuf *nbp )
+{
+	int raw;
+
+	if ( raw_count ) {
+	    INT_lock;
+	    raw = raw_rcv_i ( nbp );
+	    INT_unlock;
+	    if ( raw )
+		return;
+	}
+
+	nbp->next = (struct netbuf *) 0;
+	if ( poll_tail )
+	    poll_tail->next = nbp;
+	else
+	    poll_head = nbp;
+	poll_tail = nbp;
+}
+
+static void
+net_poll_run ( npfptr fn )
+{
+	struct netbuf *nbp;
+	int n;
+
+	net_poll_again = 0;
+	n = (*fn) ( NET_POLL_BUDGET );
+
+	if ( poll_head ) {
+	    nbp = poll_head;
+	    poll_head = poll_tail = (struct netbuf *) 0;
+	    net_handle_list ( nbp );
+	}
+
+	net_poll_count++;
+	net_poll_frames += n;
+	if ( n > NET_POLL_BUDGET )
+	    n = NET_POLL_BUDGET;
+	net_poll_hist[n]++;
+
+	/* Ring not empty yet, we will be back after
+	 * anything on the input queue gets a turn.
+	 */
+	if ( n == NET_POLL_BUDGET )
+	    net_poll_full++;
+
+	if ( n == NET_POLL_BUDGET || net_poll_again ) {
+	    INT_lock;
+	    if ( ! net_poll_fn )
+		net_poll_fn = fn;
+	    INT_unlock;
+	}
+}
+
+static void
+net_poll_show ( void )
+{
+	int i;
+
+	if ( ! net_poll_count )
+	    return;
+
+	printf ( "Rx polls: %d, %d frames, %d hit budget (%d)\n",
+	    net_poll_count, net_poll_frames, net_poll_full, NET_POLL_BUDGET );
+	printf ( "Rx frames per poll:" );
+	for ( i=0; i<=NET_POLL_BUDGET; i++ ) {
+	    if ( net_poll_hist[i] )
+		printf ( " %d:%d", i, net_poll_hist[i] );
+	}
+	printf ( "\n" );
+}
+
 /* Thread to process queue of arriving packets */
 static void
 net_thread ( long xxx )
 {
     	struct netbuf *nbp;
+	npfptr fn;
 
 	for ( ;; ) {
 
 	    INT_lock;
 
-	    /* Do we have a packet to process ? */
-	    nbp = NULL;
-	    if ( inq_head ) {
-			nbp = inq_head;
-			inq_head = nbp->next;
-			if ( ! inq_head )
-				inq_tail = (struct netbuf *) 0;
-			inq_count--;	
+	    /* Do we have packets to process ?
+	     * If so, we take the whole queue.
+	     */
+	    nbp = inq_head;
+
+	    if ( nbp ) {
+			inq_head = inq_tail = (struct netbuf *) 0;
+			inq_count = 0;
+			INT_unlock;
+			net_handle_list ( nbp );
+			continue;
 	    }
 
+	    /* Anything we sent to ourself ? */
+	    nbp = loopq_head;
+
 	    if ( nbp ) {
+			loopq_head = loopq_tail = (struct netbuf *) 0;
+			loopq_count = 0;
+			INT_unlock;
+			net_loop_rcv ( nbp );
+			continue;
+	    }
+
+	    /* Does a driver want its ring polled ? */
+	    if ( net_poll_fn ) {
+			fn = net_poll_fn;
+			net_poll_fn = (npfptr) 0;
 			INT_unlock;
-			net_handle ( nbp );
+			net_poll_run ( fn );
+			continue;
+	    }
+
+	    /* All quiet, a good time to free things */
+	    if ( net_tidy ) {
+			net_tidy = 0;
+			INT_unlock;
+			udp_reclaim ();
 			continue;
 	    }
 
@@ -513,8 +780,11 @@ output_thread ( long xxx )
 	    if ( nbp ) {
 			INT_unlock;
 			// net_handle ( nbp );
-			board_net_send ( nbp );
-			netbuf_free ( nbp );
+			/* The driver owns the netbuf now and frees it
+			 * when it is done with it (maybe much later,
+			 * once the transmit completes).
+			 */
+			(*nbp->ifp->output) ( nbp->ifp, nbp );
 			continue;
 	    }
 
@@ -536,15 +806,43 @@ output_thread ( long xxx )
 	/* NOTREACHED */
 }
 
+/* Output function for eth0, the board network driver */
+static void
+net_eth_output ( struct netif *ifp, struct netbuf *nbp )
+{
+	board_net_send ( nbp );
+}
+
 /* This gets called by everybody and anybody when they
  *   have a packet that needs to be sent.
+ * Nobody setting ifp means eth0.
  */
 void
 net_send ( struct netbuf *nbp )
 {
+	struct netif *ifp;
 
 	nbp->elen = nbp->ilen + sizeof(struct eth_hdr);
 
+	if ( ! nbp->ifp )
+	    nbp->ifp = netif_primary;
+	ifp = nbp->ifp;
+
+	if ( ! (ifp->flags & NETIF_UP) ) {
+	    NET_COUNT ( ifp->tx_drops, 1 );
+	    net_drop ( NET_DROP_IFDOWN );
+	    netbuf_free ( nbp );
+	    return;
+	}
+	NET_COUNT ( ifp->tx_packets, 1 );
+	NET_COUNT ( ifp->tx_bytes, nbp->elen );
+
+	if ( nbp->eptr->type == ETH_ARP_SWAP )
+	    NET_STAT ( NS_ARP_OUT );
+
+	if ( capture_on )
+	    capture_pkt ( nbp, 1 );
+
 	if ( net_debug_f > 0 ) {
 	    net_show_packet ( "net_send", nbp );
 	    if ( net_debug_f == 1 )
@@ -565,6 +863,7 @@ net_send ( struct netbuf *nbp )
 		outq_head = nbp;
 	}
 	outq_count++;
+	NET_STAT_HWM ( NS_OUTQ_HWM, outq_count );
 	INT_unlock;
 
 	cpu_signal ( outq_sem );
@@ -580,12 +879,47 @@ net_send ( struct netbuf *nbp )
 static int oddball_count = 0;
 static int total_count = 0;
 
+/* Checksum offload.
+ * A driver whose hardware can check and/or generate IP, UDP
+ * and TCP checksums tells us so here during its initialization.
+ * Nobody calling this (the usual case) means we do it all in
+ * software, as we always have.
+ * The board driver is eth0, so Tx offload is a flag on that
+ * interface, and ip_csum_tx() asks whatever interface a
+ * packet is going out on.
+ */
+static int net_csum_caps = 0;
+
+void
+net_offload_set ( int caps )
+{
+	net_csum_caps = caps;
+
+	if ( ! netif_primary )
+	    return;
+	if ( caps & NET_CSUM_TX )
+	    netif_primary->flags |= NETIF_CSUM_TX;
+	else
+	    netif_primary->flags &= ~NETIF_CSUM_TX;
+}
+
+int
+net_offload ( void )
+{
+	return net_csum_caps;
+}
+
 static int 
 not_our_mac ( struct netbuf *nbp )
 {
+	unsigned char *mac = nbp->ifp ? nbp->ifp->mac : host_info.our_mac;
+
 	if ( memcmp ( nbp->eptr->dst, broad, ETH_ADDR_SIZE ) == 0 )
 	    return 1;
-	if ( memcmp ( nbp->eptr->dst, host_info.our_mac, ETH_ADDR_SIZE ) != 0 )
+	/* multicast, but is it a group we are in ? */
+	if ( nbp->eptr->dst[0] & 1 )
+	    return ! ip_mcast_mac_ok ( nbp->eptr->dst );
+	if ( memcmp ( nbp->eptr->dst, mac, ETH_ADDR_SIZE ) != 0 )
 	    return 1;
 	return 0;
 }
@@ -629,13 +963,28 @@ net_dump ( struct netbuf *nbp, char *msg )
 }
 
 /* Called in the net-in thread for each received packet */
-static void
-net_handle ( struct netbuf *nbp )
+/* Ethernet level handling of an arriving packet.
+ * Returns 1 for an IP packet, which the caller passes on,
+ * otherwise we have dealt with it.
+ */
+static int
+net_ether ( struct netbuf *nbp )
 {
 	struct eth_hdr *ehp;
+	struct netif *ifp;
 
 	nbp->ilen = nbp->elen - sizeof ( struct eth_hdr );
 
+	/* Drivers other than eth0 tell us who they are */
+	if ( ! nbp->ifp )
+	    nbp->ifp = netif_primary;
+	ifp = nbp->ifp;
+	NET_COUNT ( ifp->rx_packets, 1 );
+	NET_COUNT ( ifp->rx_bytes, nbp->elen );
+
+	if ( capture_on )
+	    capture_pkt ( nbp, 0 );
+
 	// printf ( "net_handle: %d, %d\n", nbp->elen, nbp->ilen );
 
 	if ( net_debug > 0 ) {
@@ -649,8 +998,9 @@ net_handle ( struct netbuf *nbp )
 	if ( ehp->type == ETH_ARP_SWAP ) {
 	    // printf ("net_handle: type = %04x len = %d ", ehp->type, nbp->elen );
 	    // printf ( "(ARP)\n" );
+	    NET_STAT ( NS_ARP_IN );
 	    arp_rcv ( nbp );
-	    return;
+	    return 0;
 	}
 
 	/* We see this both on the BBB and Orange Pi.
@@ -659,21 +1009,66 @@ net_handle ( struct netbuf *nbp )
 	 */
 	if ( not_our_mac ( nbp ) ) {
 	    // printf ( "Rejected, dest: %s\n", ether2str(ehp->dst) );
+	    NET_COUNT ( ifp->rx_drops, 1 );
+	    net_drop ( NET_DROP_NOTUS );
 	    netbuf_free ( nbp );
-	    return;
+	    return 0;
 	}
 
 	if ( ehp->type == ETH_IP_SWAP ) {
 	    // printf ("net_handle: type = %04x len = %d ", ehp->type, nbp->elen );
 	    // printf ( "(IP)\n" );
 	    // dump_buf ( nbp->eptr, nbp->elen );
-	    ip_rcv ( nbp );
-	    return;
+	    return 1;
 	}
 
 	++oddball_count;
-	printf (" oddball packet: %04x len = %d\n", ehp->type, nbp->elen );
+	NET_COUNT ( ifp->rx_drops, 1 );
+	net_drop ( NET_DROP_ETYPE );
+	if ( net_debug > 0 )
+	    printf (" oddball packet: %04x len = %d\n", ehp->type, nbp->elen );
 	netbuf_free ( nbp );
+	return 0;
+}
+
+static int net_batch_count = 0;
+static int net_batch_max = 0;
+
+/* Handle a list of arriving packets linked through "next",
+ * usually everything that piled up on the input queue while
+ * we were busy.  ARP and such get handled one by one,
+ * the IP packets go up to ip_rcv_list() together.
+ */
+static void
+net_handle_list ( struct netbuf *list )
+{
+	struct netbuf *nbp;
+	struct netbuf *ip_head = (struct netbuf *) 0;
+	struct netbuf *ip_tail = (struct netbuf *) 0;
+	int n = 0;
+
+	while ( list ) {
+	    nbp = list;
+	    list = nbp->next;
+	    nbp->next = (struct netbuf *) 0;
+	    n++;
+
+	    if ( ! net_ether ( nbp ) )
+		continue;
+
+	    if ( ip_tail )
+		ip_tail->next = nbp;
+	    else
+		ip_head = nbp;
+	    ip_tail = nbp;
+	}
+
+	if ( ip_head )
+	    ip_rcv_list ( ip_head );
+
+	net_batch_count++;
+	if ( n > net_batch_max )
+	    net_batch_max = n;
 }
 
 int
@@ -696,13 +1091,30 @@ net_show ( void )
 	printf ( "Gateway: %s\n", ip2str32 ( host_info.gate_ip ) );
 
 	printf ( "Packets processed: %d total (%d oddballs)\n", total_count, oddball_count );
+	printf ( "Packet batches: %d (largest %d)\n", net_batch_count, net_batch_max );
 	printf ( "Packets in IP queue: %d\n", inq_count );
+	if ( net_csum_caps )
+	    printf ( "Checksum offload:%s%s\n",
+		net_csum_caps & NET_CSUM_RX ? " rx" : "",
+		net_csum_caps & NET_CSUM_TX ? " tx" : "" );
+	net_poll_show ();
+	net_stats_show ();
 
 	if ( num_eth ) board_net_show ();
 
+	netif_show ();
+	route_show ();
 	netbuf_show ();
 	arp_show ();
+	ip_frag_show ();
+	mcast_show ();
+	raw_show ();
+	capture_show ();
+	udp_show ();
 	dns_cache_show ();
+#ifdef WANT_TFTPD
+	tftpd_show ();
+#endif
 }
 
 /* ----------------------------------------- */
@@ -749,30 +1161,224 @@ net_addr_get ( char *buf )
 /* buffer handling. */
 /* ----------------------------------------- */
 
-// #define NUM_NETBUF	128
-#define NUM_NETBUF	512
+/* As of 2026 we have two size classes.
+ * Small buffers hold ARP, ICMP echo, TCP ACKs and the like.
+ * Large buffers hold a full ethernet frame.
+ * The original scheme was 512 netbufs that were all large,
+ * this uses somewhat less memory and gives more buffers.
+ */
+#define NUM_NETBUF_SMALL	512
+#define NUM_NETBUF_LARGE	384
+
+#define NUM_NETBUF	(NUM_NETBUF_SMALL + NUM_NETBUF_LARGE)
+
+struct netbuf_pool {
+	char *name;
+	int size;		/* bytes in each data area */
+	int num;		/* number configured */
+	struct netbuf *free;
+	int avail;
+	int low;		/* low water mark */
+	int fail;		/* allocations refused */
+};
+
+/* Must be in order of increasing size */
+static struct netbuf_pool nb_pool[] = {
+	{ "small", NETBUF_SMALL, NUM_NETBUF_SMALL },
+	{ "large", NETBUF_LARGE, NUM_NETBUF_LARGE },
+};
+
+#define NUM_NB_POOL	(sizeof(nb_pool) / sizeof(nb_pool[0]))
+
+/* Buffers held back in each pool for each consumer.
+ * A consumer may dip into its own reserve, but never
+ * into anybody elses.
+ */
+static int nb_reserve[NB_NUM_USER] = { 0, 0, 16, 4 };
+static int nb_reserve_total;
+
+static char *nb_user_name[NB_NUM_USER] = { "rx", "net", "tcp", "shell" };
 
-#ifdef STATIC_NETBUF
-/* This is the original way we did this
- * (prior to 4-27-2017)
+/* When any pool drops to 1/8 full we declare netbufs low,
+ * when all pools recover to 1/4 full we declare them OK again.
+ * The gap keeps us from flapping.
  */
-/* XXX simple static block of memory (2M for 512)
- * asking for 512 puts skidoo into a reboot loop
- * (maybe a bug in the bss zeroing code ...
-#define NUM_NETBUF	512
- * 2, 32, ... work OK.
+#define NB_LOW(pp)	((pp)->num / 8)
+#define NB_OK(pp)	((pp)->num / 4)
+
+#define MAX_NB_HOOK	4
+
+static nbwfptr nb_hooks[MAX_NB_HOOK];
+static int nb_num_hook;
+static int nb_is_low;
+static int nb_low_count;
+
+/* Each core keeps a small "magazine" of free buffers for each
+ * size class, so the usual alloc/free touches only data that
+ * belongs to this core and needs nothing more than the local
+ * interrupt lock.  When a magazine runs dry (or fills up) we
+ * go to the shared pool and move a batch of buffers at once,
+ * holding the spin lock that guards the shared free lists.
+ *
+ * The reservations and water marks apply to the shared pools.
+ * Buffers sitting in a magazine are handed to whoever asks on
+ * that core, so a magazine only ever holds buffers the shared
+ * pool can spare above all the reserves.  A consumer with a
+ * reserve that finds the magazine empty goes to the shared pool
+ * for a single buffer, and freed buffers go back to the shared
+ * pool until it is above the reserves again.  Otherwise one core
+ * could sit on buffers that tcp or the shell were promised.
  */
-static char netbuf_buf[NUM_NETBUF * sizeof(struct netbuf)];
-#endif
+#define NB_MAG_SIZE	32
+#define NB_MAG_BATCH	16
+
+struct netbuf_mag {
+	int count;
+	struct netbuf *bufs[NB_MAG_SIZE];
+} __attribute__ ((aligned (NETBUF_ALIGN)));
 
-static struct netbuf *nb_free;
-static int nb_avail;
+static struct netbuf_mag nb_mag[NUM_CORES][NUM_NB_POOL];
+
+static volatile int nb_pool_lock;
+static int nb_cache = 1;
+
+/* Our row of nb_mag.  A magazine must only ever
+ * be touched by the one core it belongs to.
+ */
+static inline int
+netbuf_core ( void )
+{
+	int core = get_core_id ();
+
+	if ( core >= NUM_CORES )
+	    panic ( "netbuf: core id past NUM_CORES" );
+	return core;
+}
 
 static void
-netbuf_init ( void )
+netbuf_reserve_sum ( void )
+{
+	int i;
+
+	nb_reserve_total = 0;
+	for ( i=0; i<NB_NUM_USER; i++ )
+	    nb_reserve_total += nb_reserve[i];
+}
+
+/* Set aside "count" buffers in each pool for one consumer.
+ */
+void
+netbuf_reserve ( int user, int count )
+{
+	if ( user < 0 || user >= NB_NUM_USER )
+	    return;
+
+	INT_lock;
+	nb_reserve[user] = count;
+	netbuf_reserve_sum ();
+	INT_unlock;
+
+	/* What this core is holding may now belong to the reserve */
+	if ( nb_cache )
+	    netbuf_cache_flush ();
+}
+
+/* Protocol layers register here to learn when to shed load.
+ */
+void
+netbuf_lowwater_hook ( nbwfptr func )
 {
+	if ( nb_num_hook >= MAX_NB_HOOK ) {
+	    printf ( "netbuf_lowwater_hook: too many hooks\n" );
+	    return;
+	}
+	nb_hooks[nb_num_hook++] = func;
+}
+
+int
+netbuf_low ( void )
+{
+	return nb_is_low;
+}
+
+static void
+netbuf_water_call ( int low )
+{
+	int i;
+
+	nb_is_low = low;
+	if ( low )
+	    ++nb_low_count;
+
+	for ( i=0; i<nb_num_hook; i++ )
+	    ( *nb_hooks[i] ) ( low );
+}
+
+/* Called with interrupts locked and the pool lock held
+ * after every change to a shared pool.
+ */
+static void
+netbuf_water_check ( struct netbuf_pool *pp )
+{
+	int i;
+
+	if ( ! nb_is_low ) {
+	    if ( pp->avail <= NB_LOW(pp) )
+		netbuf_water_call ( 1 );
+	    return;
+	}
+
+	for ( i=0; i<NUM_NB_POOL; i++ )
+	    if ( nb_pool[i].avail < NB_OK(&nb_pool[i]) )
+		return;
+
+	netbuf_water_call ( 0 );
+}
+
+static void
+netbuf_pool_init ( int ipool )
+{
+	struct netbuf_pool *pp = &nb_pool[ipool];
 	struct netbuf *ap;
 	struct netbuf *end;
+	char *data;
+
+	if ( pp->size % NETBUF_ALIGN )
+	    panic ( "netbuf size class not cache aligned" );
+
+	/* ram_alloc hands us cache aligned memory, and since each
+	 * data area is a multiple of the line size, they all are.
+	 */
+	ap = (struct netbuf *) ram_alloc ( pp->num * sizeof(struct netbuf) );
+	data = (char *) ram_alloc ( pp->num * pp->size );
+	end = &ap[pp->num];
+
+	pp->free = (struct netbuf *) 0;
+	pp->avail = 0;
+	pp->fail = 0;
+
+	for ( ; ap < end; ap++ ) {
+	    ap->pool = ipool;
+	    ap->size = pp->size;
+	    ap->data = data;
+	    data += pp->size;
+
+	    ap->next = pp->free;
+#ifdef NETBUF_POISON
+	    strncpy ( ap->data + NETBUF_ETH_OFF, "DEAD", 4 );
+#endif
+	    pp->free = ap;
+	    ++pp->avail;
+	}
+
+	pp->low = pp->avail;
+}
+
+static void
+netbuf_init ( void )
+{
+	int i;
+	int total = 0;
 
 	/*
 	printf ( "In netbuf_init ()\n" );
@@ -781,50 +1387,88 @@ netbuf_init ( void )
 	printf ( "In netbuf_init () 2\n" );
 	*/
 
-#ifdef STATIC_NETBUF
-	ap = (struct netbuf *) netbuf_buf;
-#else
-	ap = (struct netbuf *) ram_alloc ( NUM_NETBUF * sizeof(struct netbuf) );
-#endif
-	end = &ap[NUM_NETBUF];
+	for ( i=0; i<NUM_NB_POOL; i++ ) {
+	    netbuf_pool_init ( i );
+	    total += nb_pool[i].avail;
+	}
 
-	nb_free = (struct netbuf *) 0;
+	nb_pool_lock = 0;
 
-	nb_avail = 0;
-	for ( ap; ap < end; ap++ ) {
-	    ap->next = nb_free;
-		strncpy ( ap->data, "DEAD", 4 );
-	    nb_free = ap;
-	    ++nb_avail;
-	}
+	netbuf_reserve_sum ();
+	nb_is_low = 0;
 
-	printf ("%d netbuf initialized of %d\n", nb_avail, NUM_NETBUF );
+	printf ("%d netbuf initialized of %d\n", total, NUM_NETBUF );
 	netbuf_show ();
 }
 
 /* for debug/statistics */
-int
-netbuf_count ( void )
+static int
+netbuf_pool_count ( struct netbuf_pool *pp )
 {
 	struct netbuf *ap;
 	int count = 0;
 
-	for ( ap = nb_free; ap; ap = ap->next ) {
+	for ( ap = pp->free; ap; ap = ap->next ) {
 	    count++;
 	    // avoid runaway if list is corrupt
-	    if ( count > (NUM_NETBUF+10) )
+	    if ( count > (pp->num+10) )
 		break;
 	}
 	return count;
 }
 
+static int
+netbuf_mag_count ( int ipool )
+{
+	int core;
+	int count = 0;
+
+	for ( core=0; core<NUM_CORES; core++ )
+	    count += nb_mag[core][ipool].count;
+	return count;
+}
+
+/* Includes what the magazines are holding */
+int
+netbuf_count ( void )
+{
+	int i;
+	int count = 0;
+
+	for ( i=0; i<NUM_NB_POOL; i++ ) {
+	    count += netbuf_pool_count ( &nb_pool[i] );
+	    count += netbuf_mag_count ( i );
+	}
+	return count;
+}
+
 void
 netbuf_show ( void )
 {
-	printf ( "Netbuf head: %08x\n", nb_free );
-	printf ( "%3d netbuf available\n", nb_avail );
-	printf ( "%3d netbuf on free list\n", netbuf_count () );
-	printf ( "%3d netbuf configured\n", NUM_NETBUF );
+	struct netbuf_pool *pp;
+	int core;
+	int i;
+
+	for ( i=0; i<NUM_NB_POOL; i++ ) {
+	    pp = &nb_pool[i];
+	    printf ( "Netbuf %s (%d bytes) head: %08x\n", pp->name, pp->size, pp->free );
+	    printf ( "  %3d available, %3d on free list, %3d configured, %3d low water\n",
+		pp->avail, netbuf_pool_count ( pp ), pp->num, pp->low );
+	    printf ( "  %3d allocations refused\n", pp->fail );
+	    printf ( "  %3d in core magazines:", netbuf_mag_count ( i ) );
+	    for ( core=0; core<NUM_CORES; core++ )
+		printf ( " %d", nb_mag[core][i].count );
+	    printf ( "\n" );
+	}
+
+	printf ( "Netbuf core magazines %s\n", nb_cache ? "on" : "off" );
+
+	printf ( "Netbuf reserve per pool:" );
+	for ( i=0; i<NB_NUM_USER; i++ )
+	    printf ( " %s %d", nb_user_name[i], nb_reserve[i] );
+	printf ( "\n" );
+
+	printf ( "Netbufs %s, went low %d times\n", nb_is_low ? "LOW" : "ok", nb_low_count );
 }
 
 /* get a netbuf, with lock */
@@ -843,39 +1487,241 @@ netbuf_alloc ( void )
 	return rv;
 }
 
+/* Get a netbuf that can hold a frame of the
+ * given size, with lock.
+ */
+struct netbuf *
+netbuf_alloc_size ( int size )
+{
+	struct netbuf *rv;
+
+	INT_lock;
+	rv = netbuf_alloc_user_i ( NB_USER_NET, size );
+	INT_unlock;
+
+	return rv;
+}
+
+struct netbuf *
+netbuf_alloc_user ( int user, int size )
+{
+	struct netbuf *rv;
+
+	INT_lock;
+	rv = netbuf_alloc_user_i ( user, size );
+	INT_unlock;
+
+	return rv;
+}
+
 /* This can be called directly from interrupt level
  * since an ISR implicitly holds a lock.
  */
 struct netbuf *
 netbuf_alloc_i ( void )
 {
-	struct netbuf *rv;
-	struct netbuf **nbpt;
+	return netbuf_alloc_user_i ( NB_USER_NET, NETBUF_MAX );
+}
 
-	if ( ! nb_free ) {
-	    panic ( "We just flat ran out of netbufs !!" );
-	    // return (struct netbuf *) 0;
-	}
+struct netbuf *
+netbuf_alloc_size_i ( int size )
+{
+	return netbuf_alloc_user_i ( NB_USER_NET, size );
+}
 
-	rv = nb_free;
-	nb_free = nb_free->next;
-	nb_avail--;
+/* Take one buffer from a shared pool.
+ * Caller holds the interrupt lock and the pool lock.
+ */
+static struct netbuf *
+netbuf_pool_get ( struct netbuf_pool *pp )
+{
+	struct netbuf *rv;
 
-	if ( ! valid_ram_address ( nb_free ) ) {
-	    printf ( "netbuf_alloc rv, free = %08x, %08x\n", rv, nb_free );
+	rv = pp->free;
+	pp->free = rv->next;
+	pp->avail--;
+	if ( pp->avail < pp->low )
+	    pp->low = pp->avail;
+
+	if ( pp->free && ! valid_ram_address ( pp->free ) ) {
+	    printf ( "netbuf_alloc rv, free = %08x, %08x\n", rv, pp->free );
 	    netbuf_show ();
 	    panic ( "netbuf_alloc_i -- bad next address\n" );
 	}
 
+	return rv;
+}
+
+static void
+netbuf_pool_put ( struct netbuf_pool *pp, struct netbuf *old )
+{
+	old->next = pp->free;
+	pp->free = old;
+	++pp->avail;
+}
+
+/* Refill an empty magazine with a batch from the shared pool,
+ * taking no more than is left above the reserves.
+ */
+static void
+netbuf_mag_fill ( struct netbuf_mag *mp, int ipool )
+{
+	struct netbuf_pool *pp = &nb_pool[ipool];
+	int n;
+
+	cpu_spin_lock ( &nb_pool_lock );
+
+	n = pp->avail - nb_reserve_total;
+	if ( n > NB_MAG_BATCH )
+	    n = NB_MAG_BATCH;
+
+	if ( n > 0 ) {
+	    while ( n-- )
+		mp->bufs[mp->count++] = netbuf_pool_get ( pp );
+	    netbuf_water_check ( pp );
+	}
+
+	cpu_spin_unlock ( &nb_pool_lock );
+}
+
+/* Hand a batch from a full magazine back to the shared pool */
+static void
+netbuf_mag_drain ( struct netbuf_mag *mp, int ipool, int n )
+{
+	struct netbuf_pool *pp = &nb_pool[ipool];
+
+	cpu_spin_lock ( &nb_pool_lock );
+
+	while ( n-- && mp->count > 0 )
+	    netbuf_pool_put ( pp, mp->bufs[--mp->count] );
+
+	if ( nb_is_low )
+	    netbuf_water_check ( pp );
+
+	cpu_spin_unlock ( &nb_pool_lock );
+}
+
+/* Caller holds the interrupt lock */
+static void
+netbuf_mag_empty ( int core )
+{
+	struct netbuf_mag *mp;
+	int i;
+
+	for ( i=0; i<NUM_NB_POOL; i++ ) {
+	    mp = &nb_mag[core][i];
+	    if ( mp->count )
+		netbuf_mag_drain ( mp, i, mp->count );
+	}
+}
+
+/* Empty the magazines of the calling core.
+ * Other cores must flush their own.
+ */
+void
+netbuf_cache_flush ( void )
+{
+	INT_lock;
+	netbuf_mag_empty ( netbuf_core () );
+	INT_unlock;
+}
+
+/* Turn the per core magazines on or off.
+ * Off gives the old behavior where every alloc and free
+ * goes to the shared pool, which is handy for comparison.
+ * We can't reach into another core's magazines, so with
+ * them off each core empties its own the next time it
+ * allocates a buffer (see netbuf_alloc_user_i).
+ */
+void
+netbuf_cache_set ( int on )
+{
+	nb_cache = on;
+	if ( ! on )
+	    netbuf_cache_flush ();
+}
+
+/* Pick the smallest size class that will hold a frame
+ * of "size" bytes.  If that class is empty (or down to
+ * what others have reserved) we move up to a larger one.
+ *
+ * This used to panic when we ran out.  Now we return 0 and
+ * callers must cope, usually by dropping the packet.
+ * A burst of traffic should not take the system down.
+ */
+struct netbuf *
+netbuf_alloc_user_i ( int user, int size )
+{
+	struct netbuf_pool *pp;
+	struct netbuf_mag *mp;
+	struct netbuf *rv;
+	struct netbuf **nbpt;
+	int floor;
+	int core;
+	int want;
+	int i;
+
+	floor = nb_reserve_total - nb_reserve[user];
+	core = netbuf_core ();
+
+	/* Magazines were turned off by some other core */
+	if ( ! nb_cache )
+	    netbuf_mag_empty ( core );
+
+	rv = (struct netbuf *) 0;
+	want = -1;
+	for ( i=0; i<NUM_NB_POOL; i++ ) {
+	    pp = &nb_pool[i];
+	    if ( size > pp->size - NETBUF_ETH_OFF )
+		continue;
+	    if ( want < 0 )
+		want = i;
+
+	    if ( nb_cache ) {
+		mp = &nb_mag[core][i];
+		if ( mp->count == 0 )
+		    netbuf_mag_fill ( mp, i );
+		if ( mp->count > 0 ) {
+		    rv = mp->bufs[--mp->count];
+		    break;
+		}
+	    }
+
+	    /* Magazines off, or empty and all that is
+	     * left is reserved.  Maybe some of it is ours.
+	     */
+	    cpu_spin_lock ( &nb_pool_lock );
+	    if ( pp->avail > floor ) {
+		rv = netbuf_pool_get ( pp );
+		netbuf_water_check ( pp );
+	    }
+	    cpu_spin_unlock ( &nb_pool_lock );
+	    if ( rv )
+		break;
+	}
+
+	/* Moving up a size class is not a refusal,
+	 * coming back empty handed is.
+	 */
+	if ( ! rv ) {
+	    if ( want >= 0 )
+		nb_pool[want].fail++;
+	    return (struct netbuf *) 0;
+	}
+
 	if ( ! valid_ram_address ( rv ) ) {
-	    printf ( "netbuf_alloc rv, free = %08x, *08x\n", rv, nb_free );
+	    printf ( "netbuf_alloc rv = %08x\n", rv );
 	    netbuf_show ();
 	    panic ( "netbuf_alloc_i -- bad address\n" );
 	}
 
 	rv->refcount = 1;
+	rv->flags = 0;
+	rv->frag = (struct netbuf *) 0;
+	rv->ifp = (struct netif *) 0;
+	rv->elen = 0;
 	rv->bptr = rv->data;
-	rv->eptr = (struct eth_hdr *) (rv->bptr + NETBUF_PREPAD * sizeof(struct netbuf *));
+	rv->eptr = (struct eth_hdr *) (rv->bptr + NETBUF_ETH_OFF);
 	rv->iptr = (struct ip_hdr *) ((char *) rv->eptr + sizeof ( struct eth_hdr ));
 
 	/* Store the embedded back pointer used by Xinu tcp */
@@ -883,7 +1729,7 @@ netbuf_alloc_i ( void )
 	*nbpt = rv;
 
 // XXX debug
-//	memset ( rv->data, 0xAB, NETBUF_MAX );
+//	memset ( rv->data, 0xAB, rv->size );
 
 #ifdef ARM_ALIGNMENT_HACK
 	if ( ((u32) rv->iptr) & 0x3 )
@@ -896,8 +1742,53 @@ netbuf_alloc_i ( void )
 	return rv;
 }
 
+/* Put a buffer back in this core's magazine for its size class,
+ * or straight onto the shared free list if magazines are off.
+ * Caller holds the interrupt lock.
+ */
+static void
+netbuf_release_i ( struct netbuf *old )
+{
+	struct netbuf_pool *pp;
+	struct netbuf_mag *mp;
+	struct netbuf *more;
+
+	/* A reassembled IP datagram takes the rest
+	 * of its fragments along with it.
+	 */
+	for ( ; old; old = more ) {
+	    more = old->frag;
+
+#ifdef NETBUF_POISON
+	    /* Sanity check for h5-emac bug */
+	    strncpy ( old->data + NETBUF_ETH_OFF, "DEAD", 4 );
+#endif
+
+	    pp = &nb_pool[old->pool];
+
+	    /* The reserves get refilled before any magazine.
+	     * Reading avail without the pool lock is only a hint,
+	     * at worst one buffer lands in the wrong place and the
+	     * next drain puts it right.
+	     */
+	    if ( nb_cache && pp->avail >= nb_reserve_total ) {
+		mp = &nb_mag[netbuf_core()][old->pool];
+		if ( mp->count >= NB_MAG_SIZE )
+		    netbuf_mag_drain ( mp, old->pool, NB_MAG_BATCH );
+		mp->bufs[mp->count++] = old;
+		continue;
+	    }
+
+	    cpu_spin_lock ( &nb_pool_lock );
+	    netbuf_pool_put ( pp, old );
+	    if ( nb_is_low )
+		netbuf_water_check ( pp );
+	    cpu_spin_unlock ( &nb_pool_lock );
+	}
+}
+
 /* Note that we never actually free memory, we just put the
- * buffer back on the free list.
+ * buffer back on the free list for its size class.
  */
 void
 netbuf_free ( struct netbuf *old )
@@ -905,23 +1796,69 @@ netbuf_free ( struct netbuf *old )
 	// int count = netbuf_count ();
 	// printf ( "NETBUF_free: %08x, ref= %d", old, old->refcount );
 
+	/* A UDP socket can hold a reference to a netbuf the
+	 * net thread is also about to free, so this must be
+	 * done with interrupts off.
+	 */
+	INT_lock;
 	old->refcount--;
 	if ( old->refcount > 0 ) {
 	    // printf ( "\n" );
+	    INT_unlock;
 	    return;
 	}
 
 	// printf ( " (%d --> %d free)\n", count, count+1 );
-	INT_lock;
+	netbuf_release_i ( old );
+	INT_unlock;
+}
+
+/* For use at interrupt level, where we must not
+ * fiddle with the interrupt lock.
+ */
+void
+netbuf_free_i ( struct netbuf *old )
+{
+	old->refcount--;
+	if ( old->refcount > 0 )
+	    return;
 
-	/* Sanity check for h5-emac bug */
-	strncpy ( old->data, "DEAD", 4 );
+	netbuf_release_i ( old );
+}
 
-	old->next = nb_free;
-	nb_free = old;
-	++nb_avail;
+/* Copy out the payload (dptr on), following the chain
+ * if this is an IP datagram that came in fragments.
+ * Returns how many bytes we copied.
+ */
+int
+netbuf_copy_data ( struct netbuf *nbp, char *buf, int len )
+{
+	char *p;
+	int n, done;
 
-	INT_unlock;
+	if ( len > nbp->dlen )
+	    len = nbp->dlen;
+
+	if ( ! nbp->frag ) {
+	    memcpy ( buf, nbp->dptr, len );
+	    return len;
+	}
+
+	p = nbp->dptr;
+	n = nbp->pptr + nbp->flen - p;
+	for ( done = 0; done < len; ) {
+	    if ( n > len - done )
+		n = len - done;
+	    memcpy ( buf + done, p, n );
+	    done += n;
+
+	    nbp = nbp->frag;
+	    if ( ! nbp )
+		break;
+	    p = nbp->pptr;
+	    n = nbp->flen;
+	}
+	return done;
 }
 
 /* ------------------------------------------- */
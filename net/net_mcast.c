@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * net_mcast.c
+ * IP multicast, and just enough IGMP (version 2) to go with it.
+ *
+ * Instruments like to multicast their data, and until now the only
+ * way to hear it was to turn on "all multicast" in the emac and throw
+ * away what we didn't want in software.  On a busy network that is
+ * a lot of interrupts for nothing.  Now you call ip_mcast_join()
+ * and we tell the hardware exactly which addresses to let in
+ * (see board_net_mcast()), and tell the switches and routers
+ * we want the group with an IGMP report.
+ *
+ * A group maps to a MAC address as 01:00:5e plus the low 23 bits
+ * of the address, so 32 groups share each MAC.  The hardware filter
+ * only looks at the MAC, so ip_check() makes the final decision
+ * with ip_mcast_member().  We are always in 224.0.0.1 (all hosts),
+ * which is where IGMP queries come from.
+ *
+ * Joins are counted, so two threads can join the same group and the
+ * first to leave doesn't pull the rug out from under the other one.
+ * The table changes with interrupts off, but the hardware and IGMP
+ * get dealt with after, since sending a packet with interrupts off
+ * is not allowed.
+ *
+ * Not every board has a multicast filter we know how to program.
+ * Those say so (board_net_mcast returns nonzero), and then joining
+ * a group fails rather than pretend we will hear it.
+ *
+ * Reports go out twice when we join (in case the first one gets lost),
+ * and again after a random delay whenever a router asks.  If another
+ * host on the net reports the group first, we keep quiet, as the
+ * RFC says.  A leave goes to all routers (224.0.0.2).
+ *
+ * Multicast we send goes out with a TTL of 1 (it stays on this net)
+ * unless you change that with ip_mcast_ttl_set().
+ *
+ * agent  10-19-2026
+ */
+
+#include <arch/types.h>
+#include <kyu.h>
+#include <kyulib.h>
+
+#include "net.h"
+#include "netbuf.h"
+#include "arch/cpu.h"
+
+#define MCAST_MAX	16
+
+int board_net_mcast ( unsigned char *, int );
+
+#define IGMP_QUERY	0x11
+#define IGMP_REPORT_V1	0x12
+#define IGMP_REPORT	0x16
+#define IGMP_LEAVE	0x17
+
+#define IGMP_ALL_HOSTS		0xe0000001	/* 224.0.0.1 */
+#define IGMP_ALL_ROUTERS	0xe0000002	/* 224.0.0.2 */
+
+/* Router alert, RFC 2113 */
+#define IP_OPT_RA		0x94040000
+
+/* Seconds, when a query doesn't say */
+#define IGMP_RESP_DEF		10
+
+struct igmp_hdr {
+	unsigned char type;
+	unsigned char code;	/* max response time, tenths of a second */
+	unsigned short sum;
+	u32 group;
+};
+
+#define IGMP_HLEN	sizeof(struct igmp_hdr)
+#define IGMP_IP_HLEN	(sizeof(struct ip_hdr) + sizeof(u32))
+
+struct mcast_group {
+	u32 group;		/* network byte order, 0 if free */
+	int refs;
+	int report;		/* seconds until we send one, 0 for never */
+};
+
+static struct mcast_group mcast_table[MCAST_MAX];
+static int mcast_count;
+
+int ip_mcast_ttl = 1;
+
+static struct mcast_stats {
+	int in;
+	int out;
+	int queries;
+	int bad;
+	int quiet;		/* somebody else reported first */
+} mcast_stats;
+
+static void igmp_send ( int, u32, u32 );
+
+static struct mcast_group *
+mcast_lookup ( u32 group )
+{
+	int i;
+
+	for ( i=0; i<MCAST_MAX; i++ )
+	    if ( mcast_table[i].group == group )
+		return &mcast_table[i];
+	return (struct mcast_group *) 0;
+}
+
+/* Also for ip_arp_send() */
+void
+mcast_ether ( u32 group, unsigned char *mac )
+{
+	u32 ip = ntohl ( group );
+
+	mac[0] = 0x01;
+	mac[1] = 0x00;
+	mac[2] = 0x5e;
+	mac[3] = (ip >> 16) & 0x7f;
+	mac[4] = (ip >> 8) & 0xff;
+	mac[5] = ip & 0xff;
+}
+
+/* Tell the hardware what to let in.
+ * Never called with interrupts off.
+ * Returns nonzero if the hardware can't do it.
+ */
+static int
+mcast_filter ( void )
+{
+	unsigned char list[(MCAST_MAX+1) * ETH_ADDR_SIZE];
+	int count = 0;
+	int i;
+
+	mcast_ether ( htonl ( IGMP_ALL_HOSTS ), list );
+	count++;
+
+	INT_lock;
+	for ( i=0; i<MCAST_MAX; i++ ) {
+	    if ( mcast_table[i].group ) {
+		mcast_ether ( mcast_table[i].group, &list[count * ETH_ADDR_SIZE] );
+		count++;
+	    }
+	}
+	INT_unlock;
+
+	return board_net_mcast ( list, count );
+}
+
+/* After the network is up.
+ * All multicast goes out eth0 unless somebody says otherwise.
+ */
+void
+mcast_init ( void )
+{
+	(void) route_add ( htonl ( 0xe0000000 ), htonl ( 0xf0000000 ), 0, netif_primary );
+	if ( mcast_filter () )
+	    printf ( "No multicast filter, IP multicast is off\n" );
+}
+
+/* Returns 0 if we can't, either it is not a
+ * multicast address, the table is full, or the
+ * hardware has no filter to put it in.
+ */
+int
+ip_mcast_join ( u32 group )
+{
+	struct mcast_group *mp;
+
+	if ( ! IP_MULTICAST ( group ) )
+	    return 0;
+	if ( group == htonl ( IGMP_ALL_HOSTS ) )
+	    return 1;
+
+	INT_lock;
+	mp = mcast_lookup ( group );
+	if ( mp ) {
+	    mp->refs++;
+	    INT_unlock;
+	    return 1;
+	}
+
+	mp = mcast_lookup ( 0 );
+	if ( ! mp ) {
+	    INT_unlock;
+	    return 0;
+	}
+	mp->group = group;
+	mp->refs = 1;
+	mp->report = 1;
+	mcast_count++;
+	INT_unlock;
+
+	if ( mcast_filter () ) {
+	    INT_lock;
+	    if ( --mp->refs <= 0 ) {
+		mp->group = 0;
+		mp->report = 0;
+		mcast_count--;
+	    }
+	    INT_unlock;
+	    return 0;
+	}
+
+	igmp_send ( IGMP_REPORT, group, group );
+	return 1;
+}
+
+/* Returns 0 if we weren't in the group */
+int
+ip_mcast_leave ( u32 group )
+{
+	struct mcast_group *mp;
+
+	if ( group == htonl ( IGMP_ALL_HOSTS ) )
+	    return 1;
+
+	INT_lock;
+	mp = mcast_lookup ( group );
+	if ( ! mp || ! group ) {
+	    INT_unlock;
+	    return 0;
+	}
+	if ( --mp->refs > 0 ) {
+	    INT_unlock;
+	    return 1;
+	}
+	mp->group = 0;
+	mp->report = 0;
+	mcast_count--;
+	INT_unlock;
+
+	(void) mcast_filter ();
+	igmp_send ( IGMP_LEAVE, group, htonl ( IGMP_ALL_ROUTERS ) );
+	return 1;
+}
+
+/* From ip_check(), should we take a packet to this group ? */
+int
+ip_mcast_member ( u32 group )
+{
+	if ( group == htonl ( IGMP_ALL_HOSTS ) )
+	    return 1;
+	return mcast_lookup ( group ) != (struct mcast_group *) 0;
+}
+
+/* From not_our_mac(), for hardware that lets in more than it should */
+int
+ip_mcast_mac_ok ( unsigned char *mac )
+{
+	unsigned char gmac[ETH_ADDR_SIZE];
+	int i;
+
+	if ( mac[0] != 0x01 || mac[1] != 0x00 || mac[2] != 0x5e )
+	    return 0;
+
+	mcast_ether ( htonl ( IGMP_ALL_HOSTS ), gmac );
+	if ( memcmp ( mac, gmac, ETH_ADDR_SIZE ) == 0 )
+	    return 1;
+
+	for ( i=0; i<MCAST_MAX; i++ ) {
+	    if ( ! mcast_table[i].group )
+		continue;
+	    mcast_ether ( mcast_table[i].group, gmac );
+	    if ( memcmp ( mac, gmac, ETH_ADDR_SIZE ) == 0 )
+		return 1;
+	}
+	return 0;
+}
+
+void
+ip_mcast_ttl_set ( int ttl )
+{
+	if ( ttl < 1 )
+	    ttl = 1;
+	if ( ttl > 255 )
+	    ttl = 255;
+	ip_mcast_ttl = ttl;
+}
+
+/* IGMP goes out with the router alert option,
+ * so we build the IP header ourself.
+ */
+static void
+igmp_send ( int type, u32 group, u32 dst )
+{
+	struct netbuf *nbp;
+	struct ip_hdr *ipp;
+	struct igmp_hdr *igp;
+	u32 *opt;
+
+	nbp = netbuf_alloc_size ( sizeof(struct eth_hdr) + IGMP_IP_HLEN + IGMP_HLEN );
+	if ( ! nbp ) {
+	    net_drop ( NET_DROP_NOBUF );
+	    return;
+	}
+
+	ipp = nbp->iptr;
+	nbp->pptr = (char *) ipp + IGMP_IP_HLEN;
+	nbp->plen = IGMP_HLEN;
+	nbp->ilen = IGMP_IP_HLEN + IGMP_HLEN;
+
+	ipp->hl = IGMP_IP_HLEN / sizeof(u32);
+	ipp->ver = 4;
+	ipp->tos = 0;
+	ipp->len = htons ( nbp->ilen );
+	ipp->id = 0;
+	ipp->offset = 0;
+	ipp->ttl = 1;
+	ipp->proto = IPPROTO_IGMP;
+	ipp->src = ip_source ( dst );
+	ipp->dst = dst;
+	opt = (u32 *) ((char *) ipp + sizeof(struct ip_hdr));
+	*opt = htonl ( IP_OPT_RA );
+	ipp->sum = 0;
+	ipp->sum = in_cksum ( (char *) ipp, IGMP_IP_HLEN );
+
+	igp = (struct igmp_hdr *) nbp->pptr;
+	igp->type = type;
+	igp->code = 0;
+	igp->group = group;
+	igp->sum = 0;
+	igp->sum = in_cksum ( (char *) igp, IGMP_HLEN );
+
+	mcast_stats.out++;
+	ip_arp_send ( nbp );
+}
+
+/* From ip_deliver(), in the net thread */
+void
+igmp_rcv ( struct netbuf *nbp )
+{
+	struct igmp_hdr *igp = (struct igmp_hdr *) nbp->pptr;
+	struct mcast_group *mp;
+	int secs;
+	int i;
+
+	mcast_stats.in++;
+
+	if ( nbp->plen < IGMP_HLEN || in_cksum ( (char *) igp, nbp->plen ) ) {
+	    mcast_stats.bad++;
+	    netbuf_free ( nbp );
+	    return;
+	}
+
+	if ( igp->type == IGMP_QUERY ) {
+	    mcast_stats.queries++;
+
+	    /* A version 1 query says nothing */
+	    secs = igp->code / 10;
+	    if ( ! igp->code )
+		secs = IGMP_RESP_DEF;
+	    if ( secs < 1 )
+		secs = 1;
+
+	    /* Answer in our own good time, so that all
+	     * the hosts on the net don't answer at once.
+	     * Zero is a general query, all groups.
+	     */
+	    INT_lock;
+	    for ( i=0; i<MCAST_MAX; i++ ) {
+		mp = &mcast_table[i];
+		if ( ! mp->group )
+		    continue;
+		if ( igp->group && igp->group != mp->group )
+		    continue;
+		if ( mp->report && mp->report <= secs )
+		    continue;
+		mp->report = 1 + gb_unif_rand ( secs );
+	    }
+	    INT_unlock;
+
+	} else if ( igp->type == IGMP_REPORT || igp->type == IGMP_REPORT_V1 ) {
+	    /* Somebody beat us to it.
+	     * Our own reports don't come back to us.
+	     */
+	    INT_lock;
+	    mp = mcast_lookup ( igp->group );
+	    if ( mp && igp->group && mp->report ) {
+		mp->report = 0;
+		mcast_stats.quiet++;
+	    }
+	    INT_unlock;
+	}
+
+	netbuf_free ( nbp );
+}
+
+/* Once a second, from the net-timer thread */
+void
+igmp_tick ( void )
+{
+	u32 due[MCAST_MAX];
+	int ndue = 0;
+	int i;
+
+	if ( ! mcast_count )
+	    return;
+
+	INT_lock;
+	for ( i=0; i<MCAST_MAX; i++ ) {
+	    if ( mcast_table[i].group && mcast_table[i].report ) {
+		if ( --mcast_table[i].report == 0 )
+		    due[ndue++] = mcast_table[i].group;
+	    }
+	}
+	INT_unlock;
+
+	for ( i=0; i<ndue; i++ )
+	    igmp_send ( IGMP_REPORT, due[i], due[i] );
+}
+
+void
+mcast_show ( void )
+{
+	int i;
+
+	if ( ! mcast_count && ! mcast_stats.in )
+	    return;
+
+	printf ( "Multicast: %d groups, ttl %d\n", mcast_count, ip_mcast_ttl );
+	for ( i=0; i<MCAST_MAX; i++ ) {
+	    if ( mcast_table[i].group )
+		printf ( "  %s, %d users\n",
+		    ip2str32 ( mcast_table[i].group ), mcast_table[i].refs );
+	}
+	printf ( "  IGMP %d in (%d queries, %d bad), %d out, %d left to others\n",
+	    mcast_stats.in, mcast_stats.queries, mcast_stats.bad,
+	    mcast_stats.out, mcast_stats.quiet );
+}
+
+/* THE END */
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * net_raw.c
+ * Raw ethernet, for protocols with their own ether type.
+ *
+ * Some of our instruments talk plain ethernet frames with a type
+ * field of their own, no IP at all.  Wrapping that in UDP just to
+ * get it through the stack would be silly, so here you can open
+ * an ether type and get the frames that carry it.
+ *
+ * This is the fast path.  net_rcv() looks at the type as the driver
+ * hands the frame over (at interrupt level), and if somebody has
+ * opened it the netbuf goes right onto that opener's ring and the
+ * reader gets woken up.  It never goes near the input queue or the
+ * net thread, and nothing gets parsed past the ethernet header.
+ * Drivers that poll (see net_rcv_poll) go the same way, only from
+ * the net thread.  Capture doesn't see these frames.
+ *
+ * The ring is an array of netbuf pointers, RAW_RING_SIZE of them.
+ * When it is full new frames get dropped, so a reader that falls
+ * behind can't eat all the receive buffers.  There is one writer
+ * (interrupt code, or the net thread with interrupts off) and
+ * readers take frames off with interrupts off.
+ *
+ * Sending is just as simple: raw_send() puts on the ethernet header
+ * and hands the frame to net_send(), no IP, no ARP.  You have to
+ * know who you are talking to (the MAC address), but that is how
+ * these instruments work anyway.
+ *
+ * agent  10-19-2026
+ */
+
+#include <arch/types.h>
+#include <kyu.h>
+#include <kyulib.h>
+#include <thread.h>
+
+#include "net.h"
+#include "netbuf.h"
+#include "arch/cpu.h"
+
+#define RAW_MAX		4
+#define RAW_RING_SIZE	64		/* must be a power of 2 */
+
+#define ETH_HLEN	sizeof(struct eth_hdr)
+
+struct raw_sock {
+	unsigned short type;	/* network byte order, 0 if free */
+	unsigned short etype;	/* host order, for show */
+	struct netbuf *ring[RAW_RING_SIZE];
+	unsigned int head;	/* next one to read */
+	unsigned int tail;	/* next empty slot */
+	int rcv_count;
+	int drop_count;
+	int send_count;
+	struct sem *rsem;	/* readers wait here */
+};
+
+static struct raw_sock raw_table[RAW_MAX];
+
+/* So net_rcv() can skip all this */
+int raw_count;
+
+void
+raw_init ( void )
+{
+	int i;
+
+	for ( i=0; i<RAW_MAX; i++ ) {
+	    raw_table[i].rsem = sem_signal_new ( SEM_FIFO );
+	    sem_set_name ( raw_table[i].rsem, "raw-eth" );
+	}
+}
+
+/* Returns 0 if we can't have it: the type is IP or ARP,
+ * somebody else already has it, or the table is full.
+ * Types below 0x600 are lengths, not types.
+ */
+struct raw_sock *
+raw_open ( int etype )
+{
+	struct raw_sock *rp;
+	struct raw_sock *free_rp = (struct raw_sock *) 0;
+	unsigned short type = htons ( etype );
+	int i;
+
+	if ( etype < 0x600 || etype > 0xffff || etype == ETH_IP || etype == ETH_ARP )
+	    return (struct raw_sock *) 0;
+
+	INT_lock;
+	for ( i=0; i<RAW_MAX; i++ ) {
+	    rp = &raw_table[i];
+	    if ( rp->type == type ) {
+		INT_unlock;
+		return (struct raw_sock *) 0;
+	    }
+	    if ( ! rp->type && ! free_rp )
+		free_rp = rp;
+	}
+	if ( ! free_rp ) {
+	    INT_unlock;
+	    return (struct raw_sock *) 0;
+	}
+
+	rp = free_rp;
+	rp->etype = etype;
+	rp->head = rp->tail = 0;
+	rp->rcv_count = 0;
+	rp->drop_count = 0;
+	rp->send_count = 0;
+	rp->type = type;
+	raw_count++;
+	INT_unlock;
+
+	return rp;
+}
+
+/* Nobody should be waiting on it when this is called */
+void
+raw_close ( struct raw_sock *rp )
+{
+	INT_lock;
+	if ( ! rp->type ) {
+	    INT_unlock;
+	    return;
+	}
+	rp->type = 0;
+	raw_count--;
+
+	while ( rp->head != rp->tail ) {
+	    netbuf_free_i ( rp->ring[rp->head % RAW_RING_SIZE] );
+	    rp->head++;
+	}
+	INT_unlock;
+}
+
+/* From net_rcv() at interrupt level, or from the net thread
+ * with interrupts off.  Returns 1 if we took the frame.
+ */
+int
+raw_rcv_i ( struct netbuf *nbp )
+{
+	struct raw_sock *rp;
+	struct netif *ifp;
+	int i;
+
+	for ( i=0; i<RAW_MAX; i++ ) {
+	    rp = &raw_table[i];
+	    if ( rp->type && rp->type == nbp->eptr->type )
+		break;
+	}
+	if ( i == RAW_MAX )
+	    return 0;
+
+	ifp = nbp->ifp ? nbp->ifp : netif_primary;
+	NET_COUNT ( ifp->rx_packets, 1 );
+	NET_COUNT ( ifp->rx_bytes, nbp->elen );
+
+	if ( rp->tail - rp->head >= RAW_RING_SIZE ) {
+	    rp->drop_count++;
+	    NET_COUNT ( ifp->rx_drops, 1 );
+	    net_drop ( NET_DROP_QUEUE );
+	    netbuf_free_i ( nbp );
+	    return 1;
+	}
+
+	nbp->next = (struct netbuf *) 0;
+	nbp->dptr = (char *) nbp->eptr + ETH_HLEN;
+	nbp->dlen = nbp->elen - ETH_HLEN;
+
+	rp->ring[rp->tail % RAW_RING_SIZE] = nbp;
+	rp->tail++;
+	rp->rcv_count++;
+
+	cpu_signal ( rp->rsem );
+	return 1;
+}
+
+/* Zero copy receive.
+ * The frame (after the ethernet header) is at dptr/dlen,
+ * the sender is in eptr->src, and the caller hands the
+ * netbuf back with netbuf_free().
+ * Returns 0 on timeout.
+ */
+struct netbuf *
+raw_recv_nb ( struct raw_sock *rp, int timeout )
+{
+	struct netbuf *nbp;
+	int start = 0;
+	int left;
+
+	if ( timeout > 0 )
+	    start = get_timer_count_t ();
+
+	for ( ;; ) {
+	    INT_lock;
+	    if ( rp->head != rp->tail ) {
+		nbp = rp->ring[rp->head % RAW_RING_SIZE];
+		rp->head++;
+		INT_unlock;
+		return nbp;
+	    }
+	    INT_unlock;
+
+	    if ( timeout == 0 )
+		return (struct netbuf *) 0;
+
+	    if ( timeout == UDP_WAIT_FOREVER ) {
+		sem_block ( rp->rsem );
+		continue;
+	    }
+
+	    left = timeout - (get_timer_count_t () - start);
+	    if ( left <= 0 )
+		return (struct netbuf *) 0;
+	    sem_block_t ( rp->rsem, left );
+	}
+}
+
+/* Copy one frame out, anything past len is lost.
+ * src may be null if you don't care who sent it.
+ * Returns the length, or -1 on timeout.
+ */
+int
+raw_recv ( struct raw_sock *rp, char *buf, int len, unsigned char *src, int timeout )
+{
+	struct netbuf *nbp;
+
+	nbp = raw_recv_nb ( rp, timeout );
+	if ( ! nbp )
+	    return -1;
+
+	if ( len > nbp->dlen )
+	    len = nbp->dlen;
+	memcpy ( buf, nbp->dptr, len );
+	if ( src )
+	    memcpy ( src, nbp->eptr->src, ETH_ADDR_SIZE );
+
+	netbuf_free ( nbp );
+	return len;
+}
+
+/* For zero copy send, fill in dptr then call raw_send_nb().
+ * Always big enough to pad out to the minimum frame.
+ */
+struct netbuf *
+raw_alloc ( int size )
+{
+	struct netbuf *nbp;
+
+	if ( size < ETH_MIN_SIZE - ETH_HLEN )
+	    nbp = netbuf_alloc_size ( ETH_MIN_SIZE );
+	else
+	    nbp = netbuf_alloc_size ( ETH_HLEN + size );
+	if ( ! nbp )
+	    return nbp;
+
+	nbp->dptr = (char *) nbp->eptr + ETH_HLEN;
+	nbp->dlen = size;
+	return nbp;
+}
+
+/* dlen says how much of the netbuf to send.
+ * Short frames get padded out with zeros.
+ */
+void
+raw_send_nb ( struct raw_sock *rp, unsigned char *dst, struct netbuf *nbp )
+{
+	int len = nbp->dlen;
+
+	if ( len < ETH_MIN_SIZE - ETH_HLEN ) {
+	    memset ( nbp->dptr + len, 0, ETH_MIN_SIZE - ETH_HLEN - len );
+	    len = ETH_MIN_SIZE - ETH_HLEN;
+	}
+
+	memcpy ( nbp->eptr->dst, dst, ETH_ADDR_SIZE );
+	nbp->eptr->type = rp->type;
+	nbp->ilen = len;
+	nbp->ifp = netif_primary;
+
+	rp->send_count++;
+	net_send ( nbp );
+}
+
+/* Returns the length sent, or -1 if we can't */
+int
+raw_send ( struct raw_sock *rp, unsigned char *dst, char *buf, int len )
+{
+	struct netbuf *nbp;
+
+	if ( len < 0 || len > ETH_MAX_SIZE - ETH_HLEN )
+	    return -1;
+
+	nbp = raw_alloc ( len );
+	if ( ! nbp )
+	    return -1;
+
+	memcpy ( nbp->dptr, buf, len );
+	raw_send_nb ( rp, dst, nbp );
+	return len;
+}
+
+void
+raw_show ( void )
+{
+	struct raw_sock *rp;
+	int i;
+
+	for ( i=0; i<RAW_MAX; i++ ) {
+	    rp = &raw_table[i];
+	    if ( ! rp->type )
+		continue;
+	    printf ( "Raw ether type %04x: %d received, %d dropped, %d queued, %d sent\n",
+		rp->etype, rp->rcv_count, rp->drop_count,
+		rp->tail - rp->head, rp->send_count );
+	}
+}
+
+/* THE END */
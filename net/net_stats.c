@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * net_stats.c
+ * Network statistics, all in one place.
+ *
+ * Counters used to live wherever somebody needed one, and a lot of
+ * trouble just got a printf.  Now there are three kinds here:
+ *  - net_stats[], counts of packets in and out by protocol,
+ *	and the high water marks of our queues (NET_STAT, NET_STAT_HWM).
+ *  - net_drops[], packets we threw away, by reason (net_drop).
+ *  - and each interface keeps its own packet and byte counts.
+ * One set of counters, bumped with an atomic add (NET_COUNT in
+ * net.h) since they get hit from interrupt routines, threads and
+ * maybe other cores.  That is still cheap enough to do anywhere.
+ *
+ * net_stats_show() prints it all for a person.  For a program,
+ * net_stats_format() gives "name value" lines, one per counter.
+ * You can fetch that as "stats" from the tftp server, or have it
+ * sent to you as a UDP datagram every so often with
+ * net_stats_export().  The names don't change, so a script
+ * scraping them can count on that.
+ *
+ * agent  10-19-2026
+ */
+
+#include <arch/types.h>
+#include <kyu.h>
+#include <kyulib.h>
+
+#include "net.h"
+#include "netbuf.h"
+#include "arch/cpu.h"
+
+int net_stats[NS_NUM];
+
+static char *net_stat_names[NS_NUM] = {
+	"arp.in", "arp.out", "ip.in", "ip.out",
+	"icmp.in", "icmp.out", "udp.in", "udp.out",
+	"tcp.in", "tcp.out", "frag.in", "frag.out",
+	"hwm.inq", "hwm.outq", "hwm.loopq", "hwm.tcpq"
+};
+
+/* Packets we threw away, by reason */
+static int net_drops[NET_DROP_NUM];
+
+static char *net_drop_names[NET_DROP_NUM] = {
+	"no_netbuf", "queue_full", "not_our_mac", "ether_type",
+	"ip_checksum", "ip_fragment", "ip_protocol", "udp_port",
+	"load_shed", "udp_checksum", "ring_full", "no_route",
+	"arp", "if_down", "mcast_group"
+};
+
+/* Periodic export */
+#define NS_BUF_SIZE	2048
+
+static char ns_buf[NS_BUF_SIZE];
+static u32 ns_ip;
+static int ns_port;
+static int ns_secs;
+static int ns_count;
+
+static int net_stats_tftp ( void *, struct tftp_seg * );
+
+void
+net_stats_init ( void )
+{
+#ifdef WANT_TFTPD
+	tftpd_export_fn ( "stats", net_stats_tftp, (void *) 0 );
+#endif
+}
+
+/* Can be called at interrupt level */
+void
+net_drop ( int reason )
+{
+	if ( reason >= 0 && reason < NET_DROP_NUM )
+	    NET_COUNT ( net_drops[reason], 1 );
+}
+
+/* Add one "name value" line, returns the new length */
+static int
+ns_line ( char *buf, int len, int size, char *pre, char *name, int val )
+{
+	int n;
+
+	if ( len >= size )
+	    return len;
+	n = snprintf ( buf + len, size - len, "%s%s %d\n", pre, name, val );
+	if ( n < 0 || len + n >= size )
+	    return size;
+	return len + n;
+}
+
+/* Everything, as text.  Returns the length. */
+int
+net_stats_format ( char *buf, int size )
+{
+	struct netif *ifp;
+	char pre[NETIF_NAME+4];
+	int len = 0;
+	int i;
+
+	len = ns_line ( buf, len, size, "", "uptime", get_timer_count_s () );
+
+	for ( i=0; i<NS_NUM; i++ )
+	    len = ns_line ( buf, len, size, "", net_stat_names[i], net_stats[i] );
+
+	for ( i=0; i<NET_DROP_NUM; i++ )
+	    len = ns_line ( buf, len, size, "drop.", net_drop_names[i], net_drops[i] );
+
+	for ( i=0; (ifp = netif_get ( i )); i++ ) {
+	    snprintf ( pre, sizeof(pre), "%s.", ifp->name );
+	    len = ns_line ( buf, len, size, pre, "rx_packets", ifp->rx_packets );
+	    len = ns_line ( buf, len, size, pre, "rx_bytes", ifp->rx_bytes );
+	    len = ns_line ( buf, len, size, pre, "rx_drops", ifp->rx_drops );
+	    len = ns_line ( buf, len, size, pre, "tx_packets", ifp->tx_packets );
+	    len = ns_line ( buf, len, size, pre, "tx_bytes", ifp->tx_bytes );
+	    len = ns_line ( buf, len, size, pre, "tx_drops", ifp->tx_drops );
+	}
+
+	if ( len > size - 1 )
+	    len = size - 1;
+	return len;
+}
+
+void
+net_stats_show ( void )
+{
+	int i;
+
+	printf ( "Packets in/out:" );
+	printf ( " ARP %d/%d, IP %d/%d, ICMP %d/%d\n",
+	    net_stats[NS_ARP_IN], net_stats[NS_ARP_OUT],
+	    net_stats[NS_IP_IN], net_stats[NS_IP_OUT],
+	    net_stats[NS_ICMP_IN], net_stats[NS_ICMP_OUT] );
+	printf ( "  UDP %d/%d, TCP %d/%d, IP fragments %d/%d\n",
+	    net_stats[NS_UDP_IN], net_stats[NS_UDP_OUT],
+	    net_stats[NS_TCP_IN], net_stats[NS_TCP_OUT],
+	    net_stats[NS_FRAG_IN], net_stats[NS_FRAG_OUT] );
+	printf ( "Most queued: in %d, out %d, loopback %d, TCP %d\n",
+	    net_stats[NS_INQ_HWM], net_stats[NS_OUTQ_HWM],
+	    net_stats[NS_LOOPQ_HWM], net_stats[NS_TCPQ_HWM] );
+
+	for ( i=0; i<NET_DROP_NUM; i++ ) {
+	    if ( net_drops[i] )
+		printf ( "Dropped (%s): %d\n", net_drop_names[i], net_drops[i] );
+	}
+
+	if ( ns_secs )
+	    printf ( "Stats to %s:%d every %d seconds, %d sent\n",
+		ip2str32 ( ns_ip ), ns_port, ns_secs, ns_count );
+}
+
+/* Send the lot to ip:port every secs seconds.
+ * The ip is in network order, as udp_send() wants it.
+ * Zero seconds turns it off.
+ */
+void
+net_stats_export ( u32 ip, int port, int secs )
+{
+	ns_secs = 0;
+	ns_ip = ip;
+	ns_port = port;
+	ns_count = 0;
+	ns_secs = secs;
+}
+
+/* Once a second, from the net-timer thread */
+void
+net_stats_tick ( void )
+{
+	int len;
+
+	if ( ! ns_secs )
+	    return;
+	if ( get_timer_count_s () % ns_secs )
+	    return;
+
+	len = net_stats_format ( ns_buf, NS_BUF_SIZE );
+	udp_send ( ns_ip, get_ephem_port (), ns_port, ns_buf, len );
+	ns_count++;
+}
+
+/* The tftp server runs in its own thread, so it gets its own buffer */
+static char ns_tftp_buf[NS_BUF_SIZE];
+
+static int
+net_stats_tftp ( void *arg, struct tftp_seg *seg )
+{
+	if ( ! seg )
+	    return 0;
+
+	seg->addr = ns_tftp_buf;
+	seg->len = net_stats_format ( ns_tftp_buf, NS_BUF_SIZE );
+	return 1;
+}
+
+/* THE END */
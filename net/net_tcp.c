@@ -67,9 +67,12 @@ tcp_none_initialize ( void )
 {
 }
 
+/* Nobody wants it, but we must not leak the netbuf */
 static void
 tcp_none_rcv ( struct netbuf *nbp )
 {
+	net_drop ( NET_DROP_PROTO );
+	netbuf_free ( nbp );
 }
 #endif
 
@@ -84,6 +87,25 @@ tcp_rcv ( struct netbuf *nbp )
 	//netbuf_free ( nbp );
 }
 
+/* Pass a list of received packets on to TCP
+ */
+void
+tcp_rcv_list ( struct netbuf *list )
+{
+	struct netbuf *nbp;
+
+	if ( tcp_ops->rcv_list ) {
+	    (*tcp_ops->rcv_list) (list);
+	    return;
+	}
+
+	while ( list ) {
+	    nbp = list;
+	    list = nbp->next;
+	    (*tcp_ops->rcv) (nbp);
+	}
+}
+
 #ifdef notHERE
 /* moved to tcp_bsd/test.c 11-21-2022 */
 void xtest_show ( long );
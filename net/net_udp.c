@@ -32,16 +32,47 @@ struct udp_hdr {
 
 extern struct host_info host_info;
 
+/* Receivers are found by hashing the port number.
+ *
+ * Only the net thread ever looks up a port (udp_rcv), and we don't
+ * want it taking a mutex for every datagram.  So lookups take no lock
+ * at all.  Changes still go through udp_sem, and they are made so that
+ * the net thread always sees either the old table or the new one:
+ *  - a new entry is filled in completely before one store links it in.
+ *  - an unhooked entry is unlinked with one store, but it is not freed.
+ *    The net thread might be preempted halfway down that very chain.
+ *    It goes on a retired list, and the net thread frees it the next
+ *    time it calls udp_rcv() or runs out of work, when it cannot be
+ *    looking at anything.
+ * Kyu runs on one core, so all we need is to keep the compiler from
+ * moving the stores around.
+ */
 struct udp_proto {
 	struct udp_proto *next;
 	int port;
 	ufptr func;
+	struct udp_sock *sock;		/* queue to a socket instead of func */
+	struct udp_proto *rnext;	/* retired list */
+	int rcv_count;		/* counters only touched by the net thread */
+	int drop_count;
 };
 
-static struct udp_proto *head = (struct udp_proto *) 0;
+#define UDP_HASH_SIZE	64	/* must be a power of 2 */
+#define UDP_HASH(port)	((port) & (UDP_HASH_SIZE-1))
+
+static int udp_sock_deliver ( struct udp_sock *, struct netbuf * );
+static void udp_sock_free ( struct udp_sock * );
+void udp_sock_show ( void );
+
+static struct udp_proto *udp_hash[UDP_HASH_SIZE];
+static struct udp_proto *udp_retired;
+static int udp_nports;
+
+#define udp_barrier()	asm volatile ( "" : : : "memory" )
 
 /* 8-17-2016 - we really need this to avoid a race between
  * unhook and checking the table during packet reception.
+ * 2026 - now it only keeps writers from tangling with each other.
  */
 static struct sem *udp_sem;
 
@@ -55,75 +86,197 @@ udp_init ( void )
 	sem_set_name ( udp_sem, "udp-lock" );
 }
 
-void
-udp_hookup ( int port, ufptr func )
+/* Returns 0 if the port belongs to a socket.
+ * Taking it over would leave that socket with nobody to
+ * free it, and its close would unhook the new owner.
+ * Returns -1 if we are out of memory.
+ */
+static int
+udp_hookup_sock ( int port, ufptr func, struct udp_sock *so )
 {
 	struct udp_proto *pp;
+	int h = UDP_HASH ( port );
 
 	UDP_LOCK;
 	/* replace any existing entry (untested) */
-	for ( pp = head; pp; pp = pp->next ) {
+	for ( pp = udp_hash[h]; pp; pp = pp->next ) {
 	    if ( pp->port == port ) {
+		if ( pp->sock ) {
+		    UDP_UNLOCK;
+		    return 0;
+		}
+		pp->sock = so;
 		pp->func = func;
 		UDP_UNLOCK;
-		return;
+		return 1;
 	    }
 	}
 
 	pp = (struct udp_proto *) malloc ( sizeof(struct udp_proto) );
+	if ( ! pp ) {
+	    UDP_UNLOCK;
+	    return -1;
+	}
 	pp->port = port;
 	pp->func = func;
-	pp->next = head;
-	head = pp;
+	pp->sock = so;
+	pp->rcv_count = 0;
+	pp->drop_count = 0;
+	pp->next = udp_hash[h];
+
+	/* publish */
+	udp_barrier ();
+	udp_hash[h] = pp;
+	udp_nports++;
 	UDP_UNLOCK;
+	return 1;
 }
 
-#ifdef notdef
 void
-udp_showl ( void )
+udp_hookup ( int port, ufptr func )
 {
-	struct udp_proto *pp;
+	int rv;
 
-	printf ( "UDP head: %08x\n", head );
-	for ( pp = head; pp; pp = pp->next )
-	    printf ( "UDP port %d\n", pp->port );
+	rv = udp_hookup_sock ( port, func, (struct udp_sock *) 0 );
+	if ( rv == 0 )
+	    printf ( "UDP port %d belongs to a socket, hookup refused\n", port );
+	if ( rv < 0 )
+	    printf ( "UDP port %d, no memory for hookup\n", port );
 }
-#endif
 
 void
 udp_unhook ( int port )
 {
 	struct udp_proto *pp;
-	struct udp_proto *prior;
-	struct udp_proto *save;
+	struct udp_proto **prior;
+	int retired = 0;
 
 	// printf ( "UDP unhook for %d\n", port );
-	if ( ! head )
-	    return;
-
 	UDP_LOCK;
-	if ( head->port == port ) {
-	    save = head;
-	    head = save->next;
-	    free ( save );
-	    UDP_UNLOCK;
-	    //udp_showl ();
-	    return;
-	}
-
-	prior = head;
-	for ( pp = prior->next; pp; pp = prior->next ) {
+	for ( prior = &udp_hash[UDP_HASH(port)]; (pp = *prior); prior = &pp->next ) {
 	    if ( pp->port == port ) {
-		prior->next = pp->next;
-		free ( pp );
-		UDP_UNLOCK;
-		//udp_showl ();
-		return;
+		*prior = pp->next;
+		udp_nports--;
+
+		/* pp->next stays valid for anyone still on it */
+		udp_barrier ();
+		INT_lock;
+		pp->port = -1;
+		pp->rnext = udp_retired;
+		udp_retired = pp;
+		INT_unlock;
+		retired = 1;
+		break;
 	    }
-	    prior = pp;
 	}
+	UDP_UNLOCK;
 
+	/* Don't wait for the next packet to free it */
+	if ( retired )
+	    net_want_tidy ();
+}
+
+/* Only the net thread calls this, see above.
+ * It does when a packet comes in, and when it goes
+ * idle after someone unhooked a port (net_want_tidy).
+ */
+void
+udp_reclaim ( void )
+{
+	struct udp_proto *pp, *xp;
+
+	INT_lock;
+	pp = udp_retired;
+	udp_retired = (struct udp_proto *) 0;
+	INT_unlock;
+
+	for ( ; pp; pp = xp ) {
+	    xp = pp->rnext;
+	    if ( pp->sock )
+		udp_sock_free ( pp->sock );
+	    free ( pp );
+	}
+}
+
+/* Lockless, only for the net thread */
+static struct udp_proto *
+udp_lookup ( int port )
+{
+	struct udp_proto *pp;
+
+	for ( pp = udp_hash[UDP_HASH(port)]; pp; pp = pp->next ) {
+	    if ( pp->port == port )
+		return pp;
+	}
+	return (struct udp_proto *) 0;
+}
+
+void
+udp_show ( void )
+{
+	struct udp_proto *pp;
+	int nret = 0;
+	int i;
+
+	INT_lock;
+	for ( pp = udp_retired; pp; pp = pp->rnext )
+	    nret++;
+	INT_unlock;
+
+	printf ( "UDP ports: %d, %d retired\n", udp_nports, nret );
+
+	UDP_LOCK;
+	for ( i=0; i<UDP_HASH_SIZE; i++ ) {
+	    for ( pp = udp_hash[i]; pp; pp = pp->next )
+		printf ( " port %5d: %d received, %d dropped\n",
+		    pp->port, pp->rcv_count, pp->drop_count );
+	}
 	UDP_UNLOCK;
+
+	udp_sock_show ();
+}
+
+/* Check the UDP checksum, pseudo header and all.
+ * A zero checksum means the sender didn't bother.
+ * Returns 1 if the packet looks good.
+ */
+static int
+udp_cksum_ok ( struct netbuf *nbp )
+{
+	struct udp_hdr *udp;
+	struct netbuf *xbp;
+	unsigned int sum;
+	int len;
+
+	if ( nbp->flags & NB_CSUM_OK )
+	    return 1;
+
+	udp = (struct udp_hdr *) nbp->pptr;
+	if ( udp->sum == 0 )
+	    return 1;
+
+	/* Don't trust plen, short frames get padded */
+	len = ntohs ( udp->len );
+	if ( len < sizeof(struct udp_hdr) || len > nbp->plen )
+	    return 0;
+
+	/* src and dst are adjacent in the IP header */
+	sum = csum_partial ( &nbp->iptr->src, 2 * sizeof(u32), 0 );
+	sum = csum_add ( sum, htons ( IPPROTO_UDP ) );
+	sum = csum_add ( sum, udp->len );
+
+	/* Fragments all hold a multiple of 8 bytes,
+	 * so the pieces just add up.
+	 */
+	if ( nbp->frag ) {
+	    if ( len != nbp->plen )
+		return 0;
+	    for ( xbp = nbp; xbp; xbp = xbp->frag )
+		sum = csum_partial ( xbp->pptr, xbp->flen, sum );
+	} else
+	    sum = csum_partial ( udp, len, sum );
+
+	return csum_fold ( sum ) == 0xffff;
 }
 
 int
@@ -154,25 +307,38 @@ udp_rcv ( struct netbuf *nbp )
 		ip2str32 ( nbp->iptr->src ), ntohs(udp->sport), ntohs(udp->dport) );
 #endif
 
-	/* XXX - validate checksum of received packets
-	 */
+	/* We are between packets, nobody can be using these */
+	if ( udp_retired )
+	    udp_reclaim ();
 
 	port = ntohs(udp->dport);
+	pp = udp_lookup ( port );
+
+	if ( ! udp_cksum_ok ( nbp ) ) {
+	    if ( pp )
+		pp->drop_count++;
+	    net_drop ( NET_DROP_UDPSUM );
+	    return;
+	}
 
 	pkt_dispatch ();
 
 	// printf ( "UDP receive for port %d\n", port );
-	// udp_showl ();
 
-	UDP_LOCK;
-	for ( pp = head; pp; pp = pp->next ) {
-	    if ( port == pp->port )
-		break;
-	}
-	UDP_UNLOCK;
-
-	if ( pp )
+	if ( pp && pp->sock ) {
+	    if ( udp_sock_deliver ( pp->sock, nbp ) )
+		pp->rcv_count++;
+	    else
+		pp->drop_count++;
+	} else if ( pp && nbp->frag ) {
+	    /* Handlers expect the whole thing in one netbuf */
+	    pp->drop_count++;
+	    net_drop ( NET_DROP_FRAG );
+	} else if ( pp ) {
+	    pp->rcv_count++;
 	    ( *pp->func ) ( nbp );
+	} else
+	    net_drop ( NET_DROP_NOPORT );
 }
 
 struct bogus_ip {
@@ -187,23 +353,35 @@ struct bogus_ip {
 	u32 dst;
 };
 
-void
-udp_send ( u32 dest_ip, int sport, int dport, char *buf, int size )
+/* Get a netbuf ready for a UDP payload of the given size,
+ * dptr points at where the caller should put it.
+ * A caller that builds its payload in place (the tftp server)
+ * saves the copy that udp_send() has to make.
+ */
+struct netbuf *
+udp_alloc ( int size )
 {
-	struct udp_hdr *udp;
 	struct netbuf *nbp;
-	struct bogus_ip *bip;
 
-	nbp = netbuf_alloc ();
+	nbp = netbuf_alloc_size ( sizeof(struct eth_hdr) + sizeof(struct ip_hdr) + sizeof(struct udp_hdr) + size );
 	if ( ! nbp )
-	    return;
+	    return nbp;
 
 	nbp->pptr = (char *) nbp->iptr + sizeof ( struct ip_hdr );
 	nbp->dptr = nbp->pptr + sizeof ( struct udp_hdr );
+	nbp->dlen = size;
+	return nbp;
+}
 
-	memcpy ( nbp->dptr, buf, size );
+/* Send a netbuf from udp_alloc(), dlen says how much of it */
+void
+udp_send_nb ( u32 dest_ip, int sport, int dport, struct netbuf *nbp )
+{
+	struct udp_hdr *udp;
+	struct bogus_ip *bip;
+	int size;
 
-	size += sizeof(struct udp_hdr);
+	size = nbp->dlen + sizeof(struct udp_hdr);
 	nbp->plen = size;
 	nbp->ilen = size + sizeof(struct ip_hdr);
 
@@ -223,16 +401,71 @@ udp_send ( u32 dest_ip, int sport, int dport, char *buf, int size )
 	bip->proto = IPPROTO_UDP;
 	bip->len = udp->len;
 	bip->dst = dest_ip;
-	bip->src = host_info.my_ip;
+	bip->src = ip_source ( dest_ip );
 
 	/*
 	udp->sum = in_cksum ( nbp->iptr, nbp->ilen );
 	*/
-	udp->sum = ~in_cksum_i ( nbp->iptr, nbp->ilen, 0 );
+	if ( ip_csum_tx ( dest_ip ) )
+	    nbp->flags |= NB_CSUM_TX;
+	else {
+	    /* zero means "no checksum", so send all ones instead */
+	    udp->sum = ~in_cksum_i ( nbp->iptr, nbp->ilen, 0 );
+	    if ( udp->sum == 0 )
+		udp->sum = 0xffff;
+	}
 
 	ip_send ( nbp, dest_ip );
 }
 
+/* Too big for one frame, IP will send it in fragments.
+ * We have to do the checksum here, over the whole thing.
+ */
+static void
+udp_send_frag ( u32 dest_ip, int sport, int dport, char *buf, int size )
+{
+	struct udp_hdr udp;
+	u32 src = ip_source ( dest_ip );
+	unsigned int sum;
+
+	udp.sport = htons(sport);
+	udp.dport = htons(dport);
+	udp.len = htons(size + sizeof(struct udp_hdr));
+	udp.sum = 0;
+
+	sum = csum_partial ( &src, sizeof(u32), 0 );
+	sum = csum_partial ( &dest_ip, sizeof(u32), sum );
+	sum = csum_add ( sum, htons ( IPPROTO_UDP ) );
+	sum = csum_add ( sum, udp.len );
+	sum = csum_partial ( &udp, sizeof(struct udp_hdr), sum );
+	sum = csum_partial ( buf, size, sum );
+
+	/* zero means "no checksum", so send all ones instead */
+	udp.sum = ~csum_fold ( sum );
+	if ( udp.sum == 0 )
+	    udp.sum = 0xffff;
+
+	ip_send_frag ( dest_ip, IPPROTO_UDP, (char *) &udp, sizeof(struct udp_hdr), buf, size );
+}
+
+void
+udp_send ( u32 dest_ip, int sport, int dport, char *buf, int size )
+{
+	struct netbuf *nbp;
+
+	if ( size > IP_MTU - sizeof(struct ip_hdr) - sizeof(struct udp_hdr) ) {
+	    udp_send_frag ( dest_ip, sport, dport, buf, size );
+	    return;
+	}
+
+	nbp = udp_alloc ( size );
+	if ( ! nbp )
+	    return;
+
+	memcpy ( nbp->dptr, buf, size );
+	udp_send_nb ( dest_ip, sport, dport, nbp );
+}
+
 /* This is a kind of funky hack to be sure the source IP gets set to
  *  zero for a broadcast, even if we know our IP (or think we do).
  */
@@ -251,4 +484,294 @@ udp_broadcast ( int sport, int dport, char *buf, int size )
 	host_info.my_ip = save;
 }
 
+/* -------------------------------------------------- */
+/* UDP sockets
+ *
+ * udp_hookup() runs the handler in the net thread, so a slow
+ * handler stalls all network input.  A socket instead gets
+ * its datagrams on a queue, and whatever thread likes can
+ * come and get them.
+ *
+ * Timeouts are in clock ticks, 0 does not wait at all,
+ * UDP_WAIT_FOREVER waits, well ...
+ * Addresses are in network byte order, ports are not.
+ *
+ * Queued datagrams are the netbufs they arrived in, so
+ * the queue length (UDP_SOCK_QMAX) is also how many receive
+ * buffers one socket can tie up.  When it is full we drop
+ * the new arrival.
+ * The queue is shared with the net thread, so it is
+ * protected by INT_lock.
+ */
+
+#define UDP_SOCK_QMAX	32
+
+struct udp_sock {
+	struct udp_sock *next;
+	int port;
+	struct netbuf *head;
+	struct netbuf *tail;
+	int count;
+	int qmax;
+	int rcv_count;
+	int drop_count;
+	struct sem *rsem;	/* readers wait here */
+};
+
+static struct udp_sock *udp_sock_list;
+
+/* Called in the net thread, from udp_rcv().
+ * We hold a reference to the netbuf,
+ * the caller still frees its own.
+ */
+static int
+udp_sock_deliver ( struct udp_sock *so, struct netbuf *nbp )
+{
+	INT_lock;
+	if ( so->count >= so->qmax ) {
+	    so->drop_count++;
+	    INT_unlock;
+	    return 0;
+	}
+
+	nbp->refcount++;
+	nbp->next = (struct netbuf *) 0;
+	if ( so->head )
+	    so->tail->next = nbp;
+	else
+	    so->head = nbp;
+	so->tail = nbp;
+	so->count++;
+	so->rcv_count++;
+	INT_unlock;
+
+	/* Nobody waiting is fine, the sem remembers */
+	sem_unblock ( so->rsem );
+	return 1;
+}
+
+/* Port 0 asks for an ephemeral port.
+ * Returns 0 if some other socket has the port,
+ * or we are out of memory.
+ */
+struct udp_sock *
+udp_sock_open ( int port )
+{
+	struct udp_sock *so;
+
+	if ( port == 0 )
+	    port = get_ephem_port ();
+
+	so = (struct udp_sock *) malloc ( sizeof(struct udp_sock) );
+	if ( ! so )
+	    return (struct udp_sock *) 0;
+	so->port = port;
+	so->head = so->tail = (struct netbuf *) 0;
+	so->count = 0;
+	so->qmax = UDP_SOCK_QMAX;
+	so->rcv_count = 0;
+	so->drop_count = 0;
+	so->rsem = sem_signal_new ( SEM_FIFO );
+	if ( ! so->rsem ) {
+	    free ( so );
+	    return (struct udp_sock *) 0;
+	}
+	sem_set_name ( so->rsem, "udp-sock" );
+
+	if ( udp_hookup_sock ( port, (ufptr) 0, so ) <= 0 ) {
+	    udp_sock_free ( so );
+	    return (struct udp_sock *) 0;
+	}
+
+	UDP_LOCK;
+	so->next = udp_sock_list;
+	udp_sock_list = so;
+	UDP_UNLOCK;
+
+	return so;
+}
+
+/* Nobody should be waiting on the socket when this is called */
+void
+udp_sock_close ( struct udp_sock *so )
+{
+	struct udp_sock **pp;
+	struct netbuf *nbp, *xbp;
+
+	/* Stop taking packets */
+	INT_lock;
+	so->qmax = 0;
+	nbp = so->head;
+	so->head = so->tail = (struct netbuf *) 0;
+	so->count = 0;
+	INT_unlock;
+
+	for ( ; nbp; nbp = xbp ) {
+	    xbp = nbp->next;
+	    netbuf_free ( nbp );
+	}
+
+	UDP_LOCK;
+	for ( pp = &udp_sock_list; *pp; pp = &(*pp)->next )
+	    if ( *pp == so ) {
+		*pp = so->next;
+		break;
+	    }
+	UDP_UNLOCK;
+
+	/* The net thread could still be delivering to us,
+	 * so the socket gets freed along with the retired port
+	 * (see udp_reclaim).
+	 */
+	udp_unhook ( so->port );
+}
+
+static void
+udp_sock_free ( struct udp_sock *so )
+{
+	sem_destroy ( so->rsem );
+	free ( so );
+}
+
+int
+udp_sock_port ( struct udp_sock *so )
+{
+	return so->port;
+}
+
+/* Set the queue limit */
+void
+udp_sock_qmax ( struct udp_sock *so, int qmax )
+{
+	so->qmax = qmax;
+}
+
+/* Take one netbuf off the queue, waiting if told to */
+static struct netbuf *
+udp_sock_get ( struct udp_sock *so, int timeout )
+{
+	struct netbuf *nbp;
+	int start = 0;
+	int left;
+
+	if ( timeout > 0 )
+	    start = get_timer_count_t ();
+
+	for ( ;; ) {
+	    INT_lock;
+	    nbp = so->head;
+	    if ( nbp ) {
+		so->head = nbp->next;
+		so->count--;
+		INT_unlock;
+		nbp->next = (struct netbuf *) 0;
+		return nbp;
+	    }
+	    INT_unlock;
+
+	    if ( timeout == 0 )
+		return (struct netbuf *) 0;
+
+	    if ( timeout == UDP_WAIT_FOREVER ) {
+		sem_block ( so->rsem );
+		continue;
+	    }
+
+	    left = timeout - (get_timer_count_t () - start);
+	    if ( left <= 0 )
+		return (struct netbuf *) 0;
+	    sem_block_t ( so->rsem, left );
+	}
+}
+
+/* Zero copy receive.
+ * The caller gets the netbuf itself, the data is at dptr/dlen,
+ * and must hand it back with netbuf_free().
+ * Returns 0 on timeout.
+ */
+struct netbuf *
+udp_recv_nb ( struct udp_sock *so, int timeout )
+{
+	return udp_sock_get ( so, timeout );
+}
+
+/* Copy one datagram out, anything past len is lost.
+ * ip and port may be null if you don't care who sent it.
+ * Returns the length, or -1 on timeout.
+ */
+int
+udp_recvfrom ( struct udp_sock *so, char *buf, int len, u32 *ip, int *port, int timeout )
+{
+	struct netbuf *nbp;
+
+	nbp = udp_sock_get ( so, timeout );
+	if ( ! nbp )
+	    return -1;
+
+	len = netbuf_copy_data ( nbp, buf, len );
+
+	if ( ip )
+	    *ip = nbp->iptr->src;
+	if ( port )
+	    *port = udp_get_sport ( nbp );
+
+	netbuf_free ( nbp );
+	return len;
+}
+
+/* Batch receive, like recvmmsg().
+ * We wait (per timeout) for the first datagram, then take as
+ * many more as are already queued, up to n.
+ * Each msg supplies buf and len, we fill in len, ip and port.
+ * Returns how many we got (0 on timeout).
+ */
+int
+udp_recvmmsg ( struct udp_sock *so, struct udp_msg *msg, int n, int timeout )
+{
+	int i;
+	int len;
+
+	/* Slots we don't fill keep their len */
+	for ( i=0; i<n; i++ ) {
+	    len = udp_recvfrom ( so, msg[i].buf, msg[i].len,
+				&msg[i].ip, &msg[i].port, i ? 0 : timeout );
+	    if ( len < 0 )
+		break;
+	    msg[i].len = len;
+	}
+	return i;
+}
+
+int
+udp_sendto ( struct udp_sock *so, u32 ip, int port, char *buf, int len )
+{
+	udp_send ( ip, so->port, port, buf, len );
+	return len;
+}
+
+/* Batch send, like sendmmsg().
+ * Returns how many we sent.
+ */
+int
+udp_sendmmsg ( struct udp_sock *so, struct udp_msg *msg, int n )
+{
+	int i;
+
+	for ( i=0; i<n; i++ )
+	    udp_send ( msg[i].ip, so->port, msg[i].port, msg[i].buf, msg[i].len );
+	return n;
+}
+
+void
+udp_sock_show ( void )
+{
+	struct udp_sock *so;
+
+	UDP_LOCK;
+	for ( so = udp_sock_list; so; so = so->next )
+	    printf ( " socket %5d: %d received, %d dropped, %d queued\n",
+		so->port, so->rcv_count, so->drop_count, so->count );
+	UDP_UNLOCK;
+}
+
 /* THE END */
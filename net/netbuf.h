@@ -42,8 +42,13 @@
  * there are alignment issues on the ARM to get
  * the IP fields aligned (prepad by 2) and there are
  * more subtle issues to get the buffer aligned on
- * cache lines to get optimal DMA, but we don't
- * fret over that kind of stuff as yet.
+ * cache lines to get optimal DMA.
+ *
+ * As of 2026 the data area is no longer part of the
+ * netbuf structure.  Each netbuf points to a separate
+ * data area that starts on a cache line.  Data areas
+ * come in size classes, so an ARP reply or a TCP ACK
+ * no longer ties up a full size buffer.
  */
 
 /* Note that all the pointers elen, .... may seem to
@@ -51,13 +56,45 @@
  * This is emphatically NOT the case, these are simply
  * convenience pointers into the data buffer, which must
  * hold a contiguous packet.
+ * The one exception is an IP datagram that came in fragments.
+ * The fragments get chained through "frag" (see net_frag.c)
+ * and each holds flen bytes of the IP payload at pptr.
+ * Freeing the first one frees them all.
  */
 
 #ifndef __NETBUF_H__
 #define __NETBUF_H__
 
+/* The biggest frame netbuf_alloc() promises to hold */
 #define NETBUF_MAX	1600
 
+/* cache line size, data areas are aligned to this */
+#define NETBUF_ALIGN	64
+
+/* Define this to write "DEAD" into every free buffer and
+ * have drivers check for it.  This caught an h5-emac bug,
+ * but it costs a store on every free, so it is debug only.
+ */
+// #define NETBUF_POISON
+
+/* Size classes for data areas (must be multiples of NETBUF_ALIGN) */
+#define NETBUF_SMALL	256
+#define NETBUF_LARGE	2048
+
+/* We reserve a full cache line ahead of the ethernet header.
+ * The tail end of this holds the back pointer used by Xinu TCP.
+ * Keeping this a full line means the frame itself starts on
+ * a cache line, which is what DMA wants.
+ */
+#define NETBUF_HEADROOM	NETBUF_ALIGN
+
+/* offset from the start of the data area to the ethernet header */
+#define NETBUF_ETH_OFF	(NETBUF_HEADROOM + NETBUF_PREPAD * sizeof(struct netbuf *))
+
+/* netbuf flags */
+#define NB_CSUM_OK	0x0001	/* Rx - hardware found IP, UDP and TCP checksums good */
+#define NB_CSUM_TX	0x0002	/* Tx - hardware fills in IP, UDP and TCP checksums */
+
 struct netbuf {
 	struct netbuf *next;
 	int flags;
@@ -75,12 +112,55 @@ struct netbuf {
 	int plen;		/* size from proto header (UDP) and on */
 	int dlen;		/* size of payload */
 	/* */
-	char data[NETBUF_MAX];
+	struct netbuf *frag;	/* rest of a reassembled datagram */
+	int flen;		/* IP payload in this one, if chained */
+	struct netif *ifp;	/* came in on, or goes out on */
+	/* */
+	int pool;		/* size class this came from */
+	int size;		/* size of data area */
+	char *data;		/* cache aligned data area */
 };
 
+/* Headroom is what lies ahead of the ethernet header,
+ * tailroom what lies beyond the end of the frame.
+ */
+#define netbuf_headroom(nbp)	((int) ((char *) (nbp)->eptr - (nbp)->bptr))
+#define netbuf_room(nbp)	((nbp)->size - netbuf_headroom(nbp))
+#define netbuf_tailroom(nbp)	(netbuf_room(nbp) - (nbp)->elen)
+
+/* Consumers of netbufs, for reservations.
+ * Each consumer may hold back some number of buffers in
+ * every size class that nobody else may take.
+ * Receive drivers reserve nothing and are the first
+ * to be refused when things get tight.
+ */
+#define NB_USER_RX	0	/* driver receive */
+#define NB_USER_NET	1	/* ordinary protocol traffic */
+#define NB_USER_TCP	2	/* TCP output, ACKs in particular */
+#define NB_USER_SHELL	3	/* ping and such from the shell */
+#define NB_NUM_USER	4
+
+/* Called with 1 when netbufs run low, 0 when they recover.
+ * Beware, this may be called at interrupt level.
+ */
+typedef void (*nbwfptr) ( int );
+
 struct netbuf * netbuf_alloc ( void );
 struct netbuf * netbuf_alloc_i ( void );
+struct netbuf * netbuf_alloc_size ( int );
+struct netbuf * netbuf_alloc_size_i ( int );
+struct netbuf * netbuf_alloc_user ( int, int );
+struct netbuf * netbuf_alloc_user_i ( int, int );
 void netbuf_free ( struct netbuf * );
+void netbuf_free_i ( struct netbuf * );
+int netbuf_copy_data ( struct netbuf *, char *, int );
+
+void netbuf_reserve ( int, int );
+void netbuf_lowwater_hook ( nbwfptr );
+int netbuf_low ( void );
+
+void netbuf_cache_set ( int );
+void netbuf_cache_flush ( void );
 
 #endif /* __NETBUF_H__ */
 /* THE END */
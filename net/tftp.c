@@ -8,41 +8,44 @@
  *
  * tftp.c
  * T. Trebisky  9-12-2015
+ *
+ * 2026 - now asks for bigger blocks (RFC 2348 blksize),
+ *  a window of blocks per ACK (RFC 7440 windowsize),
+ *  and the file size up front (RFC 2349 tsize).
+ *  A server that doesn't know about options just sends
+ *  us 512 byte blocks one at a time like it always did.
+ *  We also do proper timeouts and retransmits now.
  */
 
 #include <arch/types.h>
 #include "kyu.h"
 #include "kyulib.h"
 #include "thread.h"
+#include "malloc.h"
 #include "net.h"
 #include "netbuf.h"
 #include "arch/cpu.h"
+#include "tftp.h"
 
-#define TFTP_PORT	69
+#ifdef BOARD_HOST
+#define TFTP_SERVER	"10.0.5.1"
+#else
 #define TFTP_SERVER	"192.168.0.5"
-
-/* Note that the TFTP codes fit neatly in a byte,
- * even though the protocol gives them 2 bytes to fit in.
- * I take advantage of this to about byte swapping calls.
- */
-#define TFTP_RRQ	1
-#define TFTP_WRQ	2
-#define TFTP_DATA	3
-#define TFTP_ACK	4
-#define TFTP_ERR	5
-
-#define TFTP_BSIZE	512
+#endif
 
 static u32 tftp_ip;
 
 static int tftp_verbose = 0;
 
+/* What we ask for, a zero blksize gives classic TFTP */
+static int tftp_blksize = TFTP_BSIZE_MAX;
+static int tftp_window = TFTP_WINDOW;
+
 int tftp_fetch ( char *, char *, int );
+int tftp_size ( char * );
+void tftp_options ( int, int );
 
-static void tftp_rcv ( struct netbuf * );
-static void tftp_ack ( int );
 static void tftp_debug ( int );
-static void tftp_start ( char * );
 
 /* ------------- */
 
@@ -63,18 +66,74 @@ test_tftp ( int xxx )
 	printf ( "TFTP test fetching %s\n", test_file );
 	count = tftp_fetch ( test_file, test_buf, TEST_SIZE );
 	printf ( "TFTP test transfer finished: %d bytes\n", count );
+	tftp_debug ( 0 );
 }
-#endif
 
-/* ------------- */
+/* Put a file of a few megabytes on the server as tftp.bench
+ * and this will fetch it both ways and tell us how fast.
+ */
+#define BENCH_SIZE	(16*1024*1024)
+static char *bench_file = "tftp.bench";
 
-static int local_port;		/* my ephemeral port */
-static int server_port;		/* servers ephemeral port */
+static void
+tftp_bench_one ( char *buf, int blksize, int window )
+{
+	int hz = timer_rate_get ();
+	int start, ticks;
+	int count;
+	int kbs;
 
-static char *	tftp_buf;
-static int	tftp_limit;
-static int	tftp_count;
-static struct sem *tftp_sem;
+	tftp_options ( blksize, window );
+
+	start = get_timer_count_t ();
+	count = tftp_fetch ( bench_file, buf, BENCH_SIZE );
+	ticks = get_timer_count_t () - start;
+
+	if ( ! count ) {
+	    printf ( "TFTP bench: fetch of %s failed\n", bench_file );
+	    return;
+	}
+	if ( ticks < 1 )
+	    ticks = 1;
+
+	/* KB per second, avoiding overflow on big files */
+	kbs = (count / 1024) * hz / ticks;
+
+	printf ( "TFTP blksize %4d, window %2d: %d bytes in %d ms, %d.%02d MB/s\n",
+	    blksize ? blksize : TFTP_BSIZE, blksize ? window : 1,
+	    count, ticks * 1000 / hz, kbs / 1024, (kbs % 1024) * 100 / 1024 );
+}
+
+void
+test_tftp_bench ( long xxx )
+{
+	char *buf;
+	int size;
+
+	size = tftp_size ( bench_file );
+	if ( size < 0 )
+	    printf ( "TFTP bench: server won't tell us the size of %s\n", bench_file );
+	else
+	    printf ( "TFTP bench: %s is %d bytes\n", bench_file, size );
+
+	buf = malloc ( BENCH_SIZE );
+	if ( ! buf ) {
+	    printf ( "TFTP bench: no memory\n" );
+	    return;
+	}
+
+	tftp_bench_one ( buf, 0, 1 );
+	tftp_bench_one ( buf, TFTP_BSIZE, 1 );
+	tftp_bench_one ( buf, TFTP_BSIZE_MAX, 1 );
+	tftp_bench_one ( buf, TFTP_BSIZE_MAX, 4 );
+	tftp_bench_one ( buf, TFTP_BSIZE_MAX, TFTP_WINDOW );
+
+	free ( buf );
+	tftp_options ( TFTP_BSIZE_MAX, TFTP_WINDOW );
+}
+#endif
+
+/* ------------- */
 
 /* set the server to use */
 void
@@ -90,194 +149,520 @@ tftp_debug ( int arg )
 	tftp_verbose = arg;
 }
 
+/* What to ask the server for.
+ * blksize of zero means don't ask for anything.
+ */
+void
+tftp_options ( int blksize, int window )
+{
+	if ( blksize > TFTP_BSIZE_MAX )
+	    blksize = TFTP_BSIZE_MAX;
+	if ( blksize && blksize < 8 )
+	    blksize = 8;
+	if ( window < 1 )
+	    window = 1;
+	if ( window > TFTP_WINDOW )
+	    window = TFTP_WINDOW;
+
+	tftp_blksize = blksize;
+	tftp_window = window;
+}
+
 void
 tftp_init ( void )
 {
 	tftp_server ( TFTP_SERVER );
-	tftp_sem = sem_signal_new ( SEM_FIFO );
 }
 
-#define TFS_IDLE	0
-#define TFS_START	1
-#define TFS_RUN		2
+/* ------------- */
 
-static int tftp_state = TFS_IDLE;
+/* Everything about one transfer.
+ * The whole thing runs in the thread that called tftp_fetch(),
+ * with the packets coming in on a UDP socket.
+ */
+struct tftp_xfer {
+	struct udp_sock *so;
+	int sport;		/* the server's port, once we know it */
+	char *buf;
+	int limit;
+	int count;
 
-/* Times in seconds to start and to finish */
-#define TFTP_START_WAIT		5
-#define TFTP_TOTAL_WAIT		60
+	int blksize;
+	int window;
+	int tsize;		/* -1 if the server didn't say */
+	int block;		/* last block we have, in order */
+	int nwin;		/* blocks since our last ACK */
+	int gap_ack;		/* block we last ACKed for a gap, or -1 */
+
+	/* the last thing we sent, in case we need to send it again */
+	char pkt[128];
+	int plen;
+	int pport;
+
+	/* adaptive timeout, all in ticks */
+	int hz;
+	int srtt;
+	int rttvar;
+	int rto;
+	int sent_at;
+	int timing;		/* waiting to time a reply */
+	int retries;
+};
+
+#define TX_OK		0
+#define TX_FAIL		(-1)
+#define TX_NOOPT	(-2)	/* server turned down our options */
 
-/* Handle timeouts.
- * We are a bad boy and do timeouts our own way.
- * We watch that the initial packet gets a
- * response and that the whole transaction finishes
- * within a reasonable time.  Doing this properly
- * involves timing out each packet and handling
- * retransmits.  Not that hard, but we are lazy.
- */
 static void
-tftp_wdog ( long bogus )
+tftp_xsend ( struct tftp_xfer *xp, int timeit )
 {
-	int delay;
-	int hz = timer_rate_get();
-
-	delay = TFTP_START_WAIT;
-
-	while ( tftp_state == TFS_START && delay-- )
-	    thr_delay ( hz );
-
-	if ( tftp_state == TFS_START ) {
-	    tftp_count = 0;
-	    tftp_state = TFS_IDLE;
-	    printf ( "TFTP server not listening\n" );
-	    sem_unblock ( tftp_sem );
-	}
+	udp_sendto ( xp->so, tftp_ip, xp->pport, xp->pkt, xp->plen );
+	xp->sent_at = get_timer_count_t ();
+	xp->timing = timeit;
+}
 
-	delay = TFTP_TOTAL_WAIT - TFTP_START_WAIT;
+static void
+tftp_send_ack ( struct tftp_xfer *xp, int block )
+{
+	unsigned short rb;
 
-	while ( tftp_state != TFS_IDLE && delay-- )
-	    thr_delay ( hz );
+	xp->pkt[0] = 0;
+	xp->pkt[1] = TFTP_ACK;
+	rb = htons ( block );
+	memcpy ( &xp->pkt[2], (char *) &rb, 2 );
+	xp->plen = 4;
+	xp->pport = xp->sport;
 
-	if ( tftp_state != TFS_IDLE ) {
-	    tftp_count = 0;
-	    tftp_state = TFS_IDLE;
-	    printf ( "TFTP transfer did not finish\n" );
-	    sem_unblock ( tftp_sem );
-	}
+	/*
+	printf ( "TFTP sending Ack: " );
+	dump_buf ( xp->pkt, 4 );
+	*/
+	tftp_xsend ( xp, 1 );
+	xp->nwin = 0;
 }
 
-/* This is the main externally visible entry point */
-int
-tftp_fetch ( char *file, char *buf, int limit )
+/* Tell the server we are quitting.
+ * Nobody answers an error, so it doesn't go in pkt.
+ */
+static void
+tftp_send_err ( struct tftp_xfer *xp, int code, char *msg )
 {
-	local_port = get_ephem_port ();
-	if ( tftp_verbose )
-	    printf ( "TFTP listening on port %d\n", local_port );
-	udp_hookup ( local_port, tftp_rcv );
-
-	tftp_buf = buf;
-	tftp_limit = limit;
-	tftp_count = 0;
-
-	tftp_state = TFS_START;
-	(void) safe_thr_new ( "tftp_wdog", tftp_wdog, (void *) 0, 16, 0 );
+	char buf[64];
+	unsigned short ec;
 
-	tftp_start ( file );
+	buf[0] = 0;
+	buf[1] = TFTP_ERR;
+	ec = htons ( code );
+	memcpy ( &buf[2], (char *) &ec, 2 );
+	strcpy ( &buf[4], msg );
 
-	/* Wait here for transfer to finish (or timeout) */
-	sem_block ( tftp_sem );
-	udp_unhook ( local_port );
+	udp_sendto ( xp->so, tftp_ip, xp->sport, buf, 4 + strlen ( msg ) + 1 );
+}
 
-	return tftp_count;
+static char *
+tftp_put_str ( char *p, char *s )
+{
+	strcpy ( p, s );
+	return p + strlen ( s ) + 1;
 }
 
 /* Set up and send RRQ packet to start a request */
 static void
-tftp_start ( char *file )
+tftp_start ( struct tftp_xfer *xp, char *file, int opts )
 {
-	char rrq_buf[64];
+	char num[16];
 	char *p;
 
-	p = rrq_buf;
+	p = xp->pkt;
 	*p++ = 0;
 	*p++ = TFTP_RRQ;
-	strcpy ( p, file );
-	p += strlen ( file ) + 1;
-	strcpy ( p, "octet" );
-	p += strlen ( "octet" ) + 1;
+	p = tftp_put_str ( p, file );
+	p = tftp_put_str ( p, "octet" );
+
+	if ( opts ) {
+	    p = tftp_put_str ( p, "tsize" );
+	    p = tftp_put_str ( p, "0" );
+	    if ( tftp_blksize ) {
+		sprintf ( num, "%d", tftp_blksize );
+		p = tftp_put_str ( p, "blksize" );
+		p = tftp_put_str ( p, num );
+		if ( tftp_window > 1 ) {
+		    sprintf ( num, "%d", tftp_window );
+		    p = tftp_put_str ( p, "windowsize" );
+		    p = tftp_put_str ( p, num );
+		}
+	    }
+	}
 
-	udp_send ( tftp_ip, local_port, TFTP_PORT, rrq_buf, p - rrq_buf );
+	xp->plen = p - xp->pkt;
+	xp->pport = TFTP_PORT;
+	tftp_xsend ( xp, 1 );
 }
 
-void
-tftp_ack ( int rblock )
+/* Jacobson's smoothed round trip and variance, more or less
+ * as TCP does it, with the usual exponential backoff on
+ * timeouts.  A LAN server answers in a millisecond or two,
+ * so this gets our retransmits down from a second.
+ */
+static void
+tftp_rtt ( struct tftp_xfer *xp )
 {
-	char ack_buf[16];
-	char *p;
-	unsigned short rb;
+	int m, err;
+	int min = TFTP_RTO_MIN * xp->hz / 1000;
 
-	p = ack_buf;
-	*p++ = 0;
-	*p++ = TFTP_ACK;
+	if ( ! xp->timing )
+	    return;
+	xp->timing = 0;
+
+	m = get_timer_count_t () - xp->sent_at;
+	if ( m < 1 )
+	    m = 1;
+
+	if ( ! xp->srtt ) {
+	    xp->srtt = m;
+	    xp->rttvar = m / 2;
+	} else {
+	    err = m - xp->srtt;
+	    xp->srtt += err / 8;
+	    if ( err < 0 )
+		err = -err;
+	    xp->rttvar += (err - xp->rttvar) / 4;
+	}
 
-	rb = rblock;
-	memcpy ( p, (char *) &rb, 2 );
+	xp->rto = xp->srtt + 4 * xp->rttvar;
+	if ( min < 2 )
+	    min = 2;
+	if ( xp->rto < min )
+	    xp->rto = min;
+}
 
-	/*
-	printf ( "TFTP sending Ack: " );
-	dump_buf ( ack_buf, 4 );
-	*/
+static void
+tftp_backoff ( struct tftp_xfer *xp )
+{
+	int max = TFTP_RTO_MAX * xp->hz / 1000;
 
-	udp_send ( tftp_ip, local_port, server_port, ack_buf, 4 );
+	xp->rto *= 2;
+	if ( xp->rto > max )
+	    xp->rto = max;
 }
 
-void
-tftp_rcv ( struct netbuf *nbp )
+/* Option names are case insensitive.
+ * The server uses this too.
+ */
+int
+tftp_optcmp ( char *opt, char *name )
+{
+	int c;
+
+	while ( *opt && *name ) {
+	    c = *opt++;
+	    if ( c >= 'A' && c <= 'Z' )
+		c += 'a' - 'A';
+	    if ( c != *name++ )
+		return 1;
+	}
+	return *opt || *name;
+}
+
+/* Step past a string in a packet.
+ * Returns 0 if it runs off the end without a null.
+ */
+static char *
+tftp_skip_str ( char *p, char *end )
+{
+	while ( p < end )
+	    if ( *p++ == '\0' )
+		return p;
+	return (char *) 0;
+}
+
+/* The server answered our options.
+ * It can only ever offer the same or less than we asked for.
+ */
+static int
+tftp_oack ( struct tftp_xfer *xp, char *p, int len )
 {
+	char *end = p + len;
+	char *opt, *val;
+
+	p += 2;
+	while ( p < end ) {
+	    opt = p;
+	    p = tftp_skip_str ( p, end );
+	    if ( ! p )
+		break;
+	    val = p;
+	    p = tftp_skip_str ( p, end );
+	    if ( ! p )
+		break;
+
+	    if ( tftp_optcmp ( opt, "blksize" ) == 0 )
+		xp->blksize = atoi ( val );
+	    else if ( tftp_optcmp ( opt, "windowsize" ) == 0 )
+		xp->window = atoi ( val );
+	    else if ( tftp_optcmp ( opt, "tsize" ) == 0 )
+		xp->tsize = atoi ( val );
+	}
+
+	if ( xp->blksize < 8 || xp->blksize > TFTP_BSIZE_MAX ||
+		xp->window < 1 || xp->window > TFTP_WINDOW ) {
+	    tftp_send_err ( xp, TERR_OPTION, "bad option" );
+	    return TX_FAIL;
+	}
+
+	if ( tftp_verbose )
+	    printf ( "TFTP options: blksize %d, windowsize %d, tsize %d\n",
+		xp->blksize, xp->window, xp->tsize );
+	return TX_OK;
+}
+
+/* Run one transfer.
+ * With a negative limit we just want the size,
+ * and quit once the server tells us.
+ */
+static int
+tftp_get ( struct tftp_xfer *xp, char *file, int opts )
+{
+	struct netbuf *nbp;
+	unsigned short val;
+	int started = 0;
+	int rv = TX_FAIL;
+	char *p;
 	int code;
 	int block;
-	unsigned short rblock;
 	int count;
+	int d;
 
-	/*
-    	printf ("Received TFTP packet (%d bytes)\n", nbp->dlen );
-	*/
+	xp->tsize = -1;
+	if ( strlen ( file ) > TFTP_NAME_MAX )
+	    return TX_FAIL;
 
-	code = nbp->dptr[1];
+	xp->so = udp_sock_open ( 0 );
+	if ( ! xp->so )
+	    return TX_FAIL;
+	udp_sock_qmax ( xp->so, 2 * TFTP_WINDOW );
+	if ( tftp_verbose )
+	    printf ( "TFTP listening on port %d\n", udp_sock_port ( xp->so ) );
+
+	xp->sport = TFTP_PORT;
+	xp->count = 0;
+	xp->blksize = TFTP_BSIZE;
+	xp->window = 1;
+	xp->block = 0;
+	xp->nwin = 0;
+	xp->gap_ack = -1;
+	xp->hz = timer_rate_get ();
+	xp->srtt = 0;
+	xp->rttvar = 0;
+	xp->rto = TFTP_RTO_INIT * xp->hz / 1000;
+	xp->retries = 0;
+
+	tftp_start ( xp, file, opts );
+
+	for ( ;; ) {
+	    nbp = udp_recv_nb ( xp->so, xp->rto );
+
+	    if ( ! nbp ) {
+		if ( ++xp->retries > TFTP_RETRIES ) {
+		    if ( started )
+			printf ( "TFTP transfer did not finish\n" );
+		    else
+			printf ( "TFTP server not listening\n" );
+		    break;
+		}
+		/* Resend our last ACK, which for a window
+		 * starts it over after the last block we have.
+		 */
+		tftp_backoff ( xp );
+		tftp_xsend ( xp, 0 );
+		continue;
+	    }
 
-	/* This may be expected if we are probing for a file
-	 * that does not exist.
-	 */
-	if ( code == TFTP_ERR ) {
-	    if ( tftp_verbose ) {
-		dump_buf ( nbp->dptr, nbp->dlen );
-		printf ( "TFTP error: %s\n", &nbp->dptr[4] );
+	    if ( nbp->iptr->src != tftp_ip ) {
+		netbuf_free ( nbp );
+		continue;
 	    }
-	    tftp_count = 0;
-	    sem_unblock ( tftp_sem );
-	    tftp_state = TFS_IDLE;
-	    return;
-	}
 
-	if ( code == TFTP_DATA ) {
-	    tftp_state = TFS_RUN;
-	    memcpy ( &rblock, &nbp->dptr[2], 2 );
-	    block = ntohs ( rblock );
-	    if ( block == 1 ) {
-		server_port = udp_get_sport ( nbp );
+	    /* The server answers from a new port, which we then stick to */
+	    if ( ! started ) {
+		xp->sport = udp_get_sport ( nbp );
 		if ( tftp_verbose )
-		    printf ( "TFTP server at port %d\n", server_port );
+		    printf ( "TFTP server at port %d\n", xp->sport );
+	    } else if ( udp_get_sport ( nbp ) != xp->sport ) {
+		netbuf_free ( nbp );
+		continue;
 	    }
 
+	    /* Every packet has at least an opcode and a block
+	     * (or error) number.
+	     */
+	    if ( nbp->dlen < 4 ) {
+		netbuf_free ( nbp );
+		continue;
+	    }
+
+	    p = nbp->dptr;
+	    code = p[1];
+
+	    /* This may be expected if we are probing for a file
+	     * that does not exist.
+	     */
+	    if ( code == TFTP_ERR ) {
+		memcpy ( &val, &p[2], 2 );
+		if ( tftp_verbose ) {
+		    dump_buf ( p, nbp->dlen );
+		    if ( tftp_skip_str ( &p[4], p + nbp->dlen ) )
+			printf ( "TFTP error: %s\n", &p[4] );
+		}
+		if ( ! started && opts && ntohs ( val ) == TERR_OPTION )
+		    rv = TX_NOOPT;
+		netbuf_free ( nbp );
+		break;
+	    }
+
+	    if ( code == TFTP_OACK ) {
+		if ( started ) {
+		    netbuf_free ( nbp );
+		    continue;
+		}
+		started = 1;
+		tftp_rtt ( xp );
+		xp->retries = 0;
+		rv = tftp_oack ( xp, p, nbp->dlen );
+		netbuf_free ( nbp );
+		if ( rv != TX_OK )
+		    break;
+
+		if ( xp->limit < 0 ) {
+		    tftp_send_err ( xp, TERR_OPTION, "just asking" );
+		    break;
+		}
+		if ( xp->tsize > xp->limit ) {
+		    printf ( "TFTP %s is %d bytes, we only have room for %d\n",
+			file, xp->tsize, xp->limit );
+		    tftp_send_err ( xp, TERR_FULL, "file too big" );
+		    rv = TX_FAIL;
+		    break;
+		}
+		rv = TX_FAIL;
+		tftp_send_ack ( xp, 0 );
+		continue;
+	    }
+
+	    if ( code != TFTP_DATA ) {
+		/* XXX - should never happen */
+		printf ("TFTP unexpected opcode: %d\n", code );
+		netbuf_free ( nbp );
+		break;
+	    }
+
+	    /* Data without an OACK is a classic server */
+	    if ( ! started ) {
+		started = 1;
+		if ( xp->limit < 0 ) {
+		    netbuf_free ( nbp );
+		    tftp_send_err ( xp, TERR_OPTION, "just asking" );
+		    break;
+		}
+	    }
+
+	    memcpy ( &val, &p[2], 2 );
+	    block = ntohs ( val );
 	    count = nbp->dlen - 4;
-	    if ( tftp_verbose )
+
+	    /* 16 bit block numbers, which can wrap */
+	    d = (block - xp->block) & 0xffff;
+
+	    if ( d != 1 ) {
+		netbuf_free ( nbp );
+		/* A gap, tell the server where we are (RFC 7440).
+		 * Once is enough, the rest of the window will be
+		 * out of order too.  If the server doesn't hear us,
+		 * the timeout sends it again.
+		 * Old duplicates just get ignored.
+		 */
+		if ( d != 0 && d < 0x8000 && xp->gap_ack != xp->block ) {
+		    tftp_send_ack ( xp, xp->block );
+		    xp->gap_ack = xp->block;
+		}
+		continue;
+	    }
+
+	    if ( tftp_verbose > 1 )
 		printf ( "TFTP data block %d (%d bytes)\n", block, count );
-	    if ( count && count < tftp_limit ) {
-		memcpy ( tftp_buf, &nbp->dptr[4], count );
-		tftp_buf += count;
-		tftp_limit -= count;
-		tftp_count += count;
+
+	    if ( xp->count + count > xp->limit ) {
+		netbuf_free ( nbp );
+		printf ( "TFTP %s is too big, we only have room for %d\n", file, xp->limit );
+		tftp_send_err ( xp, TERR_FULL, "file too big" );
+		break;
 	    }
 
+	    memcpy ( xp->buf + xp->count, &p[4], count );
+	    netbuf_free ( nbp );
 
-	    tftp_ack ( rblock );
+	    xp->count += count;
+	    xp->block = block;
+	    xp->nwin++;
+	    xp->retries = 0;
+	    tftp_rtt ( xp );
 
-	    if ( count < TFTP_BSIZE ) {
-		tftp_state = TFS_IDLE;
+	    if ( count < xp->blksize ) {
+		tftp_send_ack ( xp, block );
 		if ( tftp_verbose )
-		    printf ( "TFTP transfer finished, %d bytes received\n", tftp_count );
-		sem_unblock ( tftp_sem );
+		    printf ( "TFTP transfer finished, %d bytes received\n", xp->count );
+		rv = TX_OK;
+		break;
 	    }
 
-	    tftp_state = TFS_IDLE;
-	    return;
+	    if ( xp->nwin >= xp->window )
+		tftp_send_ack ( xp, block );
+	}
+
+	udp_sock_close ( xp->so );
+	return rv;
+}
+
+/* This is the main externally visible entry point.
+ * Returns the number of bytes we got, 0 if it didn't work.
+ */
+int
+tftp_fetch ( char *file, char *buf, int limit )
+{
+	struct tftp_xfer xfer;
+	int rv;
+
+	xfer.buf = buf;
+	xfer.limit = limit;
+
+	rv = tftp_get ( &xfer, file, tftp_blksize != 0 );
+
+	/* A server that chokes on options gets asked the old way */
+	if ( rv == TX_NOOPT ) {
+	    if ( tftp_verbose )
+		printf ( "TFTP server refused options, trying again without\n" );
+	    rv = tftp_get ( &xfer, file, 0 );
 	}
 
-	/* XXX - should never happen */
-	printf ("TFTP unexpected opcode: %d\n", code );
-	tftp_count = 0;
-	tftp_state = TFS_IDLE;
-	sem_unblock ( tftp_sem );
+	if ( rv != TX_OK )
+	    return 0;
+	return xfer.count;
+}
+
+/* Ask how big a file is (RFC 2349), so a buffer can
+ * be sized before we fetch it.
+ * Returns -1 if the server won't say.
+ */
+int
+tftp_size ( char *file )
+{
+	struct tftp_xfer xfer;
+
+	xfer.buf = (char *) 0;
+	xfer.limit = -1;
+
+	(void) tftp_get ( &xfer, file, 1 );
+	return xfer.tsize;
 }
 
 /* THE END */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2016  Tom Trebisky  <tom@mmto.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * tftp.h
+ * Used by both tftp.c (the client) and tftpd.c (the server)
+ *
+ * T. Trebisky  9-12-2015 (these were in tftp.c)
+ * agent  10-19-2026
+ */
+
+#define TFTP_PORT	69
+
+/* Note that the TFTP codes fit neatly in a byte,
+ * even though the protocol gives them 2 bytes to fit in.
+ * I take advantage of this to about byte swapping calls.
+ */
+#define TFTP_RRQ	1
+#define TFTP_WRQ	2
+#define TFTP_DATA	3
+#define TFTP_ACK	4
+#define TFTP_ERR	5
+#define TFTP_OACK	6
+
+/* error codes we send or care about */
+#define TERR_NOTDEF	0
+#define TERR_NOFILE	1
+#define TERR_ACCESS	2
+#define TERR_FULL	3
+#define TERR_ILLEGAL	4
+#define TERR_TID	5
+#define TERR_OPTION	8
+
+/* The classic block size */
+#define TFTP_BSIZE	512
+
+/* Biggest block that fits in an ethernet frame,
+ * 1500 less the IP, UDP and TFTP headers.
+ */
+#define TFTP_BSIZE_MAX	(1500 - 20 - 8 - 4)
+
+#define TFTP_WINDOW	16
+
+/* Longest file name we will send */
+#define TFTP_NAME_MAX	64
+
+/* Timeouts, in milliseconds */
+#define TFTP_RTO_INIT	1000
+#define TFTP_RTO_MIN	20
+#define TFTP_RTO_MAX	5000
+#define TFTP_RETRIES	6
+
+int tftp_optcmp ( char *, char * );
+
+/* THE END */
@@ -0,0 +1,814 @@
+/*
+ * Copyright (C) 2026  agent  <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation. See README and COPYING for
+ * more details.
+ *
+ * tftpd.c
+ * A read only tftp server, for pulling data off a running Kyu.
+ * Anything big is a long wait through a 115200 baud console.
+ *
+ * There is no file system, so other code "exports" named
+ * objects that live in memory:
+ *   tftpd_export ( "fpga", addr, len ) -- a fixed region.
+ *   tftpd_export_fn ( "capture", fn, arg ) -- fn gets called when
+ *	a transfer starts and tells us where the data is, in up
+ *	to TFTPD_MAXSEG pieces.  A ring that has wrapped is two
+ *	pieces, and something like the heap summary can get
+ *	formatted into a buffer right then.  It gets called again
+ *	with a null seg when the transfer is over, so something
+ *	that changes underneath us can hold still until then.
+ * Built in, we have:
+ *   log -- everything printed on the console (see console.c)
+ *   heap -- malloc statistics
+ *   mem:ADDR:LEN -- any memory at all (in hex), only with
+ *	WANT_TFTPD_MEM (see kyu.h).  Anyone on the network can
+ *	ask for it, and a bad address takes a data abort.
+ *
+ * We do the options a modern client asks for (blksize, windowsize
+ * and tsize).  With 1468 byte blocks and 16 blocks per ACK we
+ * spend our time moving data rather than waiting on the client.
+ * Each block goes from the object straight into the outgoing
+ * netbuf (see udp_alloc), which is the only copy it ever gets.
+ *
+ * Each transfer runs in its own thread, up to TFTPD_XFERS of them,
+ * so a client that goes quiet only ties up its own slot.  A function
+ * export goes to one client at a time, since it may freeze something
+ * (the capture ring) or format into a static buffer (heap).
+ *
+ * agent  10-19-2026
+ */
+
+#include <arch/types.h>
+#include "kyu.h"
+#include "kyulib.h"
+#include "thread.h"
+#include "malloc.h"
+#include "net.h"
+#include "netbuf.h"
+#include "arch/cpu.h"
+#include "tftp.h"
+
+/* Just below the network threads */
+#define PRI_TFTPD	25
+
+#define TFTPD_NAME	32
+
+/* Transfers in progress at once */
+#define TFTPD_XFERS	8
+
+/* Until a client ACKs something we don't know it is even
+ * there (or that it asked), so we give up on it sooner.
+ */
+#define TFTPD_FIRST_RETRIES	2
+
+struct tftpd_obj {
+	struct tftpd_obj *next;
+	char name[TFTPD_NAME];
+	char *addr;		/* either a fixed region */
+	int len;
+	tdfptr fn;		/* or a function to ask */
+	void *arg;
+	int busy;		/* a function export in use */
+};
+
+static struct tftpd_obj *tftpd_list;
+
+static struct udp_sock *tftpd_so;
+
+/* Everything about the transfer in progress.
+ * Blocks are counted with an int here, the 16 bit
+ * block number on the wire just wraps around.
+ */
+struct tftpd_xfer {
+	int busy;
+	struct udp_sock *so;
+	u32 ip;			/* the client */
+	int port;
+	struct tftpd_obj *obj;	/* if we asked a function */
+	struct tftp_seg seg[TFTPD_MAXSEG];
+	int nseg;
+	int size;
+	int blksize;
+	int window;
+	int nblocks;		/* the last one is short, maybe empty */
+	int oack;		/* options to put in the OACK */
+
+	/* adaptive timeout, all in ticks */
+	int hz;
+	int srtt;
+	int rttvar;
+	int rto;
+	int sent_at;
+	int time_block;		/* block we are timing, 0 if none */
+	int retries;
+	int heard;		/* the client has ACKed something */
+};
+
+#define TFTPD_O_BLKSIZE	1
+#define TFTPD_O_WINDOW	2
+#define TFTPD_O_TSIZE	4
+
+static struct tftpd_xfer tftpd_xfers[TFTPD_XFERS];
+
+static int tftpd_verbose = 0;
+
+/* statistics */
+static int tftpd_requests;
+static int tftpd_done;
+static int tftpd_failed;
+static int tftpd_rexmit;
+static int tftpd_bytes;
+
+static void tftpd_thread ( long );
+static void tftpd_xfer_thread ( long );
+static int tftpd_log ( void *, struct tftp_seg * );
+static int tftpd_heap ( void *, struct tftp_seg * );
+
+/* ------------------------------------------------- */
+/* The export list */
+
+static struct tftpd_obj *
+tftpd_new ( char *name )
+{
+	struct tftpd_obj *op;
+
+	if ( strlen ( name ) >= TFTPD_NAME ) {
+	    printf ( "tftpd: export name too long: %s\n", name );
+	    return (struct tftpd_obj *) 0;
+	}
+
+	op = (struct tftpd_obj *) malloc ( sizeof(struct tftpd_obj) );
+	if ( ! op )
+	    return op;
+	memset ( (char *) op, 0, sizeof(struct tftpd_obj) );
+	strcpy ( op->name, name );
+
+	/* The server thread walks this without a lock,
+	 * so the entry is complete before we link it.
+	 */
+	INT_lock;
+	op->next = tftpd_list;
+	tftpd_list = op;
+	INT_unlock;
+
+	return op;
+}
+
+/* Export a fixed region of memory */
+void
+tftpd_export ( char *name, char *addr, int len )
+{
+	struct tftpd_obj *op;
+
+	op = tftpd_new ( name );
+	if ( ! op )
+	    return;
+	op->addr = addr;
+	op->len = len;
+}
+
+/* Export something that moves around or changes size.
+ * fn fills in the pieces and returns how many there are.
+ */
+void
+tftpd_export_fn ( char *name, tdfptr fn, void *arg )
+{
+	struct tftpd_obj *op;
+
+	op = tftpd_new ( name );
+	if ( ! op )
+	    return;
+	op->fn = fn;
+	op->arg = arg;
+}
+
+#ifdef WANT_TFTPD_MEM
+static int
+tftpd_hex ( char **pp, unsigned long *val )
+{
+	char *p = *pp;
+	unsigned long rv = 0;
+	int c, n = 0;
+
+	if ( p[0] == '0' && (p[1] == 'x' || p[1] == 'X') )
+	    p += 2;
+
+	for ( ;; ) {
+	    c = *p;
+	    if ( c >= '0' && c <= '9' )
+		c -= '0';
+	    else if ( c >= 'a' && c <= 'f' )
+		c -= 'a' - 10;
+	    else if ( c >= 'A' && c <= 'F' )
+		c -= 'A' - 10;
+	    else
+		break;
+	    rv = rv * 16 + c;
+	    p++;
+	    n++;
+	}
+
+	*pp = p;
+	*val = rv;
+	return n;
+}
+#endif
+
+/* Find what the client asked for.
+ * Returns the number of pieces, 0 if we don't have it,
+ * -1 if it is a function export already being sent.
+ */
+static int
+tftpd_lookup ( char *name, struct tftpd_xfer *xp )
+{
+	struct tftp_seg *seg = xp->seg;
+	struct tftpd_obj *op;
+#ifdef WANT_TFTPD_MEM
+	unsigned long addr, len;
+	char *p;
+
+	if ( strncmp ( name, "mem:", 4 ) == 0 ) {
+	    p = name + 4;
+	    if ( ! tftpd_hex ( &p, &addr ) || *p++ != ':' )
+		return 0;
+	    if ( ! tftpd_hex ( &p, &len ) || *p )
+		return 0;
+	    seg->addr = (char *) addr;
+	    seg->len = len;
+	    return 1;
+	}
+#endif
+
+	for ( op = tftpd_list; op; op = op->next ) {
+	    if ( strcmp ( name, op->name ) != 0 )
+		continue;
+	    if ( op->fn ) {
+		if ( op->busy )
+		    return -1;
+		op->busy = 1;
+		xp->obj = op;
+		return (*op->fn) ( op->arg, seg );
+	    }
+	    seg->addr = op->addr;
+	    seg->len = op->len;
+	    return 1;
+	}
+
+	return 0;
+}
+
+/* Let a function export know we are done with it */
+static void
+tftpd_release ( struct tftpd_xfer *xp )
+{
+	if ( xp->obj ) {
+	    (void) (*xp->obj->fn) ( xp->obj->arg, (struct tftp_seg *) 0 );
+	    xp->obj->busy = 0;
+	}
+	xp->obj = (struct tftpd_obj *) 0;
+}
+
+/* ------------------------------------------------- */
+/* Built in exports */
+
+int log_pieces ( char **, int *, char **, int * );
+
+static int
+tftpd_log ( void *arg, struct tftp_seg *seg )
+{
+	if ( ! seg )
+	    return 0;
+	return log_pieces ( &seg[0].addr, &seg[0].len, &seg[1].addr, &seg[1].len );
+}
+
+static char tftpd_heap_buf[256];
+
+static int
+tftpd_heap ( void *arg, struct tftp_seg *seg )
+{
+	struct mallinfo mi;
+	int n;
+
+	if ( ! seg )
+	    return 0;
+
+	mi = mallinfo ();
+	n = snprintf ( tftpd_heap_buf, sizeof(tftpd_heap_buf),
+	    "arena %d\nin use %d\nfree %d\nfree chunks %d\ntop releasable %d\n",
+	    mi.arena, mi.uordblks, mi.fordblks, mi.ordblks, mi.keepcost );
+
+	seg->addr = tftpd_heap_buf;
+	seg->len = n;
+	return 1;
+}
+
+/* ------------------------------------------------- */
+
+void
+tftpd_init ( void )
+{
+	tftpd_so = udp_sock_open ( TFTP_PORT );
+	if ( ! tftpd_so ) {
+	    printf ( "tftpd: cannot get port %d\n", TFTP_PORT );
+	    return;
+	}
+
+	tftpd_export_fn ( "log", tftpd_log, (void *) 0 );
+	tftpd_export_fn ( "heap", tftpd_heap, (void *) 0 );
+
+	(void) safe_thr_new ( "tftpd", (tfptr) tftpd_thread, (void *) 0, PRI_TFTPD, 0 );
+}
+
+void
+tftpd_show ( void )
+{
+	struct tftpd_obj *op;
+
+	printf ( "TFTP server: %d requests, %d sent, %d failed, %d bytes, %d retransmits\n",
+	    tftpd_requests, tftpd_done, tftpd_failed, tftpd_bytes, tftpd_rexmit );
+
+	printf ( "TFTP exports:" );
+	for ( op = tftpd_list; op; op = op->next )
+	    printf ( " %s", op->name );
+#ifdef WANT_TFTPD_MEM
+	printf ( " mem:ADDR:LEN" );
+#endif
+	printf ( "\n" );
+}
+
+/* ------------------------------------------------- */
+
+static void
+tftpd_send_err ( struct udp_sock *so, u32 ip, int port, int code, char *msg )
+{
+	char buf[64];
+	unsigned short ec;
+
+	buf[0] = 0;
+	buf[1] = TFTP_ERR;
+	ec = htons ( code );
+	memcpy ( &buf[2], (char *) &ec, 2 );
+	strcpy ( &buf[4], msg );
+
+	udp_sendto ( so, ip, port, buf, 4 + strlen ( msg ) + 1 );
+}
+
+/* Copy len bytes starting at off out of the pieces */
+static void
+tftpd_gather ( struct tftpd_xfer *xp, char *buf, int off, int len )
+{
+	struct tftp_seg *sp;
+	int i, n;
+
+	for ( i=0; i<xp->nseg && len > 0; i++ ) {
+	    sp = &xp->seg[i];
+	    if ( off >= sp->len ) {
+		off -= sp->len;
+		continue;
+	    }
+	    n = sp->len - off;
+	    if ( n > len )
+		n = len;
+	    memcpy ( buf, sp->addr + off, n );
+	    buf += n;
+	    len -= n;
+	    off = 0;
+	}
+}
+
+static void
+tftpd_send_block ( struct tftpd_xfer *xp, int block )
+{
+	struct netbuf *nbp;
+	unsigned short bn;
+	int off, len;
+
+	off = (block - 1) * xp->blksize;
+	len = xp->size - off;
+	if ( len > xp->blksize )
+	    len = xp->blksize;
+
+	nbp = udp_alloc ( 4 + len );
+	if ( ! nbp )
+	    return;		/* the retransmit will fix it */
+
+	nbp->dptr[0] = 0;
+	nbp->dptr[1] = TFTP_DATA;
+	bn = htons ( block );
+	memcpy ( &nbp->dptr[2], (char *) &bn, 2 );
+	tftpd_gather ( xp, &nbp->dptr[4], off, len );
+
+	udp_send_nb ( xp->ip, udp_sock_port ( xp->so ), xp->port, nbp );
+}
+
+/* Same Jacobson estimator the client uses (see tftp.c),
+ * timing one block per window, and never one that
+ * has been sent twice (Karn).
+ */
+static void
+tftpd_rtt ( struct tftpd_xfer *xp )
+{
+	int m, err;
+	int min = TFTP_RTO_MIN * xp->hz / 1000;
+
+	m = get_timer_count_t () - xp->sent_at;
+	if ( m < 1 )
+	    m = 1;
+	xp->time_block = 0;
+
+	if ( ! xp->srtt ) {
+	    xp->srtt = m;
+	    xp->rttvar = m / 2;
+	} else {
+	    err = m - xp->srtt;
+	    xp->srtt += err / 8;
+	    if ( err < 0 )
+		err = -err;
+	    xp->rttvar += (err - xp->rttvar) / 4;
+	}
+
+	xp->rto = xp->srtt + 4 * xp->rttvar;
+	if ( min < 2 )
+	    min = 2;
+	if ( xp->rto < min )
+	    xp->rto = min;
+}
+
+static void
+tftpd_backoff ( struct tftpd_xfer *xp )
+{
+	int max = TFTP_RTO_MAX * xp->hz / 1000;
+
+	xp->rto *= 2;
+	if ( xp->rto > max )
+	    xp->rto = max;
+}
+
+/* After a timeout, is it time to quit? */
+static int
+tftpd_give_up ( struct tftpd_xfer *xp )
+{
+	if ( xp->heard )
+	    return ++xp->retries > TFTP_RETRIES;
+	return ++xp->retries > TFTPD_FIRST_RETRIES;
+}
+
+/* Wait for an ACK from our client.
+ * Returns the 16 bit block number, or -1 on a timeout,
+ * or -2 if the client gave up on us.
+ */
+static int
+tftpd_wait_ack ( struct tftpd_xfer *xp )
+{
+	struct netbuf *nbp;
+	unsigned short bn;
+	int port, rv;
+	u32 ip;
+
+	for ( ;; ) {
+	    nbp = udp_recv_nb ( xp->so, xp->rto );
+	    if ( ! nbp )
+		return -1;
+
+	    ip = nbp->iptr->src;
+	    port = udp_get_sport ( nbp );
+	    if ( ip != xp->ip || port != xp->port ) {
+		/* never answer an error */
+		if ( nbp->dlen < 2 || nbp->dptr[1] != TFTP_ERR )
+		    tftpd_send_err ( xp->so, ip, port, TERR_TID, "wrong TID" );
+		netbuf_free ( nbp );
+		continue;
+	    }
+
+	    rv = -3;
+	    if ( nbp->dlen >= 4 && nbp->dptr[0] == 0 ) {
+		if ( nbp->dptr[1] == TFTP_ACK ) {
+		    memcpy ( (char *) &bn, &nbp->dptr[2], 2 );
+		    rv = ntohs ( bn );
+		} else if ( nbp->dptr[1] == TFTP_ERR )
+		    rv = -2;
+	    }
+	    netbuf_free ( nbp );
+
+	    if ( rv >= 0 )
+		xp->heard = 1;
+	    if ( rv != -3 )
+		return rv;
+	}
+}
+
+/* Send the object, a window at a time.
+ * An ACK for less than the whole window means the client
+ * saw a gap, so we start over from there (RFC 7440).
+ */
+static int
+tftpd_send ( struct tftpd_xfer *xp )
+{
+	int base, next, last;
+	int ack, acked;
+
+	base = 1;		/* oldest block not yet ACKed */
+	next = 1;		/* next one to send */
+
+	for ( ;; ) {
+	    last = base + xp->window - 1;
+	    if ( last > xp->nblocks )
+		last = xp->nblocks;
+
+	    while ( next <= last ) {
+		if ( ! xp->time_block ) {
+		    xp->time_block = last;
+		    xp->sent_at = get_timer_count_t ();
+		}
+		tftpd_send_block ( xp, next++ );
+	    }
+
+	    ack = tftpd_wait_ack ( xp );
+	    if ( ack == -2 )
+		return 1;
+
+	    if ( ack == -1 ) {
+		if ( tftpd_give_up ( xp ) )
+		    return 1;
+		tftpd_backoff ( xp );
+		xp->time_block = -1;	/* nothing in this window */
+		tftpd_rexmit += next - base;
+		next = base;
+		continue;
+	    }
+
+	    /* Turn the 16 bit number back into a full one.
+	     * Anything outside what is in flight is an old duplicate.
+	     */
+	    acked = base - 1 + ((ack - (base - 1)) & 0xffff);
+	    if ( acked < base || acked >= next )
+		continue;
+
+	    xp->retries = 0;
+	    if ( xp->time_block > 0 && acked >= xp->time_block )
+		tftpd_rtt ( xp );
+
+	    base = acked + 1;
+	    if ( acked == xp->nblocks )
+		return 0;
+
+	    /* a new window gets timed again */
+	    if ( xp->time_block < 0 )
+		xp->time_block = 0;
+
+	    if ( acked < next - 1 ) {
+		tftpd_rexmit += next - base;
+		next = base;
+		xp->time_block = -1;
+	    }
+	}
+}
+
+/* Tell the client which of its options we took,
+ * and wait for the ACK of block 0 that says go.
+ * Timeouts back off the same as for data, and only an
+ * OACK that went out once gets timed.
+ */
+static int
+tftpd_oack ( struct tftpd_xfer *xp )
+{
+	char pkt[128];
+	char *p;
+	int len;
+	int ack;
+
+	p = pkt;
+	*p++ = 0;
+	*p++ = TFTP_OACK;
+	if ( xp->oack & TFTPD_O_BLKSIZE ) {
+	    strcpy ( p, "blksize" );
+	    p += strlen ( p ) + 1;
+	    p += sprintf ( p, "%d", xp->blksize ) + 1;
+	}
+	if ( xp->oack & TFTPD_O_WINDOW ) {
+	    strcpy ( p, "windowsize" );
+	    p += strlen ( p ) + 1;
+	    p += sprintf ( p, "%d", xp->window ) + 1;
+	}
+	if ( xp->oack & TFTPD_O_TSIZE ) {
+	    strcpy ( p, "tsize" );
+	    p += strlen ( p ) + 1;
+	    p += sprintf ( p, "%d", xp->size ) + 1;
+	}
+	len = p - pkt;
+
+	xp->sent_at = get_timer_count_t ();
+	udp_sendto ( xp->so, xp->ip, xp->port, pkt, len );
+
+	for ( ;; ) {
+	    ack = tftpd_wait_ack ( xp );
+	    if ( ack == 0 )
+		break;
+	    if ( ack == -2 )
+		return 1;
+	    if ( ack == -1 ) {
+		if ( tftpd_give_up ( xp ) )
+		    return 1;
+		tftpd_backoff ( xp );
+		tftpd_rexmit++;
+		udp_sendto ( xp->so, xp->ip, xp->port, pkt, len );
+	    }
+	}
+
+	if ( ! xp->retries )
+	    tftpd_rtt ( xp );
+	xp->retries = 0;
+	return 0;
+}
+
+/* One transfer, start to finish, in its own thread */
+static void
+tftpd_xfer_thread ( long arg )
+{
+	struct tftpd_xfer *xp = (struct tftpd_xfer *) arg;
+
+	if ( xp->oack && tftpd_oack ( xp ) ) {
+	    tftpd_failed++;
+	} else if ( tftpd_send ( xp ) ) {
+	    tftpd_failed++;
+	} else {
+	    tftpd_done++;
+	    tftpd_bytes += xp->size;
+	}
+
+	udp_sock_close ( xp->so );
+	tftpd_release ( xp );
+	xp->busy = 0;
+}
+
+/* A free slot for a new transfer, or 0 if we are full up
+ * or already busy with this client (a resent request).
+ */
+static struct tftpd_xfer *
+tftpd_xfer_alloc ( u32 ip, int port, int *dup )
+{
+	struct tftpd_xfer *xp;
+	struct tftpd_xfer *rv = (struct tftpd_xfer *) 0;
+	int i;
+
+	*dup = 0;
+	for ( i=0; i<TFTPD_XFERS; i++ ) {
+	    xp = &tftpd_xfers[i];
+	    if ( ! xp->busy ) {
+		if ( ! rv )
+		    rv = xp;
+		continue;
+	    }
+	    if ( xp->ip == ip && xp->port == port ) {
+		*dup = 1;
+		return (struct tftpd_xfer *) 0;
+	    }
+	}
+	return rv;
+}
+
+/* Handle one read request.
+ * The packet has been null terminated for us.
+ */
+static void
+tftpd_request ( char *pkt, int len, u32 ip, int port )
+{
+	struct tftpd_xfer *xp;
+	char *end = pkt + len;
+	char *file, *mode;
+	char *opt, *val;
+	int dup;
+	int i;
+
+	/* Never answer an error (RFC 1350) */
+	if ( pkt[0] == 0 && pkt[1] == TFTP_ERR )
+	    return;
+
+	if ( pkt[0] != 0 || pkt[1] != TFTP_RRQ ) {
+	    if ( pkt[0] == 0 && pkt[1] == TFTP_WRQ )
+		tftpd_send_err ( tftpd_so, ip, port, TERR_ACCESS, "read only" );
+	    else
+		tftpd_send_err ( tftpd_so, ip, port, TERR_ILLEGAL, "bad request" );
+	    tftpd_requests++;
+	    tftpd_failed++;
+	    return;
+	}
+
+	/* The client got tired of waiting for our first
+	 * packet, which we are already resending.
+	 */
+	xp = tftpd_xfer_alloc ( ip, port, &dup );
+	if ( dup )
+	    return;
+
+	tftpd_requests++;
+
+	if ( ! xp ) {
+	    tftpd_send_err ( tftpd_so, ip, port, TERR_NOTDEF, "server busy" );
+	    tftpd_failed++;
+	    return;
+	}
+
+	/* We treat every mode as octet */
+	file = pkt + 2;
+	mode = file + strlen ( file ) + 1;
+	if ( mode >= end ) {
+	    tftpd_send_err ( tftpd_so, ip, port, TERR_ILLEGAL, "bad request" );
+	    tftpd_failed++;
+	    return;
+	}
+
+	memset ( (char *) xp, 0, sizeof(struct tftpd_xfer) );
+	xp->ip = ip;
+	xp->port = port;
+	xp->blksize = TFTP_BSIZE;
+	xp->window = 1;
+	xp->hz = timer_rate_get ();
+	xp->rto = TFTP_RTO_INIT * xp->hz / 1000;
+
+	/* Options we don't know about are just left out of the OACK */
+	opt = mode + strlen ( mode ) + 1;
+	while ( opt < end ) {
+	    val = opt + strlen ( opt ) + 1;
+	    if ( val >= end )
+		break;
+
+	    if ( tftp_optcmp ( opt, "blksize" ) == 0 ) {
+		i = atoi ( val );
+		if ( i >= 8 ) {
+		    xp->blksize = i > TFTP_BSIZE_MAX ? TFTP_BSIZE_MAX : i;
+		    xp->oack |= TFTPD_O_BLKSIZE;
+		}
+	    } else if ( tftp_optcmp ( opt, "windowsize" ) == 0 ) {
+		i = atoi ( val );
+		if ( i >= 1 ) {
+		    xp->window = i > TFTP_WINDOW ? TFTP_WINDOW : i;
+		    xp->oack |= TFTPD_O_WINDOW;
+		}
+	    } else if ( tftp_optcmp ( opt, "tsize" ) == 0 )
+		xp->oack |= TFTPD_O_TSIZE;
+
+	    opt = val + strlen ( val ) + 1;
+	}
+
+	xp->nseg = tftpd_lookup ( file, xp );
+	if ( xp->nseg < 0 ) {
+	    tftpd_send_err ( tftpd_so, ip, port, TERR_NOTDEF, "object busy" );
+	    tftpd_failed++;
+	    return;
+	}
+	if ( xp->nseg < 1 || xp->nseg > TFTPD_MAXSEG ) {
+	    tftpd_send_err ( tftpd_so, ip, port, TERR_NOFILE, "no such object" );
+	    tftpd_failed++;
+	    tftpd_release ( xp );
+	    return;
+	}
+
+	for ( i=0; i<xp->nseg; i++ )
+	    xp->size += xp->seg[i].len;
+	xp->nblocks = xp->size / xp->blksize + 1;
+
+	if ( tftpd_verbose )
+	    printf ( "tftpd: %s to %s, %d bytes, blksize %d, window %d\n",
+		file, ip2str32 ( ip ), xp->size, xp->blksize, xp->window );
+
+	/* Each transfer gets its own port (the TID) */
+	xp->so = udp_sock_open ( 0 );
+	if ( ! xp->so ) {
+	    tftpd_send_err ( tftpd_so, ip, port, TERR_NOTDEF, "no socket" );
+	    tftpd_failed++;
+	    tftpd_release ( xp );
+	    return;
+	}
+
+	xp->busy = 1;
+	if ( ! thr_new ( "tftpd-x", (tfptr) tftpd_xfer_thread, (void *) xp, PRI_TFTPD, 0 ) ) {
+	    tftpd_send_err ( tftpd_so, ip, port, TERR_NOTDEF, "no thread" );
+	    tftpd_failed++;
+	    udp_sock_close ( xp->so );
+	    tftpd_release ( xp );
+	    xp->busy = 0;
+	}
+}
+
+static void
+tftpd_thread ( long xxx )
+{
+	char pkt[TFTP_BSIZE + 1];
+	u32 ip;
+	int port;
+	int len;
+
+	for ( ;; ) {
+	    len = udp_recvfrom ( tftpd_so, pkt, TFTP_BSIZE, &ip, &port, UDP_WAIT_FOREVER );
+	    if ( len < 4 )
+		continue;
+	    pkt[len] = 0;
+	    tftpd_request ( pkt, len, ip, port );
+	}
+}
+
+/* THE END */
@@ -193,11 +193,13 @@ struct domain inetdomain =
 
 static void bsd_init ( void );
 static void tcp_bsd_rcv ( struct netbuf * );
+static void tcp_bsd_rcv_list ( struct netbuf * );
 static void tcp_bsd_process ( struct netbuf * );
 
 struct tcp_ops bsd_ops = {
 	bsd_init,
-	tcp_bsd_rcv
+	tcp_bsd_rcv,
+	tcp_bsd_rcv_list
 };
 
 /* Kyu calls this during initialization */
@@ -240,6 +242,16 @@ bsd_panic ( char *msg )
 #define	PRI_TCP_MAIN	24
 #define	PRI_TCP_TIMER	25
 
+/* Set when netbufs run low, we then refuse new connections */
+static int tcp_shed_load;
+
+/* May be called at interrupt level */
+static void
+tcp_lowwater ( int low )
+{
+	tcp_shed_load = low;
+}
+
 static void
 bsd_init ( void )
 {
@@ -262,6 +274,8 @@ bsd_init ( void )
 	    bsd_panic ( "TCP timer rate" );
 	}
 
+	netbuf_lowwater_hook ( tcp_lowwater );
+
 	(void) safe_thr_new ( "tcp-input", tcp_thread, (void *) 0, PRI_TCP_MAIN, 0 );
 	(void) thr_new_repeat ( "tcp-timer", tcp_timer_func, (void *) 0, PRI_TCP_TIMER, 0, 100 );
 }
@@ -571,8 +585,52 @@ tcp_thread ( long xxx )
 static void
 tcp_bsd_rcv ( struct netbuf *nbp )
 {
-        nbp->next = (struct netbuf *) 0;
-	// bpf2 ( "bsd_rcv %08x, %d\n", nbp, nbp->ilen );
+	nbp->next = (struct netbuf *) 0;
+	tcp_bsd_rcv_list ( nbp );
+}
+
+/* From ip_rcv_list(), a bunch of packets linked through "next".
+ * They all go on our queue with one trip through the lock
+ * and one wakeup for the TCP thread.
+ */
+static void
+tcp_bsd_rcv_list ( struct netbuf *list )
+{
+	struct netbuf *nbp;
+	struct netbuf *head = (struct netbuf *) 0;
+	struct netbuf *tail = (struct netbuf *) 0;
+	struct tcphdr *th;
+	int count = 0;
+
+	while ( list ) {
+	    nbp = list;
+	    list = nbp->next;
+	    nbp->next = (struct netbuf *) 0;
+
+	    /* While netbufs are short, turn away anyone trying to
+	     * open a new connection.  Established connections carry on.
+	     */
+	    if ( tcp_shed_load ) {
+		th = (struct tcphdr *) nbp->pptr;
+		if ( (th->th_flags & (TH_SYN|TH_ACK)) == TH_SYN ) {
+		    net_drop ( NET_DROP_SHED );
+		    netbuf_free ( nbp );
+		    continue;
+		}
+	    }
+
+	    if ( tail )
+		tail->next = nbp;
+	    else
+		head = nbp;
+	    tail = nbp;
+	    count++;
+	}
+
+	if ( ! head )
+	    return;
+
+	// bpf2 ( "bsd_rcv %08x, %d\n", head, count );
 
 	// XXX
 	// for debugging orange Pi
@@ -581,16 +639,17 @@ tcp_bsd_rcv ( struct netbuf *nbp )
 	// sem_block ( tcp_queue_lock_sem );
 	cv_lock ( tcp_queue_cv );
 
-	    // printf ( " --- LIST++1: H, T = %08x %08x %08x\n", tcp_q_head, tcp_q_tail, nbp->next );
+	    // printf ( " --- LIST++1: H, T = %08x %08x %08x\n", tcp_q_head, tcp_q_tail, head );
         if ( tcp_q_tail ) {
-            tcp_q_tail->next = nbp;
-            tcp_q_tail = nbp;
+            tcp_q_tail->next = head;
+            tcp_q_tail = tail;
         } else {
-            tcp_q_tail = nbp;
-            tcp_q_head = nbp;
+            tcp_q_tail = tail;
+            tcp_q_head = head;
         }
-	tcp_inq_count++;
-	    // printf ( " --- LIST++2: H, T = %08x %08x %08x\n", tcp_q_head, tcp_q_tail, nbp->next );
+	tcp_inq_count += count;
+	NET_STAT_HWM ( NS_TCPQ_HWM, tcp_inq_count );
+	    // printf ( " --- LIST++2: H, T = %08x %08x %08x\n", tcp_q_head, tcp_q_tail, tail );
 
 	// sem_unblock ( tcp_queue_lock_sem );
 	cv_unlock ( tcp_queue_cv );
@@ -639,11 +698,17 @@ tcp_bsd_process ( struct netbuf *nbp )
 	m = mb_devget ( (char *) nbp->iptr, len, 0, NULL, 0 );
 	if ( ! m ) {
 	    printf ( "** mb_devget fails\n" );
+	    netbuf_free ( nbp );
+	    master_lock.input_busy = 0;
+	    sem_unblock ( master_lock.sem );
 	    return;
 	}
 
 	// mbuf_game ( m, "tcp_bsd_process" );
 
+	if ( nbp->flags & NB_CSUM_OK )
+	    m->m_flags |= M_CSUM_OK;
+
 	/* We can free it now since we have copied everything into
 	 * an mbuf.
 	 */
@@ -660,6 +725,19 @@ tcp_bsd_process ( struct netbuf *nbp )
 	 * in the IP datagram that tcp_input has is then "wrong"
 	 */
 	iip = mtod(m, struct ip *);
+
+	/* mb_devget summed the packet while copying it.
+	 * Take the IP header back out of that and tcp_input can finish
+	 * the checksum with just the pseudo header.  We can't do this if
+	 * there are IP options or the ethernet frame was padded.
+	 */
+	if ( ! (m->m_flags & M_CSUM_OK) &&
+	    iip->ip_hl == sizeof(struct ip) >> 2 && iip->ip_len == len ) {
+	    m->m_pkthdr.csum = csum_sub ( m->m_pkthdr.csum,
+		csum_partial ( iip, sizeof(struct ip), 0 ) );
+	    m->m_flags |= M_CSUM;
+	}
+
 	iip->ip_len -= sizeof(struct ip);
 
 	/* Given the way I implemented net_lock/unlock, I cannot just
@@ -713,7 +791,14 @@ ip_output ( struct mbuf *A, struct mbuf *B, struct route *R, int N,  struct ip_m
 	bpf_dump ( 3, (char *) A, 128 );
 #endif
 
-        nbp = netbuf_alloc ();
+	/* Size up the chain so that a bare ACK can go out
+	 * in a small netbuf.
+	 */
+	size = sizeof(struct eth_hdr);
+	for (mp = A; mp; mp = mp->m_next)
+		size += mp->m_len;
+
+        nbp = netbuf_alloc_user ( NB_USER_TCP, size );
         if ( ! nbp )
             return 1;
 
@@ -753,6 +838,9 @@ ip_output ( struct mbuf *A, struct mbuf *B, struct route *R, int N,  struct ip_m
         }
 	// printf ( "IP output 2\n" );
 
+	if ( A->m_flags & M_CSUM_TX )
+	    nbp->flags |= NB_CSUM_TX;
+
         mb_freem ( A );
 
 	// printf ( "IP output 3\n" );
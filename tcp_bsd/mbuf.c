@@ -6,6 +6,7 @@
  */
 
 #include <bsd.h>
+#include "../net/net.h"		/* Kyu */
 
 /* See mbuf.h */
 int max_linkhdr;
@@ -637,6 +638,10 @@ mb_clget ( struct mbuf *m )
  * puts the ethernet header at the end (trailing packet).
  * I have yet to encounter one of these.
 	struct ifnet *ifp, void (*copy)()  )
+ * Kyu - when no copy routine is given we checksum as we copy
+ *  and leave the sum of everything we copied in m_pkthdr.csum.
+ *  It is up to the caller to decide if that is useful and
+ *  set M_CSUM (see tcp_bsd_process).
  */
 struct mbuf *
 mb_devget ( char *buf, int totlen, int off0,
@@ -649,6 +654,8 @@ mb_devget ( char *buf, int totlen, int off0,
 	int len;
 	char *cp;
 	char *epkt;
+	u_int sum = 0;
+	int sumoff = 0;
 
 	mp = &top;
 
@@ -708,8 +715,11 @@ mb_devget ( char *buf, int totlen, int off0,
 
 		if (copy)
 			copy(cp, mtod(m, caddr_t), (unsigned)len);
-		else
-			bcopy(cp, mtod(m, caddr_t), (unsigned)len);
+		else {
+			sum = csum_block_add ( sum,
+			    csum_partial_copy ( mtod(m, caddr_t), cp, len, 0 ), sumoff );
+			sumoff += len;
+		}
 
 		cp += len;
 		*mp = m;
@@ -719,6 +729,9 @@ mb_devget ( char *buf, int totlen, int off0,
 			cp = buf;
 	}
 
+	if ( top )
+	    top->m_pkthdr.csum = sum;
+
 	// mbuf_game ( top, "mb_devget 3" );
 	return (top);
 }
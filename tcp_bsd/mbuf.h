@@ -103,6 +103,7 @@ struct m_hdr {
 struct	pkthdr {
 	int	len;		/* total packet length */
 	struct	ifnet *rcvif;	/* rcv interface */
+	u_int	csum;		/* Kyu - partial sum, see M_CSUM */
 };
 
 /* description of external storage mapped into mbuf, valid if M_EXT set */
@@ -146,9 +147,12 @@ struct mbuf {
 /* mbuf pkthdr flags, also in m_flags */
 #define	M_BCAST		0x0100	/* send/received as link-level broadcast */
 #define	M_MCAST		0x0200	/* send/received as link-level multicast */
+#define	M_CSUM		0x0400	/* Kyu - pkthdr.csum is the sum past the IP header */
+#define	M_CSUM_OK	0x0800	/* Kyu - hardware verified the checksum */
+#define	M_CSUM_TX	0x1000	/* Kyu - hardware will fill in the checksum */
 
 /* flags copied when copying m_pkthdr */
-#define	M_COPYFLAGS	(M_PKTHDR|M_EOR|M_BCAST|M_MCAST)
+#define	M_COPYFLAGS	(M_PKTHDR|M_EOR|M_BCAST|M_MCAST|M_CSUM|M_CSUM_OK|M_CSUM_TX)
 
 /* mbuf types */
 #define	MT_FREE		0	/* should be on free list */
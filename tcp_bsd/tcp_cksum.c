@@ -35,6 +35,7 @@
  */
 
 #include <bsd.h>
+#include "../net/net.h"		/* Kyu */
 
 #ifdef notdef 
 #include <sys/param.h>
@@ -49,85 +50,35 @@
  *
  * This routine is very heavily used in the network
  * code and should be modified for each CPU to be as fast as possible.
- * 
- * This implementation is 386 version.
- */
-
-#undef	ADDCARRY
-#define ADDCARRY(sum)  {				\
-			if (sum & 0xffff0000) {		\
-				sum &= 0xffff;		\
-				sum++;			\
-			}				\
-		}
-
-/* Kyu - copied from i386/i386/in_cksum.c
- * name changed to avoid conflict with Kyu routine
- * by the same name.
+ *
+ * Kyu - this was the 386 version, copied from i386/i386/in_cksum.c
+ * and renamed to avoid conflict with the Kyu routine by the same name.
+ * Now it just walks the mbuf chain and lets csum_partial()
+ * (arch/cksum.S) do the real work on each piece.
+ * A piece that starts at an odd offset in the packet has its
+ * sum byte swapped by csum_block_add().
  */
 int
 tcp_cksum ( struct mbuf *m, int len )
 {
-	union word {
-		char	c[2];
-		u_short	s;
-	} u;
-	register u_short *w;
-	register int sum = 0;
-	register int mlen = 0;
+	u_int sum = 0;
+	int off = 0;
+	int mlen;
 
 	for (;m && len; m = m->m_next) {
 
-		// bpf2 ( "tcp_cksum: mbuf: %08x (len, mb_len, mlen = %d, %d,%d bytes)\n", m, len, m->m_len, mlen );
+		// bpf2 ( "tcp_cksum: mbuf: %08x (len, mb_len = %d, %d bytes)\n", m, len, m->m_len );
 
 		if (m->m_len == 0)
 			continue;
-		w = mtod(m, u_short *);
-		if (mlen == -1) {
-			/*
-			 * The first byte of this mbuf is the continuation
-			 * of a word spanning between this mbuf and the
-			 * last mbuf.
-			 */
-
-			/* u.c[0] is already saved when scanning previous 
-			 * mbuf.
-			 */
-			u.c[1] = *(u_char *)w;
-			sum += u.s;
-			ADDCARRY(sum);
-			w = (u_short *)((char *)w + 1);
-			mlen = m->m_len - 1;
-			len--;
-		} else
-			mlen = m->m_len;
-
+		mlen = m->m_len;
 		if (len < mlen)
 			mlen = len;
-		len -= mlen;
 
-		/*
-		 * add by words.
-		 */
-		while ((mlen -= 2) >= 0) {
-			if ((int)w & 0x1) {
-				/* word is not aligned */
-				u.c[0] = *(char *)w;
-				u.c[1] = *((char *)w+1);
-				sum += u.s;
-				w++;
-			} else
-				sum += *w++;
-			ADDCARRY(sum);
-		}
-		if (mlen == -1)
-			/*
-			 * This mbuf has odd number of bytes. 
-			 * There could be a word split betwen
-			 * this mbuf and the next mbuf.
-			 * Save the last byte (to prepend to next mbuf).
-			 */
-			u.c[0] = *(u_char *)w;
+		sum = csum_block_add ( sum, csum_partial ( mtod(m, char *), mlen, 0 ), off );
+
+		off += mlen;
+		len -= mlen;
 	}
 
 	/* This happens when the length in the mbuf (or mbuf chain)
@@ -136,14 +87,7 @@ tcp_cksum ( struct mbuf *m, int len )
 	if (len)
 		printf("cksum: out of data\n");
 
-	if (mlen == -1) {
-		/* The last mbuf has odd # of bytes. Follow the
-		   standard (the odd byte is shifted left by 8 bits) */
-		u.c[1] = 0;
-		sum += u.s;
-		ADDCARRY(sum);
-	}
-	return (~sum & 0xffff);
+	return (~csum_fold ( sum ) & 0xffff);
 }
 
 // THE END
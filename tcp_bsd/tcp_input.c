@@ -34,6 +34,7 @@
  */
 
 #include <bsd.h>
+#include "../net/net.h"		/* Kyu */
 
 int	tcprexmtthresh = 3;
 struct	tcpiphdr tcp_saveti;
@@ -597,7 +598,16 @@ tcp_input ( struct mbuf *m, int iphlen)
 
 	// if (ti->ti_sum = in_cksum(m, len)) {
 	// if (ti->ti_sum = tcp_cksum(m, len)) {
-	ti->ti_sum = tcp_cksum(m, len);
+	/* Kyu - if the data was summed while it was copied
+	 * into the mbuf, we only need to add the overlay.
+	 */
+	if ( m->m_flags & M_CSUM_OK )
+		ti->ti_sum = 0;
+	else if ( m->m_flags & M_CSUM )
+		ti->ti_sum = ~csum_fold ( csum_partial ( (char *) ti,
+		    sizeof (struct ip), m->m_pkthdr.csum ) ) & 0xffff;
+	else
+		ti->ti_sum = tcp_cksum(m, len);
 	// bpf2 ( "TCP_INPUT, cksum: %x\n", ti->ti_sum );
 
 	if ( ti->ti_sum ) {
@@ -34,6 +34,7 @@
  */
 
 #include <bsd.h>
+#include "../net/net.h"		/* Kyu */
 
 /* -- tjt -- moved here from tcp_fsm.h
  * Flags used when sending segments in tcp_output.
@@ -494,7 +495,14 @@ send:
 #endif
 
 	// ti->ti_sum = in_cksum(m, (int)(hdrlen + len));
-	ti->ti_sum = tcp_cksum(m, (int)(hdrlen + len));
+	/* Kyu - let the network hardware do it if it can,
+	 * and don't bother at all if it is going to lo.
+	 */
+	if ( ip_csum_tx ( ti->ti_dst.s_addr ) ) {
+		ti->ti_sum = 0;
+		m->m_flags |= M_CSUM_TX;
+	} else
+		ti->ti_sum = tcp_cksum(m, (int)(hdrlen + len));
 
 	/*
 	 * In transmit state, time the transmission and arrange for
@@ -39,6 +39,8 @@ void	tcpack(
 
 	// pkt = tcpalloc(tcbptr, 0);
 	nbp = tcpalloc(tcbptr, 0);
+	if ( ! nbp )
+		return;		/* no netbuf, the peer will retransmit */
 	pkt = (struct netpacket *) nbp->eptr;
 
 	/* Fill in TCP header */
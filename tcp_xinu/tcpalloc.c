@@ -17,7 +17,9 @@ struct netbuf *tcpalloc(
 
 	/* Allocate a buffer for a TCB */
 #ifdef KYU
-	nbp = (struct netbuf *) netbuf_alloc ();
+	nbp = (struct netbuf *) netbuf_alloc_user ( NB_USER_TCP, NETBUF_MAX );
+	if ( ! nbp )
+		return (struct netbuf *) 0;
 	// pkt = (struct netpacket *) get_netpacket ();
 	pkt = (struct netpacket *) nbp->eptr;
 	// printf ( "TCPalloc: nbp, pkt = %08x  %08x\n", nbp, pkt );
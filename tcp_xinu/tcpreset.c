@@ -24,8 +24,10 @@ int32	tcpreset(
 	/* Allocate a buffer */
 #ifdef KYU
 	// pkt = (struct netpacket *) get_netpacket ();
-	// Kyu never fails (it panics if it runs out of buffers)
-	nbp = (struct netbuf *) netbuf_alloc ();
+	// Kyu used to panic if it ran out of buffers, now it fails
+	nbp = (struct netbuf *) netbuf_alloc_user ( NB_USER_TCP, NETBUF_MAX );
+	if ( ! nbp )
+		return SYSERR;
 	pkt = (struct netpacket *) nbp->eptr;
 #else
 	pkt = (struct netpacket *)getbuf(netbufpool);
@@ -27,12 +27,15 @@ void	tcpsendseg(
 
 	// pkt = tcpalloc (tcbptr, len);
 	nbp = tcpalloc (tcbptr, len);
-	pkt = (struct netpacket *) nbp->eptr;
 
-#ifndef KYU
-	/* In Kyu, the above never fails, but panics if we run
-	 * out of buffers.
+#ifdef KYU
+	/* In Kyu, the above used to panic if we ran out of
+	 * buffers, now it fails like Xinu does.
 	 */
+	if ( ! nbp )
+		return;
+	pkt = (struct netpacket *) nbp->eptr;
+#else
 	if ((int32)pkt == SYSERR) {
 		return;
 	}
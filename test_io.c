@@ -83,6 +83,7 @@ static void test_cache ( long );
 static void test_generic ( long );
 static void test_cpu_clock ( long );
 static void test_cache2 ( long );
+static void test_memspeed ( long );
 
 /* Here is the IO test menu */
 /* arguments are now ignored */
@@ -139,6 +140,7 @@ struct test io_test_list[] = {
 	test_cpu_clock,	"CPU clock test",	0,
 	test_generic,	"generic board test",	0,
 	test_cache2,	"show cache status",	0,
+	test_memspeed,	"memcpy/memset speed",	0,
 
 	0,		0,			0
 };
@@ -973,4 +975,141 @@ test_regs ( long xxx )
 	show_my_regs ();
 }
 
+/* Time the assembly memcpy, memset and memcmp against
+ * the generic C versions (still in lib/string.c as memcpy_c
+ * and so on) for a range of sizes and alignments.
+ * We do integer arithmetic only, since the floating point
+ * registers are not saved across thread switches.
+ */
+void *memcpy_c ( void *, const void *, size_t );
+void *memset_c ( void *, int, size_t );
+int memcmp_c ( const void *, const void *, size_t );
+
+#define MEM_BENCH_BYTES	(1024*1024)
+#define MEM_BENCH_MAX	(64*1024)
+
+enum mem_op { MB_CPY, MB_SET, MB_CMP };
+
+static char *mem_op_name[] = { "memcpy", "memset", "memcmp" };
+
+static int mem_sizes[] = { 16, 64, 256, 1514, 4096, MEM_BENCH_MAX, 0 };
+
+/* source and destination offsets from cache line alignment */
+static int mem_align[][2] = { { 0, 0 }, { 2, 2 }, { 2, 0 }, { 1, 3 } };
+
+#define NUM_MEM_ALIGN	(sizeof(mem_align) / sizeof(mem_align[0]))
+
+/* returns cycles for one call */
+static unsigned long
+mem_time ( enum mem_op op, int generic, char *dst, char *src, int size )
+{
+	unsigned long t1, t2;
+	int count;
+	int i;
+
+	count = MEM_BENCH_BYTES / size;
+	if ( count < 16 )
+	    count = 16;
+
+	set_CCNT ( 0 );
+	t1 = r_CCNT ();
+
+	for ( i=0; i<count; i++ ) {
+	    switch ( op ) {
+		case MB_CPY:
+		    if ( generic )
+			memcpy_c ( dst, src, size );
+		    else
+			memcpy ( dst, src, size );
+		    break;
+		case MB_SET:
+		    if ( generic )
+			memset_c ( dst, 0, size );
+		    else
+			memset ( dst, 0, size );
+		    break;
+		case MB_CMP:
+		    if ( generic )
+			(void) memcmp_c ( dst, src, size );
+		    else
+			(void) memcmp ( dst, src, size );
+		    break;
+	    }
+	}
+
+	t2 = r_CCNT ();
+	return (t2 - t1) / count;
+}
+
+/* MB/s, from bytes per cycle and the clock in Mhz */
+static int
+mem_rate ( int size, unsigned long cycles, int mhz )
+{
+	if ( cycles < 1 )
+	    cycles = 1;
+	return ((unsigned long) size * mhz) / cycles;
+}
+
+static void
+mem_show ( enum mem_op op, char *dst, char *src, int mhz )
+{
+	int j;
+	int rc, ra;
+	int *sp;
+	char *d, *s;
+
+	printf ( "%s   size  src/dst    C (GB/s)   asm (GB/s)\n", mem_op_name[op] );
+
+	for ( sp = mem_sizes; *sp; sp++ ) {
+	    for ( j=0; j<NUM_MEM_ALIGN; j++ ) {
+		/* alignment of the source doesn't matter for memset */
+		if ( op == MB_SET && mem_align[j][0] != mem_align[j][1] )
+		    continue;
+		s = src + mem_align[j][0];
+		d = dst + mem_align[j][1];
+		if ( op == MB_CMP )
+		    memcpy ( d, s, *sp );
+
+		rc = mem_rate ( *sp, mem_time ( op, 1, d, s, *sp ), mhz );
+		ra = mem_rate ( *sp, mem_time ( op, 0, d, s, *sp ), mhz );
+		printf ( "        %6d    %d/%d     %3d.%02d     %3d.%02d\n",
+		    *sp, mem_align[j][0], mem_align[j][1],
+		    rc / 1000, (rc % 1000) / 10, ra / 1000, (ra % 1000) / 10 );
+	    }
+	}
+}
+
+static void
+test_memspeed ( long xxx )
+{
+	char *src_mem, *dst_mem;
+	char *src, *dst;
+	int mhz;
+	int i;
+
+	/* extra room to line up on a cache line, then go past it */
+	src_mem = malloc ( MEM_BENCH_MAX + 128 );
+	dst_mem = malloc ( MEM_BENCH_MAX + 128 );
+	if ( ! src_mem || ! dst_mem ) {
+	    printf ( "memspeed: no memory\n" );
+	    return;
+	}
+
+	src = (char *) (((unsigned long) src_mem + 63) & ~63);
+	dst = (char *) (((unsigned long) dst_mem + 63) & ~63);
+
+	for ( i=0; i<MEM_BENCH_MAX; i++ )
+	    src[i] = i * 7;
+
+	mhz = board_get_cpu_mhz ();
+	printf ( "CPU at %d Mhz, %d bytes moved per measurement\n", mhz, MEM_BENCH_BYTES );
+
+	mem_show ( MB_CPY, dst, src, mhz );
+	mem_show ( MB_SET, dst, src, mhz );
+	mem_show ( MB_CMP, dst, src, mhz );
+
+	free ( src_mem );
+	free ( dst_mem );
+}
+
 /* THE END */
@@ -23,6 +23,7 @@
 
 #include "tests.h"
 #include "netbuf.h"
+#include "net.h"
 
 /* ---------------------------------------------------------------------- */
 /* ---------------------------------------------------------------------- */
@@ -35,6 +36,7 @@ void pkt_arrive ( void );
 
 #ifdef WANT_NET
 static void test_netshow ( long );
+static void test_netstats ( long );
 static void test_netarp ( long );
 static void test_bootp ( long );
 static void test_dhcp ( long );
@@ -42,13 +44,22 @@ static void test_icmp ( long );
 static void test_dns ( long );
 static void test_arp ( long );
  void test_tftp ( long );
+ void test_tftp_bench ( long );
 static void test_udp ( long );
 static void test_udp_echo ( long );
+static void test_udp_sock ( long );
+static void test_udp_frag ( long );
+static void test_udp_loop ( long );
+static void test_capture ( long );
+static void test_mcast ( long );
+static void test_raw ( long );
 
 #endif
 
 static void test_netdebug ( long );
 static void test_fast ( long );
+static void test_netbuf_speed ( long );
+static void test_cksum_speed ( long );
 
 #ifdef notdef
 void
@@ -77,6 +88,7 @@ struct test net_test_list[] = {
 
 #ifdef WANT_NET
 	test_netshow,	"Net show",		0,
+	test_netstats,	"Net stats export",	0,
 	test_netarp,	"ARP ping",		0,
 	test_bootp,	"test BOOTP",		0,
 	test_dhcp,	"test DHCP",		0,
@@ -84,12 +96,21 @@ struct test net_test_list[] = {
 	test_dns,	"Test DNS",		0,
 	test_arp,	"gratu arp [n]",	0,
 	test_tftp,	"Test TFTP",		0,
+	test_tftp_bench, "TFTP speed",		0,
 	test_udp,	"Test UDP",		0,
 	test_udp_echo,	"Endless UDP echo",	0,
+	test_udp_sock,	"UDP socket echo",	0,
+	test_udp_frag,	"UDP 8K echo (fragments)", 0,
+	test_udp_loop,	"UDP loopback speed",	0,
+	test_capture,	"Capture on/off",	0,
+	test_mcast,	"Multicast join/leave",	0,
+	test_raw,	"Raw ethernet echo",	0,
 	// test_tcp,	"Test TCP",		0,
 #endif
 	test_netdebug,	"Debug interface",	0,
 	test_fast,	"Test network speed",	0,
+	test_netbuf_speed, "netbuf alloc/free speed", 0,
+	test_cksum_speed, "checksum speed",	0,
 	0,		0,			0
 };
 
@@ -101,7 +122,29 @@ test_netshow ( long test )
 	net_show ();
 }
 
-extern unsigned long test_ip;
+/* What the monitoring sees, then send it to the test
+ * machine (port 9 is discard) once a second for a few
+ * seconds, and turn that off again.
+ */
+static char netstats_buf[2048];
+
+#define NETSTATS_SECS	5
+
+static void
+test_netstats ( long test )
+{
+	extern u32 test_ip;
+
+	(void) net_stats_format ( netstats_buf, sizeof(netstats_buf) );
+	puts ( netstats_buf );
+
+	net_stats_export ( htonl(test_ip), 9, 1 );
+	thr_delay ( NETSTATS_SECS * timer_rate_get () );
+	net_stats_show ();
+	net_stats_export ( htonl(test_ip), 9, 0 );
+}
+
+extern u32 test_ip;
 
 static void
 test_netarp ( long test )
@@ -173,7 +216,11 @@ Aug  2 12:17:53 localhost xinetd[14745]: Activating service echo
  * and use it instead.
  */
 
+#ifdef BOARD_HOST
+#define UTEST_SERVER	"10.0.5.1"
+#else
 #define UTEST_SERVER	"192.168.0.5"
+#endif
 #define UTEST_PORT	7
 
 static int udp_echo_count;
@@ -247,6 +294,227 @@ test_udp ( long xxx )
 	printf ( "%d responses to %d messages\n", udp_echo_count, ECHO_COUNT );
 }
 
+/* Same as the above, but through a UDP socket, with the
+ * replies taken in batches by this thread rather than
+ * handled in the net thread.
+ */
+#define SOCK_BATCH	8
+
+static void
+test_udp_sock ( long xxx )
+{
+	struct udp_sock *so;
+	struct udp_msg msg[SOCK_BATCH];
+	static char rbuf[SOCK_BATCH][UDP_TEST_SIZE];
+	unsigned long test_ip;
+	int sent, got, batches;
+	int i, n;
+
+	memset ( udp_test_buf, 0xaa, UDP_TEST_SIZE );
+	(void) net_dots ( UTEST_SERVER, &test_ip );
+
+	so = udp_sock_open ( 0 );
+
+	printf ("sending %d UDP messages from port %d\n", ECHO_COUNT, udp_sock_port ( so ) );
+
+	got = batches = 0;
+	for ( sent = 0; sent < ECHO_COUNT; sent += UDP_BURST ) {
+	    for ( i=0; i<UDP_BURST; i++ ) {
+		msg[i].buf = udp_test_buf;
+		msg[i].len = UDP_TEST_SIZE;
+		msg[i].ip = test_ip;
+		msg[i].port = UTEST_PORT;
+	    }
+	    (void) udp_sendmmsg ( so, msg, UDP_BURST );
+
+	    for ( i=0; i<SOCK_BATCH; i++ ) {
+		msg[i].buf = rbuf[i];
+		msg[i].len = UDP_TEST_SIZE;
+	    }
+	    n = udp_recvmmsg ( so, msg, SOCK_BATCH, ECHO_DELAY );
+	    if ( n ) {
+		got += n;
+		batches++;
+	    }
+	}
+
+	/* Allow time for last responses to roll in */
+	for ( ;; ) {
+	    for ( i=0; i<SOCK_BATCH; i++ ) {
+		msg[i].buf = rbuf[i];
+		msg[i].len = UDP_TEST_SIZE;
+	    }
+	    n = udp_recvmmsg ( so, msg, SOCK_BATCH, 100 );
+	    if ( ! n )
+		break;
+	    got += n;
+	    batches++;
+	}
+
+	udp_sock_close ( so );
+
+	printf ( "%d responses to %d messages (%d batches)\n", got, ECHO_COUNT, batches );
+}
+
+/* Big enough that it goes out and comes back in pieces */
+#define FRAG_TEST_SIZE	8192
+#define FRAG_TEST_COUNT	20
+
+static void
+test_udp_frag ( long xxx )
+{
+	struct udp_sock *so;
+	static char sbuf[FRAG_TEST_SIZE];
+	static char rbuf[FRAG_TEST_SIZE];
+	unsigned long test_ip;
+	int i, n;
+	int good = 0;
+
+	for ( i=0; i<FRAG_TEST_SIZE; i++ )
+	    sbuf[i] = i * 7;
+	(void) net_dots ( UTEST_SERVER, &test_ip );
+
+	so = udp_sock_open ( 0 );
+
+	for ( i=0; i<FRAG_TEST_COUNT; i++ ) {
+	    udp_sendto ( so, test_ip, UTEST_PORT, sbuf, FRAG_TEST_SIZE );
+	    n = udp_recvfrom ( so, rbuf, FRAG_TEST_SIZE, 0, 0, 1000 );
+	    if ( n == FRAG_TEST_SIZE && memcmp ( sbuf, rbuf, n ) == 0 )
+		good++;
+	}
+
+	udp_sock_close ( so );
+
+	printf ( "%d of %d %d byte datagrams came back intact\n", good, FRAG_TEST_COUNT, FRAG_TEST_SIZE );
+	ip_frag_show ();
+}
+
+/* Round trips through lo, so this is the cost of
+ * the IP and UDP code with no driver or wire involved.
+ */
+#define LOOP_TEST_SIZE	1024
+#define LOOP_TEST_COUNT	10000
+
+static void
+test_udp_loop ( long xxx )
+{
+	struct udp_sock *so;
+	static char sbuf[LOOP_TEST_SIZE];
+	static char rbuf[LOOP_TEST_SIZE];
+	struct netif *ifp;
+	u32 lo_ip;
+	int hz = timer_rate_get ();
+	int start, ticks;
+	int i, n;
+	int good = 0;
+
+	for ( i=0; i<LOOP_TEST_SIZE; i++ )
+	    sbuf[i] = i * 3;
+	(void) net_dots ( "127.0.0.1", &lo_ip );
+
+	so = udp_sock_open ( 0 );
+
+	start = get_timer_count_t ();
+	for ( i=0; i<LOOP_TEST_COUNT; i++ ) {
+	    udp_sendto ( so, lo_ip, udp_sock_port ( so ), sbuf, LOOP_TEST_SIZE );
+	    n = udp_recvfrom ( so, rbuf, LOOP_TEST_SIZE, 0, 0, 100 );
+	    if ( n == LOOP_TEST_SIZE && memcmp ( sbuf, rbuf, n ) == 0 )
+		good++;
+	}
+	ticks = get_timer_count_t () - start;
+
+	udp_sock_close ( so );
+
+	if ( ticks < 1 )
+	    ticks = 1;
+	printf ( "%d of %d %d byte datagrams came back intact in %d ms\n",
+	    good, LOOP_TEST_COUNT, LOOP_TEST_SIZE, ticks * 1000 / hz );
+	printf ( "%d round trips per second\n", good * hz / ticks );
+
+	if ( (ifp = netif_find ( "lo" )) )
+	    printf ( "lo: %d packets in, %d out, %d dropped\n",
+		ifp->rx_packets, ifp->tx_packets, ifp->tx_drops );
+}
+
+/* Fetch the result with "tftp kyu -m binary -c get capture" */
+static void
+test_capture ( long xxx )
+{
+	if ( capture_on ) {
+	    capture_stop ();
+	    printf ( "Capture stopped\n" );
+	} else {
+	    capture_filter ( 0, 0, 0 );
+	    capture_start ( 0 );
+	    printf ( "Capturing everything\n" );
+	}
+	capture_show ();
+}
+
+/* From linux, "iperf -c 239.1.1.1 -u -T 1" should now get in,
+ * and our own datagram to the group should show up in tcpdump
+ * along with the IGMP report.
+ */
+#define MCAST_TEST_GROUP	0xef010101	/* 239.1.1.1 */
+
+static void
+test_mcast ( long xxx )
+{
+	static int joined;
+	u32 group = htonl ( MCAST_TEST_GROUP );
+
+	if ( joined ) {
+	    ip_mcast_leave ( group );
+	    joined = 0;
+	    printf ( "Left %s\n", ip2str32 ( group ) );
+	} else {
+	    if ( ! ip_mcast_join ( group ) ) {
+		printf ( "Cannot join %s\n", ip2str32 ( group ) );
+		return;
+	    }
+	    joined = 1;
+	    printf ( "Joined %s\n", ip2str32 ( group ) );
+	    udp_send ( group, get_ephem_port (), 5001, "Kyu", 3 );
+	}
+	mcast_show ();
+}
+
+/* 0x88b5 is set aside for local experiments (IEEE 802).
+ * Send frames of that type from linux with a few lines of
+ * python on an AF_PACKET socket, they come right back.
+ */
+#define RAW_TEST_TYPE	0x88b5
+#define RAW_TEST_WAIT	10000		/* ms */
+
+static void
+test_raw ( long xxx )
+{
+	struct raw_sock *rp;
+	struct netbuf *nbp;
+	unsigned char src[ETH_ADDR_SIZE];
+	int count = 0;
+
+	rp = raw_open ( RAW_TEST_TYPE );
+	if ( ! rp ) {
+	    printf ( "Cannot open ether type %04x\n", RAW_TEST_TYPE );
+	    return;
+	}
+
+	printf ( "Echoing ether type %04x until idle for %d seconds\n",
+	    RAW_TEST_TYPE, RAW_TEST_WAIT / 1000 );
+
+	/* Turn the netbuf around, no copy */
+	while ( (nbp = raw_recv_nb ( rp, RAW_TEST_WAIT )) ) {
+	    memcpy ( src, nbp->eptr->src, ETH_ADDR_SIZE );
+	    raw_send_nb ( rp, src, nbp );
+	    count++;
+	}
+
+	raw_show ();
+	raw_close ( rp );
+	printf ( "%d frames echoed\n", count );
+}
+
 /* ---------------------------------------------------------- */
 /* ---------------------------------------------------------- */
 
@@ -464,26 +732,180 @@ test_fast ( long xxx )
 	printf ( "CCNT 0 = %d\n", t1 );
 	printf ( "CCNT timer, 0.1 seconds = %d\n", t2-t1 );
 
-	nbp = netbuf_alloc ();
-
-	nbp->ilen = 1000;
-
 	set_CCNT ( 0 );
 	t1 = r_CCNT ();
 
-	for ( i=0; i<10; i++ )
+	/* The emac frees each netbuf once it is sent */
+	for ( i=0; i<10; i++ ) {
+	    nbp = netbuf_alloc ();
+	    nbp->ilen = 1000;
 	    emac_send_wait ( nbp );
 	    // board_net_send ( nbp );
+	}
 
 	t2 = r_CCNT ();
 	printf ( "1M data = %d\n", t2-t1 );
-
-	netbuf_free ( nbp );
 #else
 	printf ( "Only works on the Orange Pi\n" );
 #endif /* BOARD_H3 */
 }
 
+/* Time netbuf alloc/free pairs, done in bursts the way
+ * a driver would go through them, first with the per core
+ * magazines turned off (every call goes to the shared pool),
+ * then with them on.
+ */
+#define NB_BENCH_COUNT	100000
+#define NB_BENCH_BURST	16
+
+static unsigned long
+netbuf_bench ( int size )
+{
+	struct netbuf *bufs[NB_BENCH_BURST];
+	unsigned long t1, t2;
+	int i, j;
+
+	set_CCNT ( 0 );
+	t1 = r_CCNT ();
+
+	for ( i=0; i<NB_BENCH_COUNT; i += NB_BENCH_BURST ) {
+	    for ( j=0; j<NB_BENCH_BURST; j++ )
+		bufs[j] = netbuf_alloc_size ( size );
+	    for ( j=0; j<NB_BENCH_BURST; j++ )
+		if ( bufs[j] )
+		    netbuf_free ( bufs[j] );
+	}
+
+	t2 = r_CCNT ();
+	return t2 - t1;
+}
+
+static void
+netbuf_bench_show ( char *msg, int size )
+{
+	unsigned long cycles;
+	unsigned long pps;
+	int rate;
+
+	rate = board_get_cpu_mhz ();
+	cycles = netbuf_bench ( size ) / NB_BENCH_COUNT;
+	if ( cycles < 1 )
+	    cycles = 1;
+	pps = (rate * 1000000UL) / cycles;
+
+	printf ( "%s, %4d bytes: %5d cycles per alloc/free, %8d per second\n",
+	    msg, size, cycles, pps );
+}
+
+static void
+test_netbuf_speed ( long xxx )
+{
+	netbuf_cache_set ( 0 );
+	netbuf_bench_show ( "Shared pool", 64 );
+	netbuf_bench_show ( "Shared pool", 1514 );
+
+	netbuf_cache_set ( 1 );
+	netbuf_bench_show ( "Core magazines", 64 );
+	netbuf_bench_show ( "Core magazines", 1514 );
+
+	netbuf_show ();
+}
+
+/* Compare the old C checksum with csum_partial, and
+ * memcpy followed by a checksum with csum_partial_copy.
+ * Also checks that they all agree, at odd offsets too.
+ */
+#define CK_BENCH_COUNT	10000
+#define CK_BENCH_SIZE	2048
+
+unsigned short in_cksum_c ( unsigned short *, int );
+
+static char ck_src[CK_BENCH_SIZE] __attribute__ ((aligned (64)));
+static char ck_dst[CK_BENCH_SIZE] __attribute__ ((aligned (64)));
+
+enum ck_op { CK_C, CK_ASM, CK_CPY, CK_FUSED };
+
+static unsigned long
+cksum_bench ( enum ck_op op, int size )
+{
+	unsigned long t1, t2;
+	int i;
+
+	set_CCNT ( 0 );
+	t1 = r_CCNT ();
+
+	for ( i=0; i<CK_BENCH_COUNT; i++ ) {
+	    switch ( op ) {
+		case CK_C:
+		    in_cksum_c ( (unsigned short *) ck_src, size );
+		    break;
+		case CK_ASM:
+		    in_cksum ( ck_src, size );
+		    break;
+		case CK_CPY:
+		    memcpy ( ck_dst, ck_src, size );
+		    in_cksum ( ck_dst, size );
+		    break;
+		case CK_FUSED:
+		    csum_partial_copy ( ck_dst, ck_src, size, 0 );
+		    break;
+	    }
+	}
+
+	t2 = r_CCNT ();
+	return (t2 - t1) / CK_BENCH_COUNT;
+}
+
+static void
+cksum_check ( void )
+{
+	static int sizes[] = { 1, 2, 7, 20, 63, 64, 65, 576, 1499, 1500 };
+	unsigned short a, b, c;
+	int i, off;
+	int bad = 0;
+
+	for ( i=0; i<sizeof(sizes)/sizeof(int); i++ ) {
+	    for ( off=0; off<8; off++ ) {
+		a = in_cksum_c ( (unsigned short *) &ck_src[off], sizes[i] );
+		b = in_cksum ( &ck_src[off], sizes[i] );
+		c = ~csum_fold ( csum_partial_copy ( &ck_dst[off^3], &ck_src[off], sizes[i], 0 ) );
+		if ( a != b || a != c ) {
+		    printf ( "checksum mismatch, size %d, offset %d: %04x %04x %04x\n",
+			sizes[i], off, a, b, c );
+		    bad++;
+		}
+		if ( memcmp ( &ck_dst[off^3], &ck_src[off], sizes[i] ) != 0 ) {
+		    printf ( "csum_partial_copy bad copy, size %d, offset %d\n", sizes[i], off );
+		    bad++;
+		}
+	    }
+	}
+
+	if ( ! bad )
+	    printf ( "Checksums all agree\n" );
+}
+
+static void
+test_cksum_speed ( long xxx )
+{
+	static int sizes[] = { 20, 64, 576, 1500 };
+	int i;
+
+	for ( i=0; i<CK_BENCH_SIZE; i++ )
+	    ck_src[i] = i * 7 + (i >> 8);
+
+	cksum_check ();
+
+	for ( i=0; i<sizeof(sizes)/sizeof(int); i++ ) {
+	    printf ( "%4d bytes: C %5d, asm %5d, memcpy+sum %5d, fused %5d cycles\n",
+		sizes[i],
+		cksum_bench ( CK_C, sizes[i] ),
+		cksum_bench ( CK_ASM, sizes[i] ),
+		cksum_bench ( CK_CPY, sizes[i] ),
+		cksum_bench ( CK_FUSED, sizes[i] ) );
+	}
+}
+
 /* Hook for board specific network statistics
  */
 static void
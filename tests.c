@@ -244,6 +244,8 @@ static char * kyu_prompt = "Kyu (bbb), ready> ";
 static char * kyu_prompt = "Kyu (zynq), ready> ";
 #elif defined(BOARD_H5)
 static char * kyu_prompt = "Kyu (opi-h5), ready> ";
+#elif defined(BOARD_HOST)
+static char * kyu_prompt = "Kyu (host), ready> ";
 #else
 static char * kyu_prompt = "Kyu (opi-h3), ready> ";
 #endif
@@ -164,6 +164,23 @@ struct int_regs {
 };
 #endif
 
+#ifdef ARCH_HOST
+/* Threads are really pthreads in the host build,
+ * so linux keeps the registers, not us.
+ */
+struct jmp_regs {
+	reg_t regs[1];
+};
+
+struct int_regs {
+	reg_t regs[1];
+};
+
+struct cont_regs {
+	reg_t regs[1];
+};
+#endif
+
 
 enum thread_mode { JMP, INT, CONT };
 
@@ -18,6 +18,7 @@
 #include "kyu.h"
 #include "kyulib.h"
 #include "board.h"
+#include "netbuf.h"
 
 void
 board_init ( void )
@@ -99,6 +100,14 @@ board_net_send ( struct netbuf *nbp )
 {
 	if ( num_ee ) ee_send ( nbp );
 	if ( num_rtl ) rtl_send ( nbp );
+	netbuf_free ( nbp );
+}
+
+/* No multicast filter on these (yet), so we say so */
+int
+board_net_mcast ( unsigned char *list, int count )
+{
+	return -1;
 }
 
 /* THE END */
@@ -455,6 +455,15 @@ board_net_send ( struct netbuf *nbp )
 #ifdef WANT_NET
         emac_send ( nbp );
 #endif
+	/* this emac does not hold on to netbufs */
+	netbuf_free ( nbp );
+}
+
+/* No multicast filter on this one (yet), so we say so */
+int
+board_net_mcast ( unsigned char *list, int count )
+{
+	return -1;
 }
 
 void